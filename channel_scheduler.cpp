@@ -0,0 +1,214 @@
+#include "channel_scheduler.h"
+
+template<class Config>
+ChannelSchedulerT<Config>::ChannelSchedulerT() :
+	policy(SCHED_STRICT_PRIORITY),
+	rr_index(0),
+	rr_new_round(true),
+	held(0)
+{
+	for (uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		configure_channel(ch, ch, CHANNEL_RELIABLE_ORDERED);
+		head[ch] = 0;
+		count[ch] = 0;
+		deficit[ch] = 0;
+		dropped[ch] = 0;
+	}
+}
+
+template<class Config>
+void ChannelSchedulerT<Config>::configure_channel(uint8_t channel, uint8_t priority, ChannelMode mode, uint16_t quantum)
+{
+	if (channel >= MAX_CHANNELS) return;
+
+	config[channel].priority = priority;
+	config[channel].mode = mode;
+	config[channel].quantum = quantum > 0 ? quantum : 1;
+}
+
+template<class Config>
+bool ChannelSchedulerT<Config>::enqueue(uint8_t channel, const uint8_t* data, uint16_t length)
+{
+	if (channel >= MAX_CHANNELS || length > Config::MAX_DATA_LEN) return false;
+	if (count[channel] >= CHANNEL_QUEUE_DEPTH)
+	{
+		dropped[channel]++;
+		return false;
+	}
+
+	QueuedMessage* msg = &queue[channel][(head[channel] + count[channel]) % CHANNEL_QUEUE_DEPTH];
+	if (length > 0) memcpy(msg->payload, data, length);
+	msg->length = length;
+	msg->built = false;
+	msg->attempts = 0;
+	msg->enqueue_time_us = micros();
+
+	count[channel]++;
+	return true;
+}
+
+template<class Config>
+int8_t ChannelSchedulerT<Config>::select_strict_priority(uint8_t skip)
+{
+	int8_t best = -1;
+
+	for (uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		if (count[ch] == 0 || (skip & (1 << ch))) continue;
+		if (best < 0 || config[ch].priority < config[best].priority) best = ch;
+	}
+	return best;
+}
+
+template<class Config>
+int8_t ChannelSchedulerT<Config>::select_deficit_round_robin()
+{
+	if (is_idle()) return -1;
+
+	//Bounded: every visit to a backlogged channel adds at least one quantum (>= 1 byte)
+	for (uint16_t visits = 0; visits < MAX_CHANNELS * (Config::MAX_DATA_LEN + 2); visits++)
+	{
+		uint8_t ch = rr_index;
+
+		if (count[ch] == 0)
+		{
+			deficit[ch] = 0;//idle channels do not bank credit
+			rr_index = (rr_index + 1) % MAX_CHANNELS;
+			rr_new_round = true;
+			continue;
+		}
+
+		//One quantum per visit, then serve the channel until its credit runs out
+		if (rr_new_round)
+		{
+			deficit[ch] += config[ch].quantum;
+			rr_new_round = false;
+		}
+
+		uint16_t cost = queue[ch][head[ch]].length;
+		if (deficit[ch] >= cost)
+		{
+			deficit[ch] -= cost;
+			return ch;
+		}
+
+		rr_index = (rr_index + 1) % MAX_CHANNELS;
+		rr_new_round = true;
+	}
+	return -1;
+}
+
+template<class Config>
+bool ChannelSchedulerT<Config>::others_backlogged(uint8_t channel) const
+{
+	for (uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		if (ch != channel && count[ch] > 0) return true;
+	}
+	return false;
+}
+
+template<class Config>
+QueuedMessageT<Config>* ChannelSchedulerT<Config>::next(uint8_t* channel)
+{
+	int8_t ch;
+
+	//A held channel sits out one selection, it only goes again right away when nobody else is waiting
+	if (policy == SCHED_STRICT_PRIORITY)
+	{
+		ch = select_strict_priority(held);
+		if (ch < 0) ch = select_strict_priority(0);
+	}
+	else
+	{
+		//Its DRR turn ends here, the remaining deficit waits for the next round
+		if ((held & (1 << rr_index)) && others_backlogged(rr_index))
+		{
+			rr_index = (rr_index + 1) % MAX_CHANNELS;
+			rr_new_round = true;
+		}
+		ch = select_deficit_round_robin();
+	}
+	held = 0;
+	if (ch < 0) return nullptr;
+
+	if (channel) *channel = (uint8_t)ch;
+	return &queue[ch][head[ch]];
+}
+
+template<class Config>
+void ChannelSchedulerT<Config>::complete(uint8_t channel, bool delivered)
+{
+	if (channel >= MAX_CHANNELS || count[channel] == 0) return;
+
+	if (delivered)
+	{
+		latency[channel].add_sample(micros() - queue[channel][head[channel]].enqueue_time_us);
+	}
+	else
+	{
+		dropped[channel]++;
+	}
+
+	head[channel] = (head[channel] + 1) % CHANNEL_QUEUE_DEPTH;
+	count[channel]--;
+}
+
+template<class Config>
+void ChannelSchedulerT<Config>::requeue(uint8_t channel)
+{
+	if (channel >= MAX_CHANNELS || count[channel] < 2) return;
+
+	//Rotate: copy head to the free slot behind the tail, then advance head
+	uint8_t tail = (head[channel] + count[channel]) % CHANNEL_QUEUE_DEPTH;
+	if (count[channel] < CHANNEL_QUEUE_DEPTH)
+	{
+		queue[channel][tail] = queue[channel][head[channel]];
+		head[channel] = (head[channel] + 1) % CHANNEL_QUEUE_DEPTH;
+	}
+	else
+	{
+		//Full ring: rotating the head index alone moves the head to the tail
+		head[channel] = (head[channel] + 1) % CHANNEL_QUEUE_DEPTH;
+	}
+}
+
+template<class Config>
+void ChannelSchedulerT<Config>::hold(uint8_t channel)
+{
+	if (channel < MAX_CHANNELS) held |= 1 << channel;
+}
+
+template<class Config>
+bool ChannelSchedulerT<Config>::is_idle() const
+{
+	for (uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		if (count[ch] > 0) return false;
+	}
+	return true;
+}
+
+template<class Config>
+void ChannelSchedulerT<Config>::print_statistics()
+{
+	Serial.println("CHANNELS (latency enqueue -> ACK, us):");
+	for (uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		const LatencyHistogram& h = latency[ch];
+		if (h.get_count() == 0 && dropped[ch] == 0) continue;
+
+		Serial.print(" Ch"); Serial.print(ch);
+		Serial.print(" prio "); Serial.print(config[ch].priority);
+		Serial.print(" n="); Serial.print(h.get_count());
+		Serial.print(" p50<="); Serial.print(h.get_percentile(50));
+		Serial.print(" p90<="); Serial.print(h.get_percentile(90));
+		Serial.print(" p99<="); Serial.print(h.get_percentile(99));
+		Serial.print(" max="); Serial.print(h.get_max());
+		Serial.print(" dropped="); Serial.println(dropped[ch]);
+	}
+}
+
+template class ChannelSchedulerT<DefaultConfig>;
+template class ChannelSchedulerT<ControlConfig>;
@@ -0,0 +1,91 @@
+#pragma once
+#ifndef CHANNEL_SCHEDULER_H
+#define CHANNEL_SCHEDULER_H
+
+#include <Arduino.h>
+#include "packet_frame.h"
+#include "latency_histogram.h"
+
+#define MAX_CHANNELS 4
+#define CHANNEL_QUEUE_DEPTH 4
+
+typedef enum
+{
+	CHANNEL_RELIABLE_ORDERED,//retried in place one attempt per turn, blocks only its own channel
+	CHANNEL_RELIABLE_UNORDERED,//failed attempt goes back to the tail, other frames may pass it
+	CHANNEL_BEST_EFFORT,//sent once as TYPE_DATAGRAM, never acknowledged
+}ChannelMode;
+
+typedef enum
+{
+	SCHED_STRICT_PRIORITY,//lowest priority value always goes first
+	SCHED_DEFICIT_ROUND_ROBIN,//byte-fair share weighted by each channel's quantum
+}SchedulerPolicy;
+
+template<class Config>
+struct QueuedMessageT
+{
+	uint8_t payload[Config::MAX_DATA_LEN];
+	uint16_t length;
+	FrameT<Config> frame;//built on first transmission, reused by retries so the sequence number sticks
+	bool built;
+	uint8_t attempts;
+	unsigned long enqueue_time_us;
+};
+
+typedef QueuedMessageT<DefaultConfig> QueuedMessage;
+
+typedef struct
+{
+	uint8_t priority;//0 = highest
+	ChannelMode mode;
+	uint16_t quantum;//DRR bytes added per round
+}ChannelConfig;
+
+template<class Config>
+class ChannelSchedulerT
+{
+public:
+	typedef QueuedMessageT<Config> QueuedMessage;
+
+private:
+	ChannelConfig config[MAX_CHANNELS];
+	SchedulerPolicy policy;
+
+	QueuedMessage queue[MAX_CHANNELS][CHANNEL_QUEUE_DEPTH];
+	uint8_t head[MAX_CHANNELS];
+	uint8_t count[MAX_CHANNELS];
+
+	uint32_t deficit[MAX_CHANNELS];
+	uint8_t rr_index;
+	bool rr_new_round;//rr_index just moved, its quantum has not been added yet
+	uint8_t held;//bit per channel: failed its last attempt, sits out the next selection
+
+	LatencyHistogram latency[MAX_CHANNELS];
+	uint32_t dropped[MAX_CHANNELS];
+
+	int8_t select_strict_priority(uint8_t skip);
+	int8_t select_deficit_round_robin();
+	bool others_backlogged(uint8_t channel) const;
+
+public:
+	ChannelSchedulerT();
+
+	void configure_channel(uint8_t channel, uint8_t priority, ChannelMode mode, uint16_t quantum = Config::MAX_DATA_LEN);
+	void set_policy(SchedulerPolicy new_policy) { policy = new_policy; }
+	ChannelMode get_mode(uint8_t channel) const { return config[channel].mode; }
+
+	bool enqueue(uint8_t channel, const uint8_t* data, uint16_t length);//false = channel queue full
+	QueuedMessage* next(uint8_t* channel);//head of the channel that should go on the wire next
+	void complete(uint8_t channel, bool delivered);//pop head, record its queueing+delivery latency
+	void requeue(uint8_t channel);//move head to the tail of its own channel
+	void hold(uint8_t channel);//head stays, the other backlogged channels get the next turn
+	bool is_idle() const;
+
+	const LatencyHistogram& get_latency(uint8_t channel) const { return latency[channel]; }
+	void print_statistics();
+};
+
+typedef ChannelSchedulerT<DefaultConfig> ChannelScheduler;
+
+#endif // !CHANNEL_SCHEDULER_H
@@ -0,0 +1,175 @@
+#include "clock_sync.h"
+
+ClockSync::ClockSync()
+{
+	reset();
+}
+
+void ClockSync::reset()
+{
+	sample_head = 0;
+	sample_count = 0;
+	interval_start = 0;
+	best_time = 0;
+	best_offset = 0;
+	best_delay = 0;
+	has_best = false;
+	has_base = false;
+	base_offset = 0;
+	last_t1 = 0;
+	last_time = 0;
+	fit_time = 0;
+	fit_offset = 0.0;
+	drift = 0.0;
+
+	memset(&forward, 0, sizeof(forward));
+	memset(&processing, 0, sizeof(processing));
+	memset(&reverse, 0, sizeof(reverse));
+}
+
+void ClockSync::add_exchange(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4)
+{
+	//All differences are modular, both micros() clocks may wrap anywhere in the exchange
+	uint32_t delay_us = (t4 - t1) - (t3 - t2);
+	uint32_t up = t2 - t1;//offset + forward
+	uint32_t down = t3 - t4;//offset - reverse
+	uint32_t offset = down + (uint32_t)((int32_t)(up - down) / 2);
+
+	//First exchange, or so long since the last one that the master clock delta is ambiguous
+	if (!has_base || t1 - last_t1 > 0x7FFFFFFFUL)
+	{
+		has_base = true;
+		base_offset = offset;
+		last_time = 0;
+		sample_count = 0;
+		sample_head = 0;
+		interval_start = 0;
+		has_best = false;
+		fit_time = 0;
+		fit_offset = 0.0;
+	}
+	else
+	{
+		last_time += t1 - last_t1;
+	}
+	last_t1 = t1;
+
+	//Interval over: its fastest exchange becomes a fit point
+	if (has_best && last_time - interval_start >= (int64_t)CLOCK_SYNC_INTERVAL_US)
+	{
+		sample_time[sample_head] = best_time;
+		sample_offset[sample_head] = best_offset;
+		sample_delay[sample_head] = best_delay;
+		sample_head = (sample_head + 1) % CLOCK_SYNC_WINDOW;
+		if (sample_count < CLOCK_SYNC_WINDOW) sample_count++;
+
+		interval_start = last_time;
+		has_best = false;
+	}
+
+	if (!has_best || delay_us < best_delay)
+	{
+		best_time = last_time;
+		best_offset = (int32_t)(offset - base_offset);
+		best_delay = delay_us;
+		has_best = true;
+	}
+
+	fit();
+
+	//Peer timestamps mapped onto the master clock with the fitted offset
+	uint32_t offset_at_t1 = predict_offset(last_time);
+	uint32_t offset_at_t4 = predict_offset(last_time + (t4 - t1));
+
+	add_sample(&forward, (int32_t)(t2 - offset_at_t1 - t1));
+	add_sample(&processing, (int32_t)(t3 - t2));
+	add_sample(&reverse, (int32_t)(t4 - (t3 - offset_at_t4)));
+}
+
+void ClockSync::fit()
+{
+	//Window points plus the running interval's best, which is always present here
+	int64_t time[CLOCK_SYNC_WINDOW + 1];
+	int32_t offset[CLOCK_SYNC_WINDOW + 1];
+	uint32_t delay[CLOCK_SYNC_WINDOW + 1];
+	uint8_t points = sample_count;
+
+	memcpy(time, sample_time, sizeof(sample_time));
+	memcpy(offset, sample_offset, sizeof(sample_offset));
+	memcpy(delay, sample_delay, sizeof(sample_delay));
+	time[points] = best_time;
+	offset[points] = best_offset;
+	delay[points] = best_delay;
+	points++;
+
+	uint32_t min_delay = UINT32_MAX;
+	for (uint8_t i = 0; i < points; i++)
+	{
+		if (delay[i] < min_delay) min_delay = delay[i];
+	}
+
+	//Least squares over the points that saw (close to) an empty path. Compared as a difference,
+	//a bogus exchange with a wrapped delay near UINT32_MAX must not push the bound past zero.
+	double sum_time = 0.0;
+	double sum_offset = 0.0;
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < points; i++)
+	{
+		if (delay[i] - min_delay > CLOCK_SYNC_DELAY_SLACK_US) continue;
+		sum_time += time[i];
+		sum_offset += offset[i];
+		n++;
+	}
+
+	if (n == 0) return;//cannot happen with the minimum itself always in, keeps the last fit rather than NaN
+
+	double mean_time = sum_time / n;
+	double mean_offset = sum_offset / n;
+	double sxx = 0.0;
+	double sxy = 0.0;
+	for (uint8_t i = 0; i < points; i++)
+	{
+		if (delay[i] - min_delay > CLOCK_SYNC_DELAY_SLACK_US) continue;
+		double dt = time[i] - mean_time;
+		sxx += dt * dt;
+		sxy += dt * (offset[i] - mean_offset);
+	}
+
+	//A single usable exchange moves the offset, the drift keeps its last estimate
+	if (n >= 2 && sxx > 0.0) drift = sxy / sxx;
+	fit_time = (int64_t)mean_time;
+	fit_offset = mean_offset + drift * (fit_time - mean_time);
+}
+
+uint32_t ClockSync::predict_offset(int64_t time) const
+{
+	double relative = fit_offset + drift * (double)(time - fit_time);
+	return base_offset + (uint32_t)(int32_t)(relative < 0 ? relative - 0.5 : relative + 0.5);
+}
+
+void ClockSync::add_sample(PathStat* stat, int32_t value_us)
+{
+	if (stat->count == 0 || value_us < stat->min_us) stat->min_us = value_us;
+	if (stat->count == 0 || value_us > stat->max_us) stat->max_us = value_us;
+	stat->total_us += value_us;
+	stat->count++;
+}
+
+void ClockSync::print_path(const char* name, const PathStat* stat)
+{
+	Serial.print(name);
+	Serial.print(stat->min_us); Serial.print("/");
+	Serial.print(stat->count ? (float)stat->total_us / stat->count : 0.0, 1); Serial.print("/");
+	Serial.print(stat->max_us); Serial.println(" us");
+}
+
+void ClockSync::print_statistics()
+{
+	Serial.println("ONE-WAY LATENCY (min/avg/max):");
+	print_path(" Forward: ", &forward);
+	print_path(" Peer Processing: ", &processing);
+	print_path(" Reverse: ", &reverse);
+	Serial.print(" Clock Offset: "); Serial.print(get_offset_us()); Serial.println(" us");
+	Serial.print(" Clock Drift: "); Serial.print(get_drift_ppm(), 2); Serial.println(" ppm");
+	Serial.print(" Exchanges: "); Serial.println(get_exchanges());
+}
@@ -0,0 +1,79 @@
+#pragma once
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define CLOCK_SYNC_WINDOW 16//intervals kept for the offset/drift fit, the drift baseline is up to WINDOW intervals
+#define CLOCK_SYNC_INTERVAL_US 1000000UL//one fit point per interval: its fastest exchange
+#define CLOCK_SYNC_DELAY_SLACK_US 1000//points slower than the fastest one + slack were queued, kept out of the fit
+
+typedef struct
+{
+	int64_t total_us;
+	int32_t min_us;
+	int32_t max_us;
+	uint32_t count;
+}PathStat;
+
+//NTP-style offset/drift estimate of the peer's micros() against ours from four timestamps
+//per DATA/ACK exchange: t1 DATA sent, t2 DATA received (peer), t3 ACK sent (peer), t4 ACK received.
+//Each interval contributes its fastest exchange (the NTP clock filter); offset and drift are a
+//least-squares fit over the last CLOCK_SYNC_WINDOW of those. Every exchange is then split into
+//forward path, peer processing and reverse path on the master clock.
+//As in NTP a constant asymmetry between the two paths is not observable: it ends up in the
+//offset, so the split is exact for the variable part (queuing, logging) and symmetric for the rest.
+class ClockSync
+{
+private:
+	//Fit points: master time and offset relative to the first exchange, so the fit works on small numbers
+	int64_t sample_time[CLOCK_SYNC_WINDOW];
+	int32_t sample_offset[CLOCK_SYNC_WINDOW];
+	uint32_t sample_delay[CLOCK_SYNC_WINDOW];//round trip minus peer processing
+	uint8_t sample_head;
+	uint8_t sample_count;
+
+	//Fastest exchange of the running interval, also a provisional fit point
+	int64_t interval_start;
+	int64_t best_time;
+	int32_t best_offset;
+	uint32_t best_delay;
+	bool has_best;
+
+	bool has_base;
+	uint32_t base_offset;
+	uint32_t last_t1;
+	int64_t last_time;//unwrapped master time of the last exchange
+
+	//offset(t) = base_offset + fit_offset + drift * (t - fit_time)
+	int64_t fit_time;
+	double fit_offset;
+	double drift;//peer us gained per master us
+
+	PathStat forward;
+	PathStat processing;
+	PathStat reverse;
+
+	void fit();
+	uint32_t predict_offset(int64_t time) const;
+	static void add_sample(PathStat* stat, int32_t value_us);
+	static void print_path(const char* name, const PathStat* stat);
+
+public:
+	ClockSync();
+
+	void add_exchange(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4);
+	void reset();
+
+	uint32_t get_exchanges() const { return forward.count; }
+	int32_t get_offset_us() const { return (int32_t)predict_offset(last_time); }//peer minus master, mod 2^32
+	float get_drift_ppm() const { return drift * 1e6; }
+	float get_average_forward_us() const { return forward.count ? (float)forward.total_us / forward.count : 0.0; }
+	float get_average_processing_us() const { return processing.count ? (float)processing.total_us / processing.count : 0.0; }
+	float get_average_reverse_us() const { return reverse.count ? (float)reverse.total_us / reverse.count : 0.0; }
+
+	void print_statistics();
+};
+
+#endif // !CLOCK_SYNC_H
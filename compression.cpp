@@ -0,0 +1,126 @@
+#include "compression.h"
+#include <string.h>
+
+const uint8_t PayloadCompressor::MIN_MATCH = 3;
+const uint8_t PayloadCompressor::MAX_MATCH = 0x7F + 3;
+const uint8_t PayloadCompressor::MAX_LITERAL_RUN = 0x80;
+const uint8_t PayloadCompressor::MAX_DISTANCE = 0xFF;
+
+//Fragments of the telemetry strings built in send_uart_data()/send_spi_data()
+const char PayloadCompressor::DICTIONARY[] = "Test  - Time: ";
+const uint8_t PayloadCompressor::DICTIONARY_LEN = sizeof(DICTIONARY) - 1;
+
+uint8_t PayloadCompressor::window_byte(const uint8_t* buffer, uint16_t virtual_pos)
+{
+	if (virtual_pos < DICTIONARY_LEN) return (uint8_t)DICTIONARY[virtual_pos];
+	return buffer[virtual_pos - DICTIONARY_LEN];
+}
+
+uint16_t PayloadCompressor::compress(const uint8_t* input, uint16_t input_len, uint8_t* output, uint16_t output_size)
+{
+	if (!input || !output || input_len == 0) return 0;
+
+	uint16_t in_pos = 0;
+	uint16_t out_pos = 0;
+	uint16_t literal_start = 0;
+	uint16_t literal_len = 0;
+
+	while (in_pos <= input_len)
+	{
+		uint16_t best_len = 0;
+		uint16_t best_dist = 0;
+		uint16_t max_len = input_len - in_pos;
+		if (max_len > MAX_MATCH) max_len = MAX_MATCH;
+
+		//Greedy longest match; window is tiny (dictionary + <= one frame payload)
+		if (max_len >= MIN_MATCH)
+		{
+			uint16_t cur = DICTIONARY_LEN + in_pos;
+			uint16_t max_dist = cur < MAX_DISTANCE ? cur : MAX_DISTANCE;
+
+			for (uint16_t dist = 1; dist <= max_dist; dist++)
+			{
+				uint16_t src = cur - dist;
+				uint16_t len = 0;
+				while (len < max_len && window_byte(input, src + len) == input[in_pos + len]) len++;
+
+				if (len > best_len)
+				{
+					best_len = len;
+					best_dist = dist;
+					if (len == max_len) break;
+				}
+			}
+		}
+
+		//Flush pending literals before a match, at the end, or when the run is full
+		bool end_of_input = (in_pos == input_len);
+		if (literal_len > 0 && (best_len >= MIN_MATCH || end_of_input || literal_len == MAX_LITERAL_RUN))
+		{
+			if (out_pos + 1 + literal_len > output_size) return 0;
+			output[out_pos++] = (uint8_t)(literal_len - 1);
+			memcpy(&output[out_pos], &input[literal_start], literal_len);
+			out_pos += literal_len;
+			literal_len = 0;
+		}
+		if (end_of_input) break;
+
+		if (best_len >= MIN_MATCH)
+		{
+			if (out_pos + 2 > output_size) return 0;
+			output[out_pos++] = (uint8_t)(0x80 | (best_len - MIN_MATCH));
+			output[out_pos++] = (uint8_t)best_dist;
+			in_pos += best_len;
+		}
+		else
+		{
+			if (literal_len == 0) literal_start = in_pos;
+			literal_len++;
+			in_pos++;
+		}
+
+		if (out_pos >= input_len) return 0;//no gain, send raw
+	}
+
+	return out_pos < input_len ? out_pos : 0;
+}
+
+uint16_t PayloadCompressor::decompress(const uint8_t* input, uint16_t input_len, uint8_t* output, uint16_t output_size)
+{
+	if (!input || !output) return 0;
+
+	uint16_t in_pos = 0;
+	uint16_t out_pos = 0;
+
+	while (in_pos < input_len)
+	{
+		uint8_t token = input[in_pos++];
+
+		if (token < 0x80)
+		{
+			uint16_t run = token + 1;
+			if (in_pos + run > input_len || out_pos + run > output_size) return 0;
+
+			memcpy(&output[out_pos], &input[in_pos], run);
+			in_pos += run;
+			out_pos += run;
+		}
+		else
+		{
+			if (in_pos >= input_len) return 0;
+
+			uint16_t len = (token & 0x7F) + MIN_MATCH;
+			uint16_t dist = input[in_pos++];
+			if (dist == 0 || dist > DICTIONARY_LEN + out_pos || out_pos + len > output_size) return 0;
+
+			//Byte-wise copy: source may overlap the bytes being produced
+			uint16_t src = DICTIONARY_LEN + out_pos - dist;
+			for (uint16_t i = 0; i < len; i++)
+			{
+				output[out_pos++] = window_byte(output, src + i);
+			}
+		}
+	}
+
+	return out_pos;
+}
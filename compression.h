@@ -0,0 +1,33 @@
+#pragma once
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdint.h>
+
+//LZ-style payload codec with a small static dictionary, tuned for short ASCII telemetry.
+//Stateless and allocation-free: RAM use is the caller's output buffer plus a few locals.
+//
+//Token stream:
+//  0x00-0x7F  literal run, (token + 1) raw bytes follow
+//  0x80-0xFF  match, length (token & 0x7F) + MIN_MATCH, next byte = distance back into
+//             the virtual window (static dictionary followed by the bytes decoded so far)
+class PayloadCompressor
+{
+public:
+	//Returns compressed length, or 0 when the result would not be smaller than the input
+	static uint16_t compress(const uint8_t* input, uint16_t input_len, uint8_t* output, uint16_t output_size);
+	//Returns decompressed length, or 0 on a malformed stream / output overflow
+	static uint16_t decompress(const uint8_t* input, uint16_t input_len, uint8_t* output, uint16_t output_size);
+
+private:
+	static const uint8_t MIN_MATCH;
+	static const uint8_t MAX_MATCH;
+	static const uint8_t MAX_LITERAL_RUN;
+	static const uint8_t MAX_DISTANCE;
+	static const char DICTIONARY[];
+	static const uint8_t DICTIONARY_LEN;
+
+	static uint8_t window_byte(const uint8_t* buffer, uint16_t virtual_pos);
+};
+
+#endif // !COMPRESSION_H
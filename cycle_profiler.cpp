@@ -0,0 +1,54 @@
+#include "cycle_profiler.h"
+
+ProfileSlot CycleProfiler::slots[PROF_STAGE_COUNT];
+
+static const char* const stage_names[PROF_STAGE_COUNT] =
+{
+	"create_frame",
+	"crc16",
+	"validate_frame",
+	"serial write",
+	"serial flush",
+	"uart parse",
+	"spi transfer",
+	"logging",
+	"aead",
+};
+
+void CycleProfiler::record(ProfileStage stage, uint32_t cycles)
+{
+#if defined(ESP32)
+	if (xPortInIsrContext()) return;
+#endif
+
+	ProfileSlot& slot = slots[stage];
+
+	if (slot.count == 0 || cycles < slot.min_cycles) slot.min_cycles = cycles;
+	if (cycles > slot.max_cycles) slot.max_cycles = cycles;
+	slot.total_cycles += cycles;
+	slot.count++;
+}
+
+void CycleProfiler::reset()
+{
+	memset(slots, 0, sizeof(slots));
+}
+
+void CycleProfiler::print_statistics()
+{
+	Serial.println("CYCLE PROFILE (min/avg/max cycles):");
+	for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++)
+	{
+		const ProfileSlot& slot = slots[i];
+		if (slot.count == 0) continue;
+
+		Serial.print(" "); Serial.print(stage_names[i]);
+		Serial.print(": "); Serial.print(slot.min_cycles);
+		Serial.print("/"); Serial.print((uint32_t)(slot.total_cycles / slot.count));
+		Serial.print("/"); Serial.print(slot.max_cycles);
+		Serial.print(" x"); Serial.println(slot.count);
+	}
+#if defined(ESP32)
+	Serial.print(" CPU: "); Serial.print(ESP.getCpuFreqMHz()); Serial.println(" MHz");
+#endif
+}
@@ -0,0 +1,94 @@
+#pragma once
+#ifndef CYCLE_PROFILER_H
+#define CYCLE_PROFILER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+//Build flag: -DENABLE_CYCLE_PROFILER=1. Off by default, every probe then expands to nothing.
+#ifndef ENABLE_CYCLE_PROFILER
+#define ENABLE_CYCLE_PROFILER 0
+#endif
+
+#if !defined(ESP32)
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+typedef enum
+{
+	PROF_CREATE_FRAME,//PacketFrame::build_frame, compression included
+	PROF_CRC,//CRC16::calculate
+	PROF_VALIDATE_FRAME,//PacketFrame::validate_frame
+	PROF_SERIAL_WRITE,//UART write() of one serialized frame
+	PROF_SERIAL_FLUSH,//UART flush() until the frame has left the FIFO
+	PROF_UART_PARSE,//UartProtocol::receive_uart span scan
+	PROF_SPI_TRANSFER,//one 64-byte SPI byte loop
+	PROF_LOGGING,//print_frame_info
+	PROF_AEAD,//FrameCipher seal/open, replaces PROF_CRC on AEAD links
+	PROF_STAGE_COUNT
+}ProfileStage;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t total_cycles;
+}ProfileSlot;
+
+//Per-stage cycle counts for the send/receive pipeline, accumulated in fixed slots.
+//Stages nest (CRC runs inside create_frame and validate_frame), so every slot is inclusive.
+//Slots are unlocked: probes hit from interrupt context (the SPI slave hook validates and builds
+//frames) are dropped, the slots only ever hold task-context samples.
+class CycleProfiler
+{
+private:
+	static ProfileSlot slots[PROF_STAGE_COUNT];
+
+public:
+	//ESP32: CCOUNT register (CPU clock). Host: TSC, or nanoseconds where there is none.
+	static inline uint32_t read_cycles()
+	{
+#if defined(ESP32)
+		return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+		return (uint32_t)__rdtsc();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+	}
+
+	static void record(ProfileStage stage, uint32_t cycles);
+	static const ProfileSlot& get_slot(ProfileStage stage) { return slots[stage]; }
+	static void print_statistics();
+	static void reset();
+};
+
+//Times the rest of the enclosing block
+class ProfileScope
+{
+private:
+	ProfileStage stage;
+	uint32_t start;
+
+public:
+	explicit ProfileScope(ProfileStage s) : stage(s), start(CycleProfiler::read_cycles()) {}
+	~ProfileScope() { CycleProfiler::record(stage, CycleProfiler::read_cycles() - start); }//unsigned, survives the 32-bit wrap
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if ENABLE_CYCLE_PROFILER
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+#else
+#define PROFILE_SCOPE(stage) ((void)0)
+#endif
+
+#endif // !CYCLE_PROFILER_H
@@ -0,0 +1,236 @@
+#include "frame_cipher.h"
+#include "cycle_profiler.h"
+
+#if !defined(ESP32)
+#include <random>
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER_ROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7)
+
+static inline uint32_t load32_le(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Poly1305 accumulator, 26-bit limbs so every product fits a 32x32->64 multiply
+typedef struct
+{
+	uint32_t r[5];
+	uint32_t s[4];//r * 5, folds the modular reduction into the multiply
+	uint32_t h[5];
+	uint32_t pad[4];
+}Poly1305;
+
+static void poly1305_init(Poly1305* st, const uint8_t* otk)
+{
+	st->r[0] = load32_le(otk + 0) & 0x3ffffff;
+	st->r[1] = (load32_le(otk + 3) >> 2) & 0x3ffff03;
+	st->r[2] = (load32_le(otk + 6) >> 4) & 0x3ffc0ff;
+	st->r[3] = (load32_le(otk + 9) >> 6) & 0x3f03fff;
+	st->r[4] = (load32_le(otk + 12) >> 8) & 0x00fffff;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		st->s[i] = st->r[i + 1] * 5;
+		st->pad[i] = load32_le(otk + 16 + 4 * i);
+	}
+	memset(st->h, 0, sizeof(st->h));
+}
+
+//Whole 16-byte blocks; a short tail is zero-padded, which is exactly RFC 8439's pad16
+static void poly1305_update(Poly1305* st, const uint8_t* data, uint16_t length)
+{
+	const uint32_t* r = st->r;
+	const uint32_t* s = st->s;
+	uint32_t* h = st->h;
+
+	while (length > 0)
+	{
+		uint8_t block[16];
+		const uint8_t* m = data;
+		uint16_t take = length < 16 ? length : 16;
+		if (take < 16)
+		{
+			memset(block, 0, sizeof(block));
+			memcpy(block, data, take);
+			m = block;
+		}
+
+		h[0] += load32_le(m + 0) & 0x3ffffff;
+		h[1] += (load32_le(m + 3) >> 2) & 0x3ffffff;
+		h[2] += (load32_le(m + 6) >> 4) & 0x3ffffff;
+		h[3] += (load32_le(m + 9) >> 6) & 0x3ffffff;
+		h[4] += (load32_le(m + 12) >> 8) | (1UL << 24);
+
+		uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s[3] + (uint64_t)h[2] * s[2] + (uint64_t)h[3] * s[1] + (uint64_t)h[4] * s[0];
+		uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s[3] + (uint64_t)h[3] * s[2] + (uint64_t)h[4] * s[1];
+		uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s[3] + (uint64_t)h[4] * s[2];
+		uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s[3];
+		uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+
+		uint32_t c = (uint32_t)(d0 >> 26); h[0] = (uint32_t)d0 & 0x3ffffff;
+		d1 += c; c = (uint32_t)(d1 >> 26); h[1] = (uint32_t)d1 & 0x3ffffff;
+		d2 += c; c = (uint32_t)(d2 >> 26); h[2] = (uint32_t)d2 & 0x3ffffff;
+		d3 += c; c = (uint32_t)(d3 >> 26); h[3] = (uint32_t)d3 & 0x3ffffff;
+		d4 += c; c = (uint32_t)(d4 >> 26); h[4] = (uint32_t)d4 & 0x3ffffff;
+		h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+		h[1] += c;
+
+		data += take;
+		length -= take;
+	}
+}
+
+//Low 16 bits of the full tag: carries only run upwards, so h1..h4 beyond the reduction are not needed
+static uint16_t poly1305_finish16(Poly1305* st)
+{
+	uint32_t* h = st->h;
+	uint32_t c;
+
+	c = h[1] >> 26; h[1] &= 0x3ffffff;
+	h[2] += c; c = h[2] >> 26; h[2] &= 0x3ffffff;
+	h[3] += c; c = h[3] >> 26; h[3] &= 0x3ffffff;
+	h[4] += c; c = h[4] >> 26; h[4] &= 0x3ffffff;
+	h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+	h[1] += c;
+
+	//h - p when h >= p (2^130 - 5), selected without a branch
+	uint32_t g[5];
+	g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= 0x3ffffff;
+	g[1] = h[1] + c; c = g[1] >> 26; g[1] &= 0x3ffffff;
+	g[2] = h[2] + c; c = g[2] >> 26; g[2] &= 0x3ffffff;
+	g[3] = h[3] + c; c = g[3] >> 26; g[3] &= 0x3ffffff;
+	g[4] = h[4] + c - (1UL << 26);
+
+	uint32_t mask = (g[4] >> 31) - 1;
+	uint32_t h0 = (h[0] & ~mask) | (g[0] & mask);
+	uint32_t h1 = (h[1] & ~mask) | (g[1] & mask);
+
+	uint32_t low = h0 | (h1 << 26);
+	return (uint16_t)(low + st->pad[0]);
+}
+
+FrameCipher::FrameCipher()
+{
+	clear();
+}
+
+void FrameCipher::set_key(const uint8_t* key_bytes)
+{
+	for (uint8_t i = 0; i < 8; i++) key[i] = load32_le(key_bytes + 4 * i);
+}
+
+void FrameCipher::clear()
+{
+	memset(key, 0, sizeof(key));
+}
+
+void FrameCipher::chacha_block(const uint32_t* key_words, uint32_t counter, const uint8_t* nonce, uint32_t* out)
+{
+	uint32_t x[16];
+	x[0] = 0x61707865;//"expand 32-byte k"
+	x[1] = 0x3320646e;
+	x[2] = 0x79622d32;
+	x[3] = 0x6b206574;
+	for (uint8_t i = 0; i < 8; i++) x[4 + i] = key_words[i];
+	x[12] = counter;
+	x[13] = load32_le(nonce + 0);
+	x[14] = load32_le(nonce + 4);
+	x[15] = load32_le(nonce + 8);
+	memcpy(out, x, sizeof(x));
+
+	for (uint8_t round = 0; round < 10; round++)
+	{
+		QUARTER_ROUND(out[0], out[4], out[8], out[12]);
+		QUARTER_ROUND(out[1], out[5], out[9], out[13]);
+		QUARTER_ROUND(out[2], out[6], out[10], out[14]);
+		QUARTER_ROUND(out[3], out[7], out[11], out[15]);
+		QUARTER_ROUND(out[0], out[5], out[10], out[15]);
+		QUARTER_ROUND(out[1], out[6], out[11], out[12]);
+		QUARTER_ROUND(out[2], out[7], out[8], out[13]);
+		QUARTER_ROUND(out[3], out[4], out[9], out[14]);
+	}
+
+	for (uint8_t i = 0; i < 16; i++) out[i] += x[i];
+}
+
+void FrameCipher::crypt(const uint8_t* nonce, uint8_t* data, uint16_t length) const
+{
+	uint32_t stream[16];
+	uint32_t counter = 1;//block 0 is the Poly1305 one-time key
+
+	for (uint16_t pos = 0; pos < length; pos += 64, counter++)
+	{
+		chacha_block(key, counter, nonce, stream);
+		uint16_t chunk = length - pos < 64 ? length - pos : 64;
+		for (uint16_t i = 0; i < chunk; i++) data[pos + i] ^= (uint8_t)(stream[i >> 2] >> (8 * (i & 3)));
+	}
+}
+
+uint16_t FrameCipher::compute_tag(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, const uint8_t* data, uint16_t length) const
+{
+	uint32_t block0[16];
+	chacha_block(key, 0, nonce, block0);
+
+	uint8_t otk[32];
+	for (uint8_t i = 0; i < 32; i++) otk[i] = (uint8_t)(block0[i >> 2] >> (8 * (i & 3)));
+
+	Poly1305 st;
+	poly1305_init(&st, otk);
+	poly1305_update(&st, aad, aad_len);
+	poly1305_update(&st, data, length);
+
+	uint8_t lengths[16];
+	memset(lengths, 0, sizeof(lengths));
+	lengths[0] = (uint8_t)aad_len;
+	lengths[1] = (uint8_t)(aad_len >> 8);
+	lengths[8] = (uint8_t)length;
+	lengths[9] = (uint8_t)(length >> 8);
+	poly1305_update(&st, lengths, sizeof(lengths));
+
+	return poly1305_finish16(&st);
+}
+
+uint16_t FrameCipher::seal(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, uint8_t* data, uint16_t length) const
+{
+	PROFILE_SCOPE(PROF_AEAD);
+	crypt(nonce, data, length);
+	return compute_tag(nonce, aad, aad_len, data, length);
+}
+
+bool FrameCipher::open(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, uint8_t* data, uint16_t length, uint16_t tag) const
+{
+	PROFILE_SCOPE(PROF_AEAD);
+	if (compute_tag(nonce, aad, aad_len, data, length) != tag) return false;
+	crypt(nonce, data, length);
+	return true;
+}
+
+bool FrameCipher::verify(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, const uint8_t* data, uint16_t length, uint16_t tag) const
+{
+	return compute_tag(nonce, aad, aad_len, data, length) == tag;
+}
+
+void FrameCipher::derive_key(const uint8_t* master_key, const uint8_t* context, uint8_t* session_key)
+{
+	uint32_t master_words[8];
+	for (uint8_t i = 0; i < 8; i++) master_words[i] = load32_le(master_key + 4 * i);
+
+	uint32_t block[16];
+	chacha_block(master_words, 0, context, block);
+	for (uint8_t i = 0; i < CIPHER_KEY_LEN; i++) session_key[i] = (uint8_t)(block[i >> 2] >> (8 * (i & 3)));
+}
+
+uint32_t FrameCipher::random_salt()
+{
+#if defined(ESP32)
+	return esp_random();//hardware RNG, seeded from RF noise once the radio or bootloader ran
+#else
+	static std::random_device device;
+	return device();
+#endif
+}
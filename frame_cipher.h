@@ -0,0 +1,46 @@
+#pragma once
+#ifndef FRAME_CIPHER_H
+#define FRAME_CIPHER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define CIPHER_KEY_LEN 32
+#define CIPHER_NONCE_LEN 12
+
+//ChaCha20-Poly1305 (RFC 8439) sized for one frame, with the tag truncated to the 16 bits of
+//the crc16 field it replaces. Plain 32-bit C, no tables: the same code on the ESP32 and host.
+//
+//seal() encrypts in place and MACs the ciphertext, open() checks the tag before it decrypts,
+//so a forged frame is never turned into plaintext. The only working state is one ChaCha20
+//block of words on the stack.
+//
+//A 16-bit tag lets a blind forgery through once per 65536 tries on average. Every failed try
+//shows up as a crc_error, which is the budget this mode trades for not stacking a MAC on CRC16.
+class FrameCipher
+{
+private:
+	uint32_t key[8];
+
+	static void chacha_block(const uint32_t* key_words, uint32_t counter, const uint8_t* nonce, uint32_t* out);
+	void crypt(const uint8_t* nonce, uint8_t* data, uint16_t length) const;//XOR keystream from block 1 on
+	uint16_t compute_tag(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, const uint8_t* data, uint16_t length) const;
+
+public:
+	FrameCipher();
+
+	void set_key(const uint8_t* key_bytes);//CIPHER_KEY_LEN bytes
+	void clear();
+
+	//Returns the truncated tag of aad + ciphertext, data is ciphertext afterwards
+	uint16_t seal(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, uint8_t* data, uint16_t length) const;
+	//false = tag mismatch, data untouched; true = data is plaintext afterwards
+	bool open(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, uint8_t* data, uint16_t length, uint16_t tag) const;
+	bool verify(const uint8_t* nonce, const uint8_t* aad, uint16_t aad_len, const uint8_t* data, uint16_t length, uint16_t tag) const;
+
+	//Session key = first ChaCha20 block of the master key under a context nonce (both peers' salts)
+	static void derive_key(const uint8_t* master_key, const uint8_t* context, uint8_t* session_key);
+	static uint32_t random_salt();
+};
+
+#endif // !FRAME_CIPHER_H
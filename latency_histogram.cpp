@@ -0,0 +1,51 @@
+#include "latency_histogram.h"
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+void LatencyHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	sample_count = 0;
+	max_us = 0;
+}
+
+void LatencyHistogram::add_sample(uint32_t latency_us)
+{
+	uint8_t index = 0;
+	uint32_t scaled = latency_us / BASE_US;
+
+	while (scaled > 0 && index < BUCKET_COUNT - 1)
+	{
+		scaled >>= 1;
+		index++;
+	}
+
+	buckets[index]++;
+	sample_count++;
+	if (latency_us > max_us) max_us = latency_us;
+}
+
+uint32_t LatencyHistogram::get_percentile(float percentile) const
+{
+	if (sample_count == 0) return 0;
+
+	uint32_t target = (uint32_t)(sample_count * percentile / 100.0f);
+	if (target >= sample_count) target = sample_count - 1;
+
+	uint32_t seen = 0;
+	for (uint8_t i = 0; i < BUCKET_COUNT; i++)
+	{
+		seen += buckets[i];
+		if (seen > target)
+		{
+			//Bucket bound, never above the real maximum (the last bucket is open-ended)
+			uint32_t limit = get_bucket_limit(i);
+			return (i == BUCKET_COUNT - 1 || limit > max_us) ? max_us : limit;
+		}
+	}
+	return max_us;
+}
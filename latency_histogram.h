@@ -0,0 +1,33 @@
+#pragma once
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+//Log2 latency histogram in microseconds: bucket n holds samples below (BASE_US << n),
+//the last bucket also takes everything above. Fixed memory, O(1) insert.
+class LatencyHistogram
+{
+public:
+	static const uint8_t BUCKET_COUNT = 16;
+	static const uint32_t BASE_US = 128;
+
+	LatencyHistogram();
+
+	void add_sample(uint32_t latency_us);
+	void reset();
+
+	uint32_t get_count() const { return sample_count; }
+	uint32_t get_bucket(uint8_t index) const { return index < BUCKET_COUNT ? buckets[index] : 0; }
+	uint32_t get_max() const { return max_us; }
+	//Upper bound of the bucket holding the given percentile (0-100), 0 if empty
+	uint32_t get_percentile(float percentile) const;
+	static uint32_t get_bucket_limit(uint8_t index) { return BASE_US << index; }
+
+private:
+	uint32_t buckets[BUCKET_COUNT];
+	uint32_t sample_count;
+	uint32_t max_us;
+};
+
+#endif // !LATENCY_HISTOGRAM_H
@@ -0,0 +1,56 @@
+#include "link_params.h"
+
+const uint32_t LinkNegotiation::STANDARD_BAUDS[] = { 115200, 230400, 460800, 921600, 2000000 };
+const uint8_t LinkNegotiation::STANDARD_BAUD_COUNT = sizeof(STANDARD_BAUDS) / sizeof(STANDARD_BAUDS[0]);
+
+void LinkNegotiation::get_local_params(LinkParams* params, uint32_t max_baud, uint8_t max_payload)
+{
+	if (!params) return;
+
+	params->version = LINK_PROTOCOL_VERSION;
+	params->max_payload = max_payload;
+	params->window_size = 1;
+	params->crc_variants = CRC_VARIANT_CCITT;
+	params->features = FEATURE_COMPRESSION;
+	params->max_baud = snap_baud(max_baud);
+}
+
+bool LinkNegotiation::negotiate(const LinkParams* local, const LinkParams* peer, LinkParams* result)
+{
+	if (!local || !peer || !result) return false;
+	if (local->version != peer->version) return false;
+
+	uint8_t common_crc = local->crc_variants & peer->crc_variants;
+	if (common_crc == 0) return false;
+
+	result->version = local->version;
+	result->max_payload = local->max_payload < peer->max_payload ? local->max_payload : peer->max_payload;
+	result->window_size = local->window_size < peer->window_size ? local->window_size : peer->window_size;
+	result->crc_variants = common_crc & (uint8_t)(-(int8_t)common_crc);//lowest common bit
+	result->features = local->features & peer->features;
+	result->max_baud = snap_baud(local->max_baud < peer->max_baud ? local->max_baud : peer->max_baud);
+
+	return result->max_payload > 0 && result->window_size > 0;
+}
+
+uint32_t LinkNegotiation::snap_baud(uint32_t baud)
+{
+	uint32_t snapped = STANDARD_BAUDS[0];
+
+	for (uint8_t i = 0; i < STANDARD_BAUD_COUNT; i++)
+	{
+		if (STANDARD_BAUDS[i] <= baud) snapped = STANDARD_BAUDS[i];
+	}
+	return snapped;
+}
+
+uint32_t LinkNegotiation::step_down_baud(uint32_t baud)
+{
+	uint32_t lower = STANDARD_BAUDS[0];
+
+	for (uint8_t i = 0; i < STANDARD_BAUD_COUNT; i++)
+	{
+		if (STANDARD_BAUDS[i] < baud) lower = STANDARD_BAUDS[i];
+	}
+	return lower;
+}
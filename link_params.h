@@ -0,0 +1,63 @@
+#pragma once
+#ifndef LINK_PARAMS_H
+#define LINK_PARAMS_H
+
+#include <stdint.h>
+
+#define LINK_PROTOCOL_VERSION 2//2: channel_id in the frame header
+#define LINK_BASE_BAUD 115200//every peer starts (and falls back) here
+
+//CRC variants, advertised as a bitmask
+#define CRC_VARIANT_CCITT 0x01//CRC16-CCITT, poly 0x1021, init 0xFFFF
+#define CRC_VARIANT_AEAD 0x02//ChaCha20-Poly1305, 16-bit tag in the crc16 field (FrameCipher)
+
+//Keyed links append a random salt to the SYN and SYN-ACK LinkParams, both feed the session key
+#define SESSION_SALT_LEN 4
+
+//Optional features, advertised as a bitmask
+#define FEATURE_COMPRESSION 0x01
+#define FEATURE_FEC 0x02
+
+//Baud step-up fallback
+#define LINK_QUALITY_WINDOW 32//frames per error-rate evaluation
+#define LINK_ERROR_THRESHOLD_PCT 5//retransmissions above this drop one baud step
+#define LINK_ERROR_BURST 8//consecutive bad frames before the receiver falls back
+#define LINK_IDLE_FALLBACK_MS 5000//silence at a stepped-up rate before the receiver falls back
+#define LINK_RECONNECT_MS 10000//interval between handshake attempts while no session
+#define LINK_AUTH_FAILURE_LIMIT 8//consecutive AEAD tag failures before the session key is dropped and renegotiated
+
+//Link liveness: silence from the peer drives UP -> SUSPECT -> DOWN, any frame brings it back UP
+#define HEARTBEAT_IDLE_MS 250//quiet time before the prober sends a POLL heartbeat
+#define HEARTBEAT_RETRY_MS 100//heartbeat interval while SUSPECT
+#define LINK_SUSPECT_MS 500//silence before the link is SUSPECT
+#define LINK_DOWN_MS 1000//silence before the link is DOWN and sends fail fast, once MAX_RETRIES probes went unanswered
+#define LINK_REPROBE_MS 250//heartbeat interval while DOWN, recovery takes at most this plus one round trip
+#define LINK_PASSIVE_FACTOR 2//the side that only answers suspects later, the prober's heartbeat can sit behind a send
+
+typedef struct __attribute__((packed))
+{
+	uint8_t version;
+	uint8_t max_payload;//bytes of data[] per frame
+	uint8_t window_size;//frames in flight (1 = stop-and-wait)
+	uint8_t crc_variants;//CRC_VARIANT_* bitmask, negotiated result has exactly one bit
+	uint8_t features;//FEATURE_* bitmask
+	uint32_t max_baud;
+}LinkParams;
+
+class LinkNegotiation
+{
+public:
+	static void get_local_params(LinkParams* params, uint32_t max_baud, uint8_t max_payload);
+	//Lowest common denominator of both peers, false if the peers cannot talk at all
+	static bool negotiate(const LinkParams* local, const LinkParams* peer, LinkParams* result);
+	//Highest standard baud rate <= baud (never below LINK_BASE_BAUD)
+	static uint32_t snap_baud(uint32_t baud);
+	//Next standard baud rate below baud (LINK_BASE_BAUD is the floor)
+	static uint32_t step_down_baud(uint32_t baud);
+
+private:
+	static const uint32_t STANDARD_BAUDS[];
+	static const uint8_t STANDARD_BAUD_COUNT;
+};
+
+#endif // !LINK_PARAMS_H
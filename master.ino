@@ -1,5 +1,6 @@
 #include "uart_protocol.h"
 #include "spi_master_protocol.h"
+#include "spi_bus_manager.h"
 #include <SPI.h>
 
 HardwareSerial SerialPort(2);
@@ -8,10 +9,45 @@ HardwareSerial SerialPort(2);
 
 #define SPI_CS 5
 
+//1: collect from several sensor nodes on the shared bus instead of talking to one slave
+#define USE_SPI_BUS 0
+
+//1: authenticate and encrypt the UART link (ChaCha20-Poly1305 in place of CRC16), same key on both ends
+#define USE_LINK_KEY 0
+
+//1: keep UART messages in flash until ACKed, so outages and reboots do not lose them.
+//Needs a data partition labelled "txjournal" in the partition table (e.g. 64 KB, subtype 0x99)
+#define USE_TX_JOURNAL 0
+
+#if USE_LINK_KEY
+//Placeholder: provision a random key per installation, never ship this one
+static const uint8_t LINK_KEY[CIPHER_KEY_LEN] =
+{
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+#endif
+
 PacketFrame packet_frame;
 UartProtocol uart_protocol(&SerialPort, 115200);
 SpiMasterProtocol spi_master(&SPI, SPI_CS);
 
+#if USE_TX_JOURNAL
+TxJournal tx_journal;
+#endif
+
+#if USE_SPI_BUS
+SpiMasterProtocol bus_sessions[] = { {&SPI, SPI_CS}, {&SPI, 4}, {&SPI, 15}, {&SPI, 27} };
+SpiBusManager spi_bus(&SPI);
+
+void on_bus_data(uint8_t slave, const uint8_t* data, uint16_t length)
+{
+  Serial.print("S"); Serial.print(slave); Serial.print(": ");
+  for (uint16_t i = 0; i < length; i++) Serial.print((char)data[i]);
+  Serial.println();
+}
+#endif
+
 //======================================================= MAIN FUNCTION ===========================================
 
 void setup() 
@@ -22,7 +58,30 @@ void setup()
   SerialPort.begin(115200, SERIAL_8N1, RX2, TX2);
 
   //SPI CONFIG
+#if USE_SPI_BUS
+  for (uint8_t i = 0; i < sizeof(bus_sessions) / sizeof(bus_sessions[0]); i++)
+  {
+    spi_bus.add_slave(&bus_sessions[i]);
+  }
+  spi_bus.set_data_callback(on_bus_data);
+  spi_bus.begin();
+#else
   spi_master.begin();
+#endif
+
+  //Telemetry strings compress well, frames fall back to raw payload when they don't
+  uart_protocol.set_compression(true);
+  spi_master.set_compression(true);
+
+  //UART starts at 115200, the handshake steps up to the fastest rate both ends accept
+  uart_protocol.set_baud_callback([](uint32_t baud) { SerialPort.updateBaudRate(baud); });
+  uart_protocol.set_max_baud(921600);
+#if USE_LINK_KEY
+  uart_protocol.set_link_key(LINK_KEY);
+#endif
+#if USE_TX_JOURNAL
+  if (tx_journal.begin("txjournal")) uart_protocol.set_journal(&tx_journal);//messages left from before a reboot go out first
+#endif
 
   Serial.println("RELIABLE COMMUNICATION SYSTEM - TRANSMITER");
   Serial.println("MODE: SPI");
@@ -50,7 +109,12 @@ void loop()
 
     if(millis() - last_stats > 15000)
     {
+      uart_protocol.request_peer_stats();//slave counters, printed with ours for end-to-end loss
       uart_protocol.get_perf_protocol().print_statistics();
+      uart_protocol.print_channel_statistics();
+#if USE_TX_JOURNAL
+      tx_journal.print_statistics();
+#endif
       last_stats = millis();
     }
 
@@ -58,10 +122,20 @@ void loop()
   }
   else//SPI Mode
   {
-    static unsigned long last_send = 0;
     static unsigned long last_stats = 0;
 
-    
+#if USE_SPI_BUS
+    //Sweep as fast as the slaves have data, idle slaves back off up to BUS_IDLE_POLL_MS
+    if(!spi_bus.service()) delay(1);
+
+    if(millis() - last_stats > 15000)
+    {
+      spi_bus.print_statistics();
+      last_stats = millis();
+    }
+#else
+    static unsigned long last_send = 0;
+
     if(millis() - last_send > 2000)
     {
       spi_master.send_spi_data();
@@ -70,10 +144,12 @@ void loop()
 
     if(millis() - last_stats > 15000)
     {
+      spi_master.request_peer_stats();//slave counters, printed with ours for end-to-end loss
       spi_master.get_perf_protocol().print_statistics();
       last_stats = millis();
     }
 
     delay(10);
+#endif
   }
 }
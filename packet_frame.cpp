@@ -1,63 +1,355 @@
-#include "packet_frame.h"
-
-PacketFrame::PacketFrame() : sequence_counter(0)
-
-{
-	sequence_counter = 0;
-}
-
-uint16_t PacketFrame::get_next_sequence()
-{
-	uint16_t seq = sequence_counter;
-	sequence_counter = (sequence_counter + 1) % 65535;
-	return seq;
-}
-
-bool PacketFrame::create_frame(PacketType type, const uint8_t* data, uint16_t data_len, Frame* frame)
-{
-	if (data_len > MAX_DATA_LEN || !frame) return false;
-
-	frame->start_marker = START_MARKER;
-	frame->packet_type = type;
-	frame->sequence_num = get_next_sequence();
-	frame->data_length = data_len;
-	frame->end_marker = END_MARKER;
-
-	//Clear and copy data
-	memset(frame->data, 0, MAX_DATA_LEN);
-	if (data_len > 0)
-	{
-		memcpy(frame->data, data, data_len);
-	}
-
-	//Calculate CRC
-	uint16_t data_part_size = 1 + 2 + 2 + data_len;//type + seq + len + data
-	frame->crc16 = CRC16::calculate((uint8_t*)&frame->packet_type, data_part_size);
-
-	perf_monitor.packet_sent(sizeof(Frame));
-	return true;
-}
-
-bool PacketFrame::validate_frame(Frame* frame)
-{
-	if (!frame) return false;
-
-	//Check marker
-	if (frame->start_marker != START_MARKER || frame->end_marker != END_MARKER)
-	{
-		return false;
-	}
-
-	//Verify CRC
-	uint16_t data_part_size = 1 + 2 + 2 + frame->data_length;
-	uint16_t calculated_crc = CRC16::calculate((uint8_t*)&frame->packet_type, data_part_size);
-
-	if (calculated_crc != frame->crc16)
-	{
-		record_crc_error();
-		return false;
-	}
-
-
-	return true;
-}
\ No newline at end of file
+#include "packet_frame.h"
+#include "cycle_profiler.h"
+
+template<class Config>
+PacketFrameT<Config>::PacketFrameT() : sequence_counter(0), datagram_counter(0), compression_enabled(false),
+	aead_required(false), aead_active(false), aead_role(0), auth_failures(0)
+
+{
+	sequence_counter = 0;
+	memset(aead_master_key, 0, sizeof(aead_master_key));
+	memset(tx_index, 0, sizeof(tx_index));
+	memset(rx_index, 0, sizeof(rx_index));
+}
+
+template<class Config>
+uint16_t PacketFrameT<Config>::get_next_sequence()
+{
+	uint16_t seq = sequence_counter;
+	sequence_counter = SequenceWindow::next_sequence(sequence_counter);
+	return seq;
+}
+
+//============================================ AEAD ========================================
+
+template<class Config>
+void PacketFrameT<Config>::set_aead_key(const uint8_t* key)
+{
+	end_aead_session();
+	aead_required = (key != nullptr);
+	if (key) memcpy(aead_master_key, key, CIPHER_KEY_LEN);
+	else memset(aead_master_key, 0, CIPHER_KEY_LEN);
+}
+
+template<class Config>
+void PacketFrameT<Config>::start_aead_session(uint32_t initiator_salt, uint32_t responder_salt, bool initiator)
+{
+	if (!aead_required) return;
+
+	//Fresh salts from both ends: a rebooted peer never reuses a nonce under an old session key
+	uint8_t context[CIPHER_NONCE_LEN] = { 'S', 'E', 'S', 'N' };
+	memcpy(context + 4, &initiator_salt, sizeof(initiator_salt));
+	memcpy(context + 8, &responder_salt, sizeof(responder_salt));
+
+	uint8_t session_key[CIPHER_KEY_LEN];
+	FrameCipher::derive_key(aead_master_key, context, session_key);
+	cipher.set_key(session_key);
+	memset(session_key, 0, sizeof(session_key));
+
+	aead_role = initiator ? 0 : 1;
+	for (uint8_t i = 0; i < AEAD_SPACE_COUNT; i++)
+	{
+		tx_index[i] = 0;
+		rx_index[i] = 0;
+	}
+	//Counters carry on from the current sequence numbers, the index only has to be unique per session
+	tx_index[AEAD_SPACE_FRAME] = sequence_counter;
+	tx_index[AEAD_SPACE_DATAGRAM] = datagram_counter;
+	auth_failures = 0;
+	aead_active = true;
+}
+
+template<class Config>
+void PacketFrameT<Config>::end_aead_session()
+{
+	aead_active = false;
+	cipher.clear();
+}
+
+template<class Config>
+AeadSpace PacketFrameT<Config>::get_space(const Frame* frame)
+{
+	if (frame->packet_type & FLAG_REPLY) return AEAD_SPACE_REPLY;
+	if (get_type(frame) == TYPE_DATAGRAM) return AEAD_SPACE_DATAGRAM;
+	return AEAD_SPACE_FRAME;
+}
+
+template<class Config>
+uint32_t PacketFrameT<Config>::estimate_rx_index(const Frame* frame, AeadSpace space) const
+{
+	uint32_t modulus = (space == AEAD_SPACE_REPLY) ? 256 : SEQUENCE_MODULUS;
+	uint32_t low = (space == AEAD_SPACE_REPLY) ? frame->channel_id : frame->sequence_num;
+
+	//Closest index to the highest one seen, the wrap count is implicit (as SRTP does with its ROC)
+	uint32_t highest = rx_index[space];
+	uint32_t candidate = highest - highest % modulus + low;
+	if (candidate > highest && candidate - highest > modulus / 2 && candidate >= modulus) candidate -= modulus;
+	else if (candidate < highest && highest - candidate > modulus / 2) candidate += modulus;
+	return candidate;
+}
+
+template<class Config>
+void PacketFrameT<Config>::build_nonce(uint8_t role, AeadSpace space, uint16_t seq_num, uint32_t index, uint8_t* nonce)
+{
+	memset(nonce, 0, CIPHER_NONCE_LEN);
+	nonce[0] = role;
+	nonce[1] = (uint8_t)space;
+	memcpy(nonce + 2, &seq_num, sizeof(seq_num));
+	memcpy(nonce + 4, &index, sizeof(index));
+}
+
+template<class Config>
+bool PacketFrameT<Config>::accept_sequence(uint16_t seq)
+{
+	uint16_t expected = rx_window.get_expected();
+	uint16_t missing = 0;
+
+	switch (rx_window.check_and_update(seq, &missing))
+	{
+	case SEQ_GAP:
+		perf_monitor.sequence_error(expected, seq);
+		return true;
+	case SEQ_DUPLICATE:
+		perf_monitor.sequence_error(expected, seq);
+		return false;
+	default:
+		return true;
+	}
+}
+
+template<class Config>
+bool PacketFrameT<Config>::accept_datagram(Frame* frame)
+{
+	uint16_t missing = 0;
+	SequenceStatus status = datagram_window.check_and_update(frame->sequence_num, &missing);
+
+	if (status == SEQ_DUPLICATE) return false;
+
+	//Nobody retransmits a datagram: every skipped sequence is gone for good.
+	//A jump past DATAGRAM_MAX_GAP is a peer that restarted its counter, not a burst of loss.
+	if (missing <= DATAGRAM_MAX_GAP) perf_monitor.datagrams_lost(missing);
+
+	perf_monitor.datagram_received(get_wire_length(frame));
+	return true;
+}
+
+template<class Config>
+bool PacketFrameT<Config>::create_frame(PacketType type, const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t flags, uint8_t channel)
+{
+	if (data_len > Config::MAX_DATA_LEN || !frame) return false;
+	return build_frame(type, get_next_sequence(), data, data_len, frame, flags, channel, tx_index[AEAD_SPACE_FRAME]++);
+}
+
+template<class Config>
+bool PacketFrameT<Config>::create_datagram(const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t channel)
+{
+	if (data_len > Config::MAX_DATA_LEN || !frame) return false;
+
+	//Separate counter: every gap in it is a lost datagram, never a reliable frame in flight
+	uint16_t seq = datagram_counter;
+	datagram_counter = SequenceWindow::next_sequence(datagram_counter);
+	return build_frame(TYPE_DATAGRAM, seq, data, data_len, frame, 0, channel, tx_index[AEAD_SPACE_DATAGRAM]++);
+}
+
+template<class Config>
+bool PacketFrameT<Config>::create_reply_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, Frame* frame)
+{
+	if (data_len > Config::MAX_DATA_LEN || !frame) return false;
+
+	//Sealed replies echo a sequence number that is not ours, the reply counter keeps their nonces apart
+	if (aead_required && !is_handshake(type))
+	{
+		uint32_t index = tx_index[AEAD_SPACE_REPLY];
+		if (!build_frame(type, seq_num, data, data_len, frame, FLAG_REPLY, (uint8_t)index, index)) return false;
+		tx_index[AEAD_SPACE_REPLY]++;
+		return true;
+	}
+	return build_frame(type, seq_num, data, data_len, frame, 0, 0, 0);
+}
+
+template<class Config>
+bool PacketFrameT<Config>::build_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t flags, uint8_t channel, uint32_t nonce_index)
+{
+	PROFILE_SCOPE(PROF_CREATE_FRAME);
+
+	//Keyed but no session yet: nothing but the handshake may leave unprotected
+	bool seal = aead_required && !is_handshake(type);
+	if (seal && !aead_active) return false;
+
+	frame->start_marker = Config::START_MARKER;
+	frame->packet_type = type | (flags & ~PACKET_TYPE_MASK);
+	frame->sequence_num = seq_num;
+	frame->data_length = data_len;
+	frame->channel_id = channel;
+	frame->end_marker = Config::END_MARKER;
+
+	//Clear and copy data
+	memset(frame->data, 0, Config::MAX_DATA_LEN);
+	if (data_len > 0)
+	{
+		uint16_t coded_len = 0;
+		if (compression_enabled && (type == TYPE_DATA || type == TYPE_DATAGRAM))
+		{
+			//Skipped automatically (coded_len == 0) when the payload does not shrink
+			coded_len = PayloadCompressor::compress(data, data_len, frame->data, Config::MAX_DATA_LEN);
+			perf_monitor.compression_sample(data_len, coded_len ? coded_len : data_len);
+		}
+
+		if (coded_len > 0)
+		{
+			frame->packet_type |= FLAG_COMPRESSED;
+			frame->data_length = coded_len;
+		}
+		else
+		{
+			memset(frame->data, 0, Config::MAX_DATA_LEN);
+			memcpy(frame->data, data, data_len);
+		}
+	}
+
+	if (seal)
+	{
+		//Header is associated data, the payload is encrypted where it lies
+		uint8_t nonce[CIPHER_NONCE_LEN];
+		build_nonce(aead_role, get_space(frame), seq_num, nonce_index, nonce);
+		frame->crc16 = cipher.seal(nonce, &frame->packet_type, FRAME_HEADER_LEN - 1, frame->data, frame->data_length);
+	}
+	else
+	{
+		//Calculate CRC
+		uint16_t data_part_size = 1 + 2 + 2 + 1 + frame->data_length;//type + seq + len + channel + data
+		frame->crc16 = CRC16::calculate((uint8_t*)&frame->packet_type, data_part_size);
+	}
+
+	perf_monitor.packet_sent(get_wire_length(frame));
+	if (type == TYPE_DATA) perf_monitor.data_frame_sent();
+	return true;
+}
+
+template<class Config>
+bool PacketFrameT<Config>::unpack_payload(Frame* frame)
+{
+	if (!frame) return false;
+	if (!(frame->packet_type & FLAG_COMPRESSED)) return true;
+
+	uint8_t decoded[Config::MAX_DATA_LEN];
+	uint16_t decoded_len = PayloadCompressor::decompress(frame->data, frame->data_length, decoded, Config::MAX_DATA_LEN);
+	if (decoded_len == 0) return false;
+
+	memcpy(frame->data, decoded, decoded_len);
+	frame->data_length = decoded_len;
+	frame->packet_type &= ~FLAG_COMPRESSED;
+	return true;
+}
+
+template<class Config>
+uint16_t PacketFrameT<Config>::serialize_frame(const Frame* frame, uint8_t* buffer)
+{
+	if (!frame || !buffer || frame->data_length > Config::MAX_DATA_LEN) return 0;
+
+	//Header fields are laid out contiguously at the start of Frame
+	memcpy(buffer, frame, FRAME_HEADER_LEN);
+	memcpy(buffer + FRAME_HEADER_LEN, frame->data, frame->data_length);
+
+	uint16_t pos = FRAME_HEADER_LEN + frame->data_length;
+	memcpy(buffer + pos, &frame->crc16, sizeof(frame->crc16));
+	pos += sizeof(frame->crc16);
+	buffer[pos++] = frame->end_marker;
+	return pos;
+}
+
+template<class Config>
+bool PacketFrameT<Config>::deserialize_frame(const uint8_t* buffer, uint16_t length, Frame* frame)
+{
+	if (!buffer || !frame || length < FRAME_HEADER_LEN + FRAME_TRAILER_LEN) return false;
+
+	memset(frame, 0, sizeof(Frame));
+	memcpy(frame, buffer, FRAME_HEADER_LEN);
+	if (frame->data_length > Config::MAX_DATA_LEN || length != get_wire_length(frame)) return false;
+
+	memcpy(frame->data, buffer + FRAME_HEADER_LEN, frame->data_length);
+	memcpy(&frame->crc16, buffer + FRAME_HEADER_LEN + frame->data_length, sizeof(frame->crc16));
+	frame->end_marker = buffer[length - 1];
+	return true;
+}
+
+template<class Config>
+bool PacketFrameT<Config>::validate_frame(Frame* frame)
+{
+	PROFILE_SCOPE(PROF_VALIDATE_FRAME);
+
+	if (!frame) return false;
+
+	//Check marker, and the length before either branch reads data_length bytes of payload
+	if (frame->start_marker != Config::START_MARKER || frame->end_marker != Config::END_MARKER ||
+		frame->data_length > Config::MAX_DATA_LEN)
+	{
+		return false;
+	}
+
+	if (!aead_required || is_handshake(get_type(frame)))
+	{
+		if (!check_integrity(frame))
+		{
+			record_crc_error();
+			return false;
+		}
+		return true;
+	}
+
+	//Tag replaces the CRC: checked on the ciphertext, then decrypted in place
+	if (!aead_active)
+	{
+		auth_failures++;
+		record_crc_error();
+		return false;
+	}
+
+	AeadSpace space = get_space(frame);
+	uint32_t index = estimate_rx_index(frame, space);
+	uint8_t nonce[CIPHER_NONCE_LEN];
+	build_nonce(aead_role ^ 1, space, frame->sequence_num, index, nonce);
+
+	if (!cipher.open(nonce, &frame->packet_type, FRAME_HEADER_LEN - 1, frame->data, frame->data_length, frame->crc16))
+	{
+		auth_failures++;
+		record_crc_error();
+		return false;
+	}
+
+	auth_failures = 0;
+	if (index > rx_index[space]) rx_index[space] = index;
+	return true;
+}
+
+template<class Config>
+bool PacketFrameT<Config>::check_frame(const Frame* frame) const
+{
+	return frame && frame->start_marker == Config::START_MARKER && frame->end_marker == Config::END_MARKER &&
+		check_integrity(frame);
+}
+
+template<class Config>
+bool PacketFrameT<Config>::check_integrity(const Frame* frame) const
+{
+	if (frame->data_length > Config::MAX_DATA_LEN) return false;
+
+	if (!aead_required || is_handshake(get_type(frame)))
+	{
+		//Verify CRC
+		uint16_t data_part_size = 1 + 2 + 2 + 1 + frame->data_length;
+		return CRC16::calculate((const uint8_t*)&frame->packet_type, data_part_size) == frame->crc16;
+	}
+
+	//Keyed link: a CRC-only frame is as good as a forgery
+	if (!aead_active) return false;
+
+	AeadSpace space = get_space(frame);
+	uint8_t nonce[CIPHER_NONCE_LEN];
+	build_nonce(aead_role ^ 1, space, frame->sequence_num, estimate_rx_index(frame, space), nonce);
+	return cipher.verify(nonce, &frame->packet_type, FRAME_HEADER_LEN - 1, frame->data, frame->data_length, frame->crc16);
+}
+
+//Every profile in protocol_config.h; code for one the binary never uses is dropped by the linker
+template class PacketFrameT<DefaultConfig>;
+template class PacketFrameT<ControlConfig>;
@@ -1,60 +1,149 @@
-#pragma once
-#ifndef PACKET_FRAME_H
-#define PACKET_FRAME_H
-
-#include <Arduino.h>
-#include <HardwareSerial.h>
-#include "crc16.h"
-#include "performance.h"
-
-#define START_MARKER 0xAA
-#define END_MARKER 0x55
-#define MAX_DATA_LEN 53
-#define MAX_RETRIES 3
-#define ACK_TIMEOUT_MS 1000
-
-typedef enum
-{
-	TYPE_DATA = 0x01,
-	TYPE_ACK = 0x02,
-	TYPE_NACK = 0x03,
-}PacketType;
-
-typedef struct
-{
-	uint8_t start_marker;//1 byte
-	uint8_t packet_type;//1 byte
-	uint16_t sequence_num;//2 byte
-	uint16_t data_length;//2 byte
-	uint8_t data[MAX_DATA_LEN];//53 byte
-	uint16_t crc16 ;//2 byte
-	uint8_t end_marker;//1 byte
-}Frame;
-
-class PacketFrame
-{
-private:
-	uint16_t sequence_counter;
-	PerformanceMonitor perf_monitor;
-public:
-	PacketFrame();
-	virtual ~PacketFrame() = default;
-
-	//Frame creation & validation
-	bool create_frame(PacketType type, const uint8_t* data, uint16_t data_len, Frame* frame);
-	bool validate_frame(Frame* frame);
-	uint16_t get_next_sequence();
-	PerformanceMonitor& get_performance_monitor() { return perf_monitor; }
-
-	//Error tracking
-	void record_crc_error() { perf_monitor.crc_error(); }//crc_errors++
-	void record_timeout() { perf_monitor.timeout_occurred(); }//timeouts++
-	void record_retransmission() { perf_monitor.retransmission_occurred(); }//retransmissions++
-	void record_packet_lost(uint16_t seq) { perf_monitor.packet_lost(seq); }//lost_packets++
-
-	void start_packet_timing(uint16_t seq_num) { perf_monitor.start_latency_measurement(seq_num); }
-	void end_packet_timing(uint16_t seq_num) { perf_monitor.end_latency_measurement(seq_num); }
-
-};
-
+#pragma once
+#ifndef PACKET_FRAME_H
+#define PACKET_FRAME_H
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include "crc16.h"
+#include "compression.h"
+#include "frame_cipher.h"
+#include "performance.h"
+#include "sequence_window.h"
+#include "protocol_config.h"
+
+//packet_type carries the type in the low bits and per-frame flags in the high bits
+#define PACKET_TYPE_MASK 0x0F
+#define FLAG_COMPRESSED 0x80//payload encoded with PayloadCompressor
+#define FLAG_MORE_FRAGMENTS 0x40//message continues in the next DATA frame
+#define FLAG_REPLY 0x20//AEAD only: built by create_reply_frame, channel_id = low byte of the reply counter
+#define FLAG_FRAGMENT 0x10//part of a fragmented message, data[0] is the fragment header (UartProtocol)
+#define DATAGRAM_MAX_GAP 256//larger datagram gaps are a sender restart, not loss
+
+//Bytes actually put on a byte-stream link: header + data_length bytes + crc + end marker
+#define FRAME_HEADER_LEN 7//start + type + seq + len + channel
+#define FRAME_TRAILER_LEN 3//crc + end
+
+typedef enum
+{
+	TYPE_DATA = 0x01,
+	TYPE_ACK = 0x02,
+	TYPE_NACK = 0x03,
+	TYPE_SYN = 0x04,//session request, payload = LinkParams offered. Empty on SPI: the sender restarted its sequence numbers
+	TYPE_SYN_ACK = 0x05,//session accept, payload = LinkParams agreed
+	TYPE_DATAGRAM = 0x06,//unacknowledged data, own sequence space, loss = sequence gap
+	TYPE_POLL = 0x07,//SPI status poll, payload = seq of the last slave DATA frame received
+	TYPE_STATS = 0x08,//statistics: empty = request, StatsSnapshot = reply (echoes the request seq)
+}PacketType;
+
+template<class Config>
+struct FrameT
+{
+	uint8_t start_marker;//1 byte
+	uint8_t packet_type;//1 byte
+	uint16_t sequence_num;//2 byte
+	uint16_t data_length;//2 byte
+	uint8_t channel_id;//1 byte, logical channel (0 = default)
+	uint8_t data[Config::MAX_DATA_LEN];//52 byte (DefaultConfig)
+	uint16_t crc16 ;//2 byte
+	uint8_t end_marker;//1 byte
+};
+
+typedef FrameT<DefaultConfig> Frame;
+
+//Smaller profiles cannot carry a snapshot: their STATS requests are answered with a NACK
+static_assert(sizeof(StatsSnapshot) <= DefaultConfig::MAX_DATA_LEN, "TYPE_STATS snapshot must fit one frame");
+
+//AEAD nonce spaces. Each sender numbers its frames per space and never repeats an index under
+//one session key; only the low bits travel (sequence_num, or channel_id for replies), the
+//receiver extends them from the highest index it has authenticated so far.
+typedef enum
+{
+	AEAD_SPACE_FRAME,//create_frame(): sequence_num, wraps at SEQUENCE_MODULUS
+	AEAD_SPACE_DATAGRAM,//create_datagram(): own sequence_num counter
+	AEAD_SPACE_REPLY,//create_reply_frame(): echoes the peer's sequence_num, counter in channel_id
+	AEAD_SPACE_COUNT
+}AeadSpace;
+
+template<class Config>
+class PacketFrameT
+{
+public:
+	typedef FrameT<Config> Frame;
+	static constexpr bool CARRIES_STATS = sizeof(StatsSnapshot) <= Config::MAX_DATA_LEN;
+
+private:
+	uint16_t sequence_counter;
+	uint16_t datagram_counter;
+	bool compression_enabled;
+	SequenceWindow rx_window;
+	SequenceWindow datagram_window;
+	PerformanceMonitor perf_monitor;
+
+	//Authenticated encryption (CRC_VARIANT_AEAD): the truncated tag takes the crc16 field
+	FrameCipher cipher;
+	uint8_t aead_master_key[CIPHER_KEY_LEN];
+	bool aead_required;//key set: only SYN/SYN-ACK still go out with CRC16
+	bool aead_active;//session key derived, frames can be sealed and opened
+	uint8_t aead_role;//0 = initiator, 1 = responder, first nonce byte of what we send
+	uint32_t tx_index[AEAD_SPACE_COUNT];//next index per space (frame/datagram: wrap count * modulus + seq)
+	uint32_t rx_index[AEAD_SPACE_COUNT];//highest index authenticated from the peer
+	uint16_t auth_failures;//consecutive tag failures, any authenticated frame clears it
+
+	bool build_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t flags, uint8_t channel, uint32_t nonce_index);
+	static bool is_handshake(uint8_t type) { return type == TYPE_SYN || type == TYPE_SYN_ACK; }
+	static AeadSpace get_space(const Frame* frame);
+	uint32_t estimate_rx_index(const Frame* frame, AeadSpace space) const;
+	static void build_nonce(uint8_t role, AeadSpace space, uint16_t seq_num, uint32_t index, uint8_t* nonce);
+	bool check_integrity(const Frame* frame) const;//CRC16 or AEAD tag, no side effects
+public:
+	PacketFrameT();
+	virtual ~PacketFrameT() = default;
+
+	//Frame creation & validation
+	bool create_frame(PacketType type, const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t flags = 0, uint8_t channel = 0);
+	bool create_datagram(const uint8_t* data, uint16_t data_len, Frame* frame, uint8_t channel = 0);
+	bool create_reply_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, Frame* frame);//ACK/NACK: echoes seq_num, CRC covers it
+	bool validate_frame(Frame* frame);//CRC16, or AEAD tag check + in-place decrypt: call once per received frame
+	bool check_frame(const Frame* frame) const;//same verdict, frame and statistics untouched (logging)
+	uint16_t get_next_sequence();
+	static uint8_t get_type(const Frame* frame) { return frame->packet_type & PACKET_TYPE_MASK; }
+	PerformanceMonitor& get_performance_monitor() { return perf_monitor; }
+
+	//Duplicate suppression (receiver side)
+	bool accept_sequence(uint16_t seq);//false = duplicate, re-ACK but do not deliver
+	bool is_duplicate_sequence(uint16_t seq) const { return rx_window.is_duplicate(seq); }
+	bool accept_datagram(Frame* frame);//false = duplicate, gaps are counted as lost datagrams
+	void reset_receive_window() { rx_window.reset(); datagram_window.reset(); }
+
+	//Compression
+	void set_compression(bool enable) { compression_enabled = enable; }
+	bool unpack_payload(Frame* frame);//decode compressed payload in place, call after validate_frame
+
+	//Authenticated encryption: nullptr key = CRC16. With a key, frames need a session (SYN/SYN-ACK salts)
+	void set_aead_key(const uint8_t* key);
+	bool is_aead_required() const { return aead_required; }
+	bool is_aead_active() const { return aead_active; }
+	uint16_t get_auth_failures() const { return auth_failures; }//keys out of step when it keeps growing
+	void start_aead_session(uint32_t initiator_salt, uint32_t responder_salt, bool initiator);
+	void end_aead_session();
+
+	//Compact wire format
+	static uint16_t get_wire_length(const Frame* frame) { return FRAME_HEADER_LEN + frame->data_length + FRAME_TRAILER_LEN; }
+	static uint16_t serialize_frame(const Frame* frame, uint8_t* buffer);
+	static bool deserialize_frame(const uint8_t* buffer, uint16_t length, Frame* frame);
+
+	//Error tracking
+	void record_crc_error() { perf_monitor.crc_error(); }//crc_errors++
+	void record_timeout() { perf_monitor.timeout_occurred(); }//timeouts++
+	void record_retransmission() { perf_monitor.retransmission_occurred(); }//retransmissions++
+	void record_packet_lost(uint16_t seq) { perf_monitor.packet_lost(seq); }//lost_packets++
+	void record_packet_received(uint16_t size) { perf_monitor.packet_received(size); }//payload collected from a peer
+
+	void start_packet_timing(uint16_t seq_num) { perf_monitor.start_latency_measurement(seq_num); }
+	void end_packet_timing(uint16_t seq_num) { perf_monitor.end_latency_measurement(seq_num); }
+
+};
+
+typedef PacketFrameT<DefaultConfig> PacketFrame;
+
 #endif// 
\ No newline at end of file
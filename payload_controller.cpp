@@ -0,0 +1,90 @@
+#include "payload_controller.h"
+#include "packet_frame.h"
+#include <math.h>
+
+//Bytes on the wire around a payload: our frame overhead plus the peer's empty ACK
+static const uint16_t FRAME_OVERHEAD = FRAME_HEADER_LEN + FRAME_TRAILER_LEN;
+static const uint16_t ACK_WIRE_LEN = FRAME_HEADER_LEN + FRAME_TRAILER_LEN;
+
+PayloadSizeController::PayloadSizeController(uint16_t max_len) :
+	min_payload(CONTROLLER_MIN_PAYLOAD),
+	max_payload(max_len),
+	current_payload(max_len),
+	timeout_bytes(0),
+	ber_estimate(0.0f),
+	last_attempts(0),
+	last_failures(0)
+{
+}
+
+void PayloadSizeController::set_limits(uint16_t min_len, uint16_t max_len)
+{
+	if (max_len == 0) return;
+
+	max_payload = max_len;
+	min_payload = min_len < max_len ? min_len : max_len;
+	current_payload = select_payload();
+}
+
+void PayloadSizeController::set_link(uint32_t baud, uint32_t ack_timeout_ms)
+{
+	//8N1: 10 bit times per byte
+	timeout_bytes = (uint32_t)((uint64_t)baud * ack_timeout_ms / 10000);
+	current_payload = select_payload();
+}
+
+float PayloadSizeController::expected_efficiency(uint16_t payload, float ber, uint32_t timeout_bytes)
+{
+	float bits = 8.0f * (payload + FRAME_OVERHEAD + ACK_WIRE_LEN);
+	float p_success = powf(1.0f - ber, bits);
+	if (p_success < 1e-6f) return 0.0f;
+
+	//Expected wire bytes per delivered frame: one good exchange plus (1/p - 1) failed attempts
+	float good_cost = payload + FRAME_OVERHEAD + ACK_WIRE_LEN;
+	float failed_cost = payload + FRAME_OVERHEAD + timeout_bytes;
+	float cost = good_cost + (1.0f / p_success - 1.0f) * failed_cost;
+
+	return payload / cost;
+}
+
+uint16_t PayloadSizeController::select_payload() const
+{
+	uint16_t best_payload = max_payload;
+	float best_efficiency = -1.0f;
+
+	for (uint16_t len = min_payload; len <= max_payload; len++)
+	{
+		float efficiency = expected_efficiency(len, ber_estimate, timeout_bytes);
+		if (efficiency > best_efficiency)
+		{
+			best_efficiency = efficiency;
+			best_payload = len;
+		}
+	}
+	return best_payload;
+}
+
+void PayloadSizeController::update(const PerformanceMonitor& perf)
+{
+	//DATA attempts only: ACKs, heartbeats and handshake retries say nothing about our frame size
+	if (perf.get_data_attempts() < last_attempts)
+	{
+		last_attempts = 0;//statistics were reset
+		last_failures = 0;
+	}
+	uint32_t attempts = perf.get_data_attempts() - last_attempts;
+	uint32_t failures = perf.get_data_failures() - last_failures;
+
+	if (attempts < CONTROLLER_MIN_SAMPLES) return;
+	last_attempts = perf.get_data_attempts();
+	last_failures = perf.get_data_failures();
+
+	//Frame error rate at the current size -> per-bit error rate
+	float fer = (float)failures / attempts;
+	if (fer > 0.99f) fer = 0.99f;
+	float bits = 8.0f * (current_payload + FRAME_OVERHEAD + ACK_WIRE_LEN);
+	float observed_ber = 1.0f - powf(1.0f - fer, 1.0f / bits);
+
+	ber_estimate += CONTROLLER_EWMA_WEIGHT * (observed_ber - ber_estimate);
+	current_payload = select_payload();
+}
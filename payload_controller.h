@@ -0,0 +1,43 @@
+#pragma once
+#ifndef PAYLOAD_CONTROLLER_H
+#define PAYLOAD_CONTROLLER_H
+
+#include <stdint.h>
+#include "performance.h"
+
+#define CONTROLLER_MIN_PAYLOAD 8
+#define CONTROLLER_MIN_SAMPLES 16//DATA attempts needed before the BER estimate moves
+#define CONTROLLER_EWMA_WEIGHT 0.25f//weight of the newest BER observation
+
+//Picks the fragment size that maximizes expected goodput for the observed bit error rate.
+//Stop-and-wait model: a frame of L payload bytes survives with (1-BER)^bits(L + overhead + ACK);
+//every failed attempt also costs the ACK timeout, expressed in byte times at the current baud.
+class PayloadSizeController
+{
+private:
+	uint16_t min_payload;
+	uint16_t max_payload;
+	uint16_t current_payload;
+	uint32_t timeout_bytes;//ACK timeout expressed in byte times
+
+	float ber_estimate;
+
+	//PerformanceMonitor DATA attempt counters at the previous update
+	uint32_t last_attempts;
+	uint32_t last_failures;
+
+	uint16_t select_payload() const;
+
+public:
+	PayloadSizeController(uint16_t max_payload);
+
+	void set_limits(uint16_t min_len, uint16_t max_len);
+	void set_link(uint32_t baud, uint32_t ack_timeout_ms);
+	void update(const PerformanceMonitor& perf);//call at message boundaries only
+
+	uint16_t get_payload_size() const { return current_payload; }
+	float get_ber_estimate() const { return ber_estimate; }
+	static float expected_efficiency(uint16_t payload, float ber, uint32_t timeout_bytes);
+};
+
+#endif // !PAYLOAD_CONTROLLER_H
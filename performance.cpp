@@ -1,281 +1,489 @@
-#include "performance.h"
-#include <Arduino.h>
-#include <climits>
-
-PerformanceMonitor::PerformanceMonitor()
-{
-	reset_statistics();
-}
-
-void PerformanceMonitor::reset_statistics()
-{
-	total_bytes_sent = 0;
-	total_bytes_received = 0;
-	total_packets_sent = 0;
-	total_packets_received = 0;
-
-	lost_packets = 0;
-	sequence_errors = 0;
-	crc_errors = 0;
-	timeouts = 0;
-	retransmissions = 0;
-
-	//Initialize latency tracking
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		latency_samples[i] = 0;
-	}
-	latency_index = 0;
-	total_latency = 0;
-	min_latency = UINT32_MAX;
-	max_latency = 0;
-	last_latency = 0;
-
-	//Create Packet Timing
-	memset(packet_start_time, 0, sizeof(packet_start_time));
-
-	measurement_start_time = millis();
-}
-
-void PerformanceMonitor::packet_sent(uint16_t packet_size)
-{
-	total_packets_sent++;
-	total_bytes_sent += packet_size;
-}
-
-void PerformanceMonitor::packet_received(uint16_t packet_size)
-{
-	total_packets_received++;
-	total_bytes_received += packet_size;
-}
-
-float PerformanceMonitor::get_throughput_kbps() const
-{
-	unsigned long current_time = millis();
-	unsigned long elapsed_time = current_time - measurement_start_time;
-
-	if (elapsed_time == 0) return 0.0;
-
-	float total_bits = total_bytes_sent * 8.0;
-	float time_seconds = elapsed_time / 1000.0;
-
-	return total_bits / time_seconds / 1024.0;
-}
-
-float PerformanceMonitor::get_packet_rate() const
-{
-	unsigned long current_time = millis();
-	unsigned long elapsed_time = current_time - measurement_start_time;
-
-	if (elapsed_time == 0) return 0.0;
-
-	float time_seconds = elapsed_time / 1000.0;
-	return total_packets_sent / time_seconds;
-}
-
-void PerformanceMonitor::start_latency_measurement(uint16_t sequence_num)
-{
-	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = millis();
-}
-
-void PerformanceMonitor::end_latency_measurement(uint16_t sequence_num)
-{
-	unsigned long end_time = millis();
-	unsigned long start_time = packet_start_time[sequence_num % MAX_SEQUENCE_NUMS];
-
-	//Micro() overflow handled automatically
-	uint32_t latency;
-	if (end_time < start_time)
-	{
-		latency = (ULONG_MAX - start_time) + end_time;
-		Serial.print(" [OVERFLOW_HANDLED]");
-	}
-	else
-	{
-		latency = end_time - start_time;
-	}
-
-	Serial.print("Raw Latency: ");
-	Serial.print(latency);
-	Serial.println(" ms");
-
-	if (latency < 1 || latency > 5000)
-	{
-		Serial.print("[WARN] Ignoring abnormal latency: ");
-		Serial.print(latency);
-		Serial.print("ms for seq: ");
-		Serial.println(sequence_num);
-		packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
-		return;
-	}
-
-	if (min_latency == UINT32_MAX)
-	{
-		min_latency = latency;
-		Serial.print("[INIT] First min_latency set to: ");
-		Serial.println(min_latency);
-	}
-
-	//Reset for not measure many time
-	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
-
-	//Update circular buffer
-	total_latency -= latency_samples[latency_index];
-	latency_samples[latency_index] = latency;
-	total_latency += latency;
-
-	//Update min/max
-	if (latency < min_latency)
-	{
-		Serial.print("[UPDATE] New min_latency: ");
-		Serial.print(latency); Serial.print("ms (was: ");
-		Serial.print(min_latency); Serial.println("ms)");
-		min_latency = latency;
-	}
-
-	if (latency > max_latency)
-	{
-		Serial.print("[UPDATE] New max_latency: ");
-		Serial.print(latency); Serial.print("ms (was: ");
-		Serial.print(max_latency); Serial.println("ms)");
-		max_latency = latency;
-	}
-
-	last_latency = latency;
-	latency_index = (latency_index + 1) % LATENCY_BUFFER_SIZE;
-	Serial.print("[BUFFER] Index: ");
-	Serial.print(latency_index);
-	Serial.print("; Current Sample: ");
-	Serial.println(latency);
-}
-
-float PerformanceMonitor::get_average_latency() const
-{
-	uint32_t valid_samples = 0;
-	uint32_t sum = 0;
-
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		if (latency_samples[i] > 0)
-		{
-			sum += latency_samples[i];
-			valid_samples++;
-		}
-	}
-
-	if (valid_samples == 0) return 0.0;
-	return sum / (float)valid_samples;
-}
-
-int PerformanceMonitor::get_max_latency() const
-{
-	if (max_latency == 0 || max_latency == UINT32_MAX)
-	{
-		return 0;
-	}
-	else return max_latency;
-}
-
-int PerformanceMonitor::get_min_latency() const
-{
-	if (min_latency == UINT32_MAX)
-	{
-		return 0;
-	}
-	else return min_latency;
-}
-
-float PerformanceMonitor::get_average_jitter() const
-{
-	if (min_latency == UINT32_MAX || max_latency == 0) return 0.0;
-
-	uint32_t valid_samples = 0;
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		if (latency_samples[i] > 0) valid_samples++;
-	}
-
-	if (valid_samples < 2) return 0.0;
-
-	return (max_latency - min_latency) / 2.0;
-}
-
-void PerformanceMonitor::packet_lost(uint16_t sequence_num)
-{
-	lost_packets++;
-}
-
-void PerformanceMonitor::sequence_error(uint16_t expected, uint16_t received)
-{
-	sequence_errors++;
-}
-
-void PerformanceMonitor::crc_error()
-{
-	crc_errors++;
-}
-
-void PerformanceMonitor::timeout_occurred()
-{
-	timeouts++;
-}
-
-void PerformanceMonitor::retransmission_occurred()
-{
-	retransmissions++;
-}
-
-float PerformanceMonitor::get_packet_loss_rate() const
-{
-	if (total_packets_sent == 0) return 0.0;
-	return (float)lost_packets / total_packets_sent * 100.0;
-}
-
-float PerformanceMonitor::get_error_rate() const
-{
-	if (total_packets_received == 0) return 0.0;
-	uint32_t total_errors = crc_errors + sequence_errors;
-	return (float)total_errors / total_packets_received * 100.0;
-}
-
-float PerformanceMonitor::get_success_rate() const
-{
-	if (total_packets_sent == 0) return 0.0;
-	uint32_t successful = total_packets_sent - retransmissions - lost_packets;
-
-	return (float)successful / total_packets_sent * 100.0;
-}
-
-void PerformanceMonitor::print_statistics()
-{
-	unsigned long current_time = millis();
-	unsigned long elapsed_time = current_time - measurement_start_time;
-
-	Serial.println("\n ==== PERFORMANCE STATISTICS ====");
-	Serial.println("THROUGHPUT: ");
-	Serial.print(" Packets Sent: "); Serial.println(total_packets_sent);
-	Serial.print(" Packets Received: "); Serial.println(total_packets_received);
-	Serial.print(" Data Sent: "); Serial.print(total_bytes_sent / 1024.0, 2); Serial.println(" KB");
-	Serial.print(" Throughput: "); Serial.print(get_throughput_kbps(), 2); Serial.println(" kbps");
-	Serial.print(" Packet Rate "); Serial.print(get_packet_rate(), 2); Serial.println(" packets/s");
-
-	Serial.println("LATENCY: ");
-	Serial.print(" Average: "); Serial.print(get_average_latency(), 2); Serial.println(" ms");
-	Serial.print(" Min: "); Serial.print(get_min_latency()); Serial.println(" ms");
-	Serial.print(" Max: "); Serial.print(get_max_latency()); Serial.println(" ms");
-	Serial.print(" Jitter: "); Serial.print(get_average_jitter(), 2); Serial.println(" ms");
-
-	Serial.println("ERROR ANALYSIS:");
-	Serial.print(" Packet Loss: "); Serial.print(get_packet_loss_rate(), 2); Serial.println("%");
-	Serial.print(" CRC Errors: "); Serial.println(crc_errors);
-	Serial.print(" Sequence Errors: "); Serial.println(sequence_errors);
-	Serial.print(" Timeouts: "); Serial.println(timeouts);
-	Serial.print(" Retransmissions: "); Serial.println(retransmissions);
-	Serial.print(" Success Rate: "); Serial.print(get_success_rate(), 2); Serial.println("%");
-
-	Serial.print("Measurement Duration: ");
-	Serial.print(elapsed_time / 1000.0, 1);
-	Serial.println(" seconds");
-	Serial.println("====================================================\n");
-
+#include "performance.h"
+#include "cycle_profiler.h"
+#include <Arduino.h>
+#include <climits>
+#include "sequence_window.h"
+
+PerformanceMonitor::PerformanceMonitor() :
+	peer_stats_valid(false),
+	time_source(nullptr)
+{
+	reset_statistics();
+}
+
+void PerformanceMonitor::reset_statistics()
+{
+	total_bytes_sent = 0;
+	total_bytes_received = 0;
+	total_packets_sent = 0;
+	total_packets_received = 0;
+	data_frames_sent = 0;
+	datagrams_received = 0;
+	datagrams_missing = 0;
+	payload_bytes_delivered = 0;
+
+	lost_packets = 0;
+	sequence_errors = 0;
+	sequence_gaps = 0;
+	duplicates = 0;
+	crc_errors = 0;
+	timeouts = 0;
+	retransmissions = 0;
+	data_attempts = 0;
+	data_failures = 0;
+
+	compression_raw_bytes = 0;
+	compression_coded_bytes = 0;
+
+	flow_control_pauses = 0;
+	flow_control_time = 0;
+
+	heartbeats_sent = 0;
+	link_failures = 0;
+	detection_time_total = 0;
+	detection_time_max = 0;
+	downtime_total = 0;
+
+	//Initialize latency tracking
+	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
+	{
+		latency_samples[i] = 0;
+	}
+	latency_index = 0;
+	total_latency = 0;
+	min_latency = UINT32_MAX;
+	max_latency = 0;
+	last_latency = 0;
+	latency_histogram.reset();
+	clock_sync.reset();
+
+	//Create Packet Timing
+	memset(packet_start_time, 0, sizeof(packet_start_time));
+
+	peer_stats_valid = false;
+
+	measurement_start_time = now_ms();
+}
+
+void PerformanceMonitor::packet_sent(uint16_t packet_size)
+{
+	total_packets_sent++;
+	total_bytes_sent += packet_size;
+}
+
+void PerformanceMonitor::packet_received(uint16_t packet_size)
+{
+	total_packets_received++;
+	total_bytes_received += packet_size;
+}
+
+void PerformanceMonitor::datagram_received(uint16_t packet_size)
+{
+	datagrams_received++;
+	packet_received(packet_size);
+}
+
+void PerformanceMonitor::payload_delivered(uint16_t payload_size)
+{
+	payload_bytes_delivered += payload_size;
+}
+
+float PerformanceMonitor::get_throughput_kbps() const
+{
+	unsigned long current_time = now_ms();
+	unsigned long elapsed_time = current_time - measurement_start_time;
+
+	if (elapsed_time == 0) return 0.0;
+
+	float total_bits = total_bytes_sent * 8.0;
+	float time_seconds = elapsed_time / 1000.0;
+
+	return total_bits / time_seconds / 1024.0;
+}
+
+float PerformanceMonitor::get_goodput_kbps() const
+{
+	unsigned long elapsed_time = now_ms() - measurement_start_time;
+	if (elapsed_time == 0) return 0.0;
+
+	return payload_bytes_delivered * 8.0 / (elapsed_time / 1000.0) / 1024.0;
+}
+
+float PerformanceMonitor::get_packet_rate() const
+{
+	unsigned long current_time = now_ms();
+	unsigned long elapsed_time = current_time - measurement_start_time;
+
+	if (elapsed_time == 0) return 0.0;
+
+	float time_seconds = elapsed_time / 1000.0;
+	return total_packets_sent / time_seconds;
+}
+
+void PerformanceMonitor::start_latency_measurement(uint16_t sequence_num)
+{
+	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = now_ms();
+}
+
+void PerformanceMonitor::end_latency_measurement(uint16_t sequence_num)
+{
+	unsigned long end_time = now_ms();
+	unsigned long start_time = packet_start_time[sequence_num % MAX_SEQUENCE_NUMS];
+
+	//Micro() overflow handled automatically
+	uint32_t latency;
+	if (end_time < start_time)
+	{
+		latency = (ULONG_MAX - start_time) + end_time;
+		Serial.print(" [OVERFLOW_HANDLED]");
+	}
+	else
+	{
+		latency = end_time - start_time;
+	}
+
+	Serial.print("Raw Latency: ");
+	Serial.print(latency);
+	Serial.println(" ms");
+
+	if (latency < 1 || latency > 5000)
+	{
+		Serial.print("[WARN] Ignoring abnormal latency: ");
+		Serial.print(latency);
+		Serial.print("ms for seq: ");
+		Serial.println(sequence_num);
+		packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
+		return;
+	}
+
+	if (min_latency == UINT32_MAX)
+	{
+		min_latency = latency;
+		Serial.print("[INIT] First min_latency set to: ");
+		Serial.println(min_latency);
+	}
+
+	//Reset for not measure many time
+	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
+
+	//Update circular buffer
+	total_latency -= latency_samples[latency_index];
+	latency_samples[latency_index] = latency;
+	total_latency += latency;
+
+	//Update min/max
+	if (latency < min_latency)
+	{
+		Serial.print("[UPDATE] New min_latency: ");
+		Serial.print(latency); Serial.print("ms (was: ");
+		Serial.print(min_latency); Serial.println("ms)");
+		min_latency = latency;
+	}
+
+	if (latency > max_latency)
+	{
+		Serial.print("[UPDATE] New max_latency: ");
+		Serial.print(latency); Serial.print("ms (was: ");
+		Serial.print(max_latency); Serial.println("ms)");
+		max_latency = latency;
+	}
+
+	last_latency = latency;
+	latency_histogram.add_sample(latency * 1000);
+	latency_index = (latency_index + 1) % LATENCY_BUFFER_SIZE;
+	Serial.print("[BUFFER] Index: ");
+	Serial.print(latency_index);
+	Serial.print("; Current Sample: ");
+	Serial.println(latency);
+}
+
+float PerformanceMonitor::get_average_latency() const
+{
+	uint32_t valid_samples = 0;
+	uint32_t sum = 0;
+
+	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
+	{
+		if (latency_samples[i] > 0)
+		{
+			sum += latency_samples[i];
+			valid_samples++;
+		}
+	}
+
+	if (valid_samples == 0) return 0.0;
+	return sum / (float)valid_samples;
+}
+
+int PerformanceMonitor::get_max_latency() const
+{
+	if (max_latency == 0 || max_latency == UINT32_MAX)
+	{
+		return 0;
+	}
+	else return max_latency;
+}
+
+int PerformanceMonitor::get_min_latency() const
+{
+	if (min_latency == UINT32_MAX)
+	{
+		return 0;
+	}
+	else return min_latency;
+}
+
+float PerformanceMonitor::get_average_jitter() const
+{
+	if (min_latency == UINT32_MAX || max_latency == 0) return 0.0;
+
+	uint32_t valid_samples = 0;
+	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
+	{
+		if (latency_samples[i] > 0) valid_samples++;
+	}
+
+	if (valid_samples < 2) return 0.0;
+
+	return (max_latency - min_latency) / 2.0;
+}
+
+void PerformanceMonitor::packet_lost(uint16_t sequence_num)
+{
+	lost_packets++;
+}
+
+void PerformanceMonitor::sequence_error(uint16_t expected, uint16_t received)
+{
+	sequence_errors++;
+
+	//Anything at or before the expected sequence was already seen
+	uint16_t ahead = SequenceWindow::forward_distance(expected, received);
+	if (ahead < SEQUENCE_MODULUS / 2)
+	{
+		sequence_gaps++;
+	}
+	else
+	{
+		duplicates++;
+	}
+}
+
+void PerformanceMonitor::crc_error()
+{
+	crc_errors++;
+}
+
+void PerformanceMonitor::timeout_occurred()
+{
+	timeouts++;
+}
+
+void PerformanceMonitor::retransmission_occurred()
+{
+	retransmissions++;
+}
+
+float PerformanceMonitor::get_packet_loss_rate() const
+{
+	if (total_packets_sent == 0) return 0.0;
+	return (float)lost_packets / total_packets_sent * 100.0;
+}
+
+float PerformanceMonitor::get_datagram_loss_rate() const
+{
+	uint32_t expected = datagrams_received + datagrams_missing;
+	if (expected == 0) return 0.0;
+	return (float)datagrams_missing / expected * 100.0;
+}
+
+float PerformanceMonitor::get_error_rate() const
+{
+	if (total_packets_received == 0) return 0.0;
+	uint32_t total_errors = crc_errors + sequence_errors;
+	return (float)total_errors / total_packets_received * 100.0;
+}
+
+float PerformanceMonitor::get_success_rate() const
+{
+	if (total_packets_sent == 0) return 0.0;
+	uint32_t successful = total_packets_sent - retransmissions - lost_packets;
+
+	return (float)successful / total_packets_sent * 100.0;
+}
+
+void PerformanceMonitor::compression_sample(uint16_t raw_len, uint16_t coded_len)
+{
+	compression_raw_bytes += raw_len;
+	compression_coded_bytes += coded_len;
+}
+
+float PerformanceMonitor::get_compression_ratio() const
+{
+	if (compression_raw_bytes == 0) return 1.0;
+	return (float)compression_coded_bytes / compression_raw_bytes;
+}
+
+void PerformanceMonitor::flow_control_pause(unsigned long duration_ms)
+{
+	flow_control_pauses++;
+	flow_control_time += duration_ms;
+}
+
+void PerformanceMonitor::link_failure_detected(unsigned long detection_ms)
+{
+	link_failures++;
+	detection_time_total += detection_ms;
+	if (detection_ms > detection_time_max) detection_time_max = detection_ms;
+}
+
+void PerformanceMonitor::get_snapshot(StatsSnapshot* snapshot) const
+{
+	memset(snapshot, 0, sizeof(StatsSnapshot));
+	snapshot->version = STATS_SNAPSHOT_VERSION;
+	snapshot->uptime_ms = now_ms() - measurement_start_time;
+	snapshot->packets_sent = total_packets_sent;
+	snapshot->data_frames_sent = data_frames_sent;
+	snapshot->packets_received = total_packets_received;
+	snapshot->datagrams_received = datagrams_received;
+	snapshot->payload_bytes_delivered = payload_bytes_delivered;
+	snapshot->crc_errors = crc_errors;
+	snapshot->sequence_gaps = sequence_gaps;
+	snapshot->duplicates = duplicates;
+	snapshot->lost_packets = lost_packets;
+	snapshot->retransmissions = retransmissions;
+	snapshot->timeouts = timeouts;
+	snapshot->flow_control_pauses = flow_control_pauses;
+
+	//Fold the 16 log2 buckets: 0-3 (< 1 ms), then pairs, the last one takes the rest
+	for (uint8_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+	{
+		uint8_t bucket = i < 4 ? 0 : (i - 2) / 2;
+		if (bucket >= STATS_LATENCY_BUCKETS) bucket = STATS_LATENCY_BUCKETS - 1;
+
+		uint32_t sum = snapshot->latency_buckets[bucket] + latency_histogram.get_bucket(i);
+		snapshot->latency_buckets[bucket] = sum > UINT16_MAX ? UINT16_MAX : sum;
+	}
+}
+
+bool PerformanceMonitor::peer_snapshot_received(const uint8_t* data, uint16_t length)
+{
+	if (length != sizeof(StatsSnapshot) || data[0] != STATS_SNAPSHOT_VERSION) return false;
+
+	memcpy(&peer_stats, data, sizeof(StatsSnapshot));
+	peer_stats_valid = true;
+
+	//One line per snapshot for the host-side CSV decoder (tools/stats_decode.cpp)
+	static const char hex[] = "0123456789ABCDEF";
+	Serial.print("STATS,");
+	Serial.print(now_ms());
+	Serial.print(",");
+	for (uint16_t i = 0; i < length; i++)
+	{
+		Serial.print(hex[data[i] >> 4]);
+		Serial.print(hex[data[i] & 0x0F]);
+	}
+	Serial.println();
+	return true;
+}
+
+float PerformanceMonitor::get_end_to_end_loss_rate() const
+{
+	if (!peer_stats_valid || data_frames_sent == 0) return 0.0;
+	if (peer_stats.packets_received >= data_frames_sent) return 0.0;//peer counters reset later than ours
+
+	return (float)(data_frames_sent - peer_stats.packets_received) / data_frames_sent * 100.0;
+}
+
+void PerformanceMonitor::print_statistics()
+{
+	unsigned long current_time = now_ms();
+	unsigned long elapsed_time = current_time - measurement_start_time;
+
+	Serial.println("\n ==== PERFORMANCE STATISTICS ====");
+	Serial.println("THROUGHPUT: ");
+	Serial.print(" Packets Sent: "); Serial.println(total_packets_sent);
+	Serial.print(" Packets Received: "); Serial.println(total_packets_received);
+	Serial.print(" Data Sent: "); Serial.print(total_bytes_sent / 1024.0, 2); Serial.println(" KB");
+	Serial.print(" Throughput: "); Serial.print(get_throughput_kbps(), 2); Serial.println(" kbps");
+	Serial.print(" Packet Rate "); Serial.print(get_packet_rate(), 2); Serial.println(" packets/s");
+
+	Serial.println("LATENCY: ");
+	Serial.print(" Average: "); Serial.print(get_average_latency(), 2); Serial.println(" ms");
+	Serial.print(" Min: "); Serial.print(get_min_latency()); Serial.println(" ms");
+	Serial.print(" Max: "); Serial.print(get_max_latency()); Serial.println(" ms");
+	Serial.print(" Jitter: "); Serial.print(get_average_jitter(), 2); Serial.println(" ms");
+
+	if (clock_sync.get_exchanges() > 0) clock_sync.print_statistics();
+
+	Serial.println("ERROR ANALYSIS:");
+	Serial.print(" Packet Loss: "); Serial.print(get_packet_loss_rate(), 2); Serial.println("%");
+	Serial.print(" CRC Errors: "); Serial.println(crc_errors);
+	Serial.print(" Sequence Errors: "); Serial.println(sequence_errors);
+	Serial.print("  Gaps: "); Serial.println(sequence_gaps);
+	Serial.print("  Duplicates: "); Serial.println(duplicates);
+	Serial.print(" Timeouts: "); Serial.println(timeouts);
+	Serial.print(" Retransmissions: "); Serial.println(retransmissions);
+	Serial.print(" Success Rate: "); Serial.print(get_success_rate(), 2); Serial.println("%");
+	if (datagrams_received > 0)
+	{
+		Serial.print(" Datagrams Received: "); Serial.println(datagrams_received);
+		Serial.print(" Datagrams Lost: "); Serial.println(datagrams_missing);
+		Serial.print(" Datagram Loss: "); Serial.print(get_datagram_loss_rate(), 2); Serial.println("%");
+	}
+
+	if (compression_raw_bytes > 0)
+	{
+		Serial.println("COMPRESSION:");
+		Serial.print(" Payload In: "); Serial.print(compression_raw_bytes); Serial.println(" bytes");
+		Serial.print(" Payload Out: "); Serial.print(compression_coded_bytes); Serial.println(" bytes");
+		Serial.print(" Ratio: "); Serial.print(get_compression_ratio(), 3); Serial.println();
+	}
+
+	if (peer_stats_valid)
+	{
+		//Frames put on each path: built + resent by the sender (retransmissions reuse the built frame)
+		uint32_t tx_path_frames = total_packets_sent + retransmissions;
+		uint32_t rx_path_frames = peer_stats.packets_sent + peer_stats.retransmissions;
+
+		Serial.println("PEER (TYPE_STATS):");
+		Serial.print(" Peer Uptime: "); Serial.print(peer_stats.uptime_ms / 1000.0, 1); Serial.println(" s");
+		Serial.print(" DATA Sent/Peer Accepted: "); Serial.print(data_frames_sent); Serial.print("/"); Serial.println(peer_stats.packets_received);
+		Serial.print(" End-to-End Loss: "); Serial.print(get_end_to_end_loss_rate(), 2); Serial.println("%");
+		Serial.print(" TX Path CRC Errors: "); Serial.print(peer_stats.crc_errors);
+		Serial.print(" ("); Serial.print(tx_path_frames ? (float)peer_stats.crc_errors / tx_path_frames * 100.0 : 0.0, 2); Serial.println("%)");
+		Serial.print(" RX Path CRC Errors: "); Serial.print(crc_errors);
+		Serial.print(" ("); Serial.print(rx_path_frames ? (float)crc_errors / rx_path_frames * 100.0 : 0.0, 2); Serial.println("%)");
+		Serial.print(" Peer Duplicates: "); Serial.println(peer_stats.duplicates);
+		Serial.print(" Peer Retransmissions: "); Serial.println(peer_stats.retransmissions);
+	}
+
+	if (payload_bytes_delivered > 0 || flow_control_pauses > 0)
+	{
+		Serial.println("FLOW CONTROL:");
+		Serial.print(" Payload Delivered: "); Serial.print(payload_bytes_delivered); Serial.println(" bytes");
+		Serial.print(" Goodput: "); Serial.print(get_goodput_kbps(), 2); Serial.println(" kbps");
+		Serial.print(" Credit Pauses: "); Serial.println(flow_control_pauses);
+		Serial.print(" Time Paused: "); Serial.print(flow_control_time); Serial.println(" ms");
+	}
+
+	if (heartbeats_sent > 0 || link_failures > 0)
+	{
+		Serial.println("LINK STATE:");
+		Serial.print(" Heartbeats Sent: "); Serial.println(heartbeats_sent);
+		Serial.print(" Link Failures: "); Serial.println(link_failures);
+		Serial.print(" Detection Time: "); Serial.print(get_average_detection_ms(), 1);
+		Serial.print(" ms avg, "); Serial.print(detection_time_max); Serial.println(" ms max");
+		Serial.print(" Downtime: "); Serial.print(downtime_total); Serial.println(" ms");
+	}
+
+#if ENABLE_CYCLE_PROFILER
+	CycleProfiler::print_statistics();
+#endif
+
+	Serial.print("Measurement Duration: ");
+	Serial.print(elapsed_time / 1000.0, 1);
+	Serial.println(" seconds");
+	Serial.println("====================================================\n");
+
 }
\ No newline at end of file
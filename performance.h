@@ -1,77 +1,146 @@
-#pragma once
-#ifndef PERFORMANCE_H
-#define PERFORMANCE_H
-
-#include <Arduino.h>
-#include <stdint.h>
-
-class PerformanceMonitor
-{
-private:
-	static const uint8_t LATENCY_BUFFER_SIZE = 50;
-	static const uint16_t MAX_SEQUENCE_NUMS = 256;
-
-	//Throughtput metrics
-	uint32_t total_bytes_sent;
-	uint32_t total_bytes_received;
-	uint32_t total_packets_sent;
-	uint32_t total_packets_received;
-	unsigned long measurement_start_time;
-
-	//Latency metrics
-	uint32_t latency_samples[LATENCY_BUFFER_SIZE];
-	uint16_t latency_index;
-	uint32_t total_latency;
-	uint32_t min_latency;
-	uint32_t max_latency;
-	uint32_t last_latency;
-
-	//Error tracking
-	uint32_t lost_packets;
-	uint32_t sequence_errors;
-	uint32_t crc_errors;
-	uint32_t timeouts;
-	uint32_t retransmissions;
-
-	//Packet timing
-	unsigned long packet_start_time[MAX_SEQUENCE_NUMS];
-
-public:
-	PerformanceMonitor();
-
-	//Throughtput measurement
-	void packet_sent(uint16_t packet_size);
-	void packet_received(uint16_t packet_size);
-	float get_throughput_kbps() const;
-	float get_packet_rate() const;
-
-	//Latency measurement
-	void start_latency_measurement(uint16_t sequence_num);
-	void end_latency_measurement(uint16_t sequence_num);
-	float get_average_latency() const;
-	int get_min_latency() const;
-	int get_max_latency() const;
-	float get_average_jitter() const;
-
-	//Error tracking
-	void packet_lost(uint16_t sequence_num);
-	void sequence_error(uint16_t expected, uint16_t received);
-	void crc_error();
-	void timeout_occurred();
-	void retransmission_occurred();
-	float get_packet_loss_rate() const;
-	float get_error_rate() const;
-	float get_success_rate() const;
-
-	//Reporting
-	void print_statistics();
-	void reset_statistics();
-
-	//Getter for external use
-	uint32_t get_packet_sent() const { return total_packets_sent; }
-	uint32_t get_packet_received() const { return total_packets_received; }
-	uint32_t get_crc_errors() const { return crc_errors; }
-	uint32_t get_retransmissions() const { return retransmissions; }
-};
-
-#endif
+#pragma once
+#ifndef PERFORMANCE_H
+#define PERFORMANCE_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "clock_sync.h"
+#include "latency_histogram.h"
+#include "stats_snapshot.h"
+
+class PerformanceMonitor
+{
+private:
+	static const uint8_t LATENCY_BUFFER_SIZE = 50;
+	static const uint16_t MAX_SEQUENCE_NUMS = 256;
+
+	//Throughtput metrics
+	uint32_t total_bytes_sent;
+	uint32_t total_bytes_received;
+	uint32_t total_packets_sent;
+	uint32_t total_packets_received;
+	uint32_t data_frames_sent;//DATA frames originated, what the peer should end up receiving
+	uint32_t datagrams_received;
+	uint32_t datagrams_missing;//receiver side: gaps in the datagram sequence, kept apart from lost_packets
+	uint32_t payload_bytes_delivered;//receiver side, handed to the application exactly once
+	unsigned long measurement_start_time;
+
+	//Latency metrics
+	uint32_t latency_samples[LATENCY_BUFFER_SIZE];
+	uint16_t latency_index;
+	uint32_t total_latency;
+	uint32_t min_latency;
+	uint32_t max_latency;
+	uint32_t last_latency;
+	LatencyHistogram latency_histogram;//same samples, exported in TYPE_STATS snapshots
+	ClockSync clock_sync;//one-way split of the round trip, from ACK timestamps
+
+	//Error tracking
+	uint32_t lost_packets;
+	uint32_t sequence_errors;
+	uint32_t sequence_gaps;
+	uint32_t duplicates;
+	uint32_t crc_errors;
+	uint32_t timeouts;
+	uint32_t retransmissions;
+	uint32_t data_attempts;//DATA transmissions incl. retries, nothing else: the payload controller's sample
+	uint32_t data_failures;//of those, not ACKed (timeout or NACK)
+
+	//Compression
+	uint32_t compression_raw_bytes;
+	uint32_t compression_coded_bytes;
+
+	//Flow control
+	uint32_t flow_control_pauses;
+	unsigned long flow_control_time;//ms spent waiting for receiver credit
+
+	//Link state (heartbeat)
+	uint32_t heartbeats_sent;
+	uint32_t link_failures;
+	unsigned long detection_time_total;//last sign of life -> link declared DOWN
+	unsigned long detection_time_max;
+	unsigned long downtime_total;//DOWN -> first frame from the peer again
+
+	//Packet timing
+	unsigned long packet_start_time[MAX_SEQUENCE_NUMS];
+
+	//Latest TYPE_STATS snapshot from the peer
+	StatsSnapshot peer_stats;
+	bool peer_stats_valid;
+
+	unsigned long (*time_source)();//nullptr = millis(), replay tools supply capture time
+	unsigned long now_ms() const { return time_source ? time_source() : millis(); }
+
+public:
+	PerformanceMonitor();
+
+	//Throughtput measurement
+	void packet_sent(uint16_t packet_size);
+	void packet_received(uint16_t packet_size);
+	void data_frame_sent() { data_frames_sent++; }
+	void datagram_received(uint16_t packet_size);
+	void datagrams_lost(uint16_t count) { datagrams_missing += count; }
+	float get_throughput_kbps() const;
+	float get_packet_rate() const;
+	void payload_delivered(uint16_t payload_size);
+	float get_goodput_kbps() const;
+
+	//Latency measurement
+	void start_latency_measurement(uint16_t sequence_num);
+	void end_latency_measurement(uint16_t sequence_num);
+	float get_average_latency() const;
+	int get_min_latency() const;
+	int get_max_latency() const;
+	float get_average_jitter() const;
+	ClockSync& get_clock_sync() { return clock_sync; }
+
+	//Error tracking
+	void packet_lost(uint16_t sequence_num);
+	void sequence_error(uint16_t expected, uint16_t received);
+	void crc_error();
+	void timeout_occurred();
+	void retransmission_occurred();
+	void data_attempt(bool acked) { data_attempts++; if (!acked) data_failures++; }
+	float get_packet_loss_rate() const;
+	float get_datagram_loss_rate() const;//receiver side: gaps / (received + gaps)
+	float get_error_rate() const;
+	float get_success_rate() const;
+
+	//Compression
+	void compression_sample(uint16_t raw_len, uint16_t coded_len);
+	float get_compression_ratio() const;
+
+	//Flow control
+	void flow_control_pause(unsigned long duration_ms);
+
+	//Link state
+	void heartbeat_sent() { heartbeats_sent++; }
+	void link_failure_detected(unsigned long detection_ms);
+	void link_recovered(unsigned long downtime_ms) { downtime_total += downtime_ms; }
+	float get_average_detection_ms() const { return link_failures ? (float)detection_time_total / link_failures : 0.0; }
+	uint32_t get_link_failures() const { return link_failures; }
+
+	//Remote statistics (TYPE_STATS)
+	void get_snapshot(StatsSnapshot* snapshot) const;
+	bool peer_snapshot_received(const uint8_t* data, uint16_t length);//false = wrong size or version
+	bool has_peer_stats() const { return peer_stats_valid; }
+	const StatsSnapshot& get_peer_stats() const { return peer_stats; }
+	float get_end_to_end_loss_rate() const;//our DATA frames the peer never accepted
+
+	//Reporting
+	void print_statistics();
+	void reset_statistics();
+	void set_time_source(unsigned long (*source)()) { time_source = source; reset_statistics(); }
+
+	//Getter for external use
+	uint32_t get_packet_sent() const { return total_packets_sent; }
+	uint32_t get_packet_received() const { return total_packets_received; }
+	uint32_t get_crc_errors() const { return crc_errors; }
+	uint32_t get_retransmissions() const { return retransmissions; }
+	uint32_t get_data_attempts() const { return data_attempts; }
+	uint32_t get_data_failures() const { return data_failures; }
+	uint32_t get_duplicates() const { return duplicates; }
+	uint32_t get_flow_control_pauses() const { return flow_control_pauses; }
+};
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#ifndef PROTOCOL_CONFIG_H
+#define PROTOCOL_CONFIG_H
+
+#include <stdint.h>
+
+//Compile-time link profile. PacketFrameT, UartProtocolT, ChannelSchedulerT and the SPI classes
+//take one as their template parameter, so frame buffers, SPI transfers and loop bounds are
+//sized per link and the constants fold into the code exactly as the old #defines did.
+//Every profile used in a binary is instantiated at the bottom of the class's .cpp; functions
+//of an unused profile are dropped by the linker (-ffunction-sections, --gc-sections).
+template<uint16_t MaxDataLen, uint8_t MaxRetries, uint16_t AckTimeoutMs, uint8_t StartMarker = 0xAA, uint8_t EndMarker = 0x55>
+struct ProtocolConfig
+{
+	static constexpr uint16_t MAX_DATA_LEN = MaxDataLen;//payload bytes per frame, also the in-RAM Frame size
+	static constexpr uint8_t MAX_RETRIES = MaxRetries;
+	static constexpr uint16_t ACK_TIMEOUT_MS = AckTimeoutMs;
+	static constexpr uint8_t START_MARKER = StartMarker;
+	static constexpr uint8_t END_MARKER = EndMarker;
+
+	static_assert(MaxDataLen > 0 && MaxDataLen <= 255, "max_payload is negotiated as one byte");
+	static_assert(StartMarker != EndMarker, "markers must differ");
+};
+
+typedef ProtocolConfig<52, 3, 1000> DefaultConfig;//the original profile: UART bulk link, SPI sensor link
+typedef ProtocolConfig<16, 5, 50> ControlConfig;//small SPI control link: 28-byte transfers, fast retries
+
+#endif // !PROTOCOL_CONFIG_H
@@ -0,0 +1,297 @@
+#include "pty_transport.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t monotonic_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool set_raw_nonblocking(int fd)
+{
+	struct termios tio;
+	if (tcgetattr(fd, &tio) == 0)//sockets have no termios, skip silently
+	{
+		cfmakeraw(&tio);
+		if (tcsetattr(fd, TCSANOW, &tio) != 0) return false;
+	}
+
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+PtyTransport::PtyTransport() :
+	fd(-1),
+	peer_fd(-1),
+	baud_rate(0),
+	byte_error_threshold(0),
+	drop_threshold(0),
+	rng_state(1)
+{
+	peer_name[0] = '\0';
+	reset_state();
+}
+
+PtyTransport::~PtyTransport()
+{
+	close_transport();
+}
+
+void PtyTransport::reset_state()
+{
+	rx_head = 0;
+	rx_tail = 0;
+	next_tx_time_us = 0;
+	bytes_corrupted = 0;
+	bytes_dropped = 0;
+}
+
+//============================================ SETUP ========================================
+
+bool PtyTransport::open_pty()
+{
+	close_transport();
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0) return false;
+
+	if (grantpt(fd) != 0 || unlockpt(fd) != 0 || ptsname_r(fd, peer_name, sizeof(peer_name)) != 0)
+	{
+		close_transport();
+		return false;
+	}
+
+	//Put the slave side in raw mode so the line discipline does not eat 0x03/0x0A etc.
+	peer_fd = ::open(peer_name, O_RDWR | O_NOCTTY);
+	if (peer_fd < 0 || !set_raw_nonblocking(peer_fd) || !set_raw_nonblocking(fd))
+	{
+		close_transport();
+		return false;
+	}
+	return true;
+}
+
+bool PtyTransport::open_device(const char* path)
+{
+	close_transport();
+
+	fd = ::open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0) return false;
+
+	if (!set_raw_nonblocking(fd))
+	{
+		close_transport();
+		return false;
+	}
+	snprintf(peer_name, sizeof(peer_name), "%s", path);
+	return true;
+}
+
+bool PtyTransport::create_socketpair(PtyTransport& a, PtyTransport& b)
+{
+	int fds[2];
+
+	a.close_transport();
+	b.close_transport();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return false;
+
+	a.fd = fds[0];
+	b.fd = fds[1];
+	if (!set_raw_nonblocking(a.fd) || !set_raw_nonblocking(b.fd))
+	{
+		a.close_transport();
+		b.close_transport();
+		return false;
+	}
+	snprintf(a.peer_name, sizeof(a.peer_name), "socketpair:%d", b.fd);
+	snprintf(b.peer_name, sizeof(b.peer_name), "socketpair:%d", a.fd);
+	return true;
+}
+
+void PtyTransport::close_transport()
+{
+	if (fd >= 0) ::close(fd);
+	if (peer_fd >= 0) ::close(peer_fd);
+	fd = -1;
+	peer_fd = -1;
+	peer_name[0] = '\0';
+	reset_state();
+}
+
+//============================================ SIMULATED LINK ========================================
+
+void PtyTransport::set_baud_rate(uint32_t baud)
+{
+	baud_rate = baud;
+	next_tx_time_us = 0;
+}
+
+void PtyTransport::set_fault_injection(float bit_error_rate, float drop_rate, uint32_t seed)
+{
+	//Per-byte corruption probability for 8 independent bits
+	double p_byte = 1.0 - pow(1.0 - (double)bit_error_rate, 8.0);
+
+	byte_error_threshold = (uint32_t)(p_byte * 4294967295.0);
+	drop_threshold = (uint32_t)((double)drop_rate * 4294967295.0);
+	rng_state = seed ? seed : 1;
+}
+
+uint32_t PtyTransport::next_random()
+{
+	//xorshift32: deterministic per seed so a failing soak run can be replayed
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+bool PtyTransport::inject_faults(uint8_t* byte)
+{
+	if (drop_threshold && next_random() < drop_threshold)
+	{
+		bytes_dropped++;
+		return false;
+	}
+
+	if (byte_error_threshold && next_random() < byte_error_threshold)
+	{
+		*byte ^= (uint8_t)(1 << (next_random() & 0x07));
+		bytes_corrupted++;
+	}
+	return true;
+}
+
+void PtyTransport::throttle(size_t len)
+{
+	if (baud_rate == 0) return;
+
+	//Wait until the previous bytes have left the "wire", then book wire time for these
+	uint64_t now = monotonic_us();
+	if (next_tx_time_us > now)
+	{
+		usleep((useconds_t)(next_tx_time_us - now));
+		now = next_tx_time_us;
+	}
+	next_tx_time_us = now + (uint64_t)len * 10ULL * 1000000ULL / baud_rate;
+}
+
+//============================================ STREAM INTERFACE ========================================
+
+bool PtyTransport::fill_rx_chunk()
+{
+	if (rx_head < rx_tail) return true;
+	if (fd < 0) return false;
+
+	ssize_t n = ::read(fd, rx_chunk, RX_CHUNK_SIZE);
+	if (n <= 0) return false;
+
+	rx_head = 0;
+	rx_tail = (uint16_t)n;
+	return true;
+}
+
+int PtyTransport::available()
+{
+	int pending = 0;
+
+	if (fd >= 0 && ioctl(fd, FIONREAD, &pending) != 0) pending = 0;
+	return (rx_tail - rx_head) + pending;
+}
+
+int PtyTransport::read()
+{
+	if (!fill_rx_chunk()) return -1;
+	return rx_chunk[rx_head++];
+}
+
+int PtyTransport::peek()
+{
+	if (!fill_rx_chunk()) return -1;
+	return rx_chunk[rx_head];
+}
+
+size_t PtyTransport::readBytes(char* buffer, size_t length)
+{
+	size_t copied = 0;
+
+	while (copied < length && fill_rx_chunk())
+	{
+		size_t chunk = rx_tail - rx_head;
+		if (chunk > length - copied) chunk = length - copied;
+
+		memcpy(buffer + copied, &rx_chunk[rx_head], chunk);
+		rx_head += chunk;
+		copied += chunk;
+	}
+	return copied;
+}
+
+size_t PtyTransport::write(uint8_t byte)
+{
+	return write(&byte, 1);
+}
+
+size_t PtyTransport::write(const uint8_t* buffer, size_t size)
+{
+	if (fd < 0 || !buffer) return 0;
+
+	throttle(size);
+
+	//Faults are applied on the way out so the peer's receiver sees a noisy line
+	uint8_t out[RX_CHUNK_SIZE];
+	size_t consumed = 0;
+
+	while (consumed < size)
+	{
+		size_t out_len = 0;
+		while (consumed < size && out_len < sizeof(out))
+		{
+			uint8_t byte = buffer[consumed++];
+			if (inject_faults(&byte)) out[out_len++] = byte;
+		}
+
+		size_t sent = 0;
+		while (sent < out_len)
+		{
+			ssize_t n = ::write(fd, out + sent, out_len - sent);
+			if (n < 0)
+			{
+				if (errno == EAGAIN || errno == EINTR)
+				{
+					usleep(100);//peer is not draining fast enough, back off
+					continue;
+				}
+				return consumed - (out_len - sent);
+			}
+			sent += (size_t)n;
+		}
+	}
+	return size;
+}
+
+void PtyTransport::flush()
+{
+	//Block until the throttled bytes would have been shifted out, like HardwareSerial::flush()
+	if (baud_rate == 0) return;
+
+	uint64_t now = monotonic_us();
+	if (next_tx_time_us > now)
+	{
+		usleep((useconds_t)(next_tx_time_us - now));
+	}
+}
+
+#endif // __linux__
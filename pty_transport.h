@@ -0,0 +1,74 @@
+#pragma once
+#ifndef PTY_TRANSPORT_H
+#define PTY_TRANSPORT_H
+
+//Host-only transport: lets UartProtocol run on Linux over a pseudo-terminal or socketpair
+//(soak testing, perf profiling). Compiled out on the ESP32 target.
+#if defined(__linux__)
+
+#include <Arduino.h>
+#include <stdint.h>
+
+class PtyTransport : public Stream
+{
+private:
+	static const uint16_t RX_CHUNK_SIZE = 256;
+
+	int fd;
+	int peer_fd;//pty slave side kept open so reads never see EIO while the peer is detached
+	char peer_name[64];
+
+	//RX staging buffer (one read() syscall per chunk instead of per byte)
+	uint8_t rx_chunk[RX_CHUNK_SIZE];
+	uint16_t rx_head;
+	uint16_t rx_tail;
+
+	//Baud-rate throttling (0 = unthrottled)
+	uint32_t baud_rate;
+	uint64_t next_tx_time_us;
+
+	//Fault injection
+	uint32_t byte_error_threshold;//P(byte corrupted) scaled to 2^32
+	uint32_t drop_threshold;//P(byte dropped) scaled to 2^32
+	uint32_t rng_state;
+	uint32_t bytes_corrupted;
+	uint32_t bytes_dropped;
+
+	bool fill_rx_chunk();
+	void throttle(size_t len);
+	uint32_t next_random();
+	bool inject_faults(uint8_t* byte);
+	void reset_state();
+
+public:
+	PtyTransport();
+	virtual ~PtyTransport();
+
+	//Transport setup
+	bool open_pty();//create a new pty, peer attaches to get_peer_name()
+	bool open_device(const char* path);//open an existing tty/pty device
+	static bool create_socketpair(PtyTransport& a, PtyTransport& b);//two connected in-process endpoints
+	void close_transport();
+	const char* get_peer_name() const { return peer_name; }
+	bool is_open() const { return fd >= 0; }
+
+	//Simulated link
+	void set_baud_rate(uint32_t baud);//10 bit times per byte (8N1), 0 disables throttling
+	void set_fault_injection(float bit_error_rate, float drop_rate, uint32_t seed = 1);
+	uint32_t get_bytes_corrupted() const { return bytes_corrupted; }
+	uint32_t get_bytes_dropped() const { return bytes_dropped; }
+
+	//Stream interface used by UartProtocol
+	int available();
+	int read();
+	int peek();
+	size_t readBytes(char* buffer, size_t length);//bulk copy, never waits for more than is available
+	size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+	size_t write(uint8_t byte);
+	size_t write(const uint8_t* buffer, size_t size);
+	void flush();
+};
+
+#endif // __linux__
+
+#endif // !PTY_TRANSPORT_H
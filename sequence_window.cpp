@@ -0,0 +1,71 @@
+#include "sequence_window.h"
+
+SequenceWindow::SequenceWindow()
+{
+	reset();
+}
+
+void SequenceWindow::reset()
+{
+	highest_seq = 0;
+	bitmap = 0;
+	initialized = false;
+}
+
+uint16_t SequenceWindow::forward_distance(uint16_t from, uint16_t to)
+{
+	//Steps needed to go from 'from' to 'to' in the wrapped sequence space
+	return (uint16_t)(((uint32_t)to + SEQUENCE_MODULUS - from) % SEQUENCE_MODULUS);
+}
+
+bool SequenceWindow::is_duplicate(uint16_t seq) const
+{
+	if (!initialized) return false;
+
+	uint16_t behind = forward_distance(seq, highest_seq);
+	return behind < WINDOW_SIZE && (bitmap & ((uint32_t)1 << behind)) != 0;
+}
+
+SequenceStatus SequenceWindow::check_and_update(uint16_t seq, uint16_t* missing)
+{
+	if (missing) *missing = 0;
+
+	if (!initialized)
+	{
+		highest_seq = seq;
+		bitmap = 1;
+		initialized = true;
+		return SEQ_IN_ORDER;
+	}
+
+	uint16_t ahead = forward_distance(highest_seq, seq);
+	if (ahead == 0) return SEQ_DUPLICATE;
+
+	//Newer: slide the window forward
+	if (ahead < SEQUENCE_MODULUS / 2)
+	{
+		bitmap = (ahead >= WINDOW_SIZE) ? 0 : (bitmap << ahead);
+		bitmap |= 1;
+		highest_seq = seq;
+
+		if (ahead == 1) return SEQ_IN_ORDER;
+		if (missing) *missing = ahead - 1;
+		return SEQ_GAP;
+	}
+
+	//Older: inside the window it is either a duplicate or a late arrival
+	uint16_t behind = forward_distance(seq, highest_seq);
+	if (behind < WINDOW_SIZE)
+	{
+		uint32_t mask = (uint32_t)1 << behind;
+		if (bitmap & mask) return SEQ_DUPLICATE;
+
+		bitmap |= mask;
+		return SEQ_LATE;
+	}
+
+	//Too old to be a retransmission we could still be asked for
+	highest_seq = seq;
+	bitmap = 1;
+	return SEQ_RESYNC;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef SEQUENCE_WINDOW_H
+#define SEQUENCE_WINDOW_H
+
+#include <stdint.h>
+
+#define SEQUENCE_MODULUS 65535//get_next_sequence() wraps 65534 -> 0
+
+typedef enum
+{
+	SEQ_IN_ORDER,//next expected sequence
+	SEQ_GAP,//newer than expected, some sequences were skipped
+	SEQ_LATE,//older than the highest seen but never delivered (fills a gap)
+	SEQ_DUPLICATE,//already delivered, must not be delivered again
+	SEQ_RESYNC,//far behind the window: peer restarted its counter
+}SequenceStatus;
+
+//Receiver-side duplicate suppression: bitmap of the last WINDOW_SIZE sequences relative
+//to the highest one seen. O(1), fixed memory, wrap-safe modulo SEQUENCE_MODULUS.
+class SequenceWindow
+{
+private:
+	static const uint8_t WINDOW_SIZE = 32;
+
+	uint16_t highest_seq;
+	uint32_t bitmap;//bit n set = (highest_seq - n) already delivered
+	bool initialized;
+
+public:
+	SequenceWindow();
+
+	SequenceStatus check_and_update(uint16_t seq, uint16_t* missing);//missing = sequences skipped on SEQ_GAP
+	bool is_duplicate(uint16_t seq) const;//already delivered, does not move the window
+	void reset();
+
+	uint16_t get_expected() const { return initialized ? next_sequence(highest_seq) : 0; }
+	static uint16_t forward_distance(uint16_t from, uint16_t to);
+	static uint16_t next_sequence(uint16_t seq) { return (seq + 1) % SEQUENCE_MODULUS; }
+};
+
+#endif // !SEQUENCE_WINDOW_H
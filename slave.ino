@@ -1,5 +1,5 @@
 #include "uart_protocol.h"
-#include <ESP32SPISlave.h>
+#include "spi_slave_engine.h"
 
 HardwareSerial SerialPort(2);
 #define RX2 16
@@ -10,17 +10,25 @@ HardwareSerial SerialPort(2);
 #define SPI_SCK 18
 #define SPI_CS 5
 
-#define FRAME_LEN 64
+#define SAMPLE_INTERVAL_MS 20//simulated sensor rate, answered on the master's status polls
+
+//1: authenticate and encrypt the UART link (ChaCha20-Poly1305 in place of CRC16), same key on both ends
+#define USE_LINK_KEY 0
+
+#if USE_LINK_KEY
+//Placeholder: provision a random key per installation, never ship this one
+static const uint8_t LINK_KEY[CIPHER_KEY_LEN] =
+{
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+#endif
 
 PacketFrame packet_frame;
 UartProtocol uart_protocol(&SerialPort, 115200);
-ESP32SPISlave slave;
-
-Frame rx_frame;
-Frame tx_frame;
+SpiSlaveEngine spi_slave(&packet_frame);//replies are built in the transaction hook, frames delivered from loop()
 
-uint8_t rx_buffer[FRAME_LEN];
-uint8_t tx_buffer[FRAME_LEN];
+unsigned long last_sample_time = 0;
 //========================================== DEBUG FUNCTION =====================================
 void display_frame_proper(Frame frame)
 {
@@ -45,61 +53,65 @@ void print_frame_info_spi(Frame* frame)
 	Serial.print(frame->sequence_num);
 	Serial.print("] Type:");
 
-	switch (frame->packet_type)
+	switch (PacketFrame::get_type(frame))
 	{
 	case TYPE_DATA: Serial.print("DATA"); break;
 	case TYPE_ACK: Serial.print("ACK"); break;
 	case TYPE_NACK: Serial.print("NACK"); break;
+	case TYPE_DATAGRAM: Serial.print("DATAGRAM"); break;
+	case TYPE_POLL: Serial.print("POLL"); break;
+	case TYPE_STATS: Serial.print("STATS"); break;
 	default: Serial.print("UNKNOWN"); break;
 	}
 
 	Serial.print(" Len: "); Serial.print(frame->data_length);
+	if (frame->packet_type & FLAG_COMPRESSED) Serial.print(" (compressed)");
 	Serial.print(" CRC: 0x"); Serial.print(frame->crc16, HEX);
-	Serial.print(" Valid: "); Serial.print(packet_frame.validate_frame(frame) ? "YES" : "NO");
 }
 
+//Runs from spi_slave.process(): the engine has already validated, unpacked and de-duplicated
+//the frame under its lock, so nothing here may touch packet_frame
 void process_received_frame_spi_slave(Frame* frame)
 {
 	Serial.print("\n<<< SLAVE RECEIVED: ");
 	print_frame_info_spi(frame);
 	Serial.println();
 
-	if (packet_frame.validate_frame(frame))
+	switch (PacketFrame::get_type(frame))
 	{
-		switch (frame->packet_type)
-		{
-		case TYPE_DATA:
+	case TYPE_DATA:
+	{
+		String received_data = "";
+
+		for (int i = 0; i < frame->data_length; i++)
 		{
-			String received_data = "";
-
-			for (int i = 0; i < frame->data_length; i++)
-			{
-				received_data += (char)frame->data[i];
-			}
-			Serial.print("Data: ");
-			Serial.println(received_data);
-
-			Serial.print("Sending ACK for seq: ");
-			Serial.println(frame->sequence_num);
-			break;
+			received_data += (char)frame->data[i];
 		}
-		case TYPE_ACK:
-			Serial.println("ACK processed - THIS SHOULD NOT HAPPEN ON SLAVE");
-			break;
-		case TYPE_NACK:
-			Serial.println("NACK processed - will retry");
-			break;
-		}
-	}
-	else
-	{
-		Serial.println("INVALID FRAME - CRC ERROR");
-		Serial.print("Sending NACK for seq: ");
+		Serial.print("Data: ");
+		Serial.println(received_data);
+
+		Serial.print("ACKed seq: ");
 		Serial.println(frame->sequence_num);
+		break;
+	}
+	case TYPE_DATAGRAM:
+		//Fire-and-forget: the engine sends no reply for it
+		Serial.print("Datagram: ");
+		for (int i = 0; i < frame->data_length; i++)
+		{
+			Serial.print((char)frame->data[i]);
+		}
+		Serial.println();
+		break;
+	case TYPE_ACK:
+		Serial.println("ACK processed - THIS SHOULD NOT HAPPEN ON SLAVE");
+		break;
+	case TYPE_NACK:
+		Serial.println("NACK processed - will retry");
+		break;
 	}
 }
 
-
 //======================================================= MAIN FUNCTION ===========================================
 
 void setup() 
@@ -108,13 +120,15 @@ void setup()
 
   //UART CONFIG
   SerialPort.begin(115200, SERIAL_8N1, RX2, TX2);
+  uart_protocol.set_baud_callback([](uint32_t baud) { SerialPort.updateBaudRate(baud); });
+  uart_protocol.set_max_baud(921600);
+#if USE_LINK_KEY
+  uart_protocol.set_link_key(LINK_KEY);
+#endif
 
   //SPI SLAVE CONFIG
-  slave.setDataMode(SPI_MODE0);
-  slave.begin(VSPI);
-
-  //Preload buffer
-  memset(tx_buffer, 0 , FRAME_LEN);
+  spi_slave.set_frame_handler(process_received_frame_spi_slave);
+  spi_slave.begin(SPI_SCK, SPI_MISO, SPI_MOSI, SPI_CS);
 
 }
 
@@ -131,38 +145,13 @@ void loop()
   }
   else//SPI Mode
   {
-    slave.queue(nullptr, rx_buffer, FRAME_LEN);
-    slave.wait();
+    //The driver keeps SPI_SLAVE_QUEUE_DEPTH transactions armed, the master never waits on the prints below
+    spi_slave.process();
 
-    memcpy(&rx_frame, rx_buffer, FRAME_LEN);
-
-    // Process frame
-    //
-    if (rx_frame.data_length > MAX_DATA_LEN)
-    {
-      Serial.println("FRAME OVERFLOW");
-      packet_frame.create_frame(TYPE_NACK, nullptr, 0, &tx_frame);
-    }
-    else if (!packet_frame.validate_frame(&rx_frame))
+    if (!spi_slave.is_sample_staged() && millis() - last_sample_time >= SAMPLE_INTERVAL_MS)
     {
-      Serial.println("CRC ERROR");
-      packet_frame.create_frame(TYPE_NACK, nullptr, 0, &tx_frame);
+      String sample = "Sensor - Time: " + String(millis());
+      if (spi_slave.stage_sample((uint8_t*)sample.c_str(), sample.length())) last_sample_time = millis();
     }
-    else
-    {
-      
-      process_received_frame_spi_slave(&rx_frame);
-      packet_frame.create_frame(TYPE_ACK, nullptr, 0, &tx_frame);
-    }
-    tx_frame.sequence_num = rx_frame.sequence_num;
-
-    uint16_t crc_len = 1 + 2 + 2; // type + seq + len
-    tx_frame.crc16 = CRC16::calculate((uint8_t*)&tx_frame.packet_type, crc_len);
-
-    memcpy(tx_buffer, &tx_frame, FRAME_LEN);
-
-    // send ACK/NACK in next transaction
-    slave.queue(tx_buffer, nullptr, FRAME_LEN);
-    slave.wait();
   }
-}
+}
\ No newline at end of file
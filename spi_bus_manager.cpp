@@ -0,0 +1,223 @@
+#include "spi_bus_manager.h"
+
+template<class Config>
+SpiBusManagerT<Config>::SpiBusManagerT(SPIClass* s) :
+	spi(s),
+	slave_count(0),
+	policy(BUS_DEMAND_DRIVEN),
+	data_callback(nullptr),
+	start_time(0),
+	sweeps(0),
+	bytes_collected(0)
+{
+}
+
+template<class Config>
+int8_t SpiBusManagerT<Config>::add_slave(SpiMasterProtocol* session, uint8_t weight)
+{
+	if (!session || slave_count >= MAX_SPI_SLAVES) return -1;
+
+	SlaveSlot& slot = slaves[slave_count];
+	slot.session = session;
+	slot.weight = weight > 0 ? weight : 1;
+	slot.credit = 0;
+	slot.pending = 0;
+	slot.idle = false;//poll everyone once before trusting the idle state
+	slot.idle_interval_ms = BUS_MIN_IDLE_POLL_MS;
+	slot.last_poll_time = 0;
+	slot.polls = 0;
+	slot.data_frames = 0;
+	slot.idle_replies = 0;
+	slot.errors = 0;
+	slot.poll_latency.reset();
+
+	return slave_count++;
+}
+
+template<class Config>
+void SpiBusManagerT<Config>::begin()
+{
+	//Sessions only claim their CS pin, the bus itself is set up once here
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		slaves[i].session->begin(false);
+	}
+
+	spi->begin(SPI_SCK, SPI_MISO, SPI_MOSI);
+	spi->setDataMode(SPI_MODE0);
+	spi->setBitOrder(MSBFIRST);
+
+	start_time = millis();
+
+	Serial.print("SPI BUS READY, slaves: ");
+	Serial.println(slave_count);
+}
+
+template<class Config>
+bool SpiBusManagerT<Config>::is_due(const SlaveSlot& slot, unsigned long now) const
+{
+	return !slot.idle || now - slot.last_poll_time >= slot.idle_interval_ms;
+}
+
+template<class Config>
+uint8_t SpiBusManagerT<Config>::select_sweep(uint8_t* batch, unsigned long now)
+{
+	uint8_t n = 0;
+
+	if (policy == BUS_WEIGHTED_ROUND_ROBIN)
+	{
+		//New round once no due slave has credit left
+		bool credit_left = false;
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			if (slaves[i].credit > 0 && is_due(slaves[i], now)) credit_left = true;
+		}
+		if (!credit_left)
+		{
+			for (uint8_t i = 0; i < slave_count; i++) slaves[i].credit = slaves[i].weight;
+		}
+
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			if (slaves[i].credit == 0 || !is_due(slaves[i], now)) continue;
+			slaves[i].credit--;
+			batch[n++] = i;
+		}
+	}
+	else
+	{
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			if (is_due(slaves[i], now)) batch[n++] = i;
+		}
+	}
+
+	return n;
+}
+
+template<class Config>
+void SpiBusManagerT<Config>::handle_reply(uint8_t index, SpiPollResult result, const uint8_t* data, uint16_t length, uint8_t pending)
+{
+	SlaveSlot& slot = slaves[index];
+
+	switch (result)
+	{
+	case POLL_DATA:
+		slot.data_frames++;
+		slot.idle = false;
+		slot.idle_interval_ms = BUS_MIN_IDLE_POLL_MS;
+		bytes_collected += length;
+		if (data_callback) data_callback(index, data, length);
+		break;
+
+	case POLL_DUPLICATE://our ACK got lost, the next poll carries it again
+	case POLL_RESTART://the next poll acknowledges the restart, the slave's data follows
+		slot.idle = false;
+		break;
+
+	case POLL_IDLE:
+		slot.idle_replies++;
+		slot.pending = pending;
+		if (pending > 0)
+		{
+			slot.idle = false;
+			break;
+		}
+		if (slot.idle) back_off(slot);
+		slot.idle = true;
+		slot.credit = 0;//rest of the round goes to slaves with data
+		break;
+
+	case POLL_ERROR://unresponsive or noisy slave only gets the idle poll rate
+		slot.errors++;
+		slot.idle = true;
+		slot.idle_interval_ms = BUS_IDLE_POLL_MS;
+		slot.credit = 0;
+		break;
+	}
+}
+
+template<class Config>
+void SpiBusManagerT<Config>::back_off(SlaveSlot& slot)
+{
+	uint16_t next = slot.idle_interval_ms * 2;
+	slot.idle_interval_ms = next < BUS_IDLE_POLL_MS ? next : BUS_IDLE_POLL_MS;
+}
+
+template<class Config>
+bool SpiBusManagerT<Config>::service()
+{
+	unsigned long now = millis();
+	uint8_t batch[MAX_SPI_SLAVES];
+	unsigned long sent_us[MAX_SPI_SLAVES];
+	bool sent[MAX_SPI_SLAVES];
+
+	uint8_t n = select_sweep(batch, now);
+	if (n == 0) return false;
+
+	//------ POLL EVERY SELECTED SLAVE ------
+	for (uint8_t k = 0; k < n; k++)
+	{
+		SlaveSlot& slot = slaves[batch[k]];
+		slot.polls++;
+		slot.last_poll_time = now;
+		sent[k] = slot.session->send_poll();
+		sent_us[k] = micros();
+	}
+
+	//One turnaround for the whole sweep instead of one per slave
+	delayMicroseconds(SPI_TURNAROUND_US);
+
+	//------ COLLECT THE REPLIES ------
+	uint8_t data[Config::MAX_DATA_LEN];
+	for (uint8_t k = 0; k < n; k++)
+	{
+		uint16_t length = 0;
+		uint8_t pending = 0;
+		SpiPollResult result = sent[k] ? slaves[batch[k]].session->read_poll_reply(data, &length, &pending) : POLL_ERROR;
+
+		if (result != POLL_ERROR) slaves[batch[k]].poll_latency.add_sample(micros() - sent_us[k]);
+		handle_reply(batch[k], result, data, length, pending);
+	}
+
+	sweeps++;
+	return true;
+}
+
+template<class Config>
+float SpiBusManagerT<Config>::get_throughput_kbps() const
+{
+	unsigned long elapsed_time = millis() - start_time;
+	if (elapsed_time == 0) return 0.0;
+
+	return bytes_collected * 8.0 / (elapsed_time / 1000.0) / 1024.0;
+}
+
+template<class Config>
+void SpiBusManagerT<Config>::print_statistics()
+{
+	Serial.print("SPI BUS (");
+	Serial.print(policy == BUS_WEIGHTED_ROUND_ROBIN ? "weighted RR" : "demand driven");
+	Serial.print("): sweeps="); Serial.print(sweeps);
+	Serial.print(" payload="); Serial.print(get_throughput_kbps(), 2); Serial.println(" kbps");
+
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		const SlaveSlot& slot = slaves[i];
+		const LatencyHistogram& h = slot.poll_latency;
+
+		Serial.print(" S"); Serial.print(i);
+		Serial.print(" cs="); Serial.print(slot.session->get_cs_pin());
+		Serial.print(" w="); Serial.print(slot.weight);
+		Serial.print(" polls="); Serial.print(slot.polls);
+		Serial.print(" data="); Serial.print(slot.data_frames);
+		Serial.print(" idle="); Serial.print(slot.idle_replies);
+		Serial.print(" err="); Serial.print(slot.errors);
+		Serial.print(" p50<="); Serial.print(h.get_percentile(50));
+		Serial.print(" p99<="); Serial.print(h.get_percentile(99));
+		Serial.print(" max="); Serial.println(h.get_max());
+	}
+}
+
+template class SpiBusManagerT<DefaultConfig>;
+template class SpiBusManagerT<ControlConfig>;
@@ -0,0 +1,86 @@
+#pragma once
+#ifndef SPI_BUS_MANAGER_H
+#define SPI_BUS_MANAGER_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "spi_master_protocol.h"
+#include "latency_histogram.h"
+
+#define MAX_SPI_SLAVES 8
+#define BUS_MIN_IDLE_POLL_MS 1//first back-off after an idle reply, doubled per idle reply in a row
+#define BUS_IDLE_POLL_MS 50//back-off ceiling for a slave that keeps reporting nothing
+
+typedef enum
+{
+	BUS_WEIGHTED_ROUND_ROBIN,//each round a slave gets 'weight' polls, idle ones only when due
+	BUS_DEMAND_DRIVEN,//slaves with data are polled every sweep, idle ones only when due
+}BusPolicy;
+
+template<class Config>
+struct SlaveSlotT
+{
+	SpiMasterProtocolT<Config>* session;//own CS pin, sequence space and PerformanceMonitor
+	uint8_t weight;
+	uint8_t credit;//polls left in the current round
+	uint8_t pending;//backlog reported by the last reply
+	bool idle;
+	uint8_t idle_interval_ms;//current back-off, reset by the next DATA reply
+	unsigned long last_poll_time;
+
+	uint32_t polls;
+	uint32_t data_frames;
+	uint32_t idle_replies;
+	uint32_t errors;
+	LatencyHistogram poll_latency;//POLL sent -> reply read, us
+};
+
+typedef SlaveSlotT<DefaultConfig> SlaveSlot;
+
+//Owns the shared SPIClass and schedules status polls across several chip-selects.
+//Each service() call is one sweep: POLL every selected slave, wait one turnaround,
+//then read all the replies, so the turnaround cost is shared by the whole sweep.
+//All slaves on one bus share a profile: the sweep reads every reply into one payload buffer.
+template<class Config>
+class SpiBusManagerT
+{
+public:
+	typedef SpiMasterProtocolT<Config> SpiMasterProtocol;
+	typedef SlaveSlotT<Config> SlaveSlot;
+
+private:
+	SPIClass* spi;
+	SlaveSlot slaves[MAX_SPI_SLAVES];
+	uint8_t slave_count;
+	BusPolicy policy;
+	void (*data_callback)(uint8_t slave, const uint8_t* data, uint16_t length);
+
+	unsigned long start_time;
+	uint32_t sweeps;
+	uint32_t bytes_collected;
+
+	bool is_due(const SlaveSlot& slot, unsigned long now) const;
+	void back_off(SlaveSlot& slot);
+	uint8_t select_sweep(uint8_t* batch, unsigned long now);
+	void handle_reply(uint8_t index, SpiPollResult result, const uint8_t* data, uint16_t length, uint8_t pending);
+
+public:
+	SpiBusManagerT(SPIClass* spi);
+
+	int8_t add_slave(SpiMasterProtocol* session, uint8_t weight = 1);//index, -1 when full
+	void begin();
+	void set_policy(BusPolicy new_policy) { policy = new_policy; }
+	void set_data_callback(void (*callback)(uint8_t slave, const uint8_t* data, uint16_t length)) { data_callback = callback; }
+
+	bool service();//one polling sweep, false when no slave was due
+	uint8_t get_slave_count() const { return slave_count; }
+	SpiMasterProtocol* get_session(uint8_t slave) { return slave < slave_count ? slaves[slave].session : nullptr; }
+	const SlaveSlot& get_slot(uint8_t slave) const { return slaves[slave]; }
+	float get_throughput_kbps() const;
+
+	void print_statistics();
+};
+
+typedef SpiBusManagerT<DefaultConfig> SpiBusManager;
+
+#endif // !SPI_BUS_MANAGER_H
@@ -1,141 +1,333 @@
-#include "spi_master_protocol.h"
-
-#define SPI_MOSI 23
-#define SPI_MISO 19
-#define SPI_SCK 18
-
-SpiMasterProtocol::SpiMasterProtocol(SPIClass* s, int cs) :
-	spi(s), cs_pin(cs)
-{
-	memset(rx_buffer, 0, sizeof(Frame));
-	memset(tx_buffer, 0, sizeof(Frame));
-}
-
-void SpiMasterProtocol::begin()
-{
-	pinMode(cs_pin, OUTPUT);
-	digitalWrite(cs_pin, HIGH);
-
-	spi->begin(SPI_SCK, SPI_MISO, SPI_MOSI, cs_pin);
-	spi->setDataMode(SPI_MODE0);
-	spi->setBitOrder(MSBFIRST);
-
-	Serial.println("SPI MASTER READY");
-}
-
-void SpiMasterProtocol::send_spi_data()
-{
-	static uint16_t test_counter = 0;
-	static unsigned long last_throughput_check = 0;
-
-	Frame frame;
-	String message = "Test " + String(test_counter) + " - Time: " + String(millis());
-	//String message = "HELLO SLAVE";
-
-	if (packet_frame.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), &frame))//Create message data
-	{
-		bool success = send_spi_master(&frame);//Check frames are sent or not
-
-		if (success)
-		{
-			Serial.println("Reliable delivery comfirmed via SPI");
-		}
-		else
-		{
-			Serial.print("Delivery failed for packet ");
-			Serial.println(frame.sequence_num);
-		}
-	}
-	test_counter++;
-
-	if (millis() - last_throughput_check > 5000)
-	{
-		float throughput = packet_frame.get_performance_monitor().get_throughput_kbps();
-		Serial.print("Current throughput: ");
-		Serial.print(throughput);
-		Serial.println(" kbps");
-		last_throughput_check = millis();
-	}
-}
-
-bool SpiMasterProtocol::send_spi_master(Frame* frame)
-{
-	Frame tx_frame;
-	Frame rx_frame;
-	
-
-	memcpy(&tx_frame, frame, sizeof(Frame));
-	memcpy(tx_buffer, &tx_frame, sizeof(Frame));
-
-	//------ SEND DATA ------
-	packet_frame.start_packet_timing(frame->sequence_num);
-	digitalWrite(cs_pin, LOW);
-	for (size_t i = 0; i < sizeof(Frame); i++)
-	{
-		spi->transfer(tx_buffer[i]);
-	}
-
-	digitalWrite(cs_pin, HIGH);
-	delay(2);
-	//delayMicroseconds(50);
-
-	//------ READ ACK/NACK ------
-
-	digitalWrite(cs_pin, LOW);
-	for (size_t i = 0; i < sizeof(Frame); i++)
-	{
-		rx_buffer[i] = spi->transfer(0x00);
-	}
-	digitalWrite(cs_pin, HIGH);
-	memcpy(&rx_frame, rx_buffer, sizeof(Frame));
-	
-	/*Serial.println("----------------------------------");
-	Serial.println("\nSend:");
-	display_frame_proper(tx_frame);
-	Serial.println("\nReceive:");
-	display_frame_proper(rx_frame);*/
-
-	if (!packet_frame.validate_frame(&rx_frame))
-	{
-		Serial.println("\nRX CRC ERROR");
-		packet_frame.record_crc_error();
-		packet_frame.record_packet_lost(tx_frame.sequence_num);
-		return false;
-	}
-	else if (rx_frame.packet_type == TYPE_ACK)
-	{
-		Serial.println("\nACK RECEIVED");
-		packet_frame.end_packet_timing(rx_frame.sequence_num);
-		return true;
-	}
-	else if (rx_frame.packet_type == TYPE_NACK)
-	{
-		Serial.println("\nNACK RECEIVED");
-		packet_frame.record_packet_lost(tx_frame.sequence_num);
-		return false;
-	}
-	else
-	{
-		Serial.println("\nUNKNOWN FRAME");
-		packet_frame.record_packet_lost(tx_frame.sequence_num);
-		return false;
-	}
-	return false;
-}
-
-void SpiMasterProtocol::display_frame_proper(Frame frame)
-{
-	Serial.print("Start Marker: "); Serial.println(frame.start_marker);
-	Serial.print("Packet Type: "); Serial.println(frame.packet_type);
-	Serial.print("Sequence Num: "); Serial.println(frame.sequence_num);
-	Serial.print("Data: ");
-	for (size_t i = 0; i < frame.data_length; i++)
-	{
-		Serial.print((char)frame.data[i]);
-	}
-	Serial.println();
-	Serial.print("Data length: "); Serial.println(frame.data_length);
-	Serial.print("CRC: "); Serial.println(frame.crc16);
-	Serial.print("End Marker: "); Serial.println(frame.end_marker);
-	Serial.println("------------------------------------------------");
-}
\ No newline at end of file
+#include "spi_master_protocol.h"
+#include "cycle_profiler.h"
+
+template<class Config>
+SpiMasterProtocolT<Config>::SpiMasterProtocolT(SPIClass* s, int cs) :
+	spi(s), cs_pin(cs), capture(nullptr), poll_seq(0), last_rx_seq(0), rx_seq_valid(false), stats_seq(0), restart_announced(false)
+{
+	memset(rx_buffer, 0, sizeof(Frame));
+	memset(tx_buffer, 0, sizeof(Frame));
+}
+
+template<class Config>
+void SpiMasterProtocolT<Config>::begin(bool init_bus)
+{
+	pinMode(cs_pin, OUTPUT);
+	digitalWrite(cs_pin, HIGH);
+
+	if (!init_bus) return;
+
+	spi->begin(SPI_SCK, SPI_MISO, SPI_MOSI, cs_pin);
+	spi->setDataMode(SPI_MODE0);
+	spi->setBitOrder(MSBFIRST);
+
+	Serial.println("SPI MASTER READY");
+}
+
+template<class Config>
+void SpiMasterProtocolT<Config>::send_spi_data()
+{
+	static uint16_t test_counter = 0;
+	static unsigned long last_throughput_check = 0;
+
+	Frame frame;
+	String message = "Test " + String(test_counter) + " - Time: " + String(millis());
+	//String message = "HELLO SLAVE";
+
+	if (packet_frame.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), &frame))//Create message data
+	{
+		bool success = send_spi_master(&frame);//Check frames are sent or not
+
+		if (success)
+		{
+			Serial.println("Reliable delivery comfirmed via SPI");
+		}
+		else
+		{
+			Serial.print("Delivery failed for packet ");
+			Serial.println(frame.sequence_num);
+		}
+	}
+	test_counter++;
+
+	if (millis() - last_throughput_check > 5000)
+	{
+		float throughput = packet_frame.get_performance_monitor().get_throughput_kbps();
+		Serial.print("Current throughput: ");
+		Serial.print(throughput);
+		Serial.println(" kbps");
+		last_throughput_check = millis();
+	}
+}
+
+template<class Config>
+bool SpiMasterProtocolT<Config>::send_spi_master(Frame* frame)
+{
+	Frame tx_frame;
+	Frame rx_frame;
+	
+	//No handshake on SPI: before our first DATA the slave learns that our sequence numbers start over,
+	//otherwise a restart while it still holds the last 32 of them is taken for retransmissions
+	if (!restart_announced)
+	{
+		Frame syn;
+		restart_announced = true;
+		if (!packet_frame.create_frame(TYPE_SYN, nullptr, 0, &syn) || !send_spi_master(&syn)) restart_announced = false;
+	}
+
+	memcpy(&tx_frame, frame, sizeof(Frame));
+	memcpy(tx_buffer, &tx_frame, sizeof(Frame));
+
+	//------ SEND DATA ------
+	packet_frame.start_packet_timing(frame->sequence_num);
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			spi->transfer(tx_buffer[i]);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_TX | CAPTURE_LINK_SPI, tx_buffer, sizeof(Frame));
+
+	digitalWrite(cs_pin, HIGH);
+	delayMicroseconds(SPI_TURNAROUND_US);
+
+	//------ READ ACK/NACK ------
+
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			rx_buffer[i] = spi->transfer(0x00);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_RX | CAPTURE_LINK_SPI, rx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+	memcpy(&rx_frame, rx_buffer, sizeof(Frame));
+	
+	/*Serial.println("----------------------------------");
+	Serial.println("\nSend:");
+	display_frame_proper(tx_frame);
+	Serial.println("\nReceive:");
+	display_frame_proper(rx_frame);*/
+
+	if (!packet_frame.validate_frame(&rx_frame))//counts the CRC error itself
+	{
+		Serial.println("\nRX CRC ERROR");
+		packet_frame.record_packet_lost(tx_frame.sequence_num);
+		return false;
+	}
+	else if (rx_frame.sequence_num != tx_frame.sequence_num)//stale reply to an earlier frame
+	{
+		Serial.println("\nSTALE REPLY");
+		packet_frame.record_packet_lost(tx_frame.sequence_num);
+		return false;
+	}
+	else if (PacketFrame::get_type(&rx_frame) == TYPE_ACK)
+	{
+		Serial.println("\nACK RECEIVED");
+		packet_frame.end_packet_timing(rx_frame.sequence_num);
+		return true;
+	}
+	else if (PacketFrame::get_type(&rx_frame) == TYPE_NACK)
+	{
+		Serial.println("\nNACK RECEIVED");
+		packet_frame.record_packet_lost(tx_frame.sequence_num);
+		return false;
+	}
+	else
+	{
+		Serial.println("\nUNKNOWN FRAME");
+		packet_frame.record_packet_lost(tx_frame.sequence_num);
+		return false;
+	}
+	return false;
+}
+
+template<class Config>
+bool SpiMasterProtocolT<Config>::request_peer_stats()
+{
+	if (!PacketFrame::CARRIES_STATS) return false;//profile too small for a snapshot
+
+	Frame frame;
+	Frame rx_frame;
+
+	//Numbered outside the DATA sequence space, the slave answers under the same number
+	uint16_t seq = stats_seq++;
+	if (!packet_frame.create_reply_frame(TYPE_STATS, seq, nullptr, 0, &frame)) return false;
+
+	memcpy(tx_buffer, &frame, sizeof(Frame));
+
+	//------ SEND REQUEST ------
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			spi->transfer(tx_buffer[i]);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_TX | CAPTURE_LINK_SPI, tx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+	delayMicroseconds(SPI_TURNAROUND_US);
+
+	//------ READ SNAPSHOT ------
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			rx_buffer[i] = spi->transfer(0x00);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_RX | CAPTURE_LINK_SPI, rx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+	memcpy(&rx_frame, rx_buffer, sizeof(Frame));
+
+	if (!packet_frame.validate_frame(&rx_frame) ||
+		PacketFrame::get_type(&rx_frame) != TYPE_STATS || rx_frame.sequence_num != seq)
+	{
+		Serial.println("\nSTATS REQUEST FAILED");
+		return false;
+	}
+
+	return packet_frame.get_performance_monitor().peer_snapshot_received(rx_frame.data, rx_frame.data_length);
+}
+
+template<class Config>
+void SpiMasterProtocolT<Config>::display_frame_proper(Frame frame)
+{
+	Serial.print("Start Marker: "); Serial.println(frame.start_marker);
+	Serial.print("Packet Type: "); Serial.println(frame.packet_type);
+	Serial.print("Sequence Num: "); Serial.println(frame.sequence_num);
+	Serial.print("Data: ");
+	for (size_t i = 0; i < frame.data_length; i++)
+	{
+		Serial.print((char)frame.data[i]);
+	}
+	Serial.println();
+	Serial.print("Data length: "); Serial.println(frame.data_length);
+	Serial.print("CRC: "); Serial.println(frame.crc16);
+	Serial.print("End Marker: "); Serial.println(frame.end_marker);
+	Serial.println("------------------------------------------------");
+}
+
+template<class Config>
+bool SpiMasterProtocolT<Config>::send_spi_datagram(const uint8_t* data, uint16_t length, uint8_t channel)
+{
+	Frame frame;
+	if (!packet_frame.create_datagram(data, length, &frame, channel)) return false;
+
+	memcpy(tx_buffer, &frame, sizeof(Frame));
+
+	//The slave does not queue a reply for datagrams, so no read-back transaction
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			spi->transfer(tx_buffer[i]);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_TX | CAPTURE_LINK_SPI, tx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+
+	return true;
+}
+
+template<class Config>
+bool SpiMasterProtocolT<Config>::send_poll()
+{
+	Frame frame;
+
+	//Piggyback the ACK for the slave's last DATA frame, the slave retransmits it otherwise
+	uint8_t ack_payload[sizeof(last_rx_seq)];
+	memcpy(ack_payload, &last_rx_seq, sizeof(last_rx_seq));
+
+	//Numbered outside the DATA sequence space, polls must not leave gaps the slave counts as loss
+	uint16_t seq = SequenceWindow::next_sequence(poll_seq);
+	if (!packet_frame.create_reply_frame(TYPE_POLL, seq, ack_payload, rx_seq_valid ? sizeof(ack_payload) : 0, &frame)) return false;
+	poll_seq = seq;
+
+	memcpy(tx_buffer, &frame, sizeof(Frame));
+
+	packet_frame.start_packet_timing(poll_seq);
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			spi->transfer(tx_buffer[i]);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_TX | CAPTURE_LINK_SPI, tx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+
+	return true;
+}
+
+template<class Config>
+SpiPollResult SpiMasterProtocolT<Config>::read_poll_reply(uint8_t* data, uint16_t* length, uint8_t* pending)
+{
+	Frame rx_frame;
+
+	*length = 0;
+	*pending = 0;
+
+	digitalWrite(cs_pin, LOW);
+	{
+		PROFILE_SCOPE(PROF_SPI_TRANSFER);
+		for (size_t i = 0; i < sizeof(Frame); i++)
+		{
+			rx_buffer[i] = spi->transfer(0x00);
+		}
+	}
+	if (capture) capture->record(CAPTURE_DIR_RX | CAPTURE_LINK_SPI, rx_buffer, sizeof(Frame));
+	digitalWrite(cs_pin, HIGH);
+	memcpy(&rx_frame, rx_buffer, sizeof(Frame));
+
+	if (!packet_frame.validate_frame(&rx_frame) || !packet_frame.unpack_payload(&rx_frame))
+	{
+		packet_frame.record_packet_lost(poll_seq);
+		return POLL_ERROR;
+	}
+
+	switch (PacketFrame::get_type(&rx_frame))
+	{
+	case TYPE_DATA:
+		packet_frame.end_packet_timing(poll_seq);
+		last_rx_seq = rx_frame.sequence_num;
+		rx_seq_valid = true;
+
+		if (!packet_frame.accept_sequence(rx_frame.sequence_num)) return POLL_DUPLICATE;
+
+		packet_frame.record_packet_received(PacketFrame::get_wire_length(&rx_frame));
+		memcpy(data, rx_frame.data, rx_frame.data_length);
+		*length = rx_frame.data_length;
+		*pending = 1;
+		return POLL_DATA;
+
+	case TYPE_SYN://slave restarted: its sequence numbers start over, ours to acknowledge
+		packet_frame.end_packet_timing(poll_seq);
+		last_rx_seq = rx_frame.sequence_num;
+		rx_seq_valid = true;
+		packet_frame.reset_receive_window();
+		Serial.println("SLAVE RESTARTED - receive window reset");
+		return POLL_RESTART;
+
+	case TYPE_ACK:
+		if (rx_frame.sequence_num != poll_seq) break;//stale reply to an earlier poll
+
+		packet_frame.end_packet_timing(poll_seq);
+		*pending = rx_frame.data_length > 0 ? rx_frame.data[0] : 0;
+		return POLL_IDLE;
+	}
+
+	packet_frame.record_packet_lost(poll_seq);
+	return POLL_ERROR;
+}
+
+template class SpiMasterProtocolT<DefaultConfig>;
+template class SpiMasterProtocolT<ControlConfig>;
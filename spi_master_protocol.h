@@ -1,35 +1,83 @@
-#pragma once
-#ifndef SPI_MASTER_PROTOCOL_H
-#define SPI_MASTER_PROTOCOL_H
-
-#include <Arduino.h>
-#include <SPI.h>
-#include "packet_frame.h"
-
-class SpiMasterProtocol
-{
-private:
-	SPIClass* spi;
-	int cs_pin;
-	PacketFrame packet_frame;
-
-	uint8_t rx_buffer[sizeof(Frame)];
-	uint8_t tx_buffer[sizeof(Frame)];
-
-	unsigned long last_byte_time;
-public:
-	SpiMasterProtocol(SPIClass* spi, int cs_pin);
-
-	void begin();
-
-	//Send DATA frame + wait ACK/NACK
-	void send_spi_data();
-	bool send_spi_master(Frame* frame);
-
-	void display_frame_proper(Frame frame);
-
-	PerformanceMonitor& get_perf_protocol() { return packet_frame.get_performance_monitor(); }
-
-};
-
+#pragma once
+#ifndef SPI_MASTER_PROTOCOL_H
+#define SPI_MASTER_PROTOCOL_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "packet_frame.h"
+#include "wire_capture.h"
+
+#define SPI_MOSI 23
+#define SPI_MISO 19
+#define SPI_SCK 18
+
+//Gap between a frame and the transaction that reads its reply. The slave engine builds
+//the reply in its transaction-done hook, so this only has to cover interrupt latency.
+#define SPI_TURNAROUND_US 50
+
+typedef enum
+{
+	POLL_DATA,//slave answered with a new DATA frame
+	POLL_IDLE,//slave answered with an ACK, nothing to collect
+	POLL_DUPLICATE,//retransmission of a DATA frame already delivered
+	POLL_RESTART,//slave restarted (empty SYN): receive window reset, the next poll acknowledges it
+	POLL_ERROR,//no valid reply
+}SpiPollResult;
+
+template<class Config>
+class SpiMasterProtocolT
+{
+public:
+	typedef FrameT<Config> Frame;
+	typedef PacketFrameT<Config> PacketFrame;
+
+private:
+	SPIClass* spi;
+	int cs_pin;
+	PacketFrame packet_frame;
+
+	uint8_t rx_buffer[sizeof(Frame)];//one transaction, sized by the profile
+	uint8_t tx_buffer[sizeof(Frame)];
+
+	unsigned long last_byte_time;
+	WireCapture* capture;//optional wire tap, one record per transaction
+
+	//Status poll state
+	uint16_t poll_seq;//sequence number of the outstanding POLL, own sequence space
+	uint16_t last_rx_seq;//last slave DATA frame received, acknowledged by the next POLL
+	bool rx_seq_valid;
+
+	uint16_t stats_seq;//TYPE_STATS requests, own sequence space
+	bool restart_announced;//empty SYN went through, the slave dropped our previous run's sequence numbers
+public:
+	SpiMasterProtocolT(SPIClass* spi, int cs_pin);
+
+	void begin(bool init_bus = true);//false: bus already set up by SpiBusManager, only claim cs_pin
+
+	//Send DATA frame + wait ACK/NACK
+	void send_spi_data();
+	bool send_spi_master(Frame* frame);
+
+	//Send DATAGRAM frame, single transaction, no ACK phase
+	bool send_spi_datagram(const uint8_t* data, uint16_t length, uint8_t channel = 0);
+
+	//Status poll, split in two transactions so SpiBusManager can overlap the turnaround of several slaves
+	bool send_poll();
+	SpiPollResult read_poll_reply(uint8_t* data, uint16_t* length, uint8_t* pending);
+
+	//Remote statistics: request + read-back transaction, the snapshot shows up in print_statistics()
+	bool request_peer_stats();
+
+	void display_frame_proper(Frame frame);
+	int get_cs_pin() const { return cs_pin; }
+
+	void set_compression(bool enable) { packet_frame.set_compression(enable); }
+	void set_capture(WireCapture* tap) { capture = tap; }
+
+	PerformanceMonitor& get_perf_protocol() { return packet_frame.get_performance_monitor(); }
+
+};
+
+typedef SpiMasterProtocolT<DefaultConfig> SpiMasterProtocol;
+
 #endif // !SPI_MASTER_PROTOCOL_H
\ No newline at end of file
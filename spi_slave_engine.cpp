@@ -0,0 +1,354 @@
+#include "spi_slave_engine.h"
+
+#if defined(ESP32)
+#define SPI_SLAVE_HOST VSPI_HOST
+#define ENGINE_LOCK_ISR() portENTER_CRITICAL_ISR(&lock)
+#define ENGINE_UNLOCK_ISR() portEXIT_CRITICAL_ISR(&lock)
+#define ENGINE_LOCK() portENTER_CRITICAL(&lock)
+#define ENGINE_UNLOCK() portEXIT_CRITICAL(&lock)
+#else
+//The host model runs the hook on the caller's thread
+#define ENGINE_LOCK_ISR()
+#define ENGINE_UNLOCK_ISR()
+#define ENGINE_LOCK()
+#define ENGINE_UNLOCK()
+#endif
+
+template<class Config>
+SpiSlaveEngineT<Config>::SpiSlaveEngineT(PacketFrame* pf) :
+	packet_frame(pf),
+	deferred_head(0),
+	deferred_tail(0),
+	frame_handler(nullptr),
+	staged(false),
+	outstanding(false),
+	transactions(0),
+	nacks(0),
+	deferred_full(0),
+	max_backlog(0)
+#if !defined(ESP32)
+	, armed_head(0),
+	armed_count(0),
+	completed_count(0),
+	active_slot(nullptr),
+	underruns(0)
+#endif
+{
+	for (uint8_t i = 0; i < SPI_SLAVE_QUEUE_DEPTH; i++)
+	{
+		memset(slots[i].tx, 0, sizeof(Frame));
+		memset(slots[i].rx, 0, sizeof(Frame));
+		slots[i].engine = this;
+		slots[i].index = i;
+	}
+	memset(&outstanding_frame, 0, sizeof(Frame));
+}
+
+template<class Config>
+bool SpiSlaveEngineT<Config>::begin(int sck, int miso, int mosi, int cs)
+{
+	//No handshake on SPI: the first poll reply tells the master our sequence numbers start over,
+	//resent like a sample until a POLL acknowledges it. No transaction is armed yet, no lock needed
+	outstanding = packet_frame->create_frame(TYPE_SYN, nullptr, 0, &outstanding_frame);
+
+#if defined(ESP32)
+	spi_bus_config_t bus = {};
+	bus.mosi_io_num = mosi;
+	bus.miso_io_num = miso;
+	bus.sclk_io_num = sck;
+	bus.quadwp_io_num = -1;
+	bus.quadhd_io_num = -1;
+	bus.max_transfer_sz = sizeof(Frame);
+
+	//intr_flags stay 0: the ISR is not in IRAM, so the hook may call flash-resident code
+	spi_slave_interface_config_t config = {};
+	config.spics_io_num = cs;
+	config.queue_size = SPI_SLAVE_QUEUE_DEPTH;
+	config.mode = SPI_MODE0;
+	config.post_trans_cb = post_trans_cb;
+
+	if (spi_slave_initialize(SPI_SLAVE_HOST, &bus, &config, SPI_DMA_CH_AUTO) != ESP_OK)
+	{
+		Serial.println("SPI SLAVE INIT FAILED");
+		return false;
+	}
+
+	//Queue order is ring order: slot i is always followed by slot i + 1
+	for (uint8_t i = 0; i < SPI_SLAVE_QUEUE_DEPTH; i++)
+	{
+		spi_slave_transaction_t& t = slots[i].trans;
+		memset(&t, 0, sizeof(t));
+		t.length = sizeof(Frame) * 8;
+		t.tx_buffer = slots[i].tx;
+		t.rx_buffer = slots[i].rx;
+		t.user = &slots[i];
+		spi_slave_queue_trans(SPI_SLAVE_HOST, &t, portMAX_DELAY);
+	}
+#else
+	(void)sck; (void)miso; (void)mosi; (void)cs;
+	armed_head = 0;
+	armed_count = SPI_SLAVE_QUEUE_DEPTH;
+	completed_count = 0;
+#endif
+
+	Serial.println("SPI SLAVE ENGINE READY");
+	return true;
+}
+
+#if defined(ESP32)
+template<class Config>
+void SpiSlaveEngineT<Config>::post_trans_cb(spi_slave_transaction_t* trans)
+{
+	SpiSlaveSlot* slot = (SpiSlaveSlot*)trans->user;
+	slot->engine->on_transaction_done(slot);
+}
+#endif
+
+template<class Config>
+void SpiSlaveEngineT<Config>::on_transaction_done(SpiSlaveSlot* slot)
+{
+	//The next slot has not been set up yet, its TX buffer is what the master reads next
+	Frame* reply = (Frame*)slots[(slot->index + 1) % SPI_SLAVE_QUEUE_DEPTH].tx;
+
+	ENGINE_LOCK_ISR();
+	transactions++;
+	build_reply((Frame*)slot->rx, reply);
+	ENGINE_UNLOCK_ISR();
+}
+
+template<class Config>
+void SpiSlaveEngineT<Config>::build_reply(Frame* rx, Frame* reply)
+{
+	//Master's read phase clocks zeros, nothing to answer
+	if (rx->start_marker != Config::START_MARKER)
+	{
+		memset(reply, 0, sizeof(Frame));
+		return;
+	}
+
+	//Datagrams never get a reply transaction, broken ones are simply lost
+	if (PacketFrame::get_type(rx) == TYPE_DATAGRAM)
+	{
+		memset(reply, 0, sizeof(Frame));
+		if (packet_frame->validate_frame(rx)) defer(rx);
+		return;
+	}
+
+	if (!packet_frame->validate_frame(rx))
+	{
+		nacks++;
+		packet_frame->create_reply_frame(TYPE_NACK, rx->sequence_num, nullptr, 0, reply);
+		return;
+	}
+
+	if (PacketFrame::get_type(rx) == TYPE_POLL)
+	{
+		build_poll_reply(rx, reply);
+		return;
+	}
+
+	if (PacketFrame::get_type(rx) == TYPE_STATS)
+	{
+		if (!PacketFrame::CARRIES_STATS)
+		{
+			packet_frame->create_reply_frame(TYPE_NACK, rx->sequence_num, nullptr, 0, reply);
+			return;
+		}
+
+		StatsSnapshot snapshot;
+		packet_frame->get_performance_monitor().get_snapshot(&snapshot);
+		packet_frame->create_reply_frame(TYPE_STATS, rx->sequence_num, (const uint8_t*)&snapshot, sizeof(snapshot), reply);
+		return;
+	}
+
+	//Only ACK what process() is guaranteed to see, a full backlog makes the master retry
+	if (defer(rx))
+	{
+		packet_frame->create_reply_frame(TYPE_ACK, rx->sequence_num, nullptr, 0, reply);
+	}
+	else
+	{
+		nacks++;
+		packet_frame->create_reply_frame(TYPE_NACK, rx->sequence_num, nullptr, 0, reply);
+	}
+}
+
+template<class Config>
+void SpiSlaveEngineT<Config>::build_poll_reply(const Frame* poll, Frame* reply)
+{
+	uint16_t acked_seq;
+	bool acked = false;
+
+	if (poll->data_length >= sizeof(acked_seq))
+	{
+		memcpy(&acked_seq, poll->data, sizeof(acked_seq));
+		acked = (acked_seq == outstanding_frame.sequence_num);
+	}
+
+	if (outstanding && !acked)
+	{
+		memcpy(reply, &outstanding_frame, sizeof(Frame));
+		return;
+	}
+	outstanding = false;
+
+	if (staged)
+	{
+		memcpy(&outstanding_frame, &staged_frame, sizeof(Frame));
+		staged = false;
+		outstanding = true;
+		memcpy(reply, &outstanding_frame, sizeof(Frame));
+		return;
+	}
+
+	uint8_t pending = 0;
+	packet_frame->create_reply_frame(TYPE_ACK, poll->sequence_num, &pending, sizeof(pending), reply);
+}
+
+template<class Config>
+bool SpiSlaveEngineT<Config>::defer(const Frame* frame)
+{
+	uint8_t next = (deferred_head + 1) % SPI_SLAVE_DEFER_DEPTH;
+	if (next == deferred_tail)
+	{
+		deferred_full++;
+		return false;
+	}
+
+	memcpy(&deferred[deferred_head], frame, sizeof(Frame));
+	deferred_head = next;
+	return true;
+}
+
+template<class Config>
+uint8_t SpiSlaveEngineT<Config>::get_backlog() const
+{
+	return (deferred_head + SPI_SLAVE_DEFER_DEPTH - deferred_tail) % SPI_SLAVE_DEFER_DEPTH;
+}
+
+template<class Config>
+bool SpiSlaveEngineT<Config>::stage_sample(const uint8_t* data, uint16_t length)
+{
+	if (staged) return false;
+
+	ENGINE_LOCK();
+	bool built = packet_frame->create_frame(TYPE_DATA, data, length, &staged_frame);
+	ENGINE_UNLOCK();
+	if (!built) return false;
+
+	staged = true;//publish only after the frame is complete
+	return true;
+}
+
+template<class Config>
+bool SpiSlaveEngineT<Config>::accept(Frame* frame)
+{
+	//Stateless, stays outside the lock
+	if (!packet_frame->unpack_payload(frame)) return false;
+
+	bool accepted = true;
+	ENGINE_LOCK();
+	switch (PacketFrame::get_type(frame))
+	{
+	case TYPE_DATAGRAM:
+		accepted = packet_frame->accept_datagram(frame);
+		break;
+	case TYPE_SYN://master restarted: forget its old sequence numbers, nothing to deliver
+		packet_frame->reset_receive_window();
+		accepted = false;
+		break;
+	case TYPE_DATA:
+		//Already ACKed by the hook, a retransmission is just not delivered twice
+		accepted = packet_frame->accept_sequence(frame->sequence_num);
+		if (accepted) packet_frame->record_packet_received(PacketFrame::get_wire_length(frame));
+		break;
+	default:
+		break;
+	}
+	ENGINE_UNLOCK();
+	return accepted;
+}
+
+template<class Config>
+uint8_t SpiSlaveEngineT<Config>::process()
+{
+	uint8_t delivered = 0;
+
+	//------ RE-ARM COMPLETED TRANSACTIONS ------
+#if defined(ESP32)
+	spi_slave_transaction_t* done;
+	while (spi_slave_get_trans_result(SPI_SLAVE_HOST, &done, 0) == ESP_OK)
+	{
+		spi_slave_queue_trans(SPI_SLAVE_HOST, done, 0);
+	}
+#else
+	armed_count += completed_count;
+	completed_count = 0;
+#endif
+
+	uint8_t backlog = get_backlog();
+	if (backlog > max_backlog) max_backlog = backlog;
+
+	//------ DELIVER DEFERRED FRAMES ------
+	//Validated by the hook, a copy frees the slot before the handler runs
+	while (deferred_tail != deferred_head)
+	{
+		Frame frame;
+		memcpy(&frame, &deferred[deferred_tail], sizeof(Frame));
+		deferred_tail = (deferred_tail + 1) % SPI_SLAVE_DEFER_DEPTH;
+
+		if (!accept(&frame)) continue;
+		if (frame_handler) frame_handler(&frame);
+		delivered++;
+	}
+
+	return delivered;
+}
+
+#if !defined(ESP32)
+template<class Config>
+bool SpiSlaveEngineT<Config>::host_cs_low(uint8_t* miso)
+{
+	if (armed_count == 0)
+	{
+		underruns++;
+		active_slot = nullptr;
+		memset(miso, 0xFF, sizeof(Frame));
+		return false;
+	}
+
+	active_slot = &slots[armed_head];
+	memcpy(miso, active_slot->tx, sizeof(Frame));
+	return true;
+}
+
+template<class Config>
+void SpiSlaveEngineT<Config>::host_cs_high(const uint8_t* mosi)
+{
+	if (!active_slot) return;
+
+	memcpy(active_slot->rx, mosi, sizeof(Frame));
+	armed_head = (armed_head + 1) % SPI_SLAVE_QUEUE_DEPTH;
+	armed_count--;
+	completed_count++;
+
+	on_transaction_done(active_slot);
+	active_slot = nullptr;
+}
+#endif
+
+template<class Config>
+void SpiSlaveEngineT<Config>::print_statistics()
+{
+	Serial.println("SPI SLAVE ENGINE:");
+	Serial.print(" Transactions: "); Serial.println(transactions);
+	Serial.print(" NACKs: "); Serial.println(nacks);
+	Serial.print(" Backlog Full: "); Serial.println(deferred_full);
+	Serial.print(" Max Backlog: "); Serial.print(max_backlog); Serial.print("/"); Serial.println(SPI_SLAVE_DEFER_DEPTH - 1);
+#if !defined(ESP32)
+	Serial.print(" Underruns: "); Serial.println(underruns);
+#endif
+}
+
+template class SpiSlaveEngineT<DefaultConfig>;
+template class SpiSlaveEngineT<ControlConfig>;
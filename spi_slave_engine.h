@@ -0,0 +1,119 @@
+#pragma once
+#ifndef SPI_SLAVE_ENGINE_H
+#define SPI_SLAVE_ENGINE_H
+
+#include <Arduino.h>
+#include "packet_frame.h"
+
+#if defined(ESP32)
+#include <driver/spi_slave.h>
+#endif
+
+#ifndef WORD_ALIGNED_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
+#endif
+
+#define SPI_SLAVE_QUEUE_DEPTH 4//transactions kept armed in the driver
+#define SPI_SLAVE_DEFER_DEPTH 8//received frames waiting for process()
+
+template<class Config> class SpiSlaveEngineT;
+
+template<class Config>
+struct SpiSlaveSlotT
+{
+	WORD_ALIGNED_ATTR uint8_t tx[sizeof(FrameT<Config>)];//DMA buffers, must stay in internal RAM
+	WORD_ALIGNED_ATTR uint8_t rx[sizeof(FrameT<Config>)];
+	SpiSlaveEngineT<Config>* engine;
+	uint8_t index;
+#if defined(ESP32)
+	spi_slave_transaction_t trans;
+#endif
+};
+
+//SPI slave with a ring of pre-armed full-duplex transactions.
+//The transaction-done hook validates the frame and writes the reply straight into the TX
+//buffer of the next slot in the ring, so the reply is on the wire in the master's very
+//next transaction. Delivery (decompression, duplicate check, Serial output) is deferred
+//to process(), which only has to keep up within SPI_SLAVE_QUEUE_DEPTH transactions.
+//
+//The hook runs in interrupt context and shares the PacketFrame (sequence and AEAD counters,
+//PerformanceMonitor) with the task side. Every engine call that touches it takes a spinlock;
+//the frame handler only gets frames that are already accepted and must not use the PacketFrame.
+//
+//Host builds replace the ESP-IDF driver with a model of the same queue semantics:
+//host_cs_low()/host_cs_high() play one master transaction against the armed ring.
+template<class Config>
+class SpiSlaveEngineT
+{
+public:
+	typedef FrameT<Config> Frame;
+	typedef PacketFrameT<Config> PacketFrame;
+	typedef SpiSlaveSlotT<Config> SpiSlaveSlot;
+
+private:
+	PacketFrame* packet_frame;
+	SpiSlaveSlot slots[SPI_SLAVE_QUEUE_DEPTH];
+
+	//Single producer (transaction hook) / single consumer (process())
+	Frame deferred[SPI_SLAVE_DEFER_DEPTH];
+	volatile uint8_t deferred_head;
+	volatile uint8_t deferred_tail;
+	void (*frame_handler)(Frame* frame);
+
+	//POLL replies
+	Frame staged_frame;//next sample, built in task context by stage_sample()
+	volatile bool staged;
+	Frame outstanding_frame;//handed to the master, resent until a POLL acknowledges it
+	bool outstanding;
+
+#if defined(ESP32)
+	portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;//PacketFrame state, hook vs. task context
+#endif
+
+	uint32_t transactions;
+	uint32_t nacks;
+	uint32_t deferred_full;
+	uint8_t max_backlog;
+
+#if !defined(ESP32)
+	uint8_t armed_head;//slot the next master transaction lands in
+	uint8_t armed_count;
+	uint8_t completed_count;//done, waiting for process() to re-arm them
+	SpiSlaveSlot* active_slot;
+	uint32_t underruns;
+#endif
+
+	void on_transaction_done(SpiSlaveSlot* slot);
+	void build_reply(Frame* rx, Frame* reply);
+	void build_poll_reply(const Frame* poll, Frame* reply);
+	bool defer(const Frame* frame);
+	bool accept(Frame* frame);//task side of the receive path, false = not for the handler
+	uint8_t get_backlog() const;
+
+#if defined(ESP32)
+	static void post_trans_cb(spi_slave_transaction_t* trans);
+#endif
+
+public:
+	SpiSlaveEngineT(PacketFrame* packet_frame);
+
+	bool begin(int sck, int miso, int mosi, int cs);
+	void set_frame_handler(void (*handler)(Frame* frame)) { frame_handler = handler; }//validated, unpacked, not a duplicate
+
+	bool stage_sample(const uint8_t* data, uint16_t length);//false while the previous sample is still staged
+	bool is_sample_staged() const { return staged; }
+
+	uint8_t process();//re-arm completed transactions, deliver deferred frames, returns frames delivered
+	void print_statistics();
+
+#if !defined(ESP32)
+	//Host model of one master transaction: CS low latches the next armed slot, CS high completes it
+	bool host_cs_low(uint8_t* miso);//false = no transaction armed, the master clocks in 0xFF
+	void host_cs_high(const uint8_t* mosi);
+	uint32_t get_underruns() const { return underruns; }
+#endif
+};
+
+typedef SpiSlaveEngineT<DefaultConfig> SpiSlaveEngine;
+
+#endif // !SPI_SLAVE_ENGINE_H
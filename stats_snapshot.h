@@ -0,0 +1,38 @@
+#pragma once
+#ifndef STATS_SNAPSHOT_H
+#define STATS_SNAPSHOT_H
+
+#include <stdint.h>
+
+//TYPE_STATS payload: packed little-endian snapshot of a peer's PerformanceMonitor.
+//Sized to fill exactly one DefaultConfig frame (MAX_DATA_LEN). Counters are cumulative since the peer's
+//reset_statistics(); the 16-bit ones wrap, readers unwrap them between snapshots.
+//Bump STATS_SNAPSHOT_VERSION on any layout change, receivers drop versions they do not know.
+#define STATS_SNAPSHOT_VERSION 1
+#define STATS_LATENCY_BUCKETS 6
+
+typedef struct __attribute__((packed))
+{
+	uint8_t version;
+	uint8_t reserved;
+	uint32_t uptime_ms;//peer measurement duration
+	uint32_t packets_sent;//every frame built, replies included
+	uint32_t data_frames_sent;//DATA frames originated, retransmissions not counted
+	uint32_t packets_received;//DATA frames accepted, duplicates not counted
+	uint32_t datagrams_received;
+	uint32_t payload_bytes_delivered;
+	uint16_t crc_errors;
+	uint16_t sequence_gaps;
+	uint16_t duplicates;
+	uint16_t lost_packets;
+	uint16_t retransmissions;
+	uint16_t timeouts;
+	uint16_t flow_control_pauses;
+	uint16_t latency_buckets[STATS_LATENCY_BUCKETS];//saturating, limits below
+}StatsSnapshot;
+
+//Upper bound of each latency bucket in microseconds, the last bucket is open-ended.
+//Bucket 0 folds LatencyHistogram buckets 0-3, every following one folds two more.
+static const uint32_t STATS_LATENCY_LIMIT_US[STATS_LATENCY_BUCKETS] = { 1024, 4096, 16384, 65536, 262144, 0 };
+
+#endif // !STATS_SNAPSHOT_H
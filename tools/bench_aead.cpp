@@ -0,0 +1,114 @@
+//Cost of the AEAD link mode against CRC16, in CPU cycles (CycleProfiler::read_cycles(): TSC on
+//x86 hosts, CCOUNT on the ESP32). First the primitives on one frame's bytes: CRC16 over header
+//and payload, FrameCipher::seal and FrameCipher::verify. Then the whole create_frame +
+//validate_frame round on a CRC16 link and on a keyed one. Every payload size is reported in
+//cycles per frame and cycles per byte.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) together with the protocol
+//sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. tools/bench_aead.cpp <protocol .cpp> <host-core .cpp> -o bench_aead
+//Usage: bench_aead [iterations]   (default 200000; exit status 1 = a frame did not validate)
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "crc16.h"
+#include "cycle_profiler.h"
+#include "frame_cipher.h"
+#include "packet_frame.h"
+
+#define BENCH_ROUNDS 5//best of, the first round also warms the caches
+#define BENCH_AAD_LEN (FRAME_HEADER_LEN - 1)//header bytes the tag covers, start marker excluded
+
+static const uint8_t bench_key[CIPHER_KEY_LEN] = { 7 };
+static const uint16_t payload_sizes[] = { 8, 32, 52 };
+
+static uint32_t iterations;
+static volatile uint16_t sink;//keeps the results alive
+
+//Best-of-rounds cycles per call
+template<class Operation>
+static double cycles_per_call(Operation operation)
+{
+	uint32_t best = 0;
+	for (uint8_t round = 0; round < BENCH_ROUNDS; round++)
+	{
+		uint32_t start = CycleProfiler::read_cycles();
+		for (uint32_t i = 0; i < iterations; i++) operation();
+		uint32_t elapsed = CycleProfiler::read_cycles() - start;
+		if (round == 0 || elapsed < best) best = elapsed;
+	}
+	return (double)best / iterations;
+}
+
+static void bench_primitives()
+{
+	FrameCipher cipher;
+	cipher.set_key(bench_key);
+	uint8_t nonce[CIPHER_NONCE_LEN] = { 0 };
+	uint8_t buffer[BENCH_AAD_LEN + DefaultConfig::MAX_DATA_LEN];
+	for (uint16_t i = 0; i < sizeof(buffer); i++) buffer[i] = i * 7;
+
+	printf("primitives          crc16           seal            verify\n");
+	for (uint16_t length : payload_sizes)
+	{
+		uint8_t* data = buffer + BENCH_AAD_LEN;
+		uint16_t tag = cipher.seal(nonce, buffer, BENCH_AAD_LEN, data, length);
+
+		double crc = cycles_per_call([&]() { sink = CRC16::calculate(buffer, BENCH_AAD_LEN + length); });
+		double seal = cycles_per_call([&]() { sink = cipher.seal(nonce, buffer, BENCH_AAD_LEN, data, length); });
+		tag = cipher.seal(nonce, buffer, BENCH_AAD_LEN, data, length);
+		double verify = cycles_per_call([&]() { sink = cipher.verify(nonce, buffer, BENCH_AAD_LEN, data, length, tag); });
+
+		printf("payload %2u   %6.0f (%5.1f/B)  %6.0f (%5.1f/B)  %6.0f (%5.1f/B)\n", length,
+			crc, crc / (BENCH_AAD_LEN + length), seal, seal / length, verify, verify / length);
+	}
+}
+
+static bool bench_frames()
+{
+	uint8_t payload[DefaultConfig::MAX_DATA_LEN];
+	for (uint16_t i = 0; i < sizeof(payload); i++) payload[i] = i * 7;
+	bool all_valid = true;
+
+	printf("create + validate   CRC16 link      AEAD link\n");
+	for (uint16_t length : payload_sizes)
+	{
+		double cycles[2];
+		for (uint8_t keyed = 0; keyed < 2; keyed++)
+		{
+			PacketFrame sender;
+			PacketFrame receiver;
+			if (keyed)
+			{
+				sender.set_aead_key(bench_key);
+				receiver.set_aead_key(bench_key);
+				sender.start_aead_session(1, 2, true);
+				receiver.start_aead_session(1, 2, false);
+			}
+
+			Frame frame;
+			uint32_t invalid = 0;
+			cycles[keyed] = cycles_per_call([&]()
+			{
+				sender.create_frame(TYPE_DATA, payload, length, &frame);
+				if (!receiver.validate_frame(&frame)) invalid++;
+			});
+			if (invalid > 0) all_valid = false;
+		}
+
+		printf("payload %2u   %6.0f (%5.1f/B)  %6.0f (%5.1f/B)  x%.1f\n", length,
+			cycles[0], cycles[0] / length, cycles[1], cycles[1] / length, cycles[1] / cycles[0]);
+	}
+
+	return all_valid;
+}
+
+int main(int argc, char** argv)
+{
+	iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+	bench_primitives();
+	return bench_frames() ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+//Receive parser throughput: UartProtocol::receive_uart() (span parser) against the per-byte
+//state machine it replaced, on the same in-memory byte stream. DATA frames with 40-byte
+//payloads are interleaved with random line noise at several shares of the stream; every run
+//reports MB/s and how many of the frames each parser got back.
+//The per-byte reference below is the old receive_uart() loop (one read() and one millis() per
+//byte, START -> header -> rest of the frame, restart the hunt after a bad end marker) brought
+//to the current variable-length wire format so both parsers see the same bytes.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) together with the protocol
+//sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. tools/bench_parser.cpp <protocol .cpp> <host-core .cpp> -o bench_parser
+//Usage: bench_parser [MB per run]   (default 8; exit status 1 = the span parser lost a frame)
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "packet_frame.h"
+#include "uart_protocol.h"
+
+#define BENCH_PAYLOAD 40
+#define BENCH_DRIVER_FIFO 256//available() never reports more than a UART driver buffer holds
+
+//Serves a prepared byte stream in driver-sized chunks
+class MemoryStream : public Stream
+{
+private:
+	const std::vector<uint8_t>& data;
+	size_t pos;
+
+public:
+	MemoryStream(const std::vector<uint8_t>& bytes) : data(bytes), pos(0) {}
+
+	bool at_end() const { return pos >= data.size(); }
+
+	int available()
+	{
+		size_t left = data.size() - pos;
+		return (int)(left < BENCH_DRIVER_FIFO ? left : BENCH_DRIVER_FIFO);
+	}
+	int read() { return pos < data.size() ? data[pos++] : -1; }
+	int peek() { return pos < data.size() ? data[pos] : -1; }
+
+	size_t readBytes(char* buffer, size_t len)
+	{
+		size_t left = data.size() - pos;
+		if (len > left) len = left;
+		memcpy(buffer, &data[pos], len);
+		pos += len;
+		return len;
+	}
+
+	size_t write(uint8_t) { return 1; }
+	size_t write(const uint8_t*, size_t size) { return size; }
+};
+
+//The replaced receive loop: one byte per iteration, the frame is only looked at once complete
+class PerByteParser
+{
+private:
+	enum { STATE_WAITING_START, STATE_RECEIVING_FRAME } rx_state;
+	uint8_t rx_buffer[sizeof(Frame)];
+	uint16_t rx_index;
+	uint16_t wire_length;
+	unsigned long last_byte_time;
+
+public:
+	PerByteParser() : rx_state(STATE_WAITING_START), rx_index(0), wire_length(0), last_byte_time(0) {}
+
+	bool receive(Stream* serial, Frame* frame)
+	{
+		while (serial->available())
+		{
+			uint8_t byte = serial->read();
+			last_byte_time = millis();
+
+			switch (rx_state)
+			{
+			case STATE_WAITING_START:
+				if (byte == DefaultConfig::START_MARKER)
+				{
+					rx_index = 0;
+					rx_buffer[rx_index++] = byte;
+					wire_length = FRAME_HEADER_LEN;
+					rx_state = STATE_RECEIVING_FRAME;
+				}
+				break;
+
+			case STATE_RECEIVING_FRAME:
+				rx_buffer[rx_index++] = byte;
+
+				if (rx_index == FRAME_HEADER_LEN)
+				{
+					uint16_t data_length;
+					memcpy(&data_length, rx_buffer + offsetof(Frame, data_length), sizeof(data_length));
+					if (data_length > DefaultConfig::MAX_DATA_LEN)
+					{
+						rx_state = STATE_WAITING_START;
+						break;
+					}
+					wire_length = FRAME_HEADER_LEN + data_length + FRAME_TRAILER_LEN;
+				}
+
+				if (rx_index >= FRAME_HEADER_LEN && rx_index == wire_length)
+				{
+					rx_state = STATE_WAITING_START;
+					if (rx_buffer[wire_length - 1] == DefaultConfig::END_MARKER && PacketFrame::deserialize_frame(rx_buffer, wire_length, frame)) return true;
+				}
+				break;
+			}
+		}
+
+		return false;
+	}
+};
+
+static uint32_t rng_state = 12345;
+
+static uint8_t next_noise()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (uint8_t)rng_state;
+}
+
+//Frames interleaved with noise, noise_share of all bytes; returns the number of frames written
+static size_t build_stream(std::vector<uint8_t>& bytes, double noise_share, size_t total)
+{
+	PacketFrame frames;
+	uint8_t payload[BENCH_PAYLOAD];
+	uint8_t wire[sizeof(Frame) + FRAME_TRAILER_LEN];
+	size_t count = 0;
+
+	for (uint8_t i = 0; i < BENCH_PAYLOAD; i++) payload[i] = 'a' + i % 26;
+	size_t frame_bytes = FRAME_HEADER_LEN + BENCH_PAYLOAD + FRAME_TRAILER_LEN;
+	size_t noise_run = noise_share < 1.0 ? (size_t)(noise_share * frame_bytes / (1.0 - noise_share)) : total;
+
+	bytes.clear();
+	bytes.reserve(total + frame_bytes + noise_run);
+	while (bytes.size() < total)
+	{
+		for (size_t i = 0; i < noise_run; i++) bytes.push_back(next_noise());
+		if (noise_share >= 1.0) break;
+
+		Frame frame;
+		frames.create_frame(TYPE_DATA, payload, BENCH_PAYLOAD, &frame);
+		uint16_t length = PacketFrame::serialize_frame(&frame, wire);
+		bytes.insert(bytes.end(), wire, wire + length);
+		count++;
+	}
+
+	return count;
+}
+
+static double mb_per_s(size_t bytes, unsigned long elapsed_us)
+{
+	return elapsed_us > 0 ? (double)bytes / elapsed_us : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+	static const double noise_shares[] = { 0.0, 0.5, 0.9, 0.99 };
+	size_t total = (argc > 1 ? atoi(argv[1]) : 8) * 1000000UL;
+	bool lost = false;
+	std::vector<uint8_t> bytes;
+
+	printf("noise   per-byte MB/s  frames      span MB/s  frames      expected\n");
+	for (double noise : noise_shares)
+	{
+		size_t expected = build_stream(bytes, noise, total);
+		Frame frame;
+
+		MemoryStream old_stream(bytes);
+		PerByteParser per_byte;
+		size_t old_frames = 0;
+		unsigned long start = micros();
+		while (!old_stream.at_end()) while (per_byte.receive(&old_stream, &frame)) old_frames++;
+		unsigned long old_us = micros() - start;
+
+		MemoryStream span_stream(bytes);
+		UartProtocol span(&span_stream);
+		size_t span_frames = 0;
+		start = micros();
+		while (!span_stream.at_end()) while (span.receive_uart(&frame)) span_frames++;
+		while (span.receive_uart(&frame)) span_frames++;
+		unsigned long span_us = micros() - start;
+
+		printf("%4.0f%%   %12.1f  %-10zu  %9.1f  %-10zu  %zu\n", noise * 100, mb_per_s(bytes.size(), old_us), old_frames,
+			mb_per_s(bytes.size(), span_us), span_frames, expected);
+		if (span_frames != expected) lost = true;
+	}
+
+	return lost ? 1 : 0;
+}
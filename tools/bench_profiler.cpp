@@ -0,0 +1,66 @@
+//Cost of the cycle profiler on the frame pipeline: a create_frame + validate_frame loop timed
+//in ns/frame. Built twice, once per setting of the build flag, the two numbers show what the
+//probes cost when on and that they cost nothing when compiled out. Off, no probe may have left
+//a sample in the slots; on, create_frame and validate_frame must have one per frame.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) together with the protocol
+//sources in the repository root, the flag the same for every source:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. tools/bench_profiler.cpp <protocol .cpp> <host-core .cpp> -o bench_profiler_off
+//  g++ -O2 -std=gnu++17 -DENABLE_CYCLE_PROFILER=1 -I<host-core> -I. tools/bench_profiler.cpp <protocol .cpp> <host-core .cpp> -o bench_profiler_on
+//Usage: bench_profiler_off | bench_profiler_on [frames]   (default 2000000; exit status 1 = unexpected slot counts)
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "packet_frame.h"
+#include "cycle_profiler.h"
+
+#define BENCH_PAYLOAD 40
+#define BENCH_ROUNDS 5//best of, the first round also warms the caches
+
+int main(int argc, char** argv)
+{
+	uint32_t frames = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+	PacketFrame packet_frame;
+	Frame frame;
+	uint8_t payload[BENCH_PAYLOAD];
+	uint32_t valid = 0;
+	unsigned long best_us = 0;
+
+	for (uint8_t i = 0; i < BENCH_PAYLOAD; i++) payload[i] = i * 7;
+
+	for (uint8_t round = 0; round < BENCH_ROUNDS; round++)
+	{
+		CycleProfiler::reset();
+		valid = 0;
+		unsigned long start = micros();
+		for (uint32_t n = 0; n < frames; n++)
+		{
+			payload[0] = (uint8_t)n;
+			packet_frame.create_frame(TYPE_DATA, payload, BENCH_PAYLOAD, &frame);
+			if (packet_frame.validate_frame(&frame)) valid++;
+		}
+		unsigned long elapsed_us = micros() - start;
+		if (round == 0 || elapsed_us < best_us) best_us = elapsed_us;
+	}
+
+	printf("profiler %s: %.1f ns/frame create + validate, %u/%u valid\n", ENABLE_CYCLE_PROFILER ? "on" : "off",
+		best_us * 1000.0 / frames, valid, frames);
+
+	bool slots_ok = valid == frames;
+	for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++)
+	{
+		uint32_t count = CycleProfiler::get_slot((ProfileStage)i).count;
+		uint32_t expected = 0;
+		if (ENABLE_CYCLE_PROFILER && (i == PROF_CREATE_FRAME || i == PROF_VALIDATE_FRAME)) expected = frames;
+		if (ENABLE_CYCLE_PROFILER && i == PROF_CRC) continue;//once or twice per frame, depends on the build
+		if (count != expected) slots_ok = false;
+	}
+
+#if ENABLE_CYCLE_PROFILER
+	CycleProfiler::print_statistics();
+#endif
+
+	return slots_ok ? 0 : 1;
+}
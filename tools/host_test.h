@@ -0,0 +1,87 @@
+#pragma once
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+//Shared by the tools/test_*.cpp host programs: plain checks, no framework.
+//A failed CHECK prints where and what and the run carries on, so one run lists every failure.
+//test_summary() is the exit status: 0 = every check passed.
+//
+//Link tests run the peer in a forked child on the other end of a PtyTransport socketpair;
+//the child reports what its handler saw through a pipe, see PeerReport.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static unsigned test_checks = 0;
+static unsigned test_failures = 0;
+
+#define CHECK(condition) do \
+{ \
+	test_checks++; \
+	if (!(condition)) \
+	{ \
+		test_failures++; \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+	} \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do \
+{ \
+	long long check_actual = (long long)(actual); \
+	long long check_expected = (long long)(expected); \
+	test_checks++; \
+	if (check_actual != check_expected) \
+	{ \
+		test_failures++; \
+		printf("FAIL %s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #actual, check_actual, check_expected); \
+	} \
+} while (0)
+
+static inline int test_summary(const char* name)
+{
+	printf("%s: %u checks, %u failed\n", name, test_checks, test_failures);
+	return test_failures == 0 ? 0 : 1;
+}
+
+//Child -> parent channel for link tests: fixed-size records, read back non-blocking
+class PeerReport
+{
+private:
+	int fds[2];
+
+public:
+	PeerReport() { fds[0] = -1; fds[1] = -1; }
+	bool open() { return pipe(fds) == 0; }
+
+	void child_side() { close(fds[0]); }
+	void parent_side() { close(fds[1]); fcntl(fds[0], F_SETFL, O_NONBLOCK); }
+
+	void send(const void* record, size_t length) { if (write(fds[1], record, length) != (ssize_t)length) _exit(2); }
+	bool receive(void* record, size_t length) { return read(fds[0], record, length) == (ssize_t)length; }
+};
+
+//Runs body() in a forked child, stop_peer() ends it
+template<class Body>
+static pid_t start_peer(Body body)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		body();
+		_exit(0);
+	}
+	return pid;
+}
+
+static inline void stop_peer(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+}
+
+#endif // !HOST_TEST_H
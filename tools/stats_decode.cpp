@@ -0,0 +1,123 @@
+//Turns TYPE_STATS snapshots from a master's Serial log into CSV time series.
+//The master prints one line per snapshot received (PerformanceMonitor::peer_snapshot_received):
+//  STATS,<master ms>,<StatsSnapshot as hex>
+//Everything else in the log is skipped. 16-bit counters are unwrapped into running totals,
+//a peer restart (uptime going backwards) starts the totals again.
+//
+//Host-only, plain C++:
+//  g++ -O2 -std=c++17 -I. tools/stats_decode.cpp -o stats_decode
+//Usage: stats_decode [log.txt] > stats.csv   (stdin when no file is given)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats_snapshot.h"
+
+#define LINE_MAX_LEN 512
+
+//Running total for a counter that wraps at 16 bits on the wire
+typedef struct
+{
+	uint16_t last_raw;
+	uint64_t total;
+}UnwrappedCounter;
+
+static void unwrap(UnwrappedCounter* counter, uint16_t raw, bool restart)
+{
+	if (restart) counter->total = raw;
+	else counter->total += (uint16_t)(raw - counter->last_raw);
+	counter->last_raw = raw;
+}
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+//"STATS,<ms>,<hex>" anywhere in the line, false for anything else
+static bool parse_line(const char* line, unsigned long* host_ms, StatsSnapshot* snapshot)
+{
+	const char* p = strstr(line, "STATS,");
+	if (!p) return false;
+	p += 6;
+
+	char* end;
+	*host_ms = strtoul(p, &end, 10);
+	if (end == p || *end != ',') return false;
+	p = end + 1;
+
+	uint8_t* out = (uint8_t*)snapshot;
+	for (size_t i = 0; i < sizeof(StatsSnapshot); i++)
+	{
+		int high = hex_value(p[2 * i]);
+		int low = high < 0 ? -1 : hex_value(p[2 * i + 1]);
+		if (low < 0) return false;
+		out[i] = (uint8_t)(high << 4 | low);
+	}
+
+	return snapshot->version == STATS_SNAPSHOT_VERSION;
+}
+
+int main(int argc, char** argv)
+{
+	FILE* in = stdin;
+	if (argc > 1)
+	{
+		in = fopen(argv[1], "r");
+		if (!in)
+		{
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	printf("host_ms,uptime_ms,packets_sent,data_frames_sent,packets_received,datagrams_received,payload_bytes_delivered,"
+		"crc_errors,sequence_gaps,duplicates,lost_packets,retransmissions,timeouts,flow_control_pauses");
+	for (uint8_t i = 0; i < STATS_LATENCY_BUCKETS; i++)
+	{
+		if (STATS_LATENCY_LIMIT_US[i]) printf(",lat_lt_%uus", (unsigned)STATS_LATENCY_LIMIT_US[i]);
+		else printf(",lat_ge_%uus", (unsigned)STATS_LATENCY_LIMIT_US[i - 1]);
+	}
+	printf("\n");
+
+	UnwrappedCounter counters[7];
+	memset(counters, 0, sizeof(counters));
+	uint32_t last_uptime = 0;
+	bool first = true;
+	unsigned long rows = 0;
+	unsigned long skipped = 0;
+
+	char line[LINE_MAX_LEN];
+	while (fgets(line, sizeof(line), in))
+	{
+		unsigned long host_ms;
+		StatsSnapshot s;
+		if (!parse_line(line, &host_ms, &s))
+		{
+			if (strstr(line, "STATS,")) skipped++;
+			continue;
+		}
+
+		bool restart = first || s.uptime_ms < last_uptime;
+		last_uptime = s.uptime_ms;
+		first = false;
+
+		const uint16_t raw[7] = { s.crc_errors, s.sequence_gaps, s.duplicates, s.lost_packets, s.retransmissions, s.timeouts, s.flow_control_pauses };
+		for (uint8_t i = 0; i < 7; i++) unwrap(&counters[i], raw[i], restart);
+
+		printf("%lu,%u,%u,%u,%u,%u,%u", host_ms, s.uptime_ms, s.packets_sent, s.data_frames_sent,
+			s.packets_received, s.datagrams_received, s.payload_bytes_delivered);
+		for (uint8_t i = 0; i < 7; i++) printf(",%llu", (unsigned long long)counters[i].total);
+		for (uint8_t i = 0; i < STATS_LATENCY_BUCKETS; i++) printf(",%u", s.latency_buckets[i]);
+		printf("\n");
+		rows++;
+	}
+
+	fprintf(stderr, "%lu snapshots, %lu malformed or unknown version\n", rows, skipped);
+	if (in != stdin) fclose(in);
+	return 0;
+}
@@ -0,0 +1,346 @@
+//Host test for the AEAD frame mode: FrameCipher seal/open, per-space nonces that never repeat
+//between roles, spaces or sessions, index extension across the sequence and reply counter
+//wraps, tampered frames and foreign session keys rejected with auth_failures counting up and
+//resetting, and a keyed link that delivers while only ciphertext crosses the wire.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_aead.cpp <protocol .cpp> <host-core .cpp> -o test_aead
+//Usage: test_aead   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <vector>
+
+#include "host_test.h"
+#include "frame_cipher.h"
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+#include "wire_capture.h"
+
+#define INITIATOR_SALT 0x11223344
+#define RESPONDER_SALT 0x55667788
+#define LINK_MESSAGES 20
+
+static const uint8_t link_key[CIPHER_KEY_LEN] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+};
+
+static const uint8_t plaintext[] = "AEAD frame payload, 0123456789";
+
+static void test_cipher()
+{
+	FrameCipher cipher;
+	cipher.set_key(link_key);
+	uint8_t nonce[CIPHER_NONCE_LEN] = { 0, 1, 2 };
+	uint8_t aad[4] = { 0xA0, 0xA1, 0xA2, 0xA3 };
+	uint8_t data[sizeof(plaintext)];
+
+	memcpy(data, plaintext, sizeof(data));
+	uint16_t tag = cipher.seal(nonce, aad, sizeof(aad), data, sizeof(data));
+	CHECK(memcmp(data, plaintext, sizeof(data)) != 0);
+	CHECK(cipher.verify(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+
+	//Any change to ciphertext, header, nonce or tag: refused, and the ciphertext stays as it was
+	uint8_t sealed[sizeof(data)];
+	memcpy(sealed, data, sizeof(sealed));
+
+	data[3] ^= 0x01;
+	CHECK(!cipher.open(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+	data[3] ^= 0x01;
+	CHECK(memcmp(data, sealed, sizeof(data)) == 0);
+
+	aad[0] ^= 0x80;
+	CHECK(!cipher.open(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+	aad[0] ^= 0x80;
+
+	nonce[11] ^= 0x01;
+	CHECK(!cipher.open(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+	nonce[11] ^= 0x01;
+
+	CHECK(!cipher.open(nonce, aad, sizeof(aad), data, sizeof(data), tag ^ 0x0100));
+	CHECK(memcmp(data, sealed, sizeof(data)) == 0);
+
+	CHECK(cipher.open(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+	CHECK(memcmp(data, plaintext, sizeof(data)) == 0);
+
+	//Another key does not open it
+	FrameCipher other;
+	uint8_t other_key[CIPHER_KEY_LEN];
+	memcpy(other_key, link_key, sizeof(other_key));
+	other_key[31] ^= 0x01;
+	other.set_key(other_key);
+	memcpy(data, sealed, sizeof(data));
+	CHECK(!other.open(nonce, aad, sizeof(aad), data, sizeof(data), tag));
+}
+
+//Initiator and responder of one session
+static void start_pair(PacketFrame& initiator, PacketFrame& responder)
+{
+	initiator.set_aead_key(link_key);
+	responder.set_aead_key(link_key);
+	initiator.start_aead_session(INITIATOR_SALT, RESPONDER_SALT, true);
+	responder.start_aead_session(INITIATOR_SALT, RESPONDER_SALT, false);
+}
+
+static void test_session()
+{
+	PacketFrame initiator;
+	PacketFrame responder;
+	Frame frame;
+
+	//Keyed but no session yet: nothing can be sealed, only the handshake goes out (with CRC16)
+	initiator.set_aead_key(link_key);
+	responder.set_aead_key(link_key);
+	CHECK(!initiator.is_aead_active());
+	CHECK(!initiator.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &frame));
+	CHECK(initiator.create_frame(TYPE_SYN, plaintext, 8, &frame));
+	CHECK(responder.validate_frame(&frame));
+	CHECK_EQ(responder.get_auth_failures(), 0);
+
+	start_pair(initiator, responder);
+	CHECK(initiator.is_aead_active() && responder.is_aead_active());
+
+	//Both directions, all three nonce spaces
+	CHECK(initiator.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &frame));
+	CHECK(memcmp(frame.data, plaintext, sizeof(plaintext)) != 0);
+	CHECK(responder.validate_frame(&frame));
+	CHECK(memcmp(frame.data, plaintext, sizeof(plaintext)) == 0);
+
+	CHECK(responder.create_reply_frame(TYPE_ACK, frame.sequence_num, nullptr, 0, &frame));
+	CHECK(frame.packet_type & FLAG_REPLY);
+	CHECK(initiator.validate_frame(&frame));
+	CHECK_EQ(PacketFrame::get_type(&frame), TYPE_ACK);
+
+	CHECK(responder.create_datagram(plaintext, sizeof(plaintext), &frame));
+	CHECK(initiator.validate_frame(&frame));
+	CHECK(memcmp(frame.data, plaintext, sizeof(plaintext)) == 0);
+
+	CHECK(responder.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &frame));
+	CHECK(initiator.validate_frame(&frame));
+
+	//Same plaintext, same sequence number, different role: different keystream
+	PacketFrame a;
+	PacketFrame b;
+	start_pair(a, b);
+	Frame from_a;
+	Frame from_b;
+	CHECK(a.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &from_a));
+	CHECK(b.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &from_b));
+	CHECK_EQ(from_a.sequence_num, from_b.sequence_num);
+	CHECK(memcmp(from_a.data, from_b.data, sizeof(plaintext)) != 0);
+
+	//A sealed ACK echoing seq 0 must not reuse the nonce of DATA seq 0
+	Frame reply;
+	CHECK(b.create_reply_frame(TYPE_ACK, 0, plaintext, sizeof(plaintext), &reply));
+	CHECK(memcmp(reply.data, from_b.data, sizeof(plaintext)) != 0);
+
+	//A new session (fresh salts) never repeats an old keystream either
+	PacketFrame c;
+	PacketFrame d;
+	c.set_aead_key(link_key);
+	d.set_aead_key(link_key);
+	c.start_aead_session(INITIATOR_SALT + 1, RESPONDER_SALT, true);
+	d.start_aead_session(INITIATOR_SALT + 1, RESPONDER_SALT, false);
+	Frame from_c;
+	CHECK(c.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &from_c));
+	CHECK(memcmp(from_c.data, from_a.data, sizeof(plaintext)) != 0);
+
+	//...and a peer still on the old session cannot open it
+	CHECK(!b.validate_frame(&from_c));
+	CHECK(d.validate_frame(&from_c));
+}
+
+static void test_rejects()
+{
+	PacketFrame initiator;
+	PacketFrame responder;
+	start_pair(initiator, responder);
+	Frame good;
+	Frame bad;
+	CHECK(initiator.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &good));
+
+	//Tampered payload, header and tag: each one counts
+	bad = good;
+	bad.data[0] ^= 0x01;
+	CHECK(!responder.validate_frame(&bad));
+	CHECK_EQ(responder.get_auth_failures(), 1);
+
+	bad = good;
+	bad.channel_id ^= 0x01;
+	CHECK(!responder.validate_frame(&bad));
+	CHECK_EQ(responder.get_auth_failures(), 2);
+
+	bad = good;
+	bad.crc16 ^= 0x8000;
+	CHECK(!responder.validate_frame(&bad));
+	CHECK_EQ(responder.get_auth_failures(), 3);
+
+	//Out of bounds length: refused before any tag check or decrypt, not an auth failure
+	bad = good;
+	bad.data_length = DefaultConfig::MAX_DATA_LEN + 1;
+	CHECK(!responder.validate_frame(&bad));
+	CHECK_EQ(responder.get_auth_failures(), 3);
+
+	//One authenticated frame clears the streak
+	CHECK(responder.validate_frame(&good));
+	CHECK_EQ(responder.get_auth_failures(), 0);
+
+	//Session ended: sealed frames keep failing until a new session starts, which resets the count
+	CHECK(initiator.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &good));
+	responder.end_aead_session();
+	for (uint16_t i = 1; i <= LINK_AUTH_FAILURE_LIMIT; i++)
+	{
+		bad = good;
+		CHECK(!responder.validate_frame(&bad));
+		CHECK_EQ(responder.get_auth_failures(), i);
+	}
+	responder.start_aead_session(INITIATOR_SALT, RESPONDER_SALT, false);
+	CHECK_EQ(responder.get_auth_failures(), 0);
+
+	//A receiver that derived its key from other salts: every frame fails
+	PacketFrame stranger;
+	stranger.set_aead_key(link_key);
+	stranger.start_aead_session(INITIATOR_SALT, RESPONDER_SALT + 1, false);
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		CHECK(initiator.create_frame(TYPE_DATA, plaintext, sizeof(plaintext), &good));
+		CHECK(!stranger.validate_frame(&good));
+	}
+	CHECK_EQ(stranger.get_auth_failures(), 4);
+}
+
+static void test_index_extension()
+{
+	PacketFrame initiator;
+	PacketFrame responder;
+	start_pair(initiator, responder);
+	Frame frame;
+
+	//Past the 16-bit sequence wrap: the receiver extends the index from what it saw
+	uint32_t failed = 0;
+	for (uint32_t n = 0; n < SEQUENCE_MODULUS + 2000; n++)
+	{
+		CHECK(initiator.create_frame(TYPE_DATA, plaintext, 8, &frame));
+		if (!responder.validate_frame(&frame)) failed++;
+	}
+	CHECK_EQ(failed, 0);
+
+	//Reply counter travels in 8 bits: same across several wraps of it
+	failed = 0;
+	for (uint32_t n = 0; n < 1000; n++)
+	{
+		CHECK(responder.create_reply_frame(TYPE_ACK, (uint16_t)n, plaintext, 8, &frame));
+		if (!initiator.validate_frame(&frame)) failed++;
+	}
+	CHECK_EQ(failed, 0);
+
+	//Lost frames and mild reordering around the wrap
+	PacketFrame a;
+	PacketFrame b;
+	start_pair(a, b);
+	std::vector<Frame> frames(SEQUENCE_MODULUS + 20);
+	for (Frame& f : frames) CHECK(a.create_frame(TYPE_DATA, plaintext, 8, &f));
+
+	failed = 0;
+	for (uint32_t n = 0; n < SEQUENCE_MODULUS - 10; n += 1000) failed += !b.validate_frame(&frames[n]);
+	for (uint32_t n = SEQUENCE_MODULUS - 10; n < frames.size(); n += 2)
+	{
+		if (n + 1 < frames.size()) failed += !b.validate_frame(&frames[n + 1]);
+		failed += !b.validate_frame(&frames[n]);
+	}
+	CHECK_EQ(failed, 0);
+}
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	uint32_t number = 0xFFFFFFFF;
+	if (length == sizeof(plaintext) + sizeof(number)) memcpy(&number, data, sizeof(number));
+	report.send(&number, sizeof(number));
+}
+
+class CaptureBuffer : public Print
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	size_t write(uint8_t value) { bytes.push_back(value); return 1; }
+	size_t write(const uint8_t* data, size_t size) { bytes.insert(bytes.end(), data, data + size); return size; }
+};
+
+static void test_keyed_link()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(921600);
+	slave_end.set_baud_rate(921600);
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_link_key(link_key);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	static WireCapture capture;
+	CaptureBuffer sink;
+	capture.begin_stream(&sink);
+
+	UartProtocol master(&master_end);
+	master.set_link_key(link_key);
+	master.set_capture(&capture);
+	CHECK(master.connect());
+	CHECK(master.is_session_up());
+
+	uint8_t message[sizeof(uint32_t) + sizeof(plaintext)];
+	memcpy(message + sizeof(uint32_t), plaintext, sizeof(plaintext));
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < LINK_MESSAGES; n++)
+	{
+		memcpy(message, &n, sizeof(n));
+		if (master.send_uart_message(message, sizeof(message))) acked++;
+		master.receive_data_uart_master();
+	}
+	CHECK_EQ(acked, LINK_MESSAGES);
+	CHECK_EQ(master.get_perf_protocol().get_crc_errors(), 0);
+	capture.stop();
+
+	unsigned long start = millis();
+	uint32_t expected = 0;
+	uint32_t number;
+	while (expected < LINK_MESSAGES && millis() - start < 1000)
+	{
+		master.receive_data_uart_master();
+		if (!report.receive(&number, sizeof(number))) continue;
+		CHECK_EQ(number, expected);
+		expected++;
+	}
+	CHECK_EQ(expected, LINK_MESSAGES);
+	stop_peer(peer);
+
+	//No plaintext on the wire
+	const uint8_t* marker = plaintext + 13;//"payload, 0123"
+	bool leaked = false;
+	for (size_t i = 0; i + 12 <= sink.bytes.size(); i++) leaked |= memcmp(&sink.bytes[i], marker, 12) == 0;
+	CHECK(sink.bytes.size() > sizeof(CaptureFileHeader));
+	CHECK(!leaked);
+}
+
+int main()
+{
+	test_cipher();
+	test_session();
+	test_rejects();
+	test_index_extension();
+	test_keyed_link();
+	return test_summary("test_aead");
+}
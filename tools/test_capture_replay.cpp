@@ -0,0 +1,304 @@
+//Host test for the wire capture tap: stream captures start with the file header and hold every
+//record verbatim, the RAM ring overwrites whole records only and counts them, and a capture of
+//a live link replays through UartProtocol::receive_uart() into exactly the frames that were sent
+//and received, the way tools/wire_replay.cpp reads it.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_capture_replay.cpp <protocol .cpp> <host-core .cpp> -o test_capture_replay
+//Usage: test_capture_replay   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <set>
+#include <vector>
+
+#include "host_test.h"
+#include "wire_capture.h"
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define RING_RECORD_LEN 40
+#define RING_RECORDS 500
+#define LINK_MESSAGES 40
+
+//Capture file sink
+class CaptureBuffer : public Print
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	size_t write(uint8_t value) { bytes.push_back(value); return 1; }
+	size_t write(const uint8_t* data, size_t size) { bytes.insert(bytes.end(), data, data + size); return size; }
+};
+
+typedef struct
+{
+	CaptureRecordHeader header;
+	std::vector<uint8_t> data;
+}CapturedRecord;
+
+//Splits a capture file into records, false if the header or any record is malformed
+static bool parse_capture(const std::vector<uint8_t>& file, std::vector<CapturedRecord>* records)
+{
+	CaptureFileHeader file_header;
+	if (file.size() < sizeof(file_header)) return false;
+	memcpy(&file_header, file.data(), sizeof(file_header));
+	if (memcmp(file_header.magic, CAPTURE_MAGIC, sizeof(file_header.magic)) != 0 || file_header.version != CAPTURE_VERSION) return false;
+
+	size_t pos = sizeof(file_header);
+	while (pos < file.size())
+	{
+		CapturedRecord record;
+		if (file.size() - pos < sizeof(record.header)) return false;
+		memcpy(&record.header, file.data() + pos, sizeof(record.header));
+		pos += sizeof(record.header);
+
+		if (record.header.length == 0 || record.header.length > file.size() - pos) return false;
+		record.data.assign(file.begin() + pos, file.begin() + pos + record.header.length);
+		pos += record.header.length;
+		records->push_back(record);
+	}
+	return true;
+}
+
+static void fill_record(uint32_t n, uint8_t* buffer, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++) buffer[i] = (uint8_t)(n * 13 + i);
+	memcpy(buffer, &n, sizeof(n));
+}
+
+static void test_stream()
+{
+	static WireCapture capture;
+	CaptureBuffer sink;
+	uint8_t buffer[RING_RECORD_LEN];
+
+	//Nothing is recorded before begin
+	fill_record(0, buffer, sizeof(buffer));
+	capture.record(CAPTURE_DIR_TX, buffer, sizeof(buffer));
+	CHECK_EQ(capture.get_records(), 0);
+
+	capture.begin_stream(&sink);
+	CHECK(capture.is_enabled());
+	CHECK_EQ(sink.bytes.size(), sizeof(CaptureFileHeader));
+
+	for (uint32_t n = 0; n < 20; n++)
+	{
+		uint16_t length = 1 + n % RING_RECORD_LEN;
+		fill_record(n, buffer, length);
+		capture.record(n % 2 ? CAPTURE_DIR_RX : CAPTURE_DIR_TX, buffer, length);
+	}
+	capture.record(CAPTURE_DIR_TX, buffer, 0);//empty reads are not records
+	capture.stop();
+	capture.record(CAPTURE_DIR_TX, buffer, sizeof(buffer));
+	CHECK_EQ(capture.get_records(), 20);
+
+	std::vector<CapturedRecord> records;
+	CHECK(parse_capture(sink.bytes, &records));
+	CHECK_EQ(records.size(), 20);
+
+	uint32_t last_timestamp = 0;
+	for (uint32_t n = 0; n < records.size(); n++)
+	{
+		uint16_t length = 1 + n % RING_RECORD_LEN;
+		fill_record(n, buffer, length);
+		CHECK_EQ(records[n].header.length, length);
+		CHECK_EQ(records[n].header.flags, n % 2 ? CAPTURE_DIR_RX : CAPTURE_DIR_TX);
+		CHECK(memcmp(records[n].data.data(), buffer, length) == 0);
+		CHECK(records[n].header.timestamp_us >= last_timestamp);
+		last_timestamp = records[n].header.timestamp_us;
+	}
+}
+
+static void test_ring()
+{
+	static WireCapture capture;
+	uint8_t buffer[RING_RECORD_LEN];
+
+	capture.begin_ram();
+	for (uint32_t n = 0; n < RING_RECORDS; n++)
+	{
+		fill_record(n, buffer, sizeof(buffer));
+		capture.record(CAPTURE_DIR_RX | CAPTURE_LINK_SPI, buffer, sizeof(buffer));
+	}
+
+	//Larger than the whole ring: counted as dropped, the ring keeps what it has
+	static uint8_t oversized[CAPTURE_RING_SIZE];
+	capture.record(CAPTURE_DIR_TX, oversized, sizeof(oversized));
+
+	CaptureBuffer sink;
+	capture.dump(&sink);
+	std::vector<CapturedRecord> records;
+	CHECK(parse_capture(sink.bytes, &records));
+
+	//Only whole records survive, the newest ones, in order, and every loss is counted
+	uint32_t per_record = sizeof(CaptureRecordHeader) + RING_RECORD_LEN;
+	CHECK_EQ(records.size(), CAPTURE_RING_SIZE / per_record);
+	CHECK_EQ(capture.get_records(), RING_RECORDS + 1);
+	CHECK_EQ(capture.get_records_dropped() + records.size(), RING_RECORDS + 1);
+
+	uint32_t first = RING_RECORDS - records.size();
+	for (uint32_t i = 0; i < records.size(); i++)
+	{
+		fill_record(first + i, buffer, sizeof(buffer));
+		CHECK_EQ(records[i].header.length, RING_RECORD_LEN);
+		CHECK_EQ(records[i].header.flags, CAPTURE_DIR_RX | CAPTURE_LINK_SPI);
+		CHECK(memcmp(records[i].data.data(), buffer, sizeof(buffer)) == 0);
+	}
+
+	//Dumping does not consume the ring, clear() does
+	CaptureBuffer again;
+	capture.dump(&again);
+	CHECK(again.bytes == sink.bytes);
+	capture.clear();
+	CaptureBuffer empty;
+	capture.dump(&empty);
+	CHECK_EQ(empty.bytes.size(), sizeof(CaptureFileHeader));
+}
+
+//Serves captured records of one direction to a UartProtocol parser
+class ReplayStream : public Stream
+{
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t pos;
+
+public:
+	ReplayStream() : data(nullptr), length(0), pos(0) {}
+
+	void load(const uint8_t* record, size_t record_length) { data = record; length = record_length; pos = 0; }
+
+	int available() { return (int)(length - pos); }
+	int read() { return pos < length ? data[pos++] : -1; }
+	int peek() { return pos < length ? data[pos] : -1; }
+
+	size_t readBytes(char* buffer, size_t len)
+	{
+		if (len > length - pos) len = length - pos;
+		memcpy(buffer, data + pos, len);
+		pos += len;
+		return len;
+	}
+
+	size_t write(uint8_t) { return 1; }
+	size_t write(const uint8_t*, size_t size) { return size; }
+};
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	uint32_t number = 0xFFFFFFFF;
+	if (length == sizeof(number)) memcpy(&number, data, sizeof(number));
+	report.send(&number, sizeof(number));
+}
+
+static void test_link_replay()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(921600);
+	slave_end.set_baud_rate(921600);
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	static WireCapture capture;
+	CaptureBuffer sink;
+	capture.begin_stream(&sink);
+
+	UartProtocol master(&master_end);
+	master.set_capture(&capture);
+	CHECK(master.connect());
+
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < LINK_MESSAGES; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked++;
+		master.receive_data_uart_master();
+	}
+	CHECK_EQ(acked, LINK_MESSAGES);
+	capture.stop();
+	stop_peer(peer);
+
+	std::vector<CapturedRecord> records;
+	CHECK(parse_capture(sink.bytes, &records));
+	CHECK_EQ(records.size(), capture.get_records());
+
+	//Per direction a frame may span records, the parser carries the partial one over
+	static ReplayStream stream[2];
+	static UartProtocol tx_parser(&stream[CAPTURE_DIR_TX]);
+	static UartProtocol rx_parser(&stream[CAPTURE_DIR_RX]);
+	UartProtocol* parser[2] = { &tx_parser, &rx_parser };
+	PacketFrame decoder;
+
+	std::set<uint32_t> sent;
+	std::set<uint16_t> data_seqs;
+	std::set<uint16_t> acked_seqs;
+	uint32_t syns = 0;
+	uint32_t syn_acks = 0;
+	uint32_t invalid = 0;
+	Frame frame;
+
+	for (CapturedRecord& record : records)
+	{
+		uint8_t direction = record.header.flags & CAPTURE_DIR_MASK;
+		CHECK_EQ(record.header.flags & CAPTURE_LINK_MASK, CAPTURE_LINK_UART);
+		stream[direction].load(record.data.data(), record.data.size());
+
+		while (true)
+		{
+			if (!parser[direction]->receive_uart(&frame))
+			{
+				if (stream[direction].available() == 0) break;
+				continue;
+			}
+			if (!decoder.validate_frame(&frame))
+			{
+				invalid++;
+				continue;
+			}
+
+			uint8_t type = PacketFrame::get_type(&frame);
+			if (direction == CAPTURE_DIR_TX && type == TYPE_SYN) syns++;
+			if (direction == CAPTURE_DIR_RX && type == TYPE_SYN_ACK) syn_acks++;
+			if (direction == CAPTURE_DIR_RX && type == TYPE_ACK) acked_seqs.insert(frame.sequence_num);
+			if (direction == CAPTURE_DIR_TX && type == TYPE_DATA && frame.data_length == sizeof(uint32_t))
+			{
+				uint32_t number;
+				memcpy(&number, frame.data, sizeof(number));
+				sent.insert(number);
+				data_seqs.insert(frame.sequence_num);
+			}
+		}
+	}
+
+	//A clean link: the capture holds the handshake, every message and the ACK for each of them
+	CHECK_EQ(invalid, 0);
+	CHECK(syns > 0);
+	CHECK(syn_acks > 0);
+	CHECK_EQ(sent.size(), LINK_MESSAGES);
+	if (!sent.empty()) CHECK_EQ(*sent.rbegin(), LINK_MESSAGES - 1);
+
+	uint32_t unacked = 0;
+	for (uint16_t seq : data_seqs) unacked += acked_seqs.count(seq) == 0;
+	CHECK_EQ(unacked, 0);
+}
+
+int main()
+{
+	test_stream();
+	test_ring();
+	test_link_replay();
+	return test_summary("test_capture_replay");
+}
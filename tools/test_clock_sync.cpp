@@ -0,0 +1,170 @@
+//Host test for ClockSync: synthetic DATA/ACK exchanges between a master and a peer whose crystal
+//runs off by a few hundred ppm either way, with queuing jitter on both paths and both micros()
+//clocks wrapping mid-run. The fitted drift and offset must track the true ones, the path split
+//must match the delays that were injected, and a bogus exchange (peer processing longer than
+//the round trip) must not poison the fit.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) together with the protocol
+//sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_clock_sync.cpp <protocol .cpp> <host-core .cpp> -o test_clock_sync
+//Usage: test_clock_sync   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "host_test.h"
+#include "clock_sync.h"
+
+#define EXCHANGE_PERIOD_US 20000
+#define RUN_US 60000000ULL//one minute, several CLOCK_SYNC_WINDOW intervals
+#define SETTLE_US 20000000ULL//checked only once the window holds a baseline
+#define PATH_BASE_US 400//symmetric part of each path, ends up in the measured paths, not the offset
+#define DRIFT_TOLERANCE_PPM 1.0f
+#define OFFSET_TOLERANCE_US 20
+#define TIGHT_SHARE_PCT 98//a new interval's first exchange is a provisional fit point and may be a queued one
+#define DRIFT_BOUND_PPM 20.0f//even then: inside the delay filter's slack
+#define OFFSET_BOUND_US (CLOCK_SYNC_DELAY_SLACK_US / 2)
+#define PATH_TOLERANCE_US 40
+
+//Both clocks as seen from true time t in us: master is the reference, the peer runs ppm fast
+typedef struct
+{
+	uint32_t master_start;
+	uint32_t peer_start;
+	double ppm;
+}Clocks;
+
+static uint32_t master_at(const Clocks* clocks, uint64_t t)
+{
+	return clocks->master_start + (uint32_t)t;
+}
+
+static uint32_t peer_at(const Clocks* clocks, uint64_t t)
+{
+	return clocks->peer_start + (uint32_t)(uint64_t)llround((double)t * (1.0 + clocks->ppm * 1e-6));
+}
+
+static int32_t true_offset(const Clocks* clocks, uint64_t t)
+{
+	return (int32_t)(peer_at(clocks, t) - master_at(clocks, t));
+}
+
+static uint32_t rng_state;
+
+static uint32_t next_random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+//Mostly a few us, now and then a frame stuck behind logging or another frame
+static uint32_t queuing_jitter()
+{
+	return next_random() % 10 < 7 ? next_random() % 20 : next_random() % 3000;
+}
+
+static void run_skew(double ppm, uint32_t master_start, uint32_t peer_start)
+{
+	Clocks clocks = { master_start, peer_start, ppm };
+	static ClockSync sync;
+	sync.reset();
+	rng_state = 0x9E3779B9u ^ (uint32_t)(int32_t)ppm;
+
+	uint64_t forward_total = 0;
+	uint64_t reverse_total = 0;
+	uint64_t processing_total = 0;
+	uint32_t exchanges = 0;
+	int32_t worst_offset = 0;
+	float worst_drift = 0;
+	uint32_t checked = 0;
+	uint32_t tight = 0;
+	bool master_wrapped = false;
+	bool peer_wrapped = false;
+
+	for (uint64_t t = 0; t < RUN_US; t += EXCHANGE_PERIOD_US)
+	{
+		uint32_t forward = PATH_BASE_US + queuing_jitter();
+		uint32_t processing = 200 + next_random() % 400;
+		uint32_t reverse = PATH_BASE_US + queuing_jitter();
+
+		uint32_t t1 = master_at(&clocks, t);
+		uint32_t t2 = peer_at(&clocks, t + forward);
+		uint32_t t3 = peer_at(&clocks, t + forward + processing);
+		uint32_t t4 = master_at(&clocks, t + forward + processing + reverse);
+		sync.add_exchange(t1, t2, t3, t4);
+
+		if (t1 < clocks.master_start) master_wrapped = true;
+		if (t2 < clocks.peer_start) peer_wrapped = true;
+		forward_total += forward;
+		reverse_total += reverse;
+		processing_total += t3 - t2;
+		exchanges++;
+
+		if (t < SETTLE_US) continue;
+
+		int32_t offset_error = sync.get_offset_us() - true_offset(&clocks, t);
+		float drift_error = sync.get_drift_ppm() - (float)ppm;
+		if (abs(offset_error) > abs(worst_offset)) worst_offset = offset_error;
+		if (fabsf(drift_error) > fabsf(worst_drift)) worst_drift = drift_error;
+		if (fabsf(drift_error) < DRIFT_TOLERANCE_PPM && abs(offset_error) < OFFSET_TOLERANCE_US) tight++;
+		checked++;
+	}
+
+	//The run really crossed both wraps
+	CHECK(master_wrapped);
+	CHECK(peer_wrapped);
+	CHECK_EQ(sync.get_exchanges(), exchanges);
+
+	//Tight nearly all the time and at the end, never outside what the delay filter lets through
+	CHECK(tight * 100 >= checked * TIGHT_SHARE_PCT);
+	CHECK(fabsf(sync.get_drift_ppm() - (float)ppm) < DRIFT_TOLERANCE_PPM);
+	CHECK(abs(sync.get_offset_us() - true_offset(&clocks, RUN_US - EXCHANGE_PERIOD_US)) < OFFSET_TOLERANCE_US);
+	CHECK(fabsf(worst_drift) < DRIFT_BOUND_PPM);
+	CHECK(abs(worst_offset) < OFFSET_BOUND_US);
+
+	//Path split: processing is measured on one clock, the paths through the fitted offset
+	CHECK(fabsf(sync.get_average_processing_us() - (float)processing_total / exchanges) < 1.0f);
+	CHECK(fabsf(sync.get_average_forward_us() - (float)forward_total / exchanges) < PATH_TOLERANCE_US);
+	CHECK(fabsf(sync.get_average_reverse_us() - (float)reverse_total / exchanges) < PATH_TOLERANCE_US);
+}
+
+static void test_bogus_exchange()
+{
+	static ClockSync sync;
+	Clocks clocks = { 0xFFFFF000u, 0x12345678u, 50.0 };
+	sync.reset();
+
+	//Peer claims a little more processing time than the whole round trip: the delay wraps to
+	//just below UINT32_MAX, closer to it than CLOCK_SYNC_DELAY_SLACK_US
+	uint32_t t1 = master_at(&clocks, 0);
+	uint32_t t4 = master_at(&clocks, 1000);
+	sync.add_exchange(t1, peer_at(&clocks, 100), peer_at(&clocks, 1600), t4);
+	CHECK(!isnan(sync.get_drift_ppm()));
+	CHECK(abs(sync.get_offset_us() - true_offset(&clocks, 0)) < 5000);
+
+	//Real exchanges afterwards still converge
+	for (uint64_t t = EXCHANGE_PERIOD_US; t < RUN_US / 2; t += EXCHANGE_PERIOD_US)
+	{
+		uint32_t forward = PATH_BASE_US;
+		uint32_t reverse = PATH_BASE_US;
+		sync.add_exchange(master_at(&clocks, t), peer_at(&clocks, t + forward), peer_at(&clocks, t + forward + 300),
+			master_at(&clocks, t + forward + 300 + reverse));
+	}
+	CHECK(!isnan(sync.get_drift_ppm()));
+	CHECK(fabsf(sync.get_drift_ppm() - 50.0f) < DRIFT_TOLERANCE_PPM);
+	CHECK(abs(sync.get_offset_us() - true_offset(&clocks, RUN_US / 2 - EXCHANGE_PERIOD_US)) < OFFSET_TOLERANCE_US);
+}
+
+int main()
+{
+	//Both clocks wrap a few seconds in, at different points, crystals up to a few hundred ppm apart
+	run_skew(0.0, 0xFFFFFFFFu - 5000000u, 0xFFFFFFFFu - 9000000u);
+	run_skew(40.0, 0xFFFFFFFFu - 5000000u, 0xFFFFFFFFu - 20000000u);
+	run_skew(-40.0, 0xFFFFFFFFu - 30000000u, 0xFFFFFFFFu - 2000000u);
+	run_skew(250.0, 0xFFFFFFFFu - 1000000u, 0xFFFFFFFFu - 40000000u);
+	run_skew(-250.0, 0xFFFFFFFFu - 45000000u, 0xFFFFFFFFu - 1000000u);
+	test_bogus_exchange();
+	return test_summary("test_clock_sync");
+}
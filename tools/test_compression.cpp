@@ -0,0 +1,196 @@
+//Host test for the payload compression stage: PayloadCompressor round trips, decoder bounds on
+//malformed input, FLAG_COMPRESSED through PacketFrame, and UartProtocol::set_compression() only
+//taking effect once a handshake agreed on it.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_compression.cpp <protocol .cpp> <host-core .cpp> -o test_compression
+//Usage: test_compression   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "compression.h"
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define GUARD_BYTE 0x5A
+#define GUARD_LEN 16
+
+//Repetitive enough that the codec has to shrink every one of them
+static const char* const telemetry[] =
+{
+	"Test 1 - Time: 12345",
+	"Sensor - Time: 98765 Sensor - Time: 98766",
+	"temp=21.50,hum=40.25,temp=21.50,hum=40.25,temp=21.75",
+	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+};
+
+static void test_round_trip()
+{
+	uint8_t coded[DefaultConfig::MAX_DATA_LEN];
+	uint8_t decoded[DefaultConfig::MAX_DATA_LEN];
+
+	for (size_t i = 0; i < sizeof(telemetry) / sizeof(telemetry[0]); i++)
+	{
+		const uint8_t* input = (const uint8_t*)telemetry[i];
+		uint16_t length = strlen(telemetry[i]);
+
+		uint16_t coded_len = PayloadCompressor::compress(input, length, coded, sizeof(coded));
+		CHECK(coded_len > 0 && coded_len < length);
+
+		uint16_t decoded_len = PayloadCompressor::decompress(coded, coded_len, decoded, sizeof(decoded));
+		CHECK_EQ(decoded_len, length);
+		CHECK(memcmp(decoded, input, length) == 0);
+	}
+
+	//Every length up to a full frame, text-like and random: either skipped (0) or exact
+	srand(27);
+	for (uint16_t length = 1; length <= DefaultConfig::MAX_DATA_LEN; length++)
+	{
+		uint8_t input[DefaultConfig::MAX_DATA_LEN];
+		for (uint8_t pass = 0; pass < 2; pass++)
+		{
+			for (uint16_t i = 0; i < length; i++)
+			{
+				input[i] = pass == 0 ? "0123456789,.=:"[(i * 7 + length) % 14] : (uint8_t)rand();
+			}
+
+			uint16_t coded_len = PayloadCompressor::compress(input, length, coded, sizeof(coded));
+			CHECK(coded_len < length);
+			if (coded_len == 0) continue;
+
+			uint16_t decoded_len = PayloadCompressor::decompress(coded, coded_len, decoded, sizeof(decoded));
+			CHECK_EQ(decoded_len, length);
+			CHECK(memcmp(decoded, input, length) == 0);
+		}
+	}
+}
+
+static void test_malformed_input()
+{
+	//Random streams must fail cleanly or decode inside output_size, never past it
+	srand(2027);
+	for (int run = 0; run < 20000; run++)
+	{
+		uint8_t input[DefaultConfig::MAX_DATA_LEN];
+		uint8_t output[32 + GUARD_LEN];
+		uint16_t input_len = 1 + rand() % sizeof(input);
+		uint16_t output_size = 1 + rand() % 32;
+
+		for (uint16_t i = 0; i < input_len; i++) input[i] = (uint8_t)rand();
+		memset(output, GUARD_BYTE, sizeof(output));
+
+		uint16_t decoded_len = PayloadCompressor::decompress(input, input_len, output, output_size);
+		CHECK(decoded_len <= output_size);
+
+		bool guard_intact = true;
+		for (uint16_t i = output_size; i < sizeof(output); i++) guard_intact &= output[i] == GUARD_BYTE;
+		CHECK(guard_intact);
+	}
+}
+
+static void test_packet_frame()
+{
+	PacketFrame sender;
+	PacketFrame receiver;
+	Frame frame;
+	const uint8_t* text = (const uint8_t*)telemetry[1];
+	uint16_t length = strlen(telemetry[1]);
+
+	sender.set_compression(true);
+	CHECK(sender.create_frame(TYPE_DATA, text, length, &frame));
+	CHECK(frame.packet_type & FLAG_COMPRESSED);
+	CHECK(frame.data_length < length);
+	CHECK(receiver.validate_frame(&frame));
+	CHECK(receiver.unpack_payload(&frame));
+	CHECK(!(frame.packet_type & FLAG_COMPRESSED));
+	CHECK_EQ(frame.data_length, length);
+	CHECK(memcmp(frame.data, text, length) == 0);
+
+	//A payload that does not shrink goes out as it is
+	uint8_t noise[DefaultConfig::MAX_DATA_LEN];
+	srand(5);
+	for (uint16_t i = 0; i < sizeof(noise); i++) noise[i] = (uint8_t)rand();
+	CHECK(sender.create_frame(TYPE_DATA, noise, sizeof(noise), &frame));
+	CHECK(!(frame.packet_type & FLAG_COMPRESSED));
+	CHECK(receiver.validate_frame(&frame) && receiver.unpack_payload(&frame));
+	CHECK(memcmp(frame.data, noise, sizeof(noise)) == 0);
+
+	//Control frames are never compressed
+	CHECK(sender.create_reply_frame(TYPE_ACK, 1, text, 8, &frame));
+	CHECK(!(frame.packet_type & FLAG_COMPRESSED));
+
+	//A corrupted compressed stream is rejected by unpack, not delivered as garbage
+	CHECK(sender.create_frame(TYPE_DATA, text, length, &frame));
+	memset(frame.data, 0xFF, frame.data_length);
+	CHECK(!receiver.unpack_payload(&frame));
+}
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	uint8_t record[64] = { 0 };
+	record[0] = length < sizeof(record) ? length : 0;
+	memcpy(record + 1, data, record[0]);
+	report.send(record, sizeof(record));
+}
+
+static void test_handshake_gating()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	PerformanceMonitor& perf = master.get_perf_protocol();
+	const uint8_t* text = (const uint8_t*)telemetry[2];
+	uint16_t length = strlen(telemetry[2]);
+
+	//Wished for before any handshake: the peer may not decode it yet, so nothing is compressed
+	master.set_compression(true);
+	CHECK(master.send_uart_message(text, length));
+	CHECK(perf.get_compression_ratio() == 1.0);
+
+	CHECK(master.connect());
+	CHECK(master.send_uart_message(text, length));
+	CHECK(perf.get_compression_ratio() < 1.0);
+
+	//Both messages arrive intact, whether or not they travelled compressed
+	unsigned long start = millis();
+	uint8_t record[64];
+	int received = 0;
+	while (received < 2 && millis() - start < 2000)
+	{
+		master.receive_data_uart_master();
+		if (!report.receive(record, sizeof(record))) continue;
+		CHECK_EQ(record[0], length);
+		CHECK(memcmp(record + 1, text, length) == 0);
+		received++;
+	}
+	CHECK_EQ(received, 2);
+
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_round_trip();
+	test_malformed_input();
+	test_packet_frame();
+	test_handshake_gating();
+	return test_summary("test_compression");
+}
@@ -0,0 +1,171 @@
+//Host test for credit-based flow control: a consumer far slower than the link must pause the
+//sender on zero credit instead of making it time out and retransmit, and every message must
+//still arrive once and in order. A consumer slower than ACK_TIMEOUT_MS itself must not cost
+//retransmissions either, its delivery waits until the sender is paused. A frame whose zero-credit
+//ACK was lost is ACKed again on retransmission, never NACKed as if the queue had no room for it.
+//
+//Host-only (Linux, runs over a PtyTransport socketpair), built against an Arduino host core
+//(e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_flow_control.cpp <protocol .cpp> <host-core .cpp> -o test_flow_control
+//Usage: test_flow_control   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+#include "packet_frame.h"
+
+#define FLOW_MESSAGES 16
+
+static PeerReport report;
+static uint32_t consumer_delay_ms;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	uint32_t number = 0xFFFFFFFF;
+	if (length == sizeof(number)) memcpy(&number, data, sizeof(number));
+	report.send(&number, sizeof(number));
+	delay(consumer_delay_ms);
+}
+
+//Slave end that loses the first zero-credit ACK and the window update that would answer it too,
+//so only the retransmission of that frame can get it ACKed
+class LostAckTransport : public PtyTransport
+{
+private:
+	uint16_t lost_seq;
+	uint8_t lost;
+
+public:
+	LostAckTransport() : lost_seq(0), lost(0) {}
+
+	size_t write(const uint8_t* buffer, size_t size)
+	{
+		Frame frame;
+		if (lost < 2 && PacketFrame::deserialize_frame(buffer, (uint16_t)size, &frame) && PacketFrame::get_type(&frame) == TYPE_ACK)
+		{
+			if (lost == 0 && frame.data_length > 0 && frame.data[0] == 0) lost_seq = frame.sequence_num;
+			if ((lost == 0 && frame.data_length > 0 && frame.data[0] == 0) || (lost > 0 && frame.sequence_num == lost_seq))
+			{
+				lost++;
+				return size;
+			}
+		}
+		return PtyTransport::write(buffer, size);
+	}
+};
+
+static void run_lost_zero_credit_ack()
+{
+	PtyTransport master_end;
+	LostAckTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(115200);
+	slave_end.set_baud_rate(115200);
+	consumer_delay_ms = 150;
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	PerformanceMonitor& perf = master.get_perf_protocol();
+	uint32_t retransmissions_before = perf.get_retransmissions();
+	uint32_t failures_before = perf.get_data_failures();
+
+	//The frame behind the lost ACK is retransmitted into a queue that already holds it: ACKed, not failed
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < FLOW_MESSAGES; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked++;
+	}
+	CHECK_EQ(acked, FLOW_MESSAGES);
+	CHECK_EQ(perf.get_retransmissions(), retransmissions_before + 1);
+	CHECK_EQ(perf.get_data_failures(), failures_before + 1);//only the attempt whose ACKs were lost
+
+	//And it is delivered once
+	unsigned long start = millis();
+	uint32_t expected = 0;
+	uint32_t number;
+	while (expected < FLOW_MESSAGES && millis() - start < (RX_DELIVERY_DEPTH + 2) * (consumer_delay_ms + CREDIT_PROBE_MS))
+	{
+		master.receive_data_uart_master();
+		if (!report.receive(&number, sizeof(number))) continue;
+		CHECK_EQ(number, expected);
+		expected++;
+	}
+	CHECK_EQ(expected, FLOW_MESSAGES);
+	CHECK(!report.receive(&number, sizeof(number)));
+
+	stop_peer(peer);
+}
+
+static void run_slow_consumer(uint32_t delay_ms, uint32_t messages)
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(115200);
+	slave_end.set_baud_rate(115200);
+	consumer_delay_ms = delay_ms;
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	PerformanceMonitor& perf = master.get_perf_protocol();
+	uint32_t retransmissions_before = perf.get_retransmissions();
+	uint32_t failures_before = perf.get_data_failures();
+
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < messages; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked++;
+		CHECK(master.get_peer_credits() <= RX_DELIVERY_DEPTH);
+	}
+	CHECK_EQ(acked, messages);
+
+	//The sender waited for credit, the link itself never looked lossy
+	CHECK(perf.get_flow_control_pauses() > 0);
+	CHECK_EQ(perf.get_retransmissions(), retransmissions_before);
+	CHECK_EQ(perf.get_data_failures(), failures_before);
+
+	//Drain what is still buffered at the receiver, then every message once, in order
+	unsigned long start = millis();
+	uint32_t expected = 0;
+	uint32_t number;
+	while (expected < messages && millis() - start < (RX_DELIVERY_DEPTH + 2) * (delay_ms + CREDIT_PROBE_MS))
+	{
+		master.receive_data_uart_master();
+		if (!report.receive(&number, sizeof(number))) continue;
+		CHECK_EQ(number, expected);
+		expected++;
+	}
+	CHECK_EQ(expected, messages);
+
+	stop_peer(peer);
+}
+
+int main()
+{
+	run_slow_consumer(150, FLOW_MESSAGES);
+	run_slow_consumer(DefaultConfig::ACK_TIMEOUT_MS + 200, RX_DELIVERY_DEPTH + 2);
+	run_lost_zero_credit_ack();
+	return test_summary("test_flow_control");
+}
@@ -0,0 +1,178 @@
+//Host test for fragmentation and the adaptive payload size: PayloadSizeController decisions
+//(DATA attempts only, rebase after a statistics reset), then whole messages up to
+//UART_MAX_MESSAGE over a clean and a noisy link, where the handler must only ever see complete,
+//intact messages and every ACKed one must arrive.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_fragmentation.cpp <protocol .cpp> <host-core .cpp> -o test_fragmentation
+//Usage: test_fragmentation   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <set>
+
+#include "host_test.h"
+#include "payload_controller.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define LINK_MESSAGES 30
+
+static void test_controller()
+{
+	PerformanceMonitor perf;
+	PayloadSizeController controller(DefaultConfig::MAX_DATA_LEN);
+	controller.set_link(115200, DefaultConfig::ACK_TIMEOUT_MS);
+	CHECK_EQ(controller.get_payload_size(), DefaultConfig::MAX_DATA_LEN);
+
+	//Control traffic and handshake retries are not DATA attempts: nothing to learn from them
+	for (int i = 0; i < 500; i++) perf.packet_sent(10);
+	for (int i = 0; i < 20; i++) perf.retransmission_occurred();
+	controller.update(perf);
+	CHECK_EQ(controller.get_payload_size(), DefaultConfig::MAX_DATA_LEN);
+	CHECK(controller.get_ber_estimate() == 0.0f);
+
+	//Below CONTROLLER_MIN_SAMPLES the estimate does not move
+	for (int i = 0; i < CONTROLLER_MIN_SAMPLES - 1; i++) perf.data_attempt(false);
+	controller.update(perf);
+	CHECK(controller.get_ber_estimate() == 0.0f);
+
+	//Three attempts in four failing: smaller fragments, never below the floor
+	for (int round = 0; round < 10; round++)
+	{
+		for (int i = 0; i < 20; i++) perf.data_attempt(i % 4 == 0);
+		controller.update(perf);
+	}
+	uint16_t degraded = controller.get_payload_size();
+	CHECK(controller.get_ber_estimate() > 0.0f);
+	CHECK(degraded < DefaultConfig::MAX_DATA_LEN);
+	CHECK(degraded >= CONTROLLER_MIN_PAYLOAD);
+
+	//A statistics reset moves the counters backwards: rebase instead of reading a huge delta
+	perf.reset_statistics();
+	for (int round = 0; round < 40; round++)
+	{
+		for (int i = 0; i < 20; i++) perf.data_attempt(true);
+		controller.update(perf);
+	}
+	CHECK(controller.get_payload_size() > degraded);
+	CHECK(controller.get_ber_estimate() < 1e-5f);
+
+	//Goodput model: on a clean link the largest payload wins, a lossy one prefers shorter frames
+	uint32_t timeout_bytes = 1000;
+	CHECK(PayloadSizeController::expected_efficiency(52, 0.0f, timeout_bytes) > PayloadSizeController::expected_efficiency(16, 0.0f, timeout_bytes));
+	CHECK(PayloadSizeController::expected_efficiency(16, 5e-3f, timeout_bytes) > PayloadSizeController::expected_efficiency(52, 5e-3f, timeout_bytes));
+}
+
+//Message k: 4-byte number, then a pattern derived from it, so any splice or gap shows up
+static uint16_t message_length(uint32_t k)
+{
+	return 4 + (k * 37) % (UART_MAX_MESSAGE - 3);
+}
+
+static void fill_message(uint32_t k, uint8_t* buffer, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++) buffer[i] = (uint8_t)(k * 31 + i * 7 + (i >> 3));
+	memcpy(buffer, &k, sizeof(k));
+}
+
+typedef struct
+{
+	uint32_t number;
+	uint16_t length;
+	uint8_t intact;
+}DeliveryRecord;
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	DeliveryRecord record = { 0xFFFFFFFF, length, 0 };
+	if (length >= sizeof(record.number))
+	{
+		uint8_t expected[UART_MAX_MESSAGE];
+		memcpy(&record.number, data, sizeof(record.number));
+		fill_message(record.number, expected, length);
+		record.intact = length == message_length(record.number) && memcmp(expected, data, length) == 0;
+	}
+	report.send(&record, sizeof(record));
+}
+
+static void run_link(float bit_error_rate)
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(921600);
+	slave_end.set_baud_rate(921600);
+	master_end.set_fault_injection(bit_error_rate, 0, 7);
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		slave_end.set_fault_injection(bit_error_rate, 0, 9);
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+
+	uint8_t buffer[UART_MAX_MESSAGE + 1];
+	std::set<uint32_t> acked;
+	for (uint32_t k = 0; k < LINK_MESSAGES; k++)
+	{
+		uint16_t length = message_length(k);
+		fill_message(k, buffer, length);
+		if (master.send_uart_message(buffer, length)) acked.insert(k);
+		for (int i = 0; i < 5; i++) master.receive_data_uart_master();
+	}
+
+	//Longer than the receiver's reassembly buffer: refused up front
+	CHECK(!master.send_uart_message(buffer, UART_MAX_MESSAGE + 1));
+
+	unsigned long start = millis();
+	while (millis() - start < 500) master.receive_data_uart_master();
+	stop_peer(peer);
+
+	std::set<uint32_t> delivered;
+	DeliveryRecord record;
+	uint32_t broken = 0;
+	while (report.receive(&record, sizeof(record)))
+	{
+		if (!record.intact)
+		{
+			broken++;
+			continue;
+		}
+		CHECK(delivered.insert(record.number).second);
+	}
+	CHECK_EQ(broken, 0);
+
+	uint32_t acked_missing = 0;
+	for (uint32_t k : acked) acked_missing += delivered.count(k) == 0;
+	CHECK_EQ(acked_missing, 0);
+
+	if (bit_error_rate == 0)
+	{
+		CHECK_EQ(acked.size(), LINK_MESSAGES);
+	}
+	else
+	{
+		//Noise costs retries and may drop whole messages, never parts of them
+		CHECK(master.get_perf_protocol().get_data_failures() > 0);
+		CHECK(delivered.size() > 0);
+	}
+	printf("BER %g: %u sent, %u ACKed, %u delivered\n", bit_error_rate, LINK_MESSAGES, (unsigned)acked.size(), (unsigned)delivered.size());
+}
+
+int main()
+{
+	test_controller();
+	run_link(0);
+	run_link(3e-4f);
+	return test_summary("test_fragmentation");
+}
@@ -0,0 +1,320 @@
+//Host test for the SYN/SYN-ACK handshake: LinkNegotiation settles mismatched max payload, CRC
+//variants, features and baud on the lowest common denominator, an incompatible offer is NACKed
+//instead of answered, a peer built for a smaller frame and a slower peer end up on the common
+//session, and a stepped-up link that fails or degrades comes back one baud step lower.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_handshake.cpp <protocol .cpp> <host-core .cpp> -o test_handshake
+//Usage: test_handshake   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "link_params.h"
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define REPLY_TIMEOUT_MS 500
+#define DEGRADED_MESSAGES 200
+
+static void test_negotiate()
+{
+	LinkParams local;
+	LinkParams peer;
+	LinkParams agreed;
+
+	LinkNegotiation::get_local_params(&local, 921600, 52);
+	LinkNegotiation::get_local_params(&peer, 230400, 16);
+
+	//Mismatched payload and baud: the smaller one of each
+	CHECK(LinkNegotiation::negotiate(&local, &peer, &agreed));
+	CHECK_EQ(agreed.version, LINK_PROTOCOL_VERSION);
+	CHECK_EQ(agreed.max_payload, 16);
+	CHECK_EQ(agreed.window_size, 1);
+	CHECK_EQ(agreed.crc_variants, CRC_VARIANT_CCITT);
+	CHECK_EQ(agreed.features, FEATURE_COMPRESSION);
+	CHECK_EQ(agreed.max_baud, 230400);
+
+	//Symmetric: both ends reach the same session
+	LinkParams reverse;
+	CHECK(LinkNegotiation::negotiate(&peer, &local, &reverse));
+	CHECK(memcmp(&agreed, &reverse, sizeof(agreed)) == 0);
+
+	//Features: only what both offer
+	peer.features = FEATURE_COMPRESSION | FEATURE_FEC;
+	local.features = FEATURE_FEC;
+	CHECK(LinkNegotiation::negotiate(&local, &peer, &agreed));
+	CHECK_EQ(agreed.features, FEATURE_FEC);
+	peer.features = 0;
+	CHECK(LinkNegotiation::negotiate(&local, &peer, &agreed));
+	CHECK_EQ(agreed.features, 0);
+
+	//CRC variants: exactly one, the lowest common bit
+	local.crc_variants = CRC_VARIANT_CCITT | CRC_VARIANT_AEAD;
+	peer.crc_variants = CRC_VARIANT_CCITT | CRC_VARIANT_AEAD;
+	CHECK(LinkNegotiation::negotiate(&local, &peer, &agreed));
+	CHECK_EQ(agreed.crc_variants, CRC_VARIANT_CCITT);
+	peer.crc_variants = CRC_VARIANT_AEAD;
+	CHECK(LinkNegotiation::negotiate(&local, &peer, &agreed));
+	CHECK_EQ(agreed.crc_variants, CRC_VARIANT_AEAD);
+
+	//Nothing in common, another protocol version or an empty window: no session at all
+	local.crc_variants = CRC_VARIANT_CCITT;
+	CHECK(!LinkNegotiation::negotiate(&local, &peer, &agreed));
+	peer.crc_variants = CRC_VARIANT_CCITT;
+	peer.version = LINK_PROTOCOL_VERSION + 1;
+	CHECK(!LinkNegotiation::negotiate(&local, &peer, &agreed));
+	peer.version = LINK_PROTOCOL_VERSION;
+	peer.window_size = 0;
+	CHECK(!LinkNegotiation::negotiate(&local, &peer, &agreed));
+	peer.window_size = 1;
+	peer.max_payload = 0;
+	CHECK(!LinkNegotiation::negotiate(&local, &peer, &agreed));
+
+	//Baud rates snap down to a standard one, the step-down floor is the base rate
+	CHECK_EQ(LinkNegotiation::snap_baud(500000), 460800);
+	CHECK_EQ(LinkNegotiation::snap_baud(9600), LINK_BASE_BAUD);
+	CHECK_EQ(LinkNegotiation::snap_baud(3000000), 2000000);
+	CHECK_EQ(LinkNegotiation::step_down_baud(921600), 460800);
+	CHECK_EQ(LinkNegotiation::step_down_baud(500000), 460800);
+	CHECK_EQ(LinkNegotiation::step_down_baud(LINK_BASE_BAUD), LINK_BASE_BAUD);
+}
+
+static PeerReport report;
+static PtyTransport* slave_link;
+static PtyTransport* master_link;
+static uint32_t master_bauds;
+
+static void slave_baud(uint32_t baud)
+{
+	slave_link->set_baud_rate(baud);
+}
+
+static void master_baud(uint32_t baud)
+{
+	master_link->set_baud_rate(baud);
+	master_bauds++;
+}
+
+//Default-profile slave that reports every session it agrees to
+static pid_t start_slave(PtyTransport& slave_end, uint32_t max_baud)
+{
+	pid_t peer = start_peer([&slave_end, max_baud]()
+	{
+		report.child_side();
+		slave_link = &slave_end;
+		UartProtocol slave(&slave_end);
+		slave.set_baud_callback(slave_baud);
+		slave.set_max_baud(max_baud);
+
+		LinkParams reported;
+		memset(&reported, 0, sizeof(reported));
+		for (;;)
+		{
+			slave.receive_data_uart_slave();
+			if (slave.is_session_up() && memcmp(&reported, &slave.get_session_params(), sizeof(reported)) != 0)
+			{
+				reported = slave.get_session_params();
+				report.send(&reported, sizeof(reported));
+			}
+		}
+	});
+	report.parent_side();
+	return peer;
+}
+
+static bool wait_report(LinkParams* params)
+{
+	unsigned long start = millis();
+	while (millis() - start < REPLY_TIMEOUT_MS)
+	{
+		if (report.receive(params, sizeof(*params))) return true;
+	}
+	return false;
+}
+
+//Raw SYN from the test itself, so the offer can be anything a foreign peer might send
+static bool exchange_syn(PtyTransport& master_end, UartProtocol& parser, const uint8_t* offer, uint16_t offer_len, Frame* reply)
+{
+	static PacketFrame sender;
+	Frame syn;
+	uint8_t wire[sizeof(Frame)];
+	if (!sender.create_frame(TYPE_SYN, offer, offer_len, &syn)) return false;
+
+	uint16_t wire_len = PacketFrame::serialize_frame(&syn, wire);
+	master_end.write(wire, wire_len);
+
+	PacketFrame checker;
+	unsigned long start = millis();
+	while (millis() - start < REPLY_TIMEOUT_MS)
+	{
+		if (parser.receive_uart(reply) && checker.validate_frame(reply) && reply->sequence_num == syn.sequence_num) return true;
+	}
+	return false;
+}
+
+static void test_offers()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	pid_t peer = start_slave(slave_end, 921600);
+
+	UartProtocol parser(&master_end);
+	LinkParams offer;
+	LinkParams agreed;
+	Frame reply;
+
+	//Compatible but different in every field: the SYN-ACK carries the common subset
+	LinkNegotiation::get_local_params(&offer, 230400, 20);
+	offer.crc_variants = CRC_VARIANT_CCITT | CRC_VARIANT_AEAD;
+	offer.features = FEATURE_FEC;
+	CHECK(exchange_syn(master_end, parser, (const uint8_t*)&offer, sizeof(offer), &reply));
+	CHECK_EQ(PacketFrame::get_type(&reply), TYPE_SYN_ACK);
+	CHECK_EQ(reply.data_length, sizeof(agreed));
+	memcpy(&agreed, reply.data, sizeof(agreed));
+	CHECK_EQ(agreed.max_payload, 20);
+	CHECK_EQ(agreed.crc_variants, CRC_VARIANT_CCITT);
+	CHECK_EQ(agreed.features, 0);
+	CHECK_EQ(agreed.max_baud, 230400);
+
+	LinkParams slave_session;
+	CHECK(wait_report(&slave_session));
+	CHECK(memcmp(&slave_session, &agreed, sizeof(agreed)) == 0);
+	master_end.set_baud_rate(230400);
+
+	//Incompatible offers are NACKed, not answered with a session
+	LinkNegotiation::get_local_params(&offer, 230400, 20);
+	offer.crc_variants = CRC_VARIANT_AEAD;
+	CHECK(exchange_syn(master_end, parser, (const uint8_t*)&offer, sizeof(offer), &reply));
+	CHECK_EQ(PacketFrame::get_type(&reply), TYPE_NACK);
+
+	LinkNegotiation::get_local_params(&offer, 230400, 20);
+	offer.version = LINK_PROTOCOL_VERSION + 1;
+	CHECK(exchange_syn(master_end, parser, (const uint8_t*)&offer, sizeof(offer), &reply));
+	CHECK_EQ(PacketFrame::get_type(&reply), TYPE_NACK);
+
+	LinkNegotiation::get_local_params(&offer, 230400, 0);
+	CHECK(exchange_syn(master_end, parser, (const uint8_t*)&offer, sizeof(offer), &reply));
+	CHECK_EQ(PacketFrame::get_type(&reply), TYPE_NACK);
+
+	//A keyed offer (salt appended) to an unkeyed peer
+	uint8_t salted[sizeof(LinkParams) + SESSION_SALT_LEN];
+	LinkNegotiation::get_local_params(&offer, 230400, 20);
+	memcpy(salted, &offer, sizeof(offer));
+	memset(salted + sizeof(offer), 0x5A, SESSION_SALT_LEN);
+	CHECK(exchange_syn(master_end, parser, salted, sizeof(salted), &reply));
+	CHECK_EQ(PacketFrame::get_type(&reply), TYPE_NACK);
+
+	//None of them moved the session the slave already had
+	CHECK(!report.receive(&slave_session, sizeof(slave_session)));
+
+	stop_peer(peer);
+}
+
+static void test_mismatched_peers()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	pid_t peer = start_slave(slave_end, 460800);
+
+	//Control-profile master, 16-byte frames and a faster UART than the peer's
+	master_link = &master_end;
+	master_bauds = 0;
+	UartProtocolT<ControlConfig> master(&master_end);
+	master.set_baud_callback(master_baud);
+	master.set_max_baud(2000000);
+	CHECK(master.connect(DefaultConfig::ACK_TIMEOUT_MS));
+	CHECK(master.is_session_up());
+
+	const LinkParams& agreed = master.get_session_params();
+	CHECK_EQ(agreed.max_payload, ControlConfig::MAX_DATA_LEN);
+	CHECK_EQ(agreed.crc_variants, CRC_VARIANT_CCITT);
+	CHECK_EQ(agreed.features, FEATURE_COMPRESSION);
+	CHECK_EQ(agreed.max_baud, 460800);
+	CHECK_EQ(master.get_current_baud(), 460800);
+	CHECK_EQ(master_bauds, 1);
+
+	LinkParams slave_session;
+	CHECK(wait_report(&slave_session));
+	CHECK(memcmp(&slave_session, &agreed, sizeof(agreed)) == 0);
+
+	//A full control-profile frame gets through on the agreed session
+	uint8_t message[ControlConfig::MAX_DATA_LEN];
+	memset(message, 0x3C, sizeof(message));
+	CHECK(master.send_uart_message(message, sizeof(message)));
+
+	stop_peer(peer);
+}
+
+//Stops the peer and returns once it really is stopped
+static void freeze(pid_t peer)
+{
+	int status;
+	kill(peer, SIGSTOP);
+	waitpid(peer, &status, WUNTRACED);
+}
+
+static void test_step_down()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	pid_t peer = start_slave(slave_end, 2000000);
+
+	master_link = &master_end;
+	UartProtocol master(&master_end);
+	master.set_baud_callback(master_baud);
+	master.set_max_baud(921600);
+	CHECK(master.connect());
+	CHECK_EQ(master.get_current_baud(), 921600);
+
+	//A frame that never gets through at the stepped-up rate: back to base, the ceiling one step lower
+	uint32_t n = 0;
+	freeze(peer);
+	CHECK(!master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+	CHECK_EQ(master.get_current_baud(), LINK_BASE_BAUD);
+	CHECK(!master.is_session_up());
+	kill(peer, SIGCONT);
+
+	//Wait out the DOWN state, then the next handshake offers the lower step
+	unsigned long start = millis();
+	while (master.get_link_state() != LINK_UP && millis() - start < 3 * LINK_REPROBE_MS) master.receive_data_uart_master();
+	CHECK(master.connect());
+	CHECK_EQ(master.get_current_baud(), 460800);
+	CHECK_EQ(master.get_session_params().max_baud, 460800);
+
+	//Still working but retransmitting above LINK_ERROR_THRESHOLD_PCT: renegotiated one step lower
+	master_end.set_fault_injection(0, 0.005f, 29);
+	for (n = 0; n < DEGRADED_MESSAGES && master.get_current_baud() == 460800; n++)
+	{
+		master.send_uart_message((const uint8_t*)&n, sizeof(n));
+		master.receive_data_uart_master();
+	}
+	master_end.set_fault_injection(0, 0, 29);
+	CHECK_EQ(master.get_current_baud(), 230400);
+	CHECK(master.is_session_up());
+
+	LinkParams slave_session;
+	LinkParams last;
+	memset(&last, 0, sizeof(last));
+	while (wait_report(&slave_session)) last = slave_session;
+	CHECK_EQ(last.max_baud, 230400);
+
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_negotiate();
+	test_offers();
+	test_mismatched_peers();
+	test_step_down();
+	return test_summary("test_handshake");
+}
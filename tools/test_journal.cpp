@@ -0,0 +1,441 @@
+//Host test for the TX journal: FIFO order and contents across reopen, a journal that fills up
+//and wraps onto acknowledged sectors, and crash recovery with set_write_limit() cutting an
+//append or an ACK at every byte, including the sector open and erase an append may start. After
+//each cut the earlier records must be intact, the cut record whole or absent, and appends must go
+//on without anything landing behind a torn record. Last, a journaled message whose ACK never
+//reached flash is sent again after a reboot and the receiver drops the repeat.
+//
+//Host-only (Linux, the backing file goes to /tmp, the link part runs over a PtyTransport
+//socketpair), built against an Arduino host core (e.g. EpoxyDuino) together with the protocol
+//sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_journal.cpp <protocol .cpp> <host-core .cpp> -o test_journal
+//Usage: test_journal   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <deque>
+
+#include "host_test.h"
+#include "tx_journal.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define WRITE_LIMIT_OFF 0xFFFFFFFF
+#define BIG_RECORD 1000//four to a sector
+#define SMALL_RECORD 37
+
+static char journal_path[] = "/tmp/test_journal_XXXXXX";
+
+//Message k, never 0xFF: a byte the cut did not program must not read back as written
+static void fill_message(uint32_t k, uint8_t* buffer, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++) buffer[i] = (uint8_t)((k * 29 + i * 3) % 255);
+}
+
+typedef struct
+{
+	uint32_t k;
+	uint16_t length;
+}JournalEntry;
+
+//Empty backing file: the next begin() creates it erased
+static void wipe()
+{
+	CHECK(truncate(journal_path, 0) == 0);
+}
+
+static bool append_message(TxJournal& journal, uint32_t k, uint16_t length)
+{
+	static uint8_t buffer[JOURNAL_MAX_PAYLOAD];
+	fill_message(k, buffer, length);
+	return journal.append(buffer, length, (uint8_t)(k % 4));
+}
+
+//Pending messages must be exactly `expected`, oldest first; acknowledges them all
+static void drain_and_check(TxJournal& journal, const std::deque<JournalEntry>& expected)
+{
+	static uint8_t buffer[JOURNAL_MAX_PAYLOAD];
+	static uint8_t reference[JOURNAL_MAX_PAYLOAD];
+
+	CHECK_EQ(journal.get_pending(), expected.size());
+	bool first = true;
+	uint32_t last_id = 0;
+	for (const JournalEntry& entry : expected)
+	{
+		uint16_t length;
+		uint8_t channel;
+		uint32_t id;
+		CHECK(journal.peek(&length, &channel, &id));
+		CHECK_EQ(length, entry.length);
+		CHECK_EQ(channel, entry.k % 4);
+		CHECK(first || id > last_id);
+		first = false;
+		last_id = id;
+
+		fill_message(entry.k, reference, entry.length);
+		CHECK(journal.read(0, buffer, entry.length));
+		CHECK(memcmp(buffer, reference, entry.length) == 0);
+		CHECK(journal.ack());
+	}
+	CHECK(!journal.peek(nullptr, nullptr));
+	CHECK(!journal.ack());
+}
+
+static void test_queue()
+{
+	wipe();
+	std::deque<JournalEntry> expected;
+	uint8_t buffer[JOURNAL_MAX_PAYLOAD];
+
+	{
+		TxJournal journal;
+		CHECK(journal.begin(journal_path, 4));
+		CHECK(!journal.peek(nullptr, nullptr));
+
+		//Bounds
+		CHECK(!journal.append(buffer, JOURNAL_MAX_PAYLOAD + 1));
+		CHECK(!journal.append(nullptr, 10));
+
+		for (uint32_t k = 0; k < 10; k++)
+		{
+			uint16_t length = 1 + k * 53;
+			CHECK(append_message(journal, k, length));
+			expected.push_back({ k, length });
+		}
+
+		//Reads stay inside the peeked message
+		uint16_t length;
+		CHECK(journal.peek(&length, nullptr));
+		CHECK(!journal.read(0, buffer, length + 1));
+		CHECK(journal.read(length - 1, buffer, 1));
+
+		CHECK(journal.ack());
+		expected.pop_front();
+	}
+
+	//A reopen sees the same pending messages, the acknowledged one stays gone
+	TxJournal journal;
+	CHECK(journal.begin(journal_path, 4));
+	drain_and_check(journal, expected);
+
+	//A whole-sector message fits, ids keep rising after the reopen
+	expected.clear();
+	CHECK(append_message(journal, 100, JOURNAL_MAX_PAYLOAD));
+	expected.push_back({ 100, (uint16_t)JOURNAL_MAX_PAYLOAD });
+	drain_and_check(journal, expected);
+
+	//Another sector count is another layout, not ours to reinterpret
+	journal.end();
+	TxJournal other;
+	CHECK(!other.begin(journal_path, 8));
+}
+
+static void test_full_and_wrap()
+{
+	wipe();
+	TxJournal journal;
+	CHECK(journal.begin(journal_path, 4));
+
+	//Every sector full of pending records: the next append is refused, nothing is overwritten
+	uint32_t stored = 0;
+	while (append_message(journal, stored, BIG_RECORD)) stored++;
+	CHECK_EQ(stored, 16);
+	CHECK_EQ(journal.get_free_sectors(), 0);
+
+	//Acknowledging the oldest sector frees it for the head
+	std::deque<JournalEntry> expected;
+	for (uint32_t k = 0; k < stored; k++) expected.push_back({ k, BIG_RECORD });
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		CHECK(journal.ack());
+		expected.pop_front();
+	}
+	for (uint32_t k = stored; k < stored + 4; k++)
+	{
+		CHECK(append_message(journal, k, BIG_RECORD));
+		expected.push_back({ k, BIG_RECORD });
+	}
+	CHECK(!append_message(journal, 99, BIG_RECORD));
+	drain_and_check(journal, expected);
+
+	//Random traffic against a FIFO model, reopened every so often: many laps around the ring
+	srand(44);
+	expected.clear();
+	uint32_t k = 1000;
+	for (int op = 0; op < 6000; op++)
+	{
+		if (op % 500 == 499)
+		{
+			journal.end();
+			CHECK(journal.begin(journal_path, 4));
+			CHECK_EQ(journal.get_pending(), expected.size());
+		}
+
+		if (rand() % 2 == 0)
+		{
+			uint16_t length = 1 + rand() % 600;
+			if (append_message(journal, k, length)) expected.push_back({ k, length });
+			else CHECK(journal.get_free_sectors() == 0);
+			k++;
+		}
+		else if (!expected.empty())
+		{
+			uint16_t length;
+			uint8_t channel;
+			uint8_t buffer[600];
+			uint8_t reference[600];
+			CHECK(journal.peek(&length, &channel));
+			CHECK_EQ(length, expected.front().length);
+			fill_message(expected.front().k, reference, length);
+			CHECK(journal.read(0, buffer, length) && memcmp(buffer, reference, length) == 0);
+			CHECK(journal.ack());
+			expected.pop_front();
+		}
+	}
+	drain_and_check(journal, expected);
+}
+
+//Journal states a torn append is tried from
+typedef enum
+{
+	TORN_MID_SECTOR,//room left in the head sector
+	TORN_OPENS_BLANK,//the append opens a never used sector
+	TORN_OPENS_USED,//the append wraps onto an acknowledged sector: retire, erase, new header
+}TornCase;
+
+static void prepare(TornCase which, TxJournal& journal, std::deque<JournalEntry>& expected, uint32_t* k)
+{
+	expected.clear();
+	switch (which)
+	{
+	case TORN_MID_SECTOR:
+		CHECK(journal.begin(journal_path, 4));
+		for (uint32_t i = 0; i < 2; i++) expected.push_back({ i, SMALL_RECORD });
+		break;
+	case TORN_OPENS_BLANK:
+		CHECK(journal.begin(journal_path, 4));
+		for (uint32_t i = 0; i < 4; i++) expected.push_back({ i, BIG_RECORD });
+		break;
+	case TORN_OPENS_USED:
+		//Three sectors: the first two hold acknowledged records only, the third is full with two pending
+		CHECK(journal.begin(journal_path, 3));
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			CHECK(append_message(journal, 100 + i, BIG_RECORD));
+			CHECK(journal.ack());
+		}
+		for (uint32_t i = 0; i < 4; i++) expected.push_back({ i, BIG_RECORD });
+		break;
+	}
+
+	for (const JournalEntry& entry : expected) CHECK(append_message(journal, entry.k, entry.length));
+	if (which == TORN_OPENS_USED)
+	{
+		CHECK(journal.ack());
+		CHECK(journal.ack());
+		expected.pop_front();
+		expected.pop_front();
+	}
+	*k = 10;
+}
+
+//One cut at `limit` bytes into the append, then a reboot; carry_on = power came back without one first
+static bool run_torn_append(TornCase which, uint16_t sectors, uint32_t limit, bool carry_on)
+{
+	std::deque<JournalEntry> expected;
+	uint32_t k;
+	uint16_t length = which == TORN_MID_SECTOR ? SMALL_RECORD : BIG_RECORD;
+	bool stored;
+
+	wipe();
+	{
+		TxJournal journal;
+		prepare(which, journal, expected, &k);
+
+		journal.set_write_limit(limit);
+		stored = append_message(journal, k, length);
+		if (stored) expected.push_back({ k, length });
+		k++;
+
+		//The same instance carries on past the damage
+		if (carry_on)
+		{
+			journal.set_write_limit(WRITE_LIMIT_OFF);
+			CHECK(append_message(journal, k, SMALL_RECORD));
+			expected.push_back({ k, SMALL_RECORD });
+			k++;
+		}
+	}
+
+	//Reboot: earlier records intact, the cut one whole or gone, appends land where they can be found
+	{
+		TxJournal journal;
+		CHECK(journal.begin(journal_path, sectors));
+		CHECK_EQ(journal.get_pending(), expected.size());
+		CHECK(append_message(journal, k, SMALL_RECORD));
+		expected.push_back({ k, SMALL_RECORD });
+	}
+
+	TxJournal journal;
+	CHECK(journal.begin(journal_path, sectors));
+	drain_and_check(journal, expected);
+	return stored;
+}
+
+static void test_torn_append(TornCase which, uint16_t sectors)
+{
+	//Every cut point from nothing written up to the first one the append survives
+	uint32_t limit;
+	unsigned failures_before = test_failures;
+	for (limit = 0;; limit++)
+	{
+		bool stored = run_torn_append(which, sectors, limit, false);
+		CHECK_EQ(run_torn_append(which, sectors, limit, true), stored);
+		if (stored) break;
+
+		if (test_failures > failures_before)
+		{
+			printf("torn append case %d: first failure at write limit %u\n", which, limit);
+			return;
+		}
+	}
+	CHECK(limit > sizeof(JournalRecord));
+}
+
+static void test_torn_ack()
+{
+	wipe();
+	std::deque<JournalEntry> expected;
+	{
+		TxJournal journal;
+		CHECK(journal.begin(journal_path, 4));
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			CHECK(append_message(journal, k, SMALL_RECORD));
+			expected.push_back({ k, SMALL_RECORD });
+		}
+
+		//The state byte never reaches flash: the message stays at the head, here and after a reboot
+		journal.set_write_limit(0);
+		CHECK(!journal.ack());
+		CHECK_EQ(journal.get_pending(), 3);
+		uint32_t id;
+		CHECK(journal.peek(nullptr, nullptr, &id));
+		CHECK_EQ(id, 0);
+	}
+
+	TxJournal journal;
+	CHECK(journal.begin(journal_path, 4));
+	drain_and_check(journal, expected);
+}
+
+typedef struct
+{
+	uint16_t length;
+	uint8_t replay;//1 = the slave dropped a journal replay
+}DeliveryRecord;
+
+static PeerReport report;
+
+static void on_message(const uint8_t*, uint16_t length, uint8_t)
+{
+	DeliveryRecord record = { length, 0 };
+	report.send(&record, sizeof(record));
+}
+
+static void test_replay_after_reboot()
+{
+	wipe();
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(921600);
+	slave_end.set_baud_rate(921600);
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		uint32_t replays = 0;
+		for (;;)
+		{
+			slave.receive_data_uart_slave();
+			for (; replays < slave.get_replays_dropped(); replays++)
+			{
+				DeliveryRecord record = { 0, 1 };
+				report.send(&record, sizeof(record));
+			}
+		}
+	});
+	report.parent_side();
+
+	//First boot: delivered and ACKed on the wire, but the ACK never reaches the journal
+	{
+		TxJournal journal;
+		CHECK(journal.begin(journal_path, 4));
+		CHECK(append_message(journal, 0, 100));
+		CHECK(append_message(journal, 1, 30));
+
+		UartProtocol master(&master_end);
+		master.set_journal(&journal);
+		journal.set_write_limit(0);
+		master.drain_journal(1);
+		CHECK_EQ(journal.get_pending(), 2);
+	}
+
+	//Second boot: the same record goes out again, tagged with the same id
+	TxJournal journal;
+	CHECK(journal.begin(journal_path, 4));
+	CHECK_EQ(journal.get_pending(), 2);
+	UartProtocol master(&master_end);
+	master.set_journal(&journal);
+
+	unsigned long start = millis();
+	while (journal.get_pending() > 0 && millis() - start < 3000)
+	{
+		master.drain_journal();
+		master.receive_data_uart_master();
+	}
+	CHECK_EQ(journal.get_pending(), 0);
+
+	start = millis();
+	while (millis() - start < 300) master.receive_data_uart_master();
+	stop_peer(peer);
+
+	//Each message delivered once, the repeat dropped by the receiver
+	uint32_t delivered_100 = 0;
+	uint32_t delivered_30 = 0;
+	uint32_t replays = 0;
+	DeliveryRecord record;
+	while (report.receive(&record, sizeof(record)))
+	{
+		if (record.replay) replays++;
+		else if (record.length == 100) delivered_100++;
+		else if (record.length == 30) delivered_30++;
+		else CHECK(false);
+	}
+	CHECK_EQ(delivered_100, 1);
+	CHECK_EQ(delivered_30, 1);
+	CHECK_EQ(replays, 1);
+}
+
+int main()
+{
+	int fd = mkstemp(journal_path);
+	CHECK(fd >= 0);
+	if (fd < 0) return test_summary("test_journal");
+	close(fd);
+
+	test_queue();
+	test_full_and_wrap();
+	test_torn_append(TORN_MID_SECTOR, 4);
+	test_torn_append(TORN_OPENS_BLANK, 4);
+	test_torn_append(TORN_OPENS_USED, 3);
+	test_torn_ack();
+	test_replay_after_reboot();
+
+	unlink(journal_path);
+	return test_summary("test_journal");
+}
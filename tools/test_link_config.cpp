@@ -0,0 +1,188 @@
+//Host test for per-link ProtocolConfig profiles: ControlConfig frames are sized and bounded by
+//its 16-byte payload, a DefaultConfig link and a ControlConfig link run side by side in one
+//program and each fragments and reassembles messages at its own frame size, and the control
+//link gives up on a silent peer after its own MAX_RETRIES * ACK_TIMEOUT_MS, not the default's.
+//
+//Host-only (Linux, runs over two PtyTransport socketpairs), built against an Arduino host core
+//(e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_link_config.cpp <protocol .cpp> <host-core .cpp> -o test_link_config
+//Usage: test_link_config   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define LINK_MESSAGES 12
+#define MESSAGE_LEN 200//several frames on either link
+#define CONTROL_FRAGMENT_DATA (ControlConfig::MAX_DATA_LEN - FRAGMENT_HEADER_LEN)
+
+typedef PacketFrameT<ControlConfig> ControlFrame;
+typedef UartProtocolT<ControlConfig> ControlLink;
+
+static void test_frames()
+{
+	ControlFrame control;
+	FrameT<ControlConfig> frame;
+	uint8_t payload[DefaultConfig::MAX_DATA_LEN];
+	uint8_t wire[sizeof(Frame) + FRAME_TRAILER_LEN];
+	memset(payload, 0x5A, sizeof(payload));
+
+	CHECK_EQ(sizeof(frame.data), ControlConfig::MAX_DATA_LEN);
+	CHECK(sizeof(FrameT<ControlConfig>) < sizeof(Frame));
+
+	//Full control payload fits, one byte more does not
+	CHECK(control.create_frame(TYPE_DATA, payload, ControlConfig::MAX_DATA_LEN, &frame));
+	CHECK_EQ(ControlFrame::serialize_frame(&frame, wire), FRAME_HEADER_LEN + ControlConfig::MAX_DATA_LEN + FRAME_TRAILER_LEN);
+	CHECK(!control.create_frame(TYPE_DATA, payload, ControlConfig::MAX_DATA_LEN + 1, &frame));
+
+	//A default-profile frame is too long for a control receiver
+	PacketFrame bulk;
+	Frame bulk_frame;
+	CHECK(bulk.create_frame(TYPE_DATA, payload, DefaultConfig::MAX_DATA_LEN, &bulk_frame));
+	uint16_t length = PacketFrame::serialize_frame(&bulk_frame, wire);
+	CHECK(PacketFrame::deserialize_frame(wire, length, &bulk_frame));
+	CHECK(!ControlFrame::deserialize_frame(wire, length, &frame));
+}
+
+//Message k: 4-byte number, then a pattern derived from it and the link
+static void fill_message(uint8_t link, uint32_t k, uint8_t* buffer)
+{
+	for (uint16_t i = 0; i < MESSAGE_LEN; i++) buffer[i] = (uint8_t)(link * 101 + k * 31 + i * 7);
+	memcpy(buffer, &k, sizeof(k));
+}
+
+typedef struct
+{
+	uint8_t link;//0 = default, 1 = control
+	uint8_t intact;
+	uint32_t number;
+}DeliveryRecord;
+
+static PeerReport report;
+
+static void deliver(uint8_t link, const uint8_t* data, uint16_t length)
+{
+	DeliveryRecord record = { link, 0, 0xFFFFFFFF };
+	if (length == MESSAGE_LEN)
+	{
+		uint8_t expected[MESSAGE_LEN];
+		memcpy(&record.number, data, sizeof(record.number));
+		fill_message(link, record.number, expected);
+		record.intact = memcmp(expected, data, length) == 0;
+	}
+	report.send(&record, sizeof(record));
+}
+
+static void on_default_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	deliver(0, data, length);
+}
+
+static void on_control_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	deliver(1, data, length);
+}
+
+//Stops the peer and returns once it really is stopped
+static void freeze(pid_t peer)
+{
+	int status;
+	kill(peer, SIGSTOP);
+	waitpid(peer, &status, WUNTRACED);
+}
+
+static void test_two_links()
+{
+	PtyTransport bulk_master;
+	PtyTransport bulk_slave;
+	PtyTransport control_master;
+	PtyTransport control_slave;
+	CHECK(PtyTransport::create_socketpair(bulk_master, bulk_slave));
+	CHECK(PtyTransport::create_socketpair(control_master, control_slave));
+	CHECK(report.open());
+
+	//One slave program serving both profiles from the same loop
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol bulk(&bulk_slave);
+		ControlLink control(&control_slave);
+		bulk.set_delivery_handler(on_default_message);
+		control.set_delivery_handler(on_control_message);
+		for (;;)
+		{
+			bulk.receive_data_uart_slave();
+			control.receive_data_uart_slave();
+		}
+	});
+	report.parent_side();
+
+	UartProtocol bulk(&bulk_master);
+	ControlLink control(&control_master);
+	CHECK(bulk.connect());
+	CHECK(control.connect());
+	CHECK_EQ(bulk.get_session_params().max_payload, DefaultConfig::MAX_DATA_LEN);
+	CHECK_EQ(control.get_session_params().max_payload, ControlConfig::MAX_DATA_LEN);
+
+	uint8_t buffer[MESSAGE_LEN];
+	uint32_t acked[2] = { 0, 0 };
+	for (uint32_t k = 0; k < LINK_MESSAGES; k++)
+	{
+		fill_message(0, k, buffer);
+		if (bulk.send_uart_message(buffer, MESSAGE_LEN)) acked[0]++;
+		fill_message(1, k, buffer);
+		if (control.send_uart_message(buffer, MESSAGE_LEN)) acked[1]++;
+	}
+	CHECK_EQ(acked[0], LINK_MESSAGES);
+	CHECK_EQ(acked[1], LINK_MESSAGES);
+
+	//Each link cut its messages at its own frame size
+	uint32_t control_frames = control.get_perf_protocol().get_data_attempts();
+	uint32_t bulk_frames = bulk.get_perf_protocol().get_data_attempts();
+	CHECK(control_frames >= LINK_MESSAGES * ((MESSAGE_LEN + CONTROL_FRAGMENT_DATA - 1) / CONTROL_FRAGMENT_DATA));
+	CHECK(bulk_frames * 2 < control_frames);
+
+	unsigned long start = millis();
+	uint32_t delivered[2] = { 0, 0 };
+	uint32_t broken = 0;
+	DeliveryRecord record;
+	while (delivered[0] + delivered[1] < 2 * LINK_MESSAGES && millis() - start < 1000)
+	{
+		if (!report.receive(&record, sizeof(record)))
+		{
+			delay(1);
+			continue;
+		}
+		if (record.link > 1 || !record.intact)
+		{
+			broken++;
+			continue;
+		}
+		CHECK_EQ(record.number, delivered[record.link]);
+		delivered[record.link]++;
+	}
+	CHECK_EQ(broken, 0);
+	CHECK_EQ(delivered[0], LINK_MESSAGES);
+	CHECK_EQ(delivered[1], LINK_MESSAGES);
+
+	//Peer gone: the control link's retry budget is its own, a fraction of the default one
+	freeze(peer);
+	fill_message(1, LINK_MESSAGES, buffer);
+	start = millis();
+	CHECK(!control.send_uart_message(buffer, ControlConfig::MAX_DATA_LEN));
+	unsigned long elapsed = millis() - start;
+	CHECK(elapsed >= (unsigned long)ControlConfig::MAX_RETRIES * ControlConfig::ACK_TIMEOUT_MS);
+	CHECK(elapsed < (unsigned long)DefaultConfig::MAX_RETRIES * DefaultConfig::ACK_TIMEOUT_MS);
+
+	kill(peer, SIGCONT);
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_frames();
+	test_two_links();
+	return test_summary("test_link_config");
+}
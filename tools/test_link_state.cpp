@@ -0,0 +1,166 @@
+//Host test for link liveness: byte loss and a loss burst shorter than the retry budget cost
+//retransmissions but never the link, a real cut (the peer stopped with SIGSTOP) is detected
+//by heartbeats within LINK_DOWN_MS plus one heartbeat interval, sends then fail fast, and the
+//link comes back UP once the peer answers again.
+//
+//Host-only (Linux, runs over a PtyTransport socketpair), built against an Arduino host core
+//(e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_link_state.cpp <protocol .cpp> <host-core .cpp> -o test_link_state
+//Usage: test_link_state   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define LOSSY_MESSAGES 40
+#define BURST_AFTER 5//the slave goes deaf on its TX side after this many deliveries
+#define BURST_MS 1500//longer than LINK_DOWN_MS, shorter than the retry budget
+
+static PtyTransport* slave_tx;
+static uint32_t delivered;
+static unsigned long burst_start;
+
+static void on_message(const uint8_t*, uint16_t, uint8_t)
+{
+	//ACKs from here on are lost until the burst is over
+	if (++delivered == BURST_AFTER)
+	{
+		slave_tx->set_fault_injection(0, 1.0f, 41);
+		burst_start = millis();
+	}
+}
+
+static pid_t start_slave(PtyTransport& slave_end, bool burst)
+{
+	return start_peer([&slave_end, burst]()
+	{
+		slave_tx = &slave_end;
+		UartProtocol slave(&slave_end);
+		if (burst) slave.set_delivery_handler(on_message);
+		for (;;)
+		{
+			slave.receive_data_uart_slave();
+			if (burst_start != 0 && millis() - burst_start >= BURST_MS)
+			{
+				slave_end.set_fault_injection(0, 0, 41);
+				burst_start = 0;
+			}
+		}
+	});
+}
+
+//Stops the peer and returns once it really is stopped, kill() alone races with the next frame
+static void freeze(pid_t peer)
+{
+	int status;
+	kill(peer, SIGSTOP);
+	waitpid(peer, &status, WUNTRACED);
+}
+
+static void test_lossy_link()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	pid_t peer = start_slave(slave_end, false);
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	PerformanceMonitor& perf = master.get_perf_protocol();
+
+	//Lost frames and ACKs are retried, the link never looks down
+	master_end.set_fault_injection(0, 0.01f, 41);
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < LOSSY_MESSAGES; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked++;
+		master.receive_data_uart_master();
+	}
+	master_end.set_fault_injection(0, 0, 41);
+
+	CHECK_EQ(acked, LOSSY_MESSAGES);
+	CHECK(perf.get_retransmissions() > 0);
+	CHECK_EQ(perf.get_link_failures(), 0);
+	CHECK_EQ(master.get_link_state(), LINK_UP);
+
+	stop_peer(peer);
+}
+
+static void test_loss_burst()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	pid_t peer = start_slave(slave_end, true);
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	PerformanceMonitor& perf = master.get_perf_protocol();
+
+	//Silent for longer than LINK_DOWN_MS, but inside one frame's retry budget: retries carry it
+	for (uint32_t n = 0; n < BURST_AFTER + 3; n++)
+	{
+		CHECK(master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+		master.receive_data_uart_master();
+	}
+	CHECK(perf.get_retransmissions() > 0);
+	CHECK_EQ(perf.get_link_failures(), 0);
+	CHECK_EQ(master.get_link_state(), LINK_UP);
+
+	stop_peer(peer);
+}
+
+static void test_cut()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	pid_t peer = start_slave(slave_end, false);
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	uint32_t n = 0;
+	CHECK(master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+
+	//Peer frozen while idle: heartbeats go unanswered, DOWN in about LINK_DOWN_MS
+	freeze(peer);
+	unsigned long start = millis();
+	while (master.get_link_state() != LINK_DOWN && millis() - start < 3 * LINK_DOWN_MS) master.receive_data_uart_master();
+	unsigned long detection = millis() - start;
+	CHECK_EQ(master.get_link_state(), LINK_DOWN);
+	CHECK(detection >= LINK_DOWN_MS);
+	CHECK(detection < LINK_DOWN_MS + HEARTBEAT_IDLE_MS);
+	CHECK_EQ(master.get_perf_protocol().get_link_failures(), 1);
+
+	//Down: sends fail at once instead of spending the retry budget
+	start = millis();
+	CHECK(!master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+	CHECK(millis() - start < 50);
+
+	//Peer back: the next reprobe is answered
+	kill(peer, SIGCONT);
+	start = millis();
+	while (master.get_link_state() != LINK_UP && millis() - start < 3 * LINK_REPROBE_MS) master.receive_data_uart_master();
+	CHECK_EQ(master.get_link_state(), LINK_UP);
+	CHECK(master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+
+	//Cut in the middle of a send: the retry budget runs out, then the link is DOWN
+	freeze(peer);
+	start = millis();
+	CHECK(!master.send_uart_message((const uint8_t*)&n, sizeof(n)));
+	CHECK(millis() - start >= (unsigned long)DefaultConfig::MAX_RETRIES * DefaultConfig::ACK_TIMEOUT_MS);
+	CHECK_EQ(master.get_link_state(), LINK_DOWN);
+
+	kill(peer, SIGCONT);
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_lossy_link();
+	test_loss_burst();
+	test_cut();
+	return test_summary("test_link_state");
+}
@@ -0,0 +1,279 @@
+//Host test for the multiplexed channels: strict priority order, DRR byte fairness against the
+//configured quanta, hold() keeping a failing ordered channel from blocking the others, requeue
+//order for unordered channels, one UartProtocol::service_tx() turn costing at most one ACK
+//timeout while the peer is silent, and datagrams reaching the peer's delivery handler on their
+//own channel next to the reliable traffic.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_scheduler.cpp <protocol .cpp> <host-core .cpp> -o test_scheduler
+//Usage: test_scheduler   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "channel_scheduler.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define DRR_TURNS 3000
+#define LINK_MESSAGES 30
+
+static uint8_t payload[DefaultConfig::MAX_DATA_LEN];
+
+static void test_strict_priority()
+{
+	ChannelScheduler scheduler;
+	uint8_t channel;
+
+	scheduler.configure_channel(0, 2, CHANNEL_RELIABLE_ORDERED);
+	scheduler.configure_channel(1, 0, CHANNEL_RELIABLE_ORDERED);
+	scheduler.configure_channel(2, 1, CHANNEL_RELIABLE_ORDERED);
+	CHECK(scheduler.is_idle());
+	CHECK(scheduler.next(&channel) == nullptr);
+
+	CHECK(scheduler.enqueue(0, payload, 8));
+	CHECK(scheduler.enqueue(2, payload, 8));
+	CHECK(scheduler.enqueue(1, payload, 8));
+
+	//Priority value, not channel number or arrival order
+	const uint8_t expected[] = { 1, 2, 0 };
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		CHECK(scheduler.next(&channel) != nullptr);
+		CHECK_EQ(channel, expected[i]);
+		scheduler.complete(channel, true);
+	}
+	CHECK(scheduler.is_idle());
+
+	//Bounded queue per channel
+	for (uint8_t i = 0; i < CHANNEL_QUEUE_DEPTH; i++) CHECK(scheduler.enqueue(0, payload, 8));
+	CHECK(!scheduler.enqueue(0, payload, 8));
+	CHECK(!scheduler.enqueue(0, payload, DefaultConfig::MAX_DATA_LEN + 1));
+}
+
+//Serves DRR_TURNS turns with every channel kept backlogged, returns bytes per channel
+static void run_drr(ChannelScheduler& scheduler, const uint16_t* sizes, uint8_t channels, uint32_t* served)
+{
+	for (uint8_t c = 0; c < channels; c++)
+	{
+		served[c] = 0;
+		while (scheduler.enqueue(c, payload, sizes[c]));
+	}
+
+	for (int turn = 0; turn < DRR_TURNS; turn++)
+	{
+		uint8_t channel;
+		QueuedMessage* message = scheduler.next(&channel);
+		CHECK(message != nullptr);
+		if (!message) return;
+
+		served[channel] += message->length;
+		scheduler.complete(channel, true);
+		scheduler.enqueue(channel, payload, sizes[channel]);
+	}
+}
+
+static void test_deficit_round_robin()
+{
+	//Equal quanta, very different message sizes: equal bytes, not equal messages
+	ChannelScheduler equal;
+	equal.set_policy(SCHED_DEFICIT_ROUND_ROBIN);
+	equal.configure_channel(0, 0, CHANNEL_RELIABLE_ORDERED, 52);
+	equal.configure_channel(1, 0, CHANNEL_RELIABLE_ORDERED, 52);
+	const uint16_t mixed_sizes[] = { 52, 13 };
+	uint32_t served[MAX_CHANNELS];
+	run_drr(equal, mixed_sizes, 2, served);
+	float share = (float)served[0] / (served[0] + served[1]);
+	CHECK(share > 0.45f && share < 0.55f);
+
+	//Quanta 2:1:1, same message size: bytes follow the quanta, priority is ignored
+	ChannelScheduler weighted;
+	weighted.set_policy(SCHED_DEFICIT_ROUND_ROBIN);
+	weighted.configure_channel(0, 3, CHANNEL_RELIABLE_ORDERED, 104);
+	weighted.configure_channel(1, 0, CHANNEL_RELIABLE_ORDERED, 52);
+	weighted.configure_channel(2, 1, CHANNEL_RELIABLE_UNORDERED, 52);
+	const uint16_t sizes[] = { 26, 26, 26 };
+	run_drr(weighted, sizes, 3, served);
+	uint32_t total = served[0] + served[1] + served[2];
+	CHECK(served[0] > total * 45 / 100 && served[0] < total * 55 / 100);
+	CHECK(served[1] > total * 20 / 100 && served[1] < total * 30 / 100);
+	CHECK(served[2] > total * 20 / 100 && served[2] < total * 30 / 100);
+}
+
+static void test_hold()
+{
+	uint8_t channel;
+
+	//DRR: channel 0 fails every attempt and is held, the others keep their share
+	ChannelScheduler drr;
+	drr.set_policy(SCHED_DEFICIT_ROUND_ROBIN);
+	for (uint8_t c = 0; c < 3; c++) drr.configure_channel(c, 0, CHANNEL_RELIABLE_ORDERED, 16);
+	for (uint8_t c = 0; c < 3; c++) for (uint8_t i = 0; i < 3; i++) drr.enqueue(c, payload, 8);
+
+	uint8_t served[3] = { 0, 0, 0 };
+	uint8_t attempts_0 = 0;
+	for (int turn = 0; turn < 12 && drr.next(&channel); turn++)
+	{
+		if (channel == 0)
+		{
+			attempts_0++;
+			drr.hold(0);
+			continue;
+		}
+		drr.complete(channel, true);
+		served[channel]++;
+	}
+	CHECK_EQ(served[1], 3);
+	CHECK_EQ(served[2], 3);
+	CHECK(attempts_0 > 0);
+
+	//Alone, a held channel still gets the next turn
+	CHECK(drr.next(&channel) != nullptr);
+	CHECK_EQ(channel, 0);
+
+	//Strict priority: a failing top channel alternates with the next one instead of starving it
+	ChannelScheduler strict;
+	strict.configure_channel(0, 0, CHANNEL_RELIABLE_ORDERED);
+	strict.configure_channel(1, 1, CHANNEL_RELIABLE_ORDERED);
+	strict.enqueue(0, payload, 8);
+	strict.enqueue(1, payload, 8);
+	strict.enqueue(1, payload, 8);
+
+	CHECK(strict.next(&channel) != nullptr && channel == 0);
+	strict.hold(0);
+	CHECK(strict.next(&channel) != nullptr && channel == 1);
+	strict.complete(1, true);
+	CHECK(strict.next(&channel) != nullptr && channel == 0);//held for one turn only
+	strict.complete(0, true);
+	CHECK(strict.next(&channel) != nullptr && channel == 1);
+}
+
+static void test_requeue()
+{
+	ChannelScheduler scheduler;
+	uint8_t channel;
+	scheduler.configure_channel(0, 0, CHANNEL_RELIABLE_UNORDERED);
+
+	for (uint8_t i = 1; i <= 3; i++)
+	{
+		uint8_t tag = i;
+		scheduler.enqueue(0, &tag, 1);
+	}
+
+	//A failed unordered message goes behind the others of its channel
+	QueuedMessage* message = scheduler.next(&channel);
+	CHECK(message && message->payload[0] == 1);
+	scheduler.requeue(0);
+
+	const uint8_t expected[] = { 2, 3, 1 };
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		message = scheduler.next(&channel);
+		CHECK(message && message->payload[0] == expected[i]);
+		scheduler.complete(0, true);
+	}
+}
+
+static void test_service_tx_turn()
+{
+	//Nobody answers: an ordered frame costs one ACK timeout per turn, then the datagram goes
+	PtyTransport master_end;
+	PtyTransport silent_end;
+	CHECK(PtyTransport::create_socketpair(master_end, silent_end));
+
+	UartProtocol master(&master_end);
+	master.configure_channel(0, 0, CHANNEL_RELIABLE_ORDERED);
+	master.configure_channel(1, 1, CHANNEL_BEST_EFFORT);
+	CHECK(master.enqueue_message(0, payload, 8));
+	CHECK(master.enqueue_message(1, payload, 8));
+
+	unsigned long start = millis();
+	master.service_tx();
+	unsigned long ordered_turn = millis() - start;
+	CHECK(ordered_turn < DefaultConfig::ACK_TIMEOUT_MS * 3 / 2);
+
+	uint32_t datagrams_before = master.get_perf_protocol().get_packet_sent();
+	start = millis();
+	CHECK(master.service_tx());
+	CHECK(millis() - start < DefaultConfig::ACK_TIMEOUT_MS / 2);
+	CHECK_EQ(master.get_perf_protocol().get_packet_sent(), datagrams_before + 1);
+}
+
+typedef struct
+{
+	uint8_t channel;
+	uint32_t number;
+}Delivery;
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t channel)
+{
+	Delivery delivery = { channel, 0xFFFFFFFF };
+	if (length == sizeof(delivery.number)) memcpy(&delivery.number, data, sizeof(delivery.number));
+	report.send(&delivery, sizeof(delivery));
+}
+
+static void test_datagram_delivery()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+
+	pid_t peer = start_peer([&]()
+	{
+		report.child_side();
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	master.configure_channel(0, 0, CHANNEL_RELIABLE_ORDERED);
+	master.configure_channel(2, 1, CHANNEL_BEST_EFFORT);
+
+	//Datagrams skip the credit queue, they still reach the handler with their channel
+	for (uint32_t n = 0; n < LINK_MESSAGES; n++)
+	{
+		CHECK(master.enqueue_message(0, (const uint8_t*)&n, sizeof(n)));
+		CHECK(master.enqueue_message(2, (const uint8_t*)&n, sizeof(n)));
+		while (master.service_tx()) master.receive_data_uart_master();
+	}
+
+	uint32_t next[3] = { 0, 0, 0 };
+	uint32_t strays = 0;
+	unsigned long start = millis();
+	Delivery delivery;
+	while ((next[0] < LINK_MESSAGES || next[2] < LINK_MESSAGES) && millis() - start < 2000)
+	{
+		master.receive_data_uart_master();
+		if (!report.receive(&delivery, sizeof(delivery))) continue;
+		if (delivery.channel != 0 && delivery.channel != 2)
+		{
+			strays++;
+			continue;
+		}
+		CHECK_EQ(delivery.number, next[delivery.channel]);
+		next[delivery.channel]++;
+	}
+	CHECK_EQ(strays, 0);
+	CHECK_EQ(next[0], LINK_MESSAGES);
+	CHECK_EQ(next[2], LINK_MESSAGES);
+
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_strict_priority();
+	test_deficit_round_robin();
+	test_hold();
+	test_requeue();
+	test_service_tx_turn();
+	test_datagram_delivery();
+	return test_summary("test_scheduler");
+}
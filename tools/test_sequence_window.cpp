@@ -0,0 +1,175 @@
+//Host test for receiver-side duplicate suppression: SequenceWindow classification across the
+//65534 -> 0 wrap, late arrivals, resync after a peer restart, a randomized reorder run checked
+//against a model, and exactly-once delivery over a link that loses ACKs.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_sequence_window.cpp <protocol .cpp> <host-core .cpp> -o test_sequence_window
+//Usage: test_sequence_window   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <set>
+
+#include "host_test.h"
+#include "sequence_window.h"
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define LINK_MESSAGES 150
+
+static void test_classification()
+{
+	SequenceWindow window;
+	uint16_t missing;
+
+	CHECK_EQ(window.check_and_update(100, &missing), SEQ_IN_ORDER);//first one seen sets the base
+	CHECK_EQ(window.check_and_update(101, &missing), SEQ_IN_ORDER);
+	CHECK_EQ(window.check_and_update(101, &missing), SEQ_DUPLICATE);
+	CHECK_EQ(window.check_and_update(100, &missing), SEQ_DUPLICATE);
+	CHECK_EQ(window.get_expected(), 102);
+
+	CHECK_EQ(window.check_and_update(105, &missing), SEQ_GAP);
+	CHECK_EQ(missing, 3);
+
+	//The read-only check agrees and leaves the window alone
+	CHECK(window.is_duplicate(105));
+	CHECK(window.is_duplicate(101));
+	CHECK(!window.is_duplicate(103));
+	CHECK(!window.is_duplicate(106));
+	CHECK_EQ(window.get_expected(), 106);
+
+	CHECK_EQ(window.check_and_update(103, &missing), SEQ_LATE);
+	CHECK_EQ(missing, 0);
+	CHECK_EQ(window.check_and_update(103, &missing), SEQ_DUPLICATE);
+	CHECK_EQ(window.check_and_update(102, &missing), SEQ_LATE);
+	CHECK_EQ(window.check_and_update(104, &missing), SEQ_LATE);
+
+	//Far behind the window: the peer started over, not an old retransmission
+	CHECK_EQ(window.check_and_update(10, &missing), SEQ_RESYNC);
+	CHECK_EQ(window.check_and_update(11, &missing), SEQ_IN_ORDER);
+
+	window.reset();
+	CHECK_EQ(window.get_expected(), 0);
+	CHECK(!window.is_duplicate(0));
+}
+
+static void test_wrap()
+{
+	SequenceWindow window;
+	uint16_t missing;
+	uint16_t seq = SEQUENCE_MODULUS - 3;
+
+	CHECK_EQ(window.check_and_update(seq, &missing), SEQ_IN_ORDER);
+	for (uint8_t i = 0; i < 6; i++)
+	{
+		seq = SequenceWindow::next_sequence(seq);
+		CHECK_EQ(window.check_and_update(seq, &missing), SEQ_IN_ORDER);
+	}
+	CHECK_EQ(seq, 3);//65532, 65533, 65534, 0, 1, 2, 3
+
+	//Duplicates from before the wrap are still recognized
+	CHECK_EQ(window.check_and_update(SEQUENCE_MODULUS - 1, &missing), SEQ_DUPLICATE);
+	CHECK_EQ(window.check_and_update(0, &missing), SEQ_DUPLICATE);
+
+	//A gap across the wrap counts the skipped sequences
+	window.reset();
+	window.check_and_update(SEQUENCE_MODULUS - 2, &missing);
+	CHECK_EQ(window.check_and_update(2, &missing), SEQ_GAP);
+	CHECK_EQ(missing, 3);//65534, 0, 1
+	CHECK_EQ(SequenceWindow::forward_distance(SEQUENCE_MODULUS - 2, 2), 4);
+}
+
+static void test_reorder_against_model()
+{
+	//Sender retransmits and the link reorders within a small distance: every sequence must be
+	//accepted exactly once, no matter how often or how late its copies show up
+	PacketFrame receiver;
+	std::set<uint32_t> delivered;
+	uint32_t accepted = 0;
+	srand(28);
+
+	for (uint32_t base = 0; base < 70000; base += 4)
+	{
+		for (uint8_t copy = 0; copy < 8; copy++)
+		{
+			uint32_t n = base + rand() % 8;//windows overlap: older copies keep arriving after newer ones
+			bool first = delivered.insert(n).second;
+			bool accept = receiver.accept_sequence(n % SEQUENCE_MODULUS);
+			CHECK_EQ(accept, first);
+			if (accept) accepted++;
+		}
+	}
+	CHECK_EQ(accepted, delivered.size());
+}
+
+static PeerReport report;
+
+static void on_message(const uint8_t* data, uint16_t length, uint8_t)
+{
+	uint32_t number = 0xFFFFFFFF;
+	if (length == sizeof(number)) memcpy(&number, data, sizeof(number));
+	report.send(&number, sizeof(number));
+}
+
+static void test_lost_acks()
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	CHECK(report.open());
+	master_end.set_baud_rate(921600);
+	slave_end.set_baud_rate(921600);
+
+	pid_t peer = start_peer([&]()
+	{
+		//Drops on the slave's TX side: a lost ACK makes the master resend a frame already delivered
+		report.child_side();
+		slave_end.set_fault_injection(0, 0.01, 28);
+		UartProtocol slave(&slave_end);
+		slave.set_delivery_handler(on_message);
+		for (;;) slave.receive_data_uart_slave();
+	});
+	report.parent_side();
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+
+	std::set<uint32_t> acked;
+	for (uint32_t n = 0; n < LINK_MESSAGES; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked.insert(n);
+		master.receive_data_uart_master();
+	}
+	CHECK(master.get_perf_protocol().get_retransmissions() > 0);
+
+	unsigned long start = millis();
+	while (millis() - start < 500) master.receive_data_uart_master();
+	stop_peer(peer);
+
+	std::set<uint32_t> delivered;
+	uint32_t number;
+	uint32_t duplicates = 0;
+	while (report.receive(&number, sizeof(number)))
+	{
+		CHECK(number < LINK_MESSAGES);
+		if (!delivered.insert(number).second) duplicates++;
+	}
+	CHECK_EQ(duplicates, 0);
+
+	//Anything ACKed was delivered; a message that ran out of retries may have been too
+	uint32_t acked_missing = 0;
+	for (uint32_t n : acked) acked_missing += delivered.count(n) == 0;
+	CHECK_EQ(acked_missing, 0);
+	CHECK(delivered.size() >= acked.size());
+}
+
+int main()
+{
+	test_classification();
+	test_wrap();
+	test_reorder_against_model();
+	test_lost_acks();
+	return test_summary("test_sequence_window");
+}
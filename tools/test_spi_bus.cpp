@@ -0,0 +1,420 @@
+//Host test for the SPI bus: SpiBusManager polls several SpiSlaveEngine instances through the
+//engine's own host model of the armed transaction ring (host_cs_low()/host_cs_high()).
+//Weighted round robin gives every busy slave its share of polls, demand-driven polling backs
+//off idle slaves, a slave that stops re-arming is counted as underruns and loses no sample.
+//send_spi_master() does not take a stale reply left in the ring for the ACK of its frame, and a
+//slave or master that reboots with fresh sequence numbers is not taken for retransmissions.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) that leaves pinMode(),
+//digitalWrite() and the SPIClass members to the program: this file defines them as the bus model.
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_spi_bus.cpp <protocol .cpp> <host-core .cpp> -o test_spi_bus
+//Usage: test_spi_bus   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <math.h>
+
+#include "host_test.h"
+#include "spi_bus_manager.h"
+#include "spi_slave_engine.h"
+
+#define BUS_SLAVES 3
+#define FIRST_CS 10
+#define WRR_SWEEPS 7000
+#define DEMAND_MS 500
+#define STALL_MS 300
+#define RESTART_AFTER 10//well inside the 32-frame receive window
+
+//------ BUS MODEL: one engine per chip-select, a transaction runs from CS low to CS high ------
+
+typedef struct
+{
+	PacketFrame* packet_frame;
+	SpiSlaveEngine* engine;
+	uint8_t miso[sizeof(Frame)];
+	uint8_t mosi[sizeof(Frame)];
+	uint32_t samples_staged;
+	uint32_t frames_delivered;
+	bool stalled;//process() not called: nothing gets re-armed
+}BusSlave;
+
+static BusSlave bus_slaves[BUS_SLAVES];
+static BusSlave* selected;
+static size_t transfer_pos;
+static BusSlave* rearm_after_next;//runs process() right after its next transaction, mid-exchange for the master
+
+SPIClass SPI;
+SPIClass::SPIClass(int) {}
+void SPIClass::begin(int, int, int, int) {}
+void SPIClass::setDataMode(uint8_t) {}
+void SPIClass::setBitOrder(uint8_t) {}
+
+uint8_t SPIClass::transfer(uint8_t value)
+{
+	if (!selected || transfer_pos >= sizeof(Frame)) return 0xFF;
+	selected->mosi[transfer_pos] = value;
+	return selected->miso[transfer_pos++];
+}
+
+void pinMode(int, int) {}
+
+void digitalWrite(int pin, int value)
+{
+	if (pin < FIRST_CS || pin >= FIRST_CS + BUS_SLAVES) return;
+	BusSlave* slave = &bus_slaves[pin - FIRST_CS];
+
+	if (value == LOW)
+	{
+		selected = slave;
+		transfer_pos = 0;
+		slave->engine->host_cs_low(slave->miso);
+		return;
+	}
+
+	slave->engine->host_cs_high(slave->mosi);
+	selected = nullptr;
+	if (rearm_after_next == slave)
+	{
+		rearm_after_next = nullptr;
+		slave->engine->process();
+	}
+}
+
+static uint8_t handler_slave;
+
+static void on_frame(Frame*)
+{
+	bus_slaves[handler_slave].frames_delivered++;
+}
+
+//Power-on: fresh sequence numbers, empty ring, nothing delivered yet
+static void boot_slave(uint8_t i)
+{
+	BusSlave& slave = bus_slaves[i];
+	delete slave.engine;
+	delete slave.packet_frame;
+	slave.packet_frame = new PacketFrame();
+	slave.engine = new SpiSlaveEngine(slave.packet_frame);
+	slave.engine->set_frame_handler(on_frame);
+	slave.engine->begin(0, 0, 0, 0);
+	slave.samples_staged = 0;
+	slave.frames_delivered = 0;
+	slave.stalled = false;
+}
+
+static void reset_slaves()
+{
+	for (uint8_t i = 0; i < BUS_SLAVES; i++) boot_slave(i);
+	selected = nullptr;
+	rearm_after_next = nullptr;
+}
+
+//Slave side of one sweep: re-arm, deliver, keep a sample staged if this slave is busy
+static void run_slaves(const bool* busy)
+{
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		BusSlave& slave = bus_slaves[i];
+		if (slave.stalled) continue;
+
+		handler_slave = i;
+		slave.engine->process();
+		if (!busy[i] || slave.engine->is_sample_staged()) continue;
+
+		uint32_t sample = slave.samples_staged;
+		if (slave.engine->stage_sample((const uint8_t*)&sample, sizeof(sample))) slave.samples_staged++;
+	}
+}
+
+//------ MASTER SIDE ------
+
+static uint32_t collected[BUS_SLAVES];
+static uint32_t next_sample[BUS_SLAVES];
+static uint32_t out_of_order;
+
+static void on_bus_data(uint8_t slave, const uint8_t* data, uint16_t length)
+{
+	uint32_t sample = 0xFFFFFFFF;
+	if (length == sizeof(sample)) memcpy(&sample, data, sizeof(sample));
+	if (sample != next_sample[slave]) out_of_order++;
+	next_sample[slave] = sample + 1;
+	collected[slave]++;
+}
+
+static void reset_collected()
+{
+	memset(collected, 0, sizeof(collected));
+	memset(next_sample, 0, sizeof(next_sample));
+	out_of_order = 0;
+}
+
+static void test_weighted_round_robin()
+{
+	static const uint8_t weights[BUS_SLAVES] = { 1, 2, 4 };
+	static SpiMasterProtocol* sessions[BUS_SLAVES];
+	SpiBusManager bus(&SPI);
+	reset_slaves();
+	reset_collected();
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		sessions[i] = new SpiMasterProtocol(&SPI, FIRST_CS + i);
+		CHECK_EQ(bus.add_slave(sessions[i], weights[i]), i);
+	}
+	bus.set_policy(BUS_WEIGHTED_ROUND_ROBIN);
+	bus.set_data_callback(on_bus_data);
+	bus.begin();
+
+	//Every slave always has data: polls and samples follow the weights exactly
+	bool busy[BUS_SLAVES] = { true, true, true };
+	for (uint32_t sweep = 0; sweep < WRR_SWEEPS; sweep++)
+	{
+		run_slaves(busy);
+		CHECK(bus.service());
+	}
+
+	uint32_t total_polls = 0;
+	uint32_t total_weight = 0;
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		total_polls += bus.get_slot(i).polls;
+		total_weight += weights[i];
+	}
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		const SlaveSlot& slot = bus.get_slot(i);
+		double expected = (double)total_polls * weights[i] / total_weight;
+		CHECK(fabs(slot.polls - expected) <= weights[i]);//at most one round apart
+		CHECK_EQ(slot.errors, 0);
+		CHECK(slot.data_frames + 2 >= slot.polls);//the first replies carry no sample yet
+		CHECK_EQ(collected[i], slot.data_frames);
+	}
+	CHECK_EQ(out_of_order, 0);
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++) delete sessions[i];
+}
+
+static void test_demand_driven()
+{
+	static SpiMasterProtocol* sessions[BUS_SLAVES];
+	SpiBusManager bus(&SPI);
+	reset_slaves();
+	reset_collected();
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		sessions[i] = new SpiMasterProtocol(&SPI, FIRST_CS + i);
+		bus.add_slave(sessions[i]);
+	}
+	bus.set_policy(BUS_DEMAND_DRIVEN);
+	bus.set_data_callback(on_bus_data);
+	bus.begin();
+
+	//Slave 0 streams, the others have nothing: they back off to BUS_IDLE_POLL_MS
+	bool busy[BUS_SLAVES] = { true, false, false };
+	unsigned long start = millis();
+	while (millis() - start < DEMAND_MS)
+	{
+		run_slaves(busy);
+		if (!bus.service()) delayMicroseconds(200);
+	}
+
+	const SlaveSlot& streaming = bus.get_slot(0);
+	CHECK(streaming.data_frames > 0);
+	CHECK_EQ(collected[0], streaming.data_frames);
+	for (uint8_t i = 1; i < BUS_SLAVES; i++)
+	{
+		const SlaveSlot& idle = bus.get_slot(i);
+		CHECK_EQ(idle.data_frames, 0);
+		CHECK_EQ(idle.errors, 0);
+		CHECK(idle.polls <= DEMAND_MS / BUS_IDLE_POLL_MS + 16);//the back-off ramp, then the ceiling
+		CHECK(idle.polls * 10 < streaming.polls);
+	}
+	CHECK_EQ(out_of_order, 0);
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++) delete sessions[i];
+}
+
+static void test_underruns()
+{
+	static SpiMasterProtocol* sessions[BUS_SLAVES];
+	SpiBusManager bus(&SPI);
+	reset_slaves();
+	reset_collected();
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		sessions[i] = new SpiMasterProtocol(&SPI, FIRST_CS + i);
+		bus.add_slave(sessions[i]);
+	}
+	bus.set_policy(BUS_WEIGHTED_ROUND_ROBIN);
+	bus.set_data_callback(on_bus_data);
+	bus.begin();
+
+	bool busy[BUS_SLAVES] = { true, true, true };
+	for (uint32_t sweep = 0; sweep < 20; sweep++)
+	{
+		run_slaves(busy);
+		bus.service();
+	}
+
+	//Slave 1 stops re-arming with a full ring: two polls still find armed transactions, every
+	//transaction after that is an underrun and the slot drops to the idle poll rate
+	bool quiet[BUS_SLAVES] = { false, false, false };
+	run_slaves(quiet);
+	BusSlave& stalled = bus_slaves[1];
+	stalled.stalled = true;
+	uint32_t errors_before = bus.get_slot(1).errors;
+	uint32_t polls_before = bus.get_slot(1).polls;
+	unsigned long start = millis();
+	while (millis() - start < STALL_MS)
+	{
+		run_slaves(busy);
+		if (!bus.service()) delayMicroseconds(200);
+	}
+	uint32_t stall_polls = bus.get_slot(1).polls - polls_before;
+	uint32_t stall_errors = bus.get_slot(1).errors - errors_before;
+
+	//Two transactions per poll, SPI_SLAVE_QUEUE_DEPTH of them were still armed
+	CHECK(stall_polls > SPI_SLAVE_QUEUE_DEPTH / 2);
+	CHECK(stall_polls <= SPI_SLAVE_QUEUE_DEPTH / 2 + STALL_MS / BUS_IDLE_POLL_MS + 1);
+	CHECK_EQ(stalled.engine->get_underruns(), 2 * stall_polls - SPI_SLAVE_QUEUE_DEPTH);
+	CHECK_EQ(stall_errors, stall_polls - SPI_SLAVE_QUEUE_DEPTH / 2);
+	CHECK_EQ(bus.get_slot(0).errors, 0);
+	CHECK_EQ(bus.get_slot(2).errors, 0);
+
+	//Back to work: the sample that was in flight is resent, nothing is lost or doubled
+	stalled.stalled = false;
+	start = millis();
+	while (collected[1] + 1 < stalled.samples_staged && millis() - start < 1000)
+	{
+		run_slaves(busy);
+		if (!bus.service()) delayMicroseconds(200);
+	}
+	CHECK(collected[1] + 1 >= stalled.samples_staged);
+	CHECK_EQ(out_of_order, 0);
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++) delete sessions[i];
+}
+
+//One transaction with nothing to say, the slave answers into its next armed slot
+static void idle_transaction(int cs)
+{
+	digitalWrite(cs, LOW);
+	for (size_t i = 0; i < sizeof(Frame); i++) SPI.transfer(0x00);
+	digitalWrite(cs, HIGH);
+}
+
+static void test_stale_reply()
+{
+	reset_slaves();
+	handler_slave = 0;
+	BusSlave& slave = bus_slaves[0];
+	SpiMasterProtocol master(&SPI, FIRST_CS);
+	master.begin(false);
+	PacketFrame frames;
+	Frame frame;
+	uint32_t n = 0;
+
+	CHECK(frames.create_frame(TYPE_DATA, (const uint8_t*)&n, sizeof(n), &frame));
+	CHECK(master.send_spi_master(&frame));
+	slave.engine->process();
+	CHECK_EQ(slave.frames_delivered, 1);
+
+	//One armed slot left: frame A lands in it, its ACK goes to a slot that is not armed yet
+	for (uint8_t i = 0; i < SPI_SLAVE_QUEUE_DEPTH - 1; i++) idle_transaction(FIRST_CS);
+	n = 1;
+	CHECK(frames.create_frame(TYPE_DATA, (const uint8_t*)&n, sizeof(n), &frame));
+	CHECK(!master.send_spi_master(&frame));
+	CHECK_EQ(slave.engine->get_underruns(), 1);
+
+	//Frame B is lost to an underrun, the slave re-arms before the read: the ring still holds A's ACK
+	rearm_after_next = &slave;
+	n = 2;
+	CHECK(frames.create_frame(TYPE_DATA, (const uint8_t*)&n, sizeof(n), &frame));
+	CHECK(!master.send_spi_master(&frame));
+	CHECK_EQ(slave.engine->get_underruns(), 2);
+
+	//Retried, B gets its own ACK and is delivered
+	slave.engine->process();
+	uint32_t delivered_before = slave.frames_delivered;
+	CHECK(master.send_spi_master(&frame));
+	slave.engine->process();
+	CHECK_EQ(slave.frames_delivered, delivered_before + 1);
+}
+
+static void test_slave_restart()
+{
+	static SpiMasterProtocol* sessions[BUS_SLAVES];
+	SpiBusManager bus(&SPI);
+	reset_slaves();
+	reset_collected();
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++)
+	{
+		sessions[i] = new SpiMasterProtocol(&SPI, FIRST_CS + i);
+		bus.add_slave(sessions[i]);
+	}
+	bus.set_policy(BUS_WEIGHTED_ROUND_ROBIN);
+	bus.set_data_callback(on_bus_data);
+	bus.begin();
+
+	//A short first run: its sequence numbers are all still inside the master's receive window
+	bool busy[BUS_SLAVES] = { true, true, true };
+	while (collected[1] < RESTART_AFTER)
+	{
+		run_slaves(busy);
+		bus.service();
+	}
+
+	//Slave 1 reboots and counts from 0 again: without the restart marker these are duplicates
+	boot_slave(1);
+	next_sample[1] = 0;
+	uint32_t before = collected[1];
+	for (uint32_t sweep = 0; sweep < RESTART_AFTER * 4 && collected[1] < before + RESTART_AFTER; sweep++)
+	{
+		run_slaves(busy);
+		bus.service();
+	}
+	CHECK_EQ(collected[1], before + RESTART_AFTER);
+	CHECK_EQ(out_of_order, 0);
+	CHECK_EQ(bus.get_slot(1).errors, 0);
+
+	for (uint8_t i = 0; i < BUS_SLAVES; i++) delete sessions[i];
+}
+
+static void test_master_restart()
+{
+	reset_slaves();
+	handler_slave = 0;
+	BusSlave& slave = bus_slaves[0];
+	Frame frame;
+
+	//The master reboots mid-stream: a new session and new sequence numbers, the slave keeps running
+	for (uint8_t run = 0; run < 2; run++)
+	{
+		SpiMasterProtocol master(&SPI, FIRST_CS);
+		master.begin(false);
+		PacketFrame frames;
+		uint32_t before = slave.frames_delivered;
+
+		for (uint32_t n = 0; n < RESTART_AFTER; n++)
+		{
+			CHECK(frames.create_frame(TYPE_DATA, (const uint8_t*)&n, sizeof(n), &frame));
+			CHECK(master.send_spi_master(&frame));
+			slave.engine->process();
+		}
+		CHECK_EQ(slave.frames_delivered, before + RESTART_AFTER);
+	}
+}
+
+int main()
+{
+	test_weighted_round_robin();
+	test_demand_driven();
+	test_underruns();
+	test_stale_reply();
+	test_slave_restart();
+	test_master_restart();
+	return test_summary("test_spi_bus");
+}
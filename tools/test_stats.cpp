@@ -0,0 +1,154 @@
+//Host test for TYPE_STATS snapshots: PerformanceMonitor::get_snapshot() exports the counters and
+//folds the latency histogram into the six wire buckets, peer_snapshot_received() takes the bytes
+//back unchanged and drops other sizes and versions, and over a link the master's request comes
+//back with the slave's view of what it delivered, duplicates from lost ACKs not counted.
+//
+//Host-only (Linux, the link part runs over a PtyTransport socketpair), built against an Arduino
+//host core (e.g. EpoxyDuino) together with the protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. -Itools tools/test_stats.cpp <protocol .cpp> <host-core .cpp> -o test_stats
+//Usage: test_stats   (exit status 0 = all checks passed)
+
+#include <Arduino.h>
+
+#include "host_test.h"
+#include "performance.h"
+#include "uart_protocol.h"
+#include "pty_transport.h"
+
+#define LINK_MESSAGES 30
+#define STATS_REQUESTS 5//a lossy link may drop the reply
+
+static unsigned long fake_ms;
+
+static unsigned long fake_clock()
+{
+	return fake_ms;
+}
+
+static void test_snapshot()
+{
+	static PerformanceMonitor perf;
+	fake_ms = 1000;
+	perf.set_time_source(fake_clock);
+
+	for (uint8_t i = 0; i < 5; i++) perf.packet_sent(20);
+	for (uint8_t i = 0; i < 3; i++) perf.data_frame_sent();
+	for (uint8_t i = 0; i < 4; i++) perf.packet_received(20);
+	for (uint8_t i = 0; i < 4; i++) perf.payload_delivered(10);
+	perf.datagram_received(12);
+	perf.crc_error();
+	perf.crc_error();
+	perf.retransmission_occurred();
+	perf.timeout_occurred();
+
+	//One latency per wire bucket edge: < 1 ms, < 4 ms, < 262 ms and the open-ended last bucket
+	static const uint32_t latencies_ms[] = { 1, 3, 100, 4000 };
+	for (uint8_t i = 0; i < sizeof(latencies_ms) / sizeof(latencies_ms[0]); i++)
+	{
+		perf.start_latency_measurement(i);
+		fake_ms += latencies_ms[i];
+		perf.end_latency_measurement(i);
+	}
+	fake_ms += 500;
+
+	StatsSnapshot snapshot;
+	perf.get_snapshot(&snapshot);
+	CHECK_EQ(sizeof(StatsSnapshot), DefaultConfig::MAX_DATA_LEN);
+	CHECK_EQ(snapshot.version, STATS_SNAPSHOT_VERSION);
+	CHECK_EQ(snapshot.uptime_ms, 1 + 3 + 100 + 4000 + 500);
+	CHECK_EQ(snapshot.packets_sent, perf.get_packet_sent());
+	CHECK_EQ(snapshot.data_frames_sent, 3);
+	CHECK_EQ(snapshot.packets_received, perf.get_packet_received());
+	CHECK_EQ(snapshot.datagrams_received, 1);
+	CHECK_EQ(snapshot.payload_bytes_delivered, 40);
+	CHECK_EQ(snapshot.crc_errors, 2);
+	CHECK_EQ(snapshot.retransmissions, 1);
+	CHECK_EQ(snapshot.timeouts, 1);
+
+	static const uint16_t expected_buckets[STATS_LATENCY_BUCKETS] = { 1, 1, 0, 0, 1, 1 };
+	for (uint8_t i = 0; i < STATS_LATENCY_BUCKETS; i++) CHECK_EQ(snapshot.latency_buckets[i], expected_buckets[i]);
+
+	//The receiving side keeps the bytes as sent
+	static PerformanceMonitor receiver;
+	CHECK(!receiver.has_peer_stats());
+	CHECK(receiver.peer_snapshot_received((const uint8_t*)&snapshot, sizeof(snapshot)));
+	CHECK(receiver.has_peer_stats());
+	CHECK(memcmp(&receiver.get_peer_stats(), &snapshot, sizeof(snapshot)) == 0);
+
+	//Other sizes and versions leave the last good snapshot alone
+	StatsSnapshot newer = snapshot;
+	newer.version = STATS_SNAPSHOT_VERSION + 1;
+	newer.packets_received = 0;
+	CHECK(!receiver.peer_snapshot_received((const uint8_t*)&newer, sizeof(newer)));
+	CHECK(!receiver.peer_snapshot_received((const uint8_t*)&snapshot, sizeof(snapshot) - 1));
+	CHECK(memcmp(&receiver.get_peer_stats(), &snapshot, sizeof(snapshot)) == 0);
+
+	perf.set_time_source(nullptr);
+}
+
+static bool request_stats(UartProtocol& master)
+{
+	for (uint8_t attempt = 0; attempt < STATS_REQUESTS; attempt++)
+	{
+		if (master.request_peer_stats()) return true;
+	}
+	return false;
+}
+
+static void run_link(float ack_drop)
+{
+	PtyTransport master_end;
+	PtyTransport slave_end;
+	CHECK(PtyTransport::create_socketpair(master_end, slave_end));
+	pid_t peer = start_peer([&slave_end, ack_drop]()
+	{
+		UartProtocol slave(&slave_end);
+		slave_end.set_fault_injection(0, ack_drop, 39);//per byte, on the slave's replies only
+		for (;;) slave.receive_data_uart_slave();
+	});
+
+	UartProtocol master(&master_end);
+	CHECK(master.connect());
+	PerformanceMonitor& perf = master.get_perf_protocol();
+
+	uint32_t acked = 0;
+	for (uint32_t n = 0; n < LINK_MESSAGES; n++)
+	{
+		if (master.send_uart_message((const uint8_t*)&n, sizeof(n))) acked++;
+	}
+	CHECK_EQ(acked, LINK_MESSAGES);
+
+	CHECK(request_stats(master));
+	CHECK(perf.has_peer_stats());
+	const StatsSnapshot& first = perf.get_peer_stats();
+	CHECK_EQ(first.version, STATS_SNAPSHOT_VERSION);
+	CHECK_EQ(first.packets_received, LINK_MESSAGES);
+	CHECK_EQ(first.payload_bytes_delivered, LINK_MESSAGES * sizeof(uint32_t));
+	CHECK_EQ(first.data_frames_sent, 0);
+	CHECK_EQ(first.crc_errors, 0);
+	if (ack_drop > 0)
+	{
+		CHECK(perf.get_retransmissions() > 0);
+		CHECK(first.duplicates > 0);
+		CHECK(first.duplicates <= perf.get_retransmissions());
+	}
+	CHECK(perf.get_end_to_end_loss_rate() == 0.0f);
+	uint32_t first_uptime = first.uptime_ms;
+
+	//A later request shows the counters moving on
+	delay(20);
+	for (uint32_t n = LINK_MESSAGES; n < 2 * LINK_MESSAGES; n++) master.send_uart_message((const uint8_t*)&n, sizeof(n));
+	CHECK(request_stats(master));
+	CHECK_EQ(perf.get_peer_stats().packets_received, 2 * LINK_MESSAGES);
+	CHECK(perf.get_peer_stats().uptime_ms > first_uptime);
+
+	stop_peer(peer);
+}
+
+int main()
+{
+	test_snapshot();
+	run_link(0);
+	run_link(0.005f);
+	return test_summary("test_stats");
+}
@@ -0,0 +1,301 @@
+//Offline replay of WireCapture files.
+//Every captured frame goes through the on-target parser (UartProtocol::receive_uart) and
+//PacketFrame::validate_frame, and the PerformanceMonitor statistics are rebuilt on the
+//capture clock, so a field capture reports the same numbers the device would have printed.
+//Frames are decoded with the DefaultConfig profile; SPI records of other sizes are skipped.
+//
+//Host-only, built against an Arduino host core (e.g. EpoxyDuino) together with the
+//protocol sources in the repository root:
+//  g++ -O2 -std=gnu++17 -I<host-core> -I. tools/wire_replay.cpp <protocol .cpp> <host-core .cpp> -o wire_replay
+//Usage: wire_replay [-q] capture.wcap
+//  -q  statistics only, no per-frame decode lines
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "packet_frame.h"
+#include "uart_protocol.h"
+#include "wire_capture.h"
+
+#define REPLAY_RELEASE_BYTES (64UL * 1024 * 1024)//drop replayed pages from the page cache this often
+
+//Capture clock: 64-bit so multi-hour captures survive the 32-bit micros() wrap
+static uint64_t capture_time_us = 1000000;//starts at 1 s, PerformanceMonitor treats 0 as "not started"
+
+static unsigned long capture_millis()
+{
+	return (unsigned long)(capture_time_us / 1000);
+}
+
+//Serves one capture record to UartProtocol::receive_uart()
+class ReplayStream : public Stream
+{
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t pos;
+
+public:
+	ReplayStream() : data(nullptr), length(0), pos(0) {}
+
+	void load(const uint8_t* record, size_t record_length) { data = record; length = record_length; pos = 0; }
+
+	int available() { return (int)(length - pos); }
+	int read() { return pos < length ? data[pos++] : -1; }
+	int peek() { return pos < length ? data[pos] : -1; }
+
+	size_t readBytes(char* buffer, size_t len)
+	{
+		if (len > length - pos) len = length - pos;
+		memcpy(buffer, data + pos, len);
+		pos += len;
+		return len;
+	}
+
+	size_t write(uint8_t) { return 1; }
+	size_t write(const uint8_t*, size_t size) { return size; }
+};
+
+//One physical link as seen from the capturing device
+typedef struct
+{
+	const char* name;
+	PacketFrame decoder;//validation + statistics, never sends
+	ReplayStream stream[2];//per direction, a UART frame may span several records
+	UartProtocol* parser[2];
+	uint16_t last_tx_data_seq;
+	bool tx_data_seen;
+	bool awaiting_ack;//ACKs of POLLs and window updates carry no timing
+	uint32_t records;
+	uint64_t bytes;
+	uint32_t frames;
+	uint32_t invalid;
+}ReplayLink;
+
+static bool quiet = false;
+
+static const char* type_name(uint8_t type)
+{
+	switch (type)
+	{
+	case TYPE_DATA: return "DATA";
+	case TYPE_ACK: return "ACK";
+	case TYPE_NACK: return "NACK";
+	case TYPE_SYN: return "SYN";
+	case TYPE_SYN_ACK: return "SYN-ACK";
+	case TYPE_DATAGRAM: return "DATAGRAM";
+	case TYPE_POLL: return "POLL";
+	case TYPE_STATS: return "STATS";
+	default: return "UNKNOWN";
+	}
+}
+
+static void account_frame(ReplayLink* link, uint8_t direction, Frame* frame)
+{
+	bool valid = frame->data_length <= DefaultConfig::MAX_DATA_LEN && link->decoder.validate_frame(frame);
+	uint8_t type = PacketFrame::get_type(frame);
+
+	link->frames++;
+	if (!valid) link->invalid++;
+
+	if (!quiet)
+	{
+		printf("%12.6f %s %s Frame[%u] Type:%s Ch: %u Len: %u%s%s%s CRC: 0x%04X Valid: %s\n",
+			capture_time_us / 1e6, link->name, direction == CAPTURE_DIR_TX ? "TX" : "RX",
+			frame->sequence_num, type_name(type), frame->channel_id, frame->data_length,
+			(frame->packet_type & FLAG_COMPRESSED) ? " (compressed)" : "",
+			(frame->packet_type & FLAG_FRAGMENT) ? " (fragment)" : "",
+			(frame->packet_type & FLAG_MORE_FRAGMENTS) ? " (more)" : "",
+			frame->crc16, valid ? "YES" : "NO");
+	}
+
+	if (!valid) return;
+
+	PerformanceMonitor& perf = link->decoder.get_performance_monitor();
+	uint16_t wire_length = PacketFrame::get_wire_length(frame);
+
+	if (direction == CAPTURE_DIR_TX)
+	{
+		perf.packet_sent(wire_length);
+		if (type == TYPE_DATA)
+		{
+			//Same sequence number again before anything else was sent = retry after a lost ACK
+			if (link->tx_data_seen && frame->sequence_num == link->last_tx_data_seq) link->decoder.record_retransmission();
+			link->decoder.start_packet_timing(frame->sequence_num);
+			link->last_tx_data_seq = frame->sequence_num;
+			link->tx_data_seen = true;
+			link->awaiting_ack = true;
+		}
+		return;
+	}
+
+	switch (type)
+	{
+	case TYPE_ACK:
+		if (link->awaiting_ack && frame->sequence_num == link->last_tx_data_seq)
+		{
+			link->decoder.end_packet_timing(frame->sequence_num);
+			link->awaiting_ack = false;
+		}
+		break;
+	case TYPE_DATA:
+		if (link->decoder.accept_sequence(frame->sequence_num)) link->decoder.record_packet_received(wire_length);
+		break;
+	case TYPE_DATAGRAM:
+		link->decoder.accept_datagram(frame);
+		break;
+	default:
+		break;
+	}
+}
+
+static void replay_uart(ReplayLink* link, uint8_t direction, const uint8_t* data, uint16_t length)
+{
+	ReplayStream& stream = link->stream[direction];
+	UartProtocol* parser = link->parser[direction];
+	Frame frame;
+
+	stream.load(data, length);
+	while (true)
+	{
+		if (parser->receive_uart(&frame)) account_frame(link, direction, &frame);
+		else if (stream.available() == 0) break;
+	}
+}
+
+static void replay_spi(ReplayLink* link, uint8_t direction, const uint8_t* data, uint16_t length)
+{
+	//One record per transaction; the read phase of a DATA exchange clocks zeros out
+	if (length != sizeof(Frame) || data[0] != DefaultConfig::START_MARKER) return;
+
+	Frame frame;
+	memcpy(&frame, data, sizeof(Frame));
+	account_frame(link, direction, &frame);
+}
+
+static void print_link(ReplayLink* link)
+{
+	if (link->records == 0) return;
+
+	printf("\n==== %s ====\n", link->name);
+	printf(" Records: %u\n", link->records);
+	printf(" Bytes: %llu\n", (unsigned long long)link->bytes);
+	printf(" Frames: %u (%u invalid)\n", link->frames, link->invalid);
+	fflush(stdout);
+	link->decoder.get_performance_monitor().print_statistics();
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-q") == 0) quiet = true;
+		else path = argv[i];
+	}
+
+	if (!path)
+	{
+		fprintf(stderr, "usage: %s [-q] capture.wcap\n", argv[0]);
+		return 2;
+	}
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	size_t size = (size_t)st.st_size;
+	if (size < sizeof(CaptureFileHeader))
+	{
+		fprintf(stderr, "%s: too short for a capture file\n", path);
+		return 1;
+	}
+
+	//Read-only private mapping: the kernel pages the file in as the replay walks it
+	const uint8_t* base = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	madvise((void*)base, size, MADV_SEQUENTIAL);
+
+	CaptureFileHeader file_header;
+	memcpy(&file_header, base, sizeof(file_header));
+	if (memcmp(file_header.magic, CAPTURE_MAGIC, sizeof(file_header.magic)) != 0 || file_header.version != CAPTURE_VERSION)
+	{
+		fprintf(stderr, "%s: not a version %d capture file\n", path, CAPTURE_VERSION);
+		return 1;
+	}
+
+	static ReplayLink links[2];
+	links[0].name = "UART";
+	links[1].name = "SPI";
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		links[i].decoder.get_performance_monitor().set_time_source(capture_millis);
+		links[i].parser[CAPTURE_DIR_TX] = new UartProtocol(&links[i].stream[CAPTURE_DIR_TX]);
+		links[i].parser[CAPTURE_DIR_RX] = new UartProtocol(&links[i].stream[CAPTURE_DIR_RX]);
+	}
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t released = 0;
+	size_t pos = sizeof(CaptureFileHeader);
+	uint32_t last_timestamp = 0;
+	bool first_record = true;
+	uint32_t total_records = 0;
+
+	while (pos + sizeof(CaptureRecordHeader) <= size)
+	{
+		CaptureRecordHeader header;
+		memcpy(&header, base + pos, sizeof(header));
+		pos += sizeof(header);
+
+		if (header.length > size - pos)
+		{
+			fprintf(stderr, "truncated record at offset %zu\n", pos - sizeof(header));
+			break;
+		}
+
+		//Unsigned delta keeps the clock monotonic across the micros() wrap
+		if (!first_record) capture_time_us += (uint32_t)(header.timestamp_us - last_timestamp);
+		last_timestamp = header.timestamp_us;
+		first_record = false;
+
+		uint8_t direction = header.flags & CAPTURE_DIR_MASK;
+		ReplayLink* link = &links[(header.flags & CAPTURE_LINK_MASK) == CAPTURE_LINK_SPI ? 1 : 0];
+		link->records++;
+		link->bytes += header.length;
+		total_records++;
+
+		if (link == &links[1]) replay_spi(link, direction, base + pos, header.length);
+		else replay_uart(link, direction, base + pos, header.length);
+
+		pos += header.length;
+
+		//Replayed pages are never touched again, keep the resident set flat on multi-GB files
+		if (pos - released >= REPLAY_RELEASE_BYTES)
+		{
+			size_t end = pos & ~((size_t)page_size - 1);
+			madvise((void*)(base + released), end - released, MADV_DONTNEED);
+			released = end;
+		}
+	}
+
+	printf("\n%s: %u records, %.3f s of capture\n", path, total_records, (capture_time_us - 1000000) / 1e6);
+	print_link(&links[0]);
+	print_link(&links[1]);
+
+	munmap((void*)base, size);
+	close(fd);
+	return 0;
+}
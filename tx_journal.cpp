@@ -0,0 +1,445 @@
+#include "tx_journal.h"
+#include "crc16.h"
+#include <stddef.h>
+
+#if !defined(ESP32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Everything but state (programmed by ack()) and the unused tail; the payload continues it
+static uint16_t header_crc(const JournalRecord* record)
+{
+	uint16_t crc = CRC16::calculate((const uint8_t*)record, offsetof(JournalRecord, state));
+	return CRC16::calculate((const uint8_t*)&record->id, sizeof(record->id), crc);
+}
+
+TxJournal::TxJournal() :
+	sector_count(0),
+	mounted(false),
+	head_sector(0),
+	head_offset(JOURNAL_SECTOR_SIZE),
+	head_sequence(0),
+	read_sector(0),
+	read_offset(JOURNAL_SECTOR_SIZE),
+	next_id(0),
+	pending(0),
+	appends(0),
+	acks(0),
+	append_failures(0),
+	sectors_erased(0),
+	torn_records(0)
+#if defined(ESP32)
+	, partition(nullptr)
+#else
+	, fd(-1),
+	map(nullptr),
+	write_limit(0xFFFFFFFF)
+#endif
+{
+	memset(&read_record, 0xFF, sizeof(read_record));
+}
+
+TxJournal::~TxJournal()
+{
+#if !defined(ESP32)
+	end();
+#endif
+}
+
+//============================================ STORAGE ========================================
+
+#if defined(ESP32)
+bool TxJournal::begin(const char* partition_label)
+{
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+	if (!partition || partition->size < 2 * JOURNAL_SECTOR_SIZE)
+	{
+		Serial.println("TX JOURNAL: partition not found");
+		partition = nullptr;
+		return false;
+	}
+
+	sector_count = partition->size / JOURNAL_SECTOR_SIZE;
+	recover();
+	mounted = true;
+	return true;
+}
+
+bool TxJournal::storage_read(uint32_t offset, void* data, uint16_t length) const
+{
+	return esp_partition_read(partition, offset, data, length) == ESP_OK;
+}
+
+bool TxJournal::storage_write(uint32_t offset, const void* data, uint16_t length)
+{
+	return esp_partition_write(partition, offset, data, length) == ESP_OK;
+}
+
+bool TxJournal::storage_erase(uint16_t sector)
+{
+	return esp_partition_erase_range(partition, sector_base(sector), JOURNAL_SECTOR_SIZE) == ESP_OK;
+}
+#else
+bool TxJournal::begin(const char* path, uint16_t sectors)
+{
+	end();
+	if (!path || sectors < 2) return false;
+
+	uint32_t size = sector_base(sectors);
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return false;
+
+	//The sector count is part of the layout, a file of another size is not ours to reinterpret
+	struct stat st;
+	bool fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+	if ((!fresh && st.st_size != (off_t)size) || (fresh && ftruncate(fd, size) != 0))
+	{
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+	{
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	map = (uint8_t*)mapped;
+	if (fresh) memset(map, 0xFF, size);//erased flash, ftruncate() fills with zeros
+
+	sector_count = sectors;
+	recover();
+	mounted = true;
+	return true;
+}
+
+void TxJournal::end()
+{
+	if (map)
+	{
+		msync(map, sector_base(sector_count), MS_SYNC);
+		munmap(map, sector_base(sector_count));
+		map = nullptr;
+	}
+	if (fd >= 0) close(fd);
+	fd = -1;
+	mounted = false;
+}
+
+bool TxJournal::storage_read(uint32_t offset, void* data, uint16_t length) const
+{
+	if (!map) return false;
+	memcpy(data, map + offset, length);
+	return true;
+}
+
+//MAP_SHARED pages outlive the process, so a killed host keeps every completed write
+bool TxJournal::storage_write(uint32_t offset, const void* data, uint16_t length)
+{
+	if (!map) return false;
+
+	const uint8_t* src = (const uint8_t*)data;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		if (write_limit == 0) return false;
+		if (write_limit != 0xFFFFFFFF) write_limit--;
+		map[offset + i] &= src[i];//NOR flash: programming clears bits, only an erase sets them
+	}
+	return true;
+}
+
+bool TxJournal::storage_erase(uint16_t sector)
+{
+	if (!map) return false;
+
+	uint32_t length = JOURNAL_SECTOR_SIZE;
+	if (write_limit < length) length = write_limit;
+	memset(map + sector_base(sector), 0xFF, length);
+	if (write_limit != 0xFFFFFFFF) write_limit -= length;
+	return length == JOURNAL_SECTOR_SIZE;
+}
+#endif
+
+//============================================ LOG ========================================
+
+bool TxJournal::is_log_sector(uint16_t sector, uint32_t* sequence) const
+{
+	JournalSectorHeader header;
+	if (!storage_read(sector_base(sector), &header, sizeof(header))) return false;
+	if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION) return false;
+
+	if (sequence) *sequence = header.sequence;
+	return true;
+}
+
+bool TxJournal::load_record(uint16_t sector, uint16_t offset, JournalRecord* record) const
+{
+	record->length = JOURNAL_UNWRITTEN;
+	if (offset + sizeof(JournalRecord) > JOURNAL_SECTOR_SIZE) return false;
+
+	uint32_t base = sector_base(sector) + offset;
+	if (!storage_read(base, record, sizeof(JournalRecord))) return false;
+	if (record->length == JOURNAL_UNWRITTEN) return false;
+	if (record->length > JOURNAL_SECTOR_SIZE - offset - sizeof(JournalRecord)) return false;//torn length
+
+	//Payload in small chunks, the record may be as large as a sector
+	uint8_t chunk[64];
+	uint16_t crc = header_crc(record);
+	for (uint16_t pos = 0; pos < record->length; pos += sizeof(chunk))
+	{
+		uint16_t take = record->length - pos;
+		if (take > sizeof(chunk)) take = sizeof(chunk);
+		if (!storage_read(base + sizeof(JournalRecord) + pos, chunk, take)) return false;
+		crc = CRC16::calculate(chunk, take, crc);
+	}
+	return crc == record->crc;
+}
+
+bool TxJournal::open_sector(uint16_t sector)
+{
+	//Retire the old header first: an erase cut short must not leave it valid over half-erased records
+	if (is_log_sector(sector, nullptr))
+	{
+		uint16_t retired = 0;
+		if (!storage_write(sector_base(sector) + offsetof(JournalSectorHeader, magic), &retired, sizeof(retired))) return false;
+	}
+	if (!storage_erase(sector)) return false;
+	sectors_erased++;
+
+	JournalSectorHeader header;
+	header.sequence = head_sequence + 1;
+	header.version = JOURNAL_VERSION;
+	header.reserved = 0xFF;
+	header.magic = JOURNAL_MAGIC;
+
+	//Magic last, a header cut short stays invalid
+	if (!storage_write(sector_base(sector), &header, offsetof(JournalSectorHeader, magic))) return false;
+	if (!storage_write(sector_base(sector) + offsetof(JournalSectorHeader, magic), &header.magic, sizeof(header.magic))) return false;
+
+	head_sector = sector;
+	head_offset = sizeof(JournalSectorHeader);
+	head_sequence = header.sequence;
+	return true;
+}
+
+void TxJournal::advance_read()
+{
+	while (pending > 0)
+	{
+		if (read_sector == head_sector && read_offset >= head_offset) break;
+
+		if (load_record(read_sector, read_offset, &read_record))
+		{
+			if (read_record.state == JOURNAL_PENDING) return;
+			read_offset += record_size(read_record.length);
+			continue;
+		}
+
+		//End of this sector, or a record a reset cut short: the log goes on in the next sector
+		if (read_sector == head_sector) break;
+		do
+		{
+			read_sector = next_sector(read_sector);
+		} while (read_sector != head_sector && !is_log_sector(read_sector, nullptr));
+		read_offset = sizeof(JournalSectorHeader);
+	}
+
+	pending = 0;
+	read_sector = head_sector;
+	read_offset = head_offset;
+}
+
+void TxJournal::recover()
+{
+	uint16_t tail_sector = 0;
+	uint32_t tail_sequence = 0;
+	bool found = false;
+
+	pending = 0;
+	next_id = 0;
+	head_sequence = 0;
+
+	//Sectors are opened in ring order with rising sequence numbers: oldest = tail, newest = head
+	for (uint16_t sector = 0; sector < sector_count; sector++)
+	{
+		uint32_t sequence;
+		if (!is_log_sector(sector, &sequence)) continue;
+
+		if (!found || sequence > head_sequence)
+		{
+			head_sector = sector;
+			head_sequence = sequence;
+		}
+		if (!found || sequence < tail_sequence)
+		{
+			tail_sector = sector;
+			tail_sequence = sequence;
+		}
+		found = true;
+	}
+
+	if (!found)
+	{
+		//Blank: a sealed pseudo-head, so the first append opens sector 0
+		head_sector = sector_count - 1;
+		head_offset = JOURNAL_SECTOR_SIZE;
+		read_sector = head_sector;
+		read_offset = head_offset;
+		return;
+	}
+
+	for (uint16_t sector = tail_sector;; sector = next_sector(sector))
+	{
+		if (is_log_sector(sector, nullptr))
+		{
+			JournalRecord record;
+			uint16_t offset = sizeof(JournalSectorHeader);
+
+			while (load_record(sector, offset, &record))
+			{
+				if (record.state == JOURNAL_PENDING)
+				{
+					if (pending == 0)
+					{
+						read_sector = sector;
+						read_offset = offset;
+						read_record = record;
+					}
+					pending++;
+				}
+				if (record.id >= next_id) next_id = record.id + 1;
+				offset += record_size(record.length);
+			}
+
+			bool torn = record.length != JOURNAL_UNWRITTEN;
+			if (torn) torn_records++;
+			if (sector == head_sector) head_offset = torn ? JOURNAL_SECTOR_SIZE : offset;//never append behind a torn record
+		}
+		if (sector == head_sector) break;
+	}
+
+	if (pending == 0)
+	{
+		read_sector = head_sector;
+		read_offset = head_offset;
+	}
+}
+
+bool TxJournal::format()
+{
+	if (sector_count == 0) return false;
+
+	for (uint16_t sector = 0; sector < sector_count; sector++)
+	{
+		if (!storage_erase(sector)) return false;
+		sectors_erased++;
+	}
+	recover();
+	return true;
+}
+
+//============================================ QUEUE ========================================
+
+bool TxJournal::append(const uint8_t* data, uint16_t length, uint8_t channel)
+{
+	if (!mounted || length > JOURNAL_MAX_PAYLOAD || (length > 0 && !data))
+	{
+		append_failures++;
+		return false;
+	}
+
+	uint16_t size = record_size(length);
+	if (head_offset + size > JOURNAL_SECTOR_SIZE)
+	{
+		//Sectors between the head and the read position hold only acknowledged records
+		uint16_t next = next_sector(head_sector);
+		if ((pending > 0 && next == read_sector) || !open_sector(next))
+		{
+			append_failures++;
+			return false;
+		}
+	}
+
+	JournalRecord record;
+	record.length = length;
+	record.channel = channel;
+	record.state = JOURNAL_PENDING;
+	record.id = next_id;
+	record.reserved = 0xFFFF;
+	record.crc = CRC16::calculate(data, length, header_crc(&record));
+
+	//Header first: a reset between the writes leaves a record whose CRC fails
+	uint16_t offset = head_offset;
+	uint32_t base = sector_base(head_sector) + offset;
+	if (!storage_write(base, &record, sizeof(record)) || (length > 0 && !storage_write(base + sizeof(record), data, length)))
+	{
+		head_offset = JOURNAL_SECTOR_SIZE;//half-programmed bytes, nothing goes behind them
+		append_failures++;
+		return false;
+	}
+	head_offset += size;
+
+	if (pending == 0)
+	{
+		read_sector = head_sector;
+		read_offset = offset;
+		read_record = record;
+	}
+	pending++;
+	next_id++;
+	appends++;
+	return true;
+}
+
+bool TxJournal::peek(uint16_t* length, uint8_t* channel, uint32_t* id) const
+{
+	if (pending == 0) return false;
+
+	if (length) *length = read_record.length;
+	if (channel) *channel = read_record.channel;
+	if (id) *id = read_record.id;
+	return true;
+}
+
+bool TxJournal::read(uint16_t offset, uint8_t* data, uint16_t length) const
+{
+	if (pending == 0 || offset + length > read_record.length) return false;
+	return storage_read(sector_base(read_sector) + read_offset + sizeof(JournalRecord) + offset, data, length);
+}
+
+bool TxJournal::ack()
+{
+	if (pending == 0) return false;
+
+	uint8_t state = JOURNAL_ACKED;
+	if (!storage_write(sector_base(read_sector) + read_offset + offsetof(JournalRecord, state), &state, sizeof(state))) return false;
+
+	pending--;
+	acks++;
+	read_offset += record_size(read_record.length);
+	advance_read();
+	return true;
+}
+
+uint32_t TxJournal::get_free_sectors() const
+{
+	if (sector_count == 0) return 0;
+	return (read_sector + sector_count - head_sector - 1) % sector_count;
+}
+
+void TxJournal::print_statistics()
+{
+	Serial.println("TX JOURNAL:");
+	Serial.print(" Pending: "); Serial.println(pending);
+	Serial.print(" Appended: "); Serial.println(appends);
+	Serial.print(" Acknowledged: "); Serial.println(acks);
+	Serial.print(" Append Failures: "); Serial.println(append_failures);
+	Serial.print(" Free Sectors: "); Serial.print(get_free_sectors()); Serial.print("/"); Serial.println(sector_count);
+	Serial.print(" Sectors Erased: "); Serial.println(sectors_erased);
+	Serial.print(" Torn Records: "); Serial.println(torn_records);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef TX_JOURNAL_H
+#define TX_JOURNAL_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#if defined(ESP32)
+#include <esp_partition.h>
+#endif
+
+//Store-and-forward TX journal: an append-only log of outgoing messages that survives link
+//outages and reboots. The storage is a ring of flash erase sectors (a data partition on the
+//ESP32, a mmap'd file with the same NOR semantics on the host):
+//  JournalSectorHeader once per sector, then JournalRecord + payload back to back, 4-byte aligned.
+//
+//Only ever appended, never rewritten: an ACK programs the record's state byte from 0xFF to 0x00
+//in place, which flash allows without an erase. Messages drain oldest first, so acknowledged
+//records pile up behind the read position and whole sectors fall free; such a sector is erased
+//only when the head wraps onto it. Compaction is one sector erase per 4 KB appended, no copying.
+//
+//Crash consistency: a record is written header first, and its CRC covers the payload, so a write
+//cut short by a reset fails the CRC. begin() stops at the first bad record and never appends
+//behind it. An append that returned true is on flash; an ACK cut short delivers the message again.
+//
+//Delivery is at-least-once on the wire: a record is acknowledged only after the peer ACKed its last
+//fragment, so a lost ACK or a reset in between sends it again. UartProtocol tags every journaled
+//message with the record id and the receiver drops an immediate repeat of the id it delivered last.
+//That makes it exactly-once unless the receiver itself restarted in between, or format() restarted
+//the ids at 0.
+#define JOURNAL_SECTOR_SIZE 4096//flash erase unit
+#define JOURNAL_MAGIC 0x4A54//"TJ", programmed last when a sector is opened
+#define JOURNAL_VERSION 1
+#define JOURNAL_ALIGN 4//record start alignment, flash programs whole words
+#define JOURNAL_PENDING 0xFF//record state as written: erased, not acknowledged
+#define JOURNAL_ACKED 0x00//record state after ack(), any programmed bit counts
+#define JOURNAL_UNWRITTEN 0xFFFF//record length on erased flash: end of the sector
+
+typedef struct __attribute__((packed))
+{
+	uint32_t sequence;//+1 per sector opened, the highest one is the head
+	uint8_t version;
+	uint8_t reserved;
+	uint16_t magic;
+}JournalSectorHeader;
+
+typedef struct __attribute__((packed))
+{
+	uint16_t length;//payload bytes
+	uint8_t channel;
+	uint8_t state;//JOURNAL_PENDING / JOURNAL_ACKED, the only byte outside the CRC
+	uint32_t id;//append order, survives reboots
+	uint16_t crc;//CRC16 over length, channel, id and payload
+	uint16_t reserved;
+}JournalRecord;
+
+#define JOURNAL_MAX_PAYLOAD (JOURNAL_SECTOR_SIZE - sizeof(JournalSectorHeader) - sizeof(JournalRecord))
+
+class TxJournal
+{
+private:
+	uint16_t sector_count;
+	bool mounted;
+
+	uint16_t head_sector;//sector appends go to
+	uint16_t head_offset;//next free byte in it, JOURNAL_SECTOR_SIZE = sealed
+	uint32_t head_sequence;
+	uint16_t read_sector;//oldest pending record, or the head position when there is none
+	uint16_t read_offset;
+	JournalRecord read_record;//header at the read position, CRC already checked
+	uint32_t next_id;
+	uint32_t pending;
+
+	uint32_t appends;
+	uint32_t acks;
+	uint32_t append_failures;//full, too large or a storage error
+	uint32_t sectors_erased;
+	uint32_t torn_records;//cut-short writes found by begin()
+
+#if defined(ESP32)
+	const esp_partition_t* partition;
+#else
+	int fd;
+	uint8_t* map;
+	uint32_t write_limit;//bytes left before the simulated power cut, 0xFFFFFFFF = off
+#endif
+
+	bool storage_read(uint32_t offset, void* data, uint16_t length) const;
+	bool storage_write(uint32_t offset, const void* data, uint16_t length);//can only clear bits
+	bool storage_erase(uint16_t sector);
+
+	static uint16_t record_size(uint16_t length) { return (sizeof(JournalRecord) + length + JOURNAL_ALIGN - 1) & ~(JOURNAL_ALIGN - 1); }
+	static uint32_t sector_base(uint16_t sector) { return (uint32_t)sector * JOURNAL_SECTOR_SIZE; }
+	uint16_t next_sector(uint16_t sector) const { return (sector + 1) % sector_count; }
+	bool is_log_sector(uint16_t sector, uint32_t* sequence) const;
+	bool load_record(uint16_t sector, uint16_t offset, JournalRecord* record) const;//false = end of the sector or torn
+	bool open_sector(uint16_t sector);
+	void advance_read();
+	void recover();
+
+public:
+	TxJournal();
+	~TxJournal();
+
+#if defined(ESP32)
+	bool begin(const char* partition_label);//data partition, a multiple of JOURNAL_SECTOR_SIZE
+#else
+	bool begin(const char* path, uint16_t sectors);//backing file, created erased (0xFF) if missing
+	void end();
+	void set_write_limit(uint32_t bytes) { write_limit = bytes; }//host tests: writes stop dead after this many bytes
+#endif
+	bool is_mounted() const { return mounted; }
+	bool format();//erase every sector, pending messages are lost
+
+	bool append(const uint8_t* data, uint16_t length, uint8_t channel = 0);//false = nothing stored
+	bool peek(uint16_t* length, uint8_t* channel, uint32_t* id = nullptr) const;//oldest pending message, false = none
+	bool read(uint16_t offset, uint8_t* data, uint16_t length) const;//slice of the peeked message
+	bool ack();//oldest pending message delivered, the next one becomes visible to peek()
+
+	uint32_t get_pending() const { return pending; }
+	uint32_t get_free_sectors() const;//sectors an append can still open
+	void print_statistics();
+};
+
+#endif // !TX_JOURNAL_H
@@ -1,361 +1,1403 @@
-#include "uart_protocol.h"
-#include <Arduino.h>
-
-UartProtocol::UartProtocol(HardwareSerial* serial_port, uint32_t baud) :
-	serial(serial_port), 
-	baud_rate(baud), 
-	rx_state(STATE_WAITING_START), 
-	rx_index(0),
-	last_byte_time(0)
-{
-	memset(rx_buffer, 0, sizeof(Frame));
-}
-
-//==============================================SEND FUNCTION=====================================
-
-void UartProtocol::send_uart_data()
-{
-	static uint16_t test_counter = 0;
-	static unsigned long last_throughput_check = 0;
-
-	Frame frame;
-	String message = "Test " + String(test_counter) + " - Time: " + String(millis());
-
-	if (packet_frame.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), &frame))//Create message data
-	{
-		bool success = send_uart_master(&frame);//Check frames are sent or not
-
-		if (success)
-		{
-			Serial.println("Reliable delivery comfirmed via ");
-		}
-		else
-		{
-			Serial.print("Delivery failed for packet ");
-			Serial.println(frame.sequence_num);
-		}
-	}
-	test_counter++;
-
-	if (millis() - last_throughput_check > 5000)
-	{
-		float throughput = packet_frame.get_performance_monitor().get_throughput_kbps();
-		Serial.print("Current throughput: ");
-		Serial.print(throughput);
-		Serial.println(" kbps");
-		last_throughput_check = millis();
-	}
-}
-
-void UartProtocol::send_uart_ack(uint16_t seq_num)//Sent ACK to Master
-{
-	Frame ack_frame;
-	uint8_t empty_data[1] = { 0 };
-
-	if (packet_frame.create_frame(TYPE_ACK, empty_data, 0, &ack_frame))
-	{
-		ack_frame.sequence_num = seq_num;
-
-		//Use current communication interface
-		send_uart_slave(&ack_frame);
-
-		Serial.print("Sent ACK for frame ");
-		Serial.print(seq_num);
-	}
-}
-
-void UartProtocol::send_uart_nack(uint16_t seq_num)//Sent NACK to Master
-{
-	Frame nack_frame;
-	uint8_t empty_data[1] = { 0 };
-
-	if (packet_frame.create_frame(TYPE_NACK, empty_data, 0, &nack_frame))
-	{
-		nack_frame.sequence_num = seq_num;
-		send_uart_slave(&nack_frame);
-
-		Serial.print("Sent NACK for frame ");
-		Serial.println(seq_num);
-	}
-
-}
-
-bool UartProtocol::send_uart_master(Frame* frame)
-{
-	int retries = MAX_RETRIES;
-
-	while (retries > 0)
-	{
-		//Start timing
-		packet_frame.start_packet_timing(frame->sequence_num);
-
-		//Send frame
-		serial->write((uint8_t*)frame, sizeof(Frame));
-		serial->flush();
-		delay(2);
-
-		Serial.print("\nSent frame ");
-		Serial.print(frame->sequence_num);
-		Serial.println(", waiting for ACK...");
-
-		if (wait_for_ack(frame->sequence_num, *serial, ACK_TIMEOUT_MS))
-		{
-			Serial.println("ACK received - SUCCESS");
-			return true;
-		}
-
-		//Timeout - retry
-		retries--;
-		packet_frame.record_retransmission();
-		Serial.print("Timeout - Retransmitting frame ");
-		Serial.print(frame->sequence_num);
-		Serial.print(", Attemps left: ");
-		Serial.println(retries);
-	}
-
-	packet_frame.record_timeout();
-	packet_frame.record_packet_lost(frame->sequence_num);
-	return false;
-}
-
-bool UartProtocol::send_uart_slave(Frame* frame)
-{
-	if (!serial) return false;
-
-	size_t bytes_written = serial->write((uint8_t*)frame, sizeof(Frame));
-	serial->flush();
-	return bytes_written == sizeof(Frame);//Sending completed
-}
-
-bool UartProtocol::wait_for_ack(uint16_t seq_num, HardwareSerial& serial, uint32_t timeout_ms)
-{
-	uint32_t start_time = millis();
-
-	while (millis() - start_time < timeout_ms)
-	{
-		if (serial.available() >= sizeof(Frame))
-		{
-			Frame response;
-			serial.readBytes((uint8_t*)&response, sizeof(Frame));
-
-			/*Serial.print("Received frame - Type: ");
-			Serial.print(response.packet_type);
-			Serial.print(", Seq: ");
-			Serial.print(response.sequence_num);
-			Serial.print(", Expected Seq: ");
-			Serial.println(seq_num);*/
-
-			if (packet_frame.validate_frame(&response))
-			{
-				if (response.packet_type == TYPE_ACK && response.sequence_num == seq_num)
-				{
-					packet_frame.end_packet_timing(seq_num);
-					Serial.println("VALID ACK RECEIVED");
-					return true;
-				}
-				else if (response.packet_type == TYPE_NACK && response.sequence_num == seq_num)
-				{
-					Serial.println("NACK RECEIVED");
-					return false;
-				}
-				else
-				{
-					Serial.println("UNEXPECTED FRAME TYPE OR SEQUENCE");
-				}
-			}
-			else
-			{
-				Serial.println("INVALID FRAME CRC");
-			}
-		}
-		delay(1);
-	}
-	Serial.println("ACK TIMEOUT");
-	return false;
-}
-
-//============================================ RECEIVE FUNCTION ========================================
-
-void UartProtocol::print_frame_info(Frame* frame)
-{
-	Serial.print("Frame[");
-	Serial.print(frame->sequence_num);
-	Serial.print("] Type:");
-
-	switch (frame->packet_type)
-	{
-	case TYPE_DATA: Serial.print("DATA"); break;
-	case TYPE_ACK: Serial.print("ACK"); break;
-	case TYPE_NACK: Serial.print("NACK"); break;
-	default: Serial.print("UNKNOWN"); break;
-	}
-
-	Serial.print(" Len: "); Serial.print(frame->data_length);
-	Serial.print(" CRC: 0x"); Serial.print(frame->crc16, HEX);
-	Serial.print(" Valid: "); Serial.print(packet_frame.validate_frame(frame) ? "YES" : "NO");
-}
-
-void UartProtocol::receive_data_uart_master()
-{
-	Frame frame;
-
-	if (receive_uart(&frame))
-	{
-		process_received_frame_uart_master(&frame);
-	}
-}
-
-void UartProtocol::receive_data_uart_slave()
-{
-	Frame frame;
-	if (receive_uart(&frame))
-	{
-		process_received_frame_uart_slave(&frame);
-	}
-}
-
-void UartProtocol::process_received_frame_uart_master(Frame* frame)//process received frames
-{
-	Serial.print("\n<<< MASTER RECEIVED: ");
-	print_frame_info(frame);//Print frame infos
-	Serial.println();
-
-	if (packet_frame.validate_frame(frame))//Check frames
-	{
-		switch (frame->packet_type)
-		{
-		case TYPE_DATA:
-			Serial.print("Data: ");
-			for (int i = 0; i < frame->data_length; i++)
-			{
-				Serial.print((char)frame->data[i]);
-			}
-			Serial.println();
-			send_uart_ack(frame->sequence_num);
-			break;
-		case TYPE_ACK:
-			Serial.println("ACK processed");
-			break;
-		case TYPE_NACK:
-			Serial.println("NACK processed - will retry");
-			break;
-
-		}
-	}
-	else
-	{
-		Serial.println("INVALID FRAME");
-		send_uart_nack(frame->sequence_num);
-	}
-}
-
-void UartProtocol::process_received_frame_uart_slave(Frame* frame)
-{
-	Serial.print("\n<<< SLAVE RECEIVED: ");
-	print_frame_info(frame);
-	Serial.println();
-
-	if (packet_frame.validate_frame(frame))
-	{
-		switch (frame->packet_type)
-		{
-		case TYPE_DATA:
-		{
-			String received_data = "";
-
-			for (int i = 0; i < frame->data_length; i++)
-			{
-				received_data += (char)frame->data[i];
-			}
-			Serial.print("Data: ");
-			Serial.println(received_data);
-
-			Serial.print("Sending ACK for seq: ");
-			Serial.println(frame->sequence_num);
-			send_uart_ack(frame->sequence_num);
-			break;
-		}
-		case TYPE_ACK:
-			Serial.println("ACK processed - THIS SHOULD NOT HAPPEN ON SLAVE");
-			break;
-		case TYPE_NACK:
-			Serial.println("NACK processed - will retry");
-			break;
-		}
-	}
-	else
-	{
-		Serial.println("INVALID FRAME - CRC ERROR");
-		Serial.print("Sending NACK for seq: ");
-		Serial.println(frame->sequence_num);
-		send_uart_nack(frame->sequence_num);
-	}
-}
-
-bool UartProtocol::receive_uart(Frame* frame)
-{
-	//Using Receiver State Machine for receiving
-
-	if (!serial) return false;
-
-	while (serial->available())
-	{
-		uint8_t byte = serial->read();
-		last_byte_time = millis();
-
-		switch (rx_state)
-		{
-		case STATE_WAITING_START:
-			if (byte == START_MARKER)
-			{
-				rx_index = 0;
-				rx_buffer[rx_index++] = byte;
-				rx_state = STATE_RECEIVING_FRAME;
-			}
-			break;
-
-		case STATE_RECEIVING_FRAME:
-			rx_buffer[rx_index++] = byte;
-
-			if (rx_index >= sizeof(Frame))
-			{
-				//Copy to output frame
-				memcpy(frame, rx_buffer, sizeof(Frame));
-
-				if (frame->end_marker == END_MARKER)
-				{
-					rx_state = STATE_WAITING_START;
-					return true;//Valid frame
-				}
-				else
-				{
-					Serial.println("Invalid end marker");
-					reset_receiver();
-					return false;//framing error
-				}
-			}
-			break;
-		}
-	}
-
-	if (rx_state == STATE_RECEIVING_FRAME && check_timeout())
-	{
-		reset_receiver();
-	}
-
-	return false;//No complete frame available yet
-}
-
-void UartProtocol::reset_receiver()
-{
-	//Resetting for new UART transfer
-	rx_state = STATE_WAITING_START;
-	rx_index = 0;
-	memset(rx_buffer, 0, sizeof(Frame));
-	last_byte_time = 0;
-}
-
-bool UartProtocol::check_timeout()
-{
-	return (millis() - last_byte_time) > 500;
-}
\ No newline at end of file
+#include "uart_protocol.h"
+#include "cycle_profiler.h"
+#include <Arduino.h>
+
+template<class Config>
+UartProtocolT<Config>::UartProtocolT(Stream* serial_port, uint32_t baud) :
+	serial(serial_port), 
+	baud_rate(baud), 
+	rx_start(0),
+	rx_end(0),
+	last_byte_time(0),
+	capture(nullptr),
+	payload_controller(Config::MAX_DATA_LEN),
+	journal(nullptr),
+	rx_message_length(0),
+	rx_message_next(0),
+	rx_message_active(false),
+	rx_message_tagged(false),
+	rx_message_id(0),
+	last_journal_id(0),
+	last_journal_id_valid(false),
+	messages_dropped(0),
+	replays_dropped(0),
+	delivery_head(0),
+	delivery_count(0),
+	last_acked_seq(0),
+	credit_update_due(false),
+	last_delivery_ms(DELIVERY_IDLE_MS),//unknown consumer is treated as slow until measured
+	delivery_handler(nullptr),
+	peer_credits(CREDITS_UNKNOWN),
+	rx_frame_time_us(0),
+	tx_time_us(0),
+	tx_timed_seq(0),
+	tx_timed_retry(false),
+	ack_stamp_rx_us(0),
+	ack_stamp_seq(0),
+	ack_stamp_due(false),
+	session_up(false),
+	compression_wanted(false),
+	current_baud(baud),
+	baud_ceiling(baud),
+	baud_callback(nullptr),
+	last_connect_attempt(0),
+	last_valid_rx_time(0),
+	consecutive_errors(0),
+	quality_frames(0),
+	quality_errors(0),
+	stats_seq(0),
+	link_state(LINK_UP),
+	last_peer_activity(0),
+	last_heartbeat(0),
+	link_down_since(0),
+	unanswered_probes(0)
+{
+	memset(rx_buffer, 0, sizeof(rx_buffer));
+	LinkNegotiation::get_local_params(&session_params, baud, Config::MAX_DATA_LEN);
+	payload_controller.set_link(baud, Config::ACK_TIMEOUT_MS);
+}
+
+//============================================ SESSION ========================================
+
+template<class Config>
+bool UartProtocolT<Config>::connect(uint32_t timeout_ms)
+{
+	if (!serial) return false;
+	last_connect_attempt = millis();
+
+	LinkParams local;
+	get_offer(&local);
+
+	//Keyed: a fresh salt per attempt, the session key is never the same twice
+	bool keyed = packet_frame.is_aead_required();
+	uint32_t salt = keyed ? FrameCipher::random_salt() : 0;
+	uint8_t offer[sizeof(LinkParams) + SESSION_SALT_LEN];
+	memcpy(offer, &local, sizeof(local));
+	memcpy(offer + sizeof(local), &salt, SESSION_SALT_LEN);
+	uint16_t offer_len = keyed ? sizeof(offer) : sizeof(local);
+
+	Frame syn;
+	if (!packet_frame.create_frame(TYPE_SYN, offer, offer_len, &syn)) return false;
+
+	for (int attempt = 0; attempt < Config::MAX_RETRIES; attempt++)
+	{
+		send_uart_slave(&syn);
+		Serial.print("\nSent SYN, offering max baud: ");
+		Serial.println(local.max_baud);
+
+		Frame response;
+		if (wait_for_frame(TYPE_SYN_ACK, syn.sequence_num, &response, timeout_ms))
+		{
+			LinkParams agreed;
+			LinkParams check;
+
+			//Peer must pick a subset of what we offered
+			memcpy(&agreed, response.data, sizeof(agreed));
+			if (response.data_length != offer_len ||
+				!LinkNegotiation::negotiate(&local, &agreed, &check) ||
+				memcmp(&check, &agreed, sizeof(agreed)) != 0)
+			{
+				Serial.println("SYN-ACK REJECTED - invalid parameters");
+				return false;
+			}
+
+			apply_session(&agreed);
+			if (keyed)
+			{
+				uint32_t peer_salt;
+				memcpy(&peer_salt, response.data + sizeof(agreed), SESSION_SALT_LEN);
+				packet_frame.start_aead_session(salt, peer_salt, true);
+			}
+			return true;
+		}
+		packet_frame.record_retransmission();
+	}
+
+	Serial.println("HANDSHAKE FAILED - using defaults");
+	return false;
+}
+
+template<class Config>
+void UartProtocolT<Config>::handle_syn(Frame* frame)
+{
+	LinkParams peer;
+	LinkParams local;
+	LinkParams agreed;
+
+	bool keyed = packet_frame.is_aead_required();
+	uint16_t offer_len = keyed ? sizeof(peer) + SESSION_SALT_LEN : sizeof(peer);
+	if (frame->data_length != offer_len)
+	{
+		send_uart_nack(frame->sequence_num);
+		return;
+	}
+	memcpy(&peer, frame->data, sizeof(peer));
+	get_offer(&local);
+
+	if (!LinkNegotiation::negotiate(&local, &peer, &agreed))
+	{
+		Serial.println("HANDSHAKE REJECTED - incompatible peer");
+		send_uart_nack(frame->sequence_num);
+		return;
+	}
+
+	uint32_t peer_salt;
+	uint32_t salt = keyed ? FrameCipher::random_salt() : 0;
+	uint8_t answer[sizeof(LinkParams) + SESSION_SALT_LEN];
+	memcpy(&peer_salt, frame->data + sizeof(peer), SESSION_SALT_LEN);
+	memcpy(answer, &agreed, sizeof(agreed));
+	memcpy(answer + sizeof(agreed), &salt, SESSION_SALT_LEN);
+
+	Frame reply;
+	if (packet_frame.create_reply_frame(TYPE_SYN_ACK, frame->sequence_num, answer, offer_len, &reply))
+	{
+		send_uart_slave(&reply);//flushed before the baud switch below
+		apply_session(&agreed);
+		if (keyed) packet_frame.start_aead_session(peer_salt, salt, false);
+	}
+}
+
+template<class Config>
+void UartProtocolT<Config>::get_offer(LinkParams* local) const
+{
+	LinkNegotiation::get_local_params(local, get_advertised_baud(), Config::MAX_DATA_LEN);
+
+	//No CRC16 fallback once keyed, a peer without the key cannot talk us down to plaintext
+	if (packet_frame.is_aead_required()) local->crc_variants = CRC_VARIANT_AEAD;
+}
+
+template<class Config>
+void UartProtocolT<Config>::apply_session(const LinkParams* params)
+{
+	session_params = *params;
+	session_up = true;
+
+	packet_frame.set_compression(compression_wanted && (params->features & FEATURE_COMPRESSION));
+	packet_frame.reset_receive_window();
+
+	consecutive_errors = 0;
+	quality_frames = 0;
+	quality_errors = 0;
+	last_valid_rx_time = millis();
+	payload_controller.set_limits(CONTROLLER_MIN_PAYLOAD, params->max_payload);
+
+	Serial.print("SESSION UP - payload: "); Serial.print(params->max_payload);
+	Serial.print(" window: "); Serial.print(params->window_size);
+	Serial.print(" features: 0x"); Serial.print(params->features, HEX);
+	Serial.print(" baud: "); Serial.println(params->max_baud);
+
+	change_baud(params->max_baud);
+}
+
+template<class Config>
+void UartProtocolT<Config>::change_baud(uint32_t baud)
+{
+	if (baud == current_baud || !baud_callback) return;
+
+	serial->flush();
+	baud_callback(baud);
+	current_baud = baud;
+	payload_controller.set_link(baud, Config::ACK_TIMEOUT_MS);
+	delay(5);//let both UARTs settle before the first frame at the new rate
+}
+
+template<class Config>
+void UartProtocolT<Config>::fallback_to_base(bool lower_ceiling)
+{
+	Serial.print("LINK FALLBACK from ");
+	Serial.print(current_baud);
+	Serial.println(" baud");
+
+	//Next handshake offers one step less than the rate that just failed
+	if (lower_ceiling) baud_ceiling = LinkNegotiation::step_down_baud(current_baud);
+
+	session_up = false;
+	packet_frame.set_compression(false);//the next peer may not decode it, the handshake turns it back on
+	change_baud(baud_rate);
+	reset_receiver();
+}
+
+template<class Config>
+void UartProtocolT<Config>::set_compression(bool enable)
+{
+	compression_wanted = enable;
+
+	//Turning it off is always safe, turning it on waits for a session that agreed to it
+	packet_frame.set_compression(enable && session_up && (session_params.features & FEATURE_COMPRESSION));
+}
+
+template<class Config>
+void UartProtocolT<Config>::update_link_quality(bool delivered, uint8_t retransmissions)
+{
+	if (current_baud == baud_rate) return;
+
+	if (!delivered)
+	{
+		fallback_to_base(true);
+		return;
+	}
+
+	quality_frames++;
+	quality_errors += retransmissions;
+	if (quality_frames < LINK_QUALITY_WINDOW) return;
+
+	bool degraded = (uint32_t)quality_errors * 100 > (uint32_t)quality_frames * LINK_ERROR_THRESHOLD_PCT;
+	quality_frames = 0;
+	quality_errors = 0;
+
+	if (degraded)
+	{
+		//Renegotiate one step lower while the link still works
+		baud_ceiling = LinkNegotiation::step_down_baud(current_baud);
+		if (!connect()) fallback_to_base(false);
+	}
+}
+
+template<class Config>
+void UartProtocolT<Config>::check_session_health()
+{
+	if (current_baud == baud_rate) return;
+
+	//Receiver side: garbage or silence at the stepped-up rate means the master already fell back
+	if (consecutive_errors >= LINK_ERROR_BURST || millis() - last_valid_rx_time > LINK_IDLE_FALLBACK_MS)
+	{
+		fallback_to_base(false);
+	}
+}
+
+//============================================ LINK STATE ========================================
+
+template<class Config>
+void UartProtocolT<Config>::note_peer_activity()
+{
+	last_peer_activity = millis();
+	unanswered_probes = 0;
+	if (link_state != LINK_UP) set_link_state(LINK_UP);
+}
+
+template<class Config>
+bool UartProtocolT<Config>::validate_rx_frame(Frame* frame)
+{
+	if (!packet_frame.validate_frame(frame))
+	{
+		//Noise breaks a tag now and then, a run of them means the peer holds another session key
+		if (session_up && packet_frame.is_aead_active() && packet_frame.get_auth_failures() >= LINK_AUTH_FAILURE_LIMIT)
+		{
+			drop_session("AEAD authentication keeps failing");
+		}
+		return false;
+	}
+	note_peer_activity();
+	return true;
+}
+
+template<class Config>
+void UartProtocolT<Config>::drop_session(const char* reason)
+{
+	Serial.print("SESSION DROPPED - ");
+	Serial.println(reason);
+
+	//A peer that rebooted listens at the base rate
+	if (current_baud != baud_rate) fallback_to_base(false);
+	session_up = false;
+	packet_frame.end_aead_session();
+	last_connect_attempt = 0;//the prober reconnects on its next call instead of after LINK_RECONNECT_MS
+}
+
+template<class Config>
+void UartProtocolT<Config>::set_link_state(LinkState state)
+{
+	unsigned long now = millis();
+	PerformanceMonitor& perf = packet_frame.get_performance_monitor();
+
+	switch (state)
+	{
+	case LINK_DOWN:
+		//Detection latency: how long the peer was already gone when we noticed
+		perf.link_failure_detected(now - last_peer_activity);
+		link_down_since = now;
+		Serial.print("LINK DOWN - no frame from peer for ");
+		Serial.print(now - last_peer_activity);
+		Serial.println(" ms");
+		break;
+	case LINK_SUSPECT:
+		Serial.println("LINK SUSPECT - peer quiet, probing");
+		break;
+	case LINK_UP:
+		if (link_state == LINK_DOWN)
+		{
+			perf.link_recovered(now - link_down_since);
+			Serial.print("LINK UP - recovered after ");
+			Serial.print(now - link_down_since);
+			Serial.println(" ms");
+
+			//Peer may have restarted: renegotiate on the next send instead of waiting LINK_RECONNECT_MS
+			if (!session_up) last_connect_attempt = 0;
+		}
+		break;
+	}
+	link_state = state;
+}
+
+template<class Config>
+LinkState UartProtocolT<Config>::update_link_state(bool prober)
+{
+	unsigned long now = millis();
+	if (last_peer_activity == 0) last_peer_activity = now;//grace period after boot
+
+	//Silence alone is not enough for the prober: an ACK wait is silent too, and a lost frame or ACK
+	//must cost a retry, not the link. It takes a whole retry budget of unanswered probes. The side
+	//that only answers outwaits a prober whose every attempt at one frame was lost.
+	unsigned long silence = now - last_peer_activity;
+	bool down = prober ? silence >= LINK_DOWN_MS && unanswered_probes >= Config::MAX_RETRIES :
+		silence >= LINK_DOWN_MS + (unsigned long)Config::MAX_RETRIES * Config::ACK_TIMEOUT_MS;
+
+	//Only escalates, note_peer_activity() is the way back up
+	if (link_state != LINK_DOWN && down)
+	{
+		set_link_state(LINK_DOWN);
+
+		//A rebooted peer listens at the base rate. The prober treats it like a failed step-up (as
+		//update_link_quality() does), the passive side keeps its ceiling like check_session_health()
+		if (current_baud != baud_rate) fallback_to_base(prober);
+
+		//Keyed: a rebooted peer lost the session key, only a new handshake brings the link back
+		if (packet_frame.is_aead_required())
+		{
+			session_up = false;
+			packet_frame.end_aead_session();
+		}
+	}
+	else if (link_state == LINK_UP && silence >= (unsigned long)LINK_SUSPECT_MS * (prober ? 1 : LINK_PASSIVE_FACTOR)) set_link_state(LINK_SUSPECT);
+	return link_state;
+}
+
+//A POLL is answered with an ACK echoing its seq. Half the sequence space away from the last DATA
+//frame sent, the ACK of a heartbeat or credit probe that arrives late (the peer was stalled, the
+//socket buffered a few) can never be taken for the ACK of a DATA frame
+template<class Config>
+uint16_t UartProtocolT<Config>::probe_sequence() const
+{
+	return (uint16_t)((tx_timed_seq + SEQUENCE_MODULUS / 2) % SEQUENCE_MODULUS);
+}
+
+template<class Config>
+void UartProtocolT<Config>::service_link(bool send_heartbeats)
+{
+	update_link_state(send_heartbeats);
+	if (!send_heartbeats || millis() - last_peer_activity < HEARTBEAT_IDLE_MS) return;
+
+	unsigned long interval = HEARTBEAT_IDLE_MS;
+	if (link_state == LINK_SUSPECT) interval = HEARTBEAT_RETRY_MS;
+	else if (link_state == LINK_DOWN) interval = LINK_REPROBE_MS;
+	if (last_heartbeat != 0 && millis() - last_heartbeat < interval) return;
+
+	//POLL is answered with an ACK by both roles, the same frame the zero-credit probe uses.
+	//A keyed link without a session has nothing to seal a POLL with, the SYN is the probe there.
+	Frame heartbeat;
+	if (packet_frame.is_aead_required() && !packet_frame.is_aead_active())
+	{
+		packet_frame.get_performance_monitor().heartbeat_sent();
+		if (unanswered_probes < 0xFF) unanswered_probes++;
+		connect(HEARTBEAT_RETRY_MS);
+	}
+	else if (packet_frame.create_reply_frame(TYPE_POLL, probe_sequence(), nullptr, 0, &heartbeat) && send_uart_slave(&heartbeat))
+	{
+		packet_frame.get_performance_monitor().heartbeat_sent();
+		if (unanswered_probes < 0xFF) unanswered_probes++;
+	}
+	last_heartbeat = millis();
+}
+
+template<class Config>
+bool UartProtocolT<Config>::wait_for_frame(uint8_t type, uint16_t seq_num, Frame* response, uint32_t timeout_ms)
+{
+	uint32_t start_time = millis();
+
+	while (millis() - start_time < timeout_ms)
+	{
+		if (receive_uart(response) && validate_rx_frame(response) && response->sequence_num == seq_num)
+		{
+			if (PacketFrame::get_type(response) == type) return true;
+			if (PacketFrame::get_type(response) == TYPE_NACK) return false;
+		}
+		delay(1);
+	}
+	return false;
+}
+
+template<class Config>
+void UartProtocolT<Config>::update_peer_credits(const Frame* frame)
+{
+	if (PacketFrame::get_type(frame) == TYPE_ACK && frame->data_length >= 1) peer_credits = frame->data[0];
+}
+
+template<class Config>
+bool UartProtocolT<Config>::wait_for_credit(uint32_t timeout_ms)
+{
+	if (peer_credits > 0) return true;
+
+	Serial.println("FLOW CONTROL: receiver has no credit, pausing");
+	uint32_t start_time = millis();
+	uint32_t last_probe = start_time;
+
+	while (millis() - start_time < timeout_ms)
+	{
+		Frame response;
+		if (receive_uart(&response) && validate_rx_frame(&response)) update_peer_credits(&response);
+		if (peer_credits > 0) break;
+
+		//Window update may have been lost: poll the receiver, its ACK carries the current credit
+		if (millis() - last_probe >= CREDIT_PROBE_MS)
+		{
+			Frame probe;
+			if (packet_frame.create_reply_frame(TYPE_POLL, probe_sequence(), nullptr, 0, &probe)) send_uart_slave(&probe);
+			last_probe = millis();
+		}
+		delay(1);
+	}
+
+	packet_frame.get_performance_monitor().flow_control_pause(millis() - start_time);
+	return peer_credits > 0;
+}
+
+//==============================================SEND FUNCTION=====================================
+
+template<class Config>
+void UartProtocolT<Config>::send_uart_data()
+{
+	static uint16_t test_counter = 0;
+	static unsigned long last_throughput_check = 0;
+
+	if (!session_up && (last_connect_attempt == 0 || millis() - last_connect_attempt > LINK_RECONNECT_MS))
+	{
+		connect();
+	}
+
+	String message = "Test " + String(test_counter) + " - Time: " + String(millis());
+
+	if (send_uart_message((uint8_t*)message.c_str(), message.length()))//Fragmented to the current payload size
+	{
+		Serial.println("Reliable delivery comfirmed via ");
+	}
+	test_counter++;
+
+	if (millis() - last_throughput_check > 5000)
+	{
+		float throughput = packet_frame.get_performance_monitor().get_throughput_kbps();
+		Serial.print("Current throughput: ");
+		Serial.print(throughput);
+		Serial.print(" kbps, payload size: ");
+		Serial.print(payload_controller.get_payload_size());
+		Serial.print(", BER estimate: ");
+		Serial.println(payload_controller.get_ber_estimate(), 7);
+		last_throughput_check = millis();
+	}
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_uart_message(const uint8_t* data, uint16_t length)
+{
+	if (length > UART_MAX_MESSAGE)
+	{
+		Serial.println("MESSAGE TOO LONG - peer cannot reassemble it");
+		return false;
+	}
+
+	//Journaled: the message is safe once stored, it goes out behind any older ones still waiting
+	if (journal)
+	{
+		if (!journal->append(data, length))
+		{
+			Serial.println("TX JOURNAL FULL - message not stored");
+			return false;
+		}
+		drain_journal();
+		return true;
+	}
+
+	return send_message(data, length, 0);
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_message(const uint8_t* data, uint16_t length, uint8_t channel, uint32_t journal_id)
+{
+	//Size only changes between messages, all fragments of one message share it
+	payload_controller.update(packet_frame.get_performance_monitor());
+	uint16_t fragment_size = payload_controller.get_payload_size();
+
+	//One frame is sent as it is, anything longer as FLAG_FRAGMENT frames the receiver reassembles.
+	//Journaled messages always are: the record id in the first one lets the receiver drop a replay.
+	bool journaled = data == nullptr;
+	bool fragmented = journaled || length > fragment_size;
+	uint8_t chunk_data[Config::MAX_DATA_LEN];
+	uint16_t offset = 0;
+	uint8_t index = 0;
+
+	do
+	{
+		uint16_t header_len = 0;
+		if (fragmented)
+		{
+			chunk_data[0] = (index & FRAGMENT_INDEX_MASK) | (index == 0 ? FRAGMENT_FIRST : 0);
+			header_len = FRAGMENT_HEADER_LEN;
+		}
+		if (journaled && index == 0)
+		{
+			chunk_data[0] |= FRAGMENT_HAS_ID;
+			memcpy(chunk_data + header_len, &journal_id, FRAGMENT_ID_LEN);
+			header_len += FRAGMENT_ID_LEN;
+		}
+
+		uint16_t chunk = length - offset;
+		if (chunk > fragment_size - header_len) chunk = fragment_size - header_len;
+		if (data) memcpy(chunk_data + header_len, data + offset, chunk);
+		else if (!journal->read(offset, chunk_data + header_len, chunk)) return false;
+
+		uint8_t flags = fragmented ? FLAG_FRAGMENT : 0;
+		if (offset + chunk < length) flags |= FLAG_MORE_FRAGMENTS;
+
+		Frame frame;
+		if (!packet_frame.create_frame(TYPE_DATA, chunk_data, header_len + chunk, &frame, flags, channel)) return false;
+
+		if (!send_uart_master(&frame))//Check frames are sent or not
+		{
+			Serial.print("Delivery failed for packet ");
+			Serial.println(frame.sequence_num);
+			return false;
+		}
+		offset += chunk;
+		index++;
+	} while (offset < length);
+
+	return true;
+}
+
+template<class Config>
+uint8_t UartProtocolT<Config>::drain_journal(uint8_t max_messages)
+{
+	uint8_t drained = 0;
+
+	//Link down: everything stays in the journal until a heartbeat gets an answer
+	if (!journal || link_state == LINK_DOWN || journal->get_pending() == 0) return 0;
+
+	//After a reboot our sequence numbers start over, the peer only takes them after a handshake
+	if (!session_up && (last_connect_attempt == 0 || millis() - last_connect_attempt > LINK_RECONNECT_MS)) connect();
+	if (!session_up) return 0;
+
+	while (drained < max_messages && link_state != LINK_DOWN && journal->get_pending() > 0)
+	{
+		if (!send_journal_head()) break;
+		drained++;
+	}
+	return drained;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_journal_head()
+{
+	uint16_t length;
+	uint8_t channel;
+	uint32_t id;
+	if (!journal->peek(&length, &channel, &id)) return false;
+
+	//Stored by a build with a larger limit: the peer would drop it, and it would block the journal
+	if (length > UART_MAX_MESSAGE)
+	{
+		Serial.println("TX JOURNAL: message too long for the peer, dropped");
+		return journal->ack();
+	}
+
+	//Always from the first fragment: the receiver drops a partial message once another one starts
+	if (!send_message(nullptr, length, channel, id))
+	{
+		Serial.println("Kept in TX journal");
+		return false;
+	}
+	return journal->ack();
+}
+
+template<class Config>
+void UartProtocolT<Config>::send_uart_ack(uint16_t seq_num)//Sent ACK to Master
+{
+	Frame ack_frame;
+	uint8_t payload[ACK_TIMESTAMP_LEN];
+	uint16_t payload_len = 1;
+	uint8_t credits = get_credits();//every ACK advertises the free delivery slots
+	payload[0] = credits;
+
+	//First ACK for a freshly received DATA frame carries its arrival time and our send time
+	if (ack_stamp_due && seq_num == ack_stamp_seq)
+	{
+		uint32_t sent_us = micros();
+		memcpy(&payload[1], &ack_stamp_rx_us, sizeof(ack_stamp_rx_us));
+		memcpy(&payload[5], &sent_us, sizeof(sent_us));
+		payload_len = ACK_TIMESTAMP_LEN;
+		ack_stamp_due = false;
+	}
+
+	if (packet_frame.create_reply_frame(TYPE_ACK, seq_num, payload, payload_len, &ack_frame))
+	{
+		//Use current communication interface
+		send_uart_slave(&ack_frame);
+		last_acked_seq = seq_num;
+		credit_update_due = (credits == 0);
+
+		Serial.print("Sent ACK for frame ");
+		Serial.print(seq_num);
+	}
+}
+
+template<class Config>
+void UartProtocolT<Config>::send_uart_nack(uint16_t seq_num)//Sent NACK to Master
+{
+	Frame nack_frame;
+	uint8_t empty_data[1] = { 0 };
+
+	if (packet_frame.create_reply_frame(TYPE_NACK, seq_num, empty_data, 0, &nack_frame))
+	{
+		send_uart_slave(&nack_frame);
+
+		Serial.print("Sent NACK for frame ");
+		Serial.println(seq_num);
+	}
+
+}
+
+template<class Config>
+bool UartProtocolT<Config>::transmit_once(Frame* frame)
+{
+	//Start timing
+	packet_frame.start_packet_timing(frame->sequence_num);
+
+	//Send frame
+	uint8_t tx_buffer[sizeof(Frame)];
+	uint16_t tx_len = PacketFrame::serialize_frame(frame, tx_buffer);
+
+	tx_timed_retry = (frame->sequence_num == tx_timed_seq);
+	tx_timed_seq = frame->sequence_num;
+	tx_time_us = micros();
+	write_wire(tx_buffer, tx_len);
+	{
+		PROFILE_SCOPE(PROF_SERIAL_FLUSH);
+		serial->flush();
+	}
+	delay(2);
+
+	Serial.print("\nSent frame ");
+	Serial.print(frame->sequence_num);
+	Serial.println(", waiting for ACK...");
+
+	bool acked = wait_for_ack(frame->sequence_num, Config::ACK_TIMEOUT_MS);
+	packet_frame.get_performance_monitor().data_attempt(acked);
+	if (!acked && unanswered_probes < 0xFF) unanswered_probes++;
+	return acked;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_uart_master(Frame* frame)
+{
+	int retries = Config::MAX_RETRIES;
+
+	if (link_state == LINK_DOWN)
+	{
+		Serial.println("LINK DOWN - frame not sent");
+		return false;
+	}
+
+	//Receiver is full: wait for a slot instead of sending into an overflowing buffer
+	if (!wait_for_credit(CREDIT_WAIT_MS))
+	{
+		Serial.println("FLOW CONTROL: receiver stalled, frame not sent");
+		return false;
+	}
+
+	while (retries > 0)
+	{
+		if (transmit_once(frame))
+		{
+			Serial.println("ACK received - SUCCESS");
+			update_link_quality(true, Config::MAX_RETRIES - retries);
+			return true;
+		}
+
+		//Peer gone: no point spending the remaining retries, the caller gets the failure now
+		if (update_link_state(true) == LINK_DOWN) break;
+
+		//Timeout - retry
+		retries--;
+		packet_frame.record_retransmission();
+		Serial.print("Timeout - Retransmitting frame ");
+		Serial.print(frame->sequence_num);
+		Serial.print(", Attemps left: ");
+		Serial.println(retries);
+	}
+
+	packet_frame.record_timeout();
+	packet_frame.record_packet_lost(frame->sequence_num);
+	update_link_quality(false, Config::MAX_RETRIES);
+	return false;
+}
+
+//============================================ CHANNELS ========================================
+
+template<class Config>
+bool UartProtocolT<Config>::service_tx()
+{
+	//Link down: everything stays queued until a heartbeat gets an answer
+	if (link_state == LINK_DOWN) return false;
+
+	uint8_t channel;
+	QueuedMessage* msg = scheduler.next(&channel);
+	if (!msg) return false;
+
+	if (scheduler.get_mode(channel) == CHANNEL_BEST_EFFORT)
+	{
+		scheduler.complete(channel, send_uart_datagram(msg->payload, msg->length, channel));
+		return true;
+	}
+
+	//Datagrams above ignore credits, reliable frames stay queued until the receiver has room
+	if (!wait_for_credit(CREDIT_WAIT_MS)) return true;
+
+	if (!msg->built)
+	{
+		if (!packet_frame.create_frame(TYPE_DATA, msg->payload, msg->length, &msg->frame, 0, channel))
+		{
+			scheduler.complete(channel, false);
+			return true;
+		}
+		msg->built = true;
+	}
+
+	//One attempt per turn, a struggling frame never holds the wire for its whole retry budget
+	if (transmit_once(&msg->frame))
+	{
+		update_link_quality(true, msg->attempts);
+		scheduler.complete(channel, true);
+	}
+	else if (update_link_state(true) == LINK_DOWN)
+	{
+		//Not the frame's fault, it keeps its attempts and goes out after recovery
+	}
+	else if (++msg->attempts >= Config::MAX_RETRIES)
+	{
+		packet_frame.record_timeout();
+		packet_frame.record_packet_lost(msg->frame.sequence_num);
+		update_link_quality(false, Config::MAX_RETRIES);
+		scheduler.complete(channel, false);
+	}
+	else
+	{
+		//Unordered: later frames of the channel may pass it. Ordered: it stays first in line.
+		packet_frame.record_retransmission();
+		if (scheduler.get_mode(channel) == CHANNEL_RELIABLE_UNORDERED) scheduler.requeue(channel);
+		scheduler.hold(channel);
+	}
+	return true;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_uart_datagram(const uint8_t* data, uint16_t length, uint8_t channel)
+{
+	Frame frame;
+	if (!serial || link_state == LINK_DOWN || !packet_frame.create_datagram(data, length, &frame, channel)) return false;
+
+	//No flush and no ACK wait: frames go out back to back at line rate
+	uint8_t tx_buffer[sizeof(Frame)];
+	uint16_t tx_len = PacketFrame::serialize_frame(&frame, tx_buffer);
+	return write_wire(tx_buffer, tx_len) == tx_len;
+}
+
+template<class Config>
+size_t UartProtocolT<Config>::write_wire(const uint8_t* data, uint16_t length)
+{
+	if (capture) capture->record(CAPTURE_DIR_TX | CAPTURE_LINK_UART, data, length);
+
+	PROFILE_SCOPE(PROF_SERIAL_WRITE);
+	return serial->write(data, length);
+}
+
+template<class Config>
+bool UartProtocolT<Config>::send_uart_slave(Frame* frame)
+{
+	if (!serial) return false;
+
+	uint8_t tx_buffer[sizeof(Frame)];
+	uint16_t tx_len = PacketFrame::serialize_frame(frame, tx_buffer);
+	if (tx_len == 0) return false;
+
+	size_t bytes_written = write_wire(tx_buffer, tx_len);
+	{
+		PROFILE_SCOPE(PROF_SERIAL_FLUSH);
+		serial->flush();
+	}
+	return bytes_written == tx_len;//Sending completed
+}
+
+template<class Config>
+bool UartProtocolT<Config>::wait_for_ack(uint16_t seq_num, uint32_t timeout_ms)
+{
+	uint32_t start_time = millis();
+
+	while (millis() - start_time < timeout_ms)
+	{
+		Frame response;
+		if (receive_uart(&response))//Frames are variable length, resync on START_MARKER
+		{
+			/*Serial.print("Received frame - Type: ");
+			Serial.print(response.packet_type);
+			Serial.print(", Seq: ");
+			Serial.print(response.sequence_num);
+			Serial.print(", Expected Seq: ");
+			Serial.println(seq_num);*/
+
+			if (validate_rx_frame(&response))
+			{
+				update_peer_credits(&response);
+
+				if (PacketFrame::get_type(&response) == TYPE_ACK && response.sequence_num == seq_num)
+				{
+					packet_frame.end_packet_timing(seq_num);
+
+					if (response.data_length >= ACK_TIMESTAMP_LEN && !tx_timed_retry && seq_num == tx_timed_seq)
+					{
+						uint32_t peer_rx_us;
+						uint32_t peer_tx_us;
+						memcpy(&peer_rx_us, &response.data[1], sizeof(peer_rx_us));
+						memcpy(&peer_tx_us, &response.data[5], sizeof(peer_tx_us));
+						packet_frame.get_performance_monitor().get_clock_sync().add_exchange(tx_time_us, peer_rx_us, peer_tx_us, rx_frame_time_us);
+					}
+					Serial.println("VALID ACK RECEIVED");
+					return true;
+				}
+				else if (PacketFrame::get_type(&response) == TYPE_NACK && response.sequence_num == seq_num)
+				{
+					Serial.println("NACK RECEIVED");
+					return false;
+				}
+				else if (PacketFrame::get_type(&response) == TYPE_STATS)
+				{
+					handle_stats(&response);
+				}
+				else
+				{
+					Serial.println("UNEXPECTED FRAME TYPE OR SEQUENCE");
+				}
+			}
+			else
+			{
+				Serial.println("INVALID FRAME CRC");
+			}
+		}
+		delay(1);
+	}
+	Serial.println("ACK TIMEOUT");
+	return false;
+}
+
+//============================================ RECEIVE FUNCTION ========================================
+
+template<class Config>
+void UartProtocolT<Config>::print_frame_info(Frame* frame)
+{
+	PROFILE_SCOPE(PROF_LOGGING);
+
+	Serial.print("Frame[");
+	Serial.print(frame->sequence_num);
+	Serial.print("] Type:");
+
+	switch (PacketFrame::get_type(frame))
+	{
+	case TYPE_DATA: Serial.print("DATA"); break;
+	case TYPE_ACK: Serial.print("ACK"); break;
+	case TYPE_NACK: Serial.print("NACK"); break;
+	case TYPE_SYN: Serial.print("SYN"); break;
+	case TYPE_SYN_ACK: Serial.print("SYN-ACK"); break;
+	case TYPE_DATAGRAM: Serial.print("DATAGRAM"); break;
+	case TYPE_POLL: Serial.print("POLL"); break;
+	case TYPE_STATS: Serial.print("STATS"); break;
+	default: Serial.print("UNKNOWN"); break;
+	}
+
+	Serial.print(" Ch: "); Serial.print(frame->channel_id);
+	Serial.print(" Len: "); Serial.print(frame->data_length);
+	if (frame->packet_type & FLAG_COMPRESSED) Serial.print(" (compressed)");
+	if (frame->packet_type & FLAG_FRAGMENT) Serial.print(" (fragment)");
+	if (frame->packet_type & FLAG_MORE_FRAGMENTS) Serial.print(" (more)");
+	Serial.print(" CRC: 0x"); Serial.print(frame->crc16, HEX);
+	Serial.print(" Valid: "); Serial.print(packet_frame.check_frame(frame) ? "YES" : "NO");
+}
+
+template<class Config>
+void UartProtocolT<Config>::receive_data_uart_master()
+{
+	Frame frame;
+
+	if (receive_uart(&frame))
+	{
+		process_received_frame_uart_master(&frame);
+	}
+	deliver_pending();
+	service_link(true);
+	drain_journal();
+}
+
+template<class Config>
+void UartProtocolT<Config>::receive_data_uart_slave()
+{
+	Frame frame;
+	if (receive_uart(&frame))
+	{
+		process_received_frame_uart_slave(&frame);
+	}
+	deliver_pending();
+	check_session_health();
+	service_link(false);
+}
+
+template<class Config>
+void UartProtocolT<Config>::process_received_frame_uart_master(Frame* frame)//process received frames
+{
+	Serial.print("\n<<< MASTER RECEIVED: ");
+	print_frame_info(frame);//Print frame infos
+	Serial.println();
+
+	if (validate_rx_frame(frame) && packet_frame.unpack_payload(frame))//Check frames
+	{
+		consecutive_errors = 0;
+		last_valid_rx_time = millis();
+
+		switch (PacketFrame::get_type(frame))
+		{
+		case TYPE_DATA:
+			handle_data(frame);
+			break;
+		case TYPE_ACK:
+			Serial.println("ACK processed");
+			break;
+		case TYPE_NACK:
+			Serial.println("NACK processed - will retry");
+			break;
+		case TYPE_SYN:
+			handle_syn(frame);
+			break;
+		case TYPE_POLL://zero-credit probe, the ACK carries the current credit
+			send_uart_ack(frame->sequence_num);
+			break;
+		case TYPE_STATS:
+			handle_stats(frame);
+			break;
+		case TYPE_DATAGRAM:
+			handle_datagram(frame);
+			break;
+		}
+	}
+	else
+	{
+		consecutive_errors++;
+		Serial.println("INVALID FRAME");
+		if (PacketFrame::get_type(frame) != TYPE_DATAGRAM) send_uart_nack(frame->sequence_num);
+	}
+}
+
+template<class Config>
+void UartProtocolT<Config>::process_received_frame_uart_slave(Frame* frame)
+{
+	Serial.print("\n<<< SLAVE RECEIVED: ");
+	print_frame_info(frame);
+	Serial.println();
+
+	if (validate_rx_frame(frame) && packet_frame.unpack_payload(frame))
+	{
+		consecutive_errors = 0;
+		last_valid_rx_time = millis();
+
+		switch (PacketFrame::get_type(frame))
+		{
+		case TYPE_DATA:
+			handle_data(frame);
+			break;
+		case TYPE_ACK:
+			Serial.println("ACK processed - THIS SHOULD NOT HAPPEN ON SLAVE");
+			break;
+		case TYPE_NACK:
+			Serial.println("NACK processed - will retry");
+			break;
+		case TYPE_SYN:
+			handle_syn(frame);
+			break;
+		case TYPE_POLL://zero-credit probe, the ACK carries the current credit
+			send_uart_ack(frame->sequence_num);
+			break;
+		case TYPE_STATS:
+			handle_stats(frame);
+			break;
+		case TYPE_DATAGRAM:
+			handle_datagram(frame);
+			break;
+		}
+	}
+	else
+	{
+		consecutive_errors++;
+		Serial.println("INVALID FRAME - CRC ERROR");
+		if (PacketFrame::get_type(frame) != TYPE_DATAGRAM)//nobody waits for a datagram NACK
+		{
+			Serial.print("Sending NACK for seq: ");
+			Serial.println(frame->sequence_num);
+			send_uart_nack(frame->sequence_num);
+		}
+	}
+}
+
+template<class Config>
+bool UartProtocolT<Config>::request_peer_stats(uint32_t timeout_ms)
+{
+	if (!PacketFrame::CARRIES_STATS) return false;//profile too small for a snapshot
+
+	Frame request;
+	Frame response;
+
+	//Numbered like the credit probe, outside the DATA sequence space
+	uint16_t seq = stats_seq++;
+	if (!packet_frame.create_reply_frame(TYPE_STATS, seq, nullptr, 0, &request)) return false;
+	if (!send_uart_slave(&request)) return false;
+
+	if (!wait_for_frame(TYPE_STATS, seq, &response, timeout_ms) || response.data_length == 0)
+	{
+		Serial.println("STATS REQUEST TIMEOUT");
+		return false;
+	}
+	return packet_frame.get_performance_monitor().peer_snapshot_received(response.data, response.data_length);
+}
+
+template<class Config>
+void UartProtocolT<Config>::handle_stats(Frame* frame)
+{
+	PerformanceMonitor& perf = packet_frame.get_performance_monitor();
+
+	//Empty = request, answered under the request's sequence number
+	if (frame->data_length == 0)
+	{
+		StatsSnapshot snapshot;
+		Frame reply;
+
+		perf.get_snapshot(&snapshot);
+		if (packet_frame.create_reply_frame(TYPE_STATS, frame->sequence_num, (const uint8_t*)&snapshot, sizeof(snapshot), &reply)) send_uart_slave(&reply);
+		return;
+	}
+
+	//Late reply to an earlier request
+	if (!perf.peer_snapshot_received(frame->data, frame->data_length))
+	{
+		Serial.println("STATS SNAPSHOT REJECTED - unknown version");
+	}
+}
+
+template<class Config>
+void UartProtocolT<Config>::handle_data(Frame* frame)
+{
+	ack_stamp_rx_us = rx_frame_time_us;
+	ack_stamp_seq = frame->sequence_num;
+	ack_stamp_due = true;
+
+	//A frame already queued is ACKed even on a full queue, a NACK would make the sender count it as failed.
+	//A new one only gets here from a sender ignoring credits: NACK before the window moves so its retry is not a duplicate
+	if (delivery_count >= RX_DELIVERY_DEPTH && !packet_frame.is_duplicate_sequence(frame->sequence_num))
+	{
+		Serial.print("RX QUEUE FULL - NACK for seq: ");
+		Serial.println(frame->sequence_num);
+		send_uart_nack(frame->sequence_num);
+		return;
+	}
+
+	//Our ACK was lost and the peer retransmitted: ACK again, deliver once
+	if (!packet_frame.accept_sequence(frame->sequence_num))
+	{
+		Serial.print("DUPLICATE - re-sending ACK for seq: ");
+		Serial.println(frame->sequence_num);
+		send_uart_ack(frame->sequence_num);
+		return;
+	}
+
+	packet_frame.record_packet_received(PacketFrame::get_wire_length(frame));
+	memcpy(&delivery_queue[(delivery_head + delivery_count) % RX_DELIVERY_DEPTH], frame, sizeof(Frame));
+	delivery_count++;
+
+	//ACK as soon as the frame is buffered, delivery runs at the application's pace
+	Serial.print("Sending ACK for seq: ");
+	Serial.println(frame->sequence_num);
+	send_uart_ack(frame->sequence_num);
+}
+
+template<class Config>
+void UartProtocolT<Config>::handle_datagram(Frame* frame)
+{
+	//Never ACKed and never queued: the sender is already streaming the next sample, it takes no credit
+	if (!packet_frame.accept_datagram(frame)) return;
+
+	if (delivery_handler)
+	{
+		delivery_handler(frame->data, frame->data_length, frame->channel_id);
+	}
+	else
+	{
+		Serial.print("Datagram: ");
+		for (int i = 0; i < frame->data_length; i++)
+		{
+			Serial.print((char)frame->data[i]);
+		}
+		Serial.println();
+	}
+	packet_frame.get_performance_monitor().payload_delivered(frame->data_length);
+}
+
+template<class Config>
+uint8_t UartProtocolT<Config>::deliver_pending(uint8_t max_frames)
+{
+	uint8_t delivered = 0;
+
+	//A slow consumer may block for longer than ACK_TIMEOUT_MS, so it only runs while the peer cannot be
+	//waiting on us: paused on zero credit, or the link has gone quiet. Fast consumers run right away.
+	bool fast_consumer = last_delivery_ms < DELIVERY_IDLE_MS;
+	bool peer_paused = credit_update_due;
+	bool link_idle = rx_start == rx_end && !serial->available() && millis() - last_valid_rx_time >= DELIVERY_IDLE_MS;
+	if (!fast_consumer && !peer_paused && !link_idle) return 0;
+
+	while (delivery_count > 0 && delivered < max_frames)
+	{
+		Frame* frame = &delivery_queue[delivery_head];
+		const uint8_t* message;
+		uint16_t message_length;
+
+		//A fragment only frees its slot, the handler runs once the last one is in
+		if (reassemble(frame, &message, &message_length))
+		{
+			unsigned long delivery_start = millis();
+
+			if (delivery_handler)
+			{
+				delivery_handler(message, message_length, frame->channel_id);
+			}
+			else
+			{
+				Serial.print("Data: ");
+				for (int i = 0; i < message_length; i++)
+				{
+					Serial.print((char)message[i]);
+				}
+				Serial.println();
+			}
+			packet_frame.get_performance_monitor().payload_delivered(message_length);
+			last_delivery_ms = millis() - delivery_start;
+		}
+
+		delivery_head = (delivery_head + 1) % RX_DELIVERY_DEPTH;
+		delivery_count--;
+		delivered++;
+	}
+
+	//Peer is paused on zero credit: announce the slot that just freed up
+	if (delivered > 0 && credit_update_due)
+	{
+		send_uart_ack(last_acked_seq);
+	}
+	return delivered;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::reassemble(const Frame* frame, const uint8_t** message, uint16_t* message_length)
+{
+	//A plain frame is a message of its own. The sender sends fragments back to back,
+	//so a partial message in front of it is one the sender gave up on.
+	if (!(frame->packet_type & FLAG_FRAGMENT))
+	{
+		if (rx_message_active) drop_message("interrupted");
+		*message = frame->data;
+		*message_length = frame->data_length;
+		return true;
+	}
+
+	if (frame->data_length < FRAGMENT_HEADER_LEN) return false;
+	uint8_t header = frame->data[0];
+	uint16_t header_len = FRAGMENT_HEADER_LEN;
+
+	if (header & FRAGMENT_FIRST)
+	{
+		if (rx_message_active) drop_message("interrupted");
+		rx_message_active = true;
+		rx_message_length = 0;
+		rx_message_next = 0;
+
+		rx_message_tagged = (header & FRAGMENT_HAS_ID) && frame->data_length >= FRAGMENT_HEADER_LEN + FRAGMENT_ID_LEN;
+		if (rx_message_tagged)
+		{
+			memcpy(&rx_message_id, frame->data + FRAGMENT_HEADER_LEN, FRAGMENT_ID_LEN);
+			header_len += FRAGMENT_ID_LEN;
+		}
+	}
+	else if (!rx_message_active)
+	{
+		Serial.println("FRAGMENT WITHOUT MESSAGE - dropped");//its first fragment went with a dropped message
+		return false;
+	}
+
+	if ((header & FRAGMENT_INDEX_MASK) != rx_message_next)
+	{
+		drop_message("fragment missing");
+		return false;
+	}
+	uint16_t payload_length = frame->data_length - header_len;
+	if (rx_message_length + payload_length > UART_MAX_MESSAGE)
+	{
+		drop_message("too long");
+		return false;
+	}
+
+	memcpy(rx_message + rx_message_length, frame->data + header_len, payload_length);
+	rx_message_length += payload_length;
+	rx_message_next = (rx_message_next + 1) & FRAGMENT_INDEX_MASK;
+	if (frame->packet_type & FLAG_MORE_FRAGMENTS) return false;
+
+	rx_message_active = false;
+
+	//The sender acknowledges a journal record only after our last ACK reached it. A lost ACK or a
+	//reboot before the record was marked sends the same message again; ids only repeat back to back.
+	if (rx_message_tagged)
+	{
+		if (last_journal_id_valid && rx_message_id == last_journal_id)
+		{
+			Serial.print("DUPLICATE MESSAGE - journal replay dropped, id ");
+			Serial.println(rx_message_id);
+			replays_dropped++;
+			return false;
+		}
+		last_journal_id = rx_message_id;
+		last_journal_id_valid = true;
+	}
+
+	*message = rx_message;
+	*message_length = rx_message_length;
+	return true;
+}
+
+template<class Config>
+void UartProtocolT<Config>::drop_message(const char* reason)
+{
+	Serial.print("PARTIAL MESSAGE DROPPED - ");
+	Serial.print(reason);
+	Serial.print(", ");
+	Serial.print(rx_message_length);
+	Serial.println(" bytes");
+
+	rx_message_active = false;
+	rx_message_length = 0;
+	messages_dropped++;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::receive_uart(Frame* frame)
+{
+	//Span parser: pull everything available in one readBytes(), then work on the buffer
+	PROFILE_SCOPE(PROF_UART_PARSE);
+
+	if (!serial) return false;
+
+	if (rx_start == rx_end)
+	{
+		rx_start = 0;
+		rx_end = 0;
+	}
+
+	int available = serial->available();
+	if (available > 0)
+	{
+		//Only a partial frame is ever left behind, move it to the front when the tail is short
+		if (rx_start > 0 && UART_RX_SPAN - rx_end < (uint16_t)available)
+		{
+			memmove(rx_buffer, rx_buffer + rx_start, rx_end - rx_start);
+			rx_end -= rx_start;
+			rx_start = 0;
+		}
+
+		uint16_t space = UART_RX_SPAN - rx_end;
+		uint16_t received = serial->readBytes(rx_buffer + rx_end, (uint16_t)available < space ? (uint16_t)available : space);
+		if (capture) capture->record(CAPTURE_DIR_RX | CAPTURE_LINK_UART, rx_buffer + rx_end, received);
+		rx_end += received;
+		last_byte_time = millis();
+	}
+
+	//One error per span of rejected candidates, a resync scans many of them for one bad frame
+	bool dropped = false;
+	while (rx_start < rx_end)
+	{
+		//Line noise is skipped by memchr (word/SIMD-wide in libc) instead of a branch per byte
+		uint8_t* candidate = (uint8_t*)memchr(rx_buffer + rx_start, Config::START_MARKER, rx_end - rx_start);
+		if (!candidate)
+		{
+			rx_start = rx_end;
+			break;
+		}
+		rx_start = candidate - rx_buffer;
+
+		//Header still on the wire, or the rest of the frame: keep it for the next call
+		uint16_t buffered = rx_end - rx_start;
+		uint16_t data_length = 0;
+		if (buffered >= FRAME_HEADER_LEN)
+		{
+			//Header complete: data_length tells how many bytes belong to this frame
+			memcpy(&data_length, candidate + offsetof(Frame, data_length), sizeof(data_length));
+			if (data_length > Config::MAX_DATA_LEN)
+			{
+				dropped = true;
+				rx_start++;//not a real header, hunt for the next START_MARKER
+				continue;
+			}
+		}
+
+		uint16_t wire_length = FRAME_HEADER_LEN + data_length + FRAME_TRAILER_LEN;
+		if (buffered < wire_length)
+		{
+			if (!check_timeout()) break;
+
+			//Partial frame that never completed: drop its marker and rescan what follows
+			dropped = true;
+			rx_start++;
+			continue;
+		}
+
+		if (candidate[wire_length - 1] != Config::END_MARKER || !PacketFrame::deserialize_frame(candidate, wire_length, frame))
+		{
+			dropped = true;
+			rx_start++;//resync on the bytes already buffered, a real frame may start inside this one
+			continue;
+		}
+
+		if (dropped) consecutive_errors++;
+		rx_start += wire_length;
+		rx_frame_time_us = micros();
+		return true;//Complete frame, the caller validates it
+	}
+
+	if (dropped) consecutive_errors++;
+	return false;//No complete frame available yet
+}
+
+template<class Config>
+void UartProtocolT<Config>::reset_receiver()
+{
+	//Resetting for new UART transfer
+	rx_start = 0;
+	rx_end = 0;
+	last_byte_time = 0;
+}
+
+template<class Config>
+bool UartProtocolT<Config>::check_timeout()
+{
+	return (millis() - last_byte_time) > 500;
+}
+
+template class UartProtocolT<DefaultConfig>;
+template class UartProtocolT<ControlConfig>;
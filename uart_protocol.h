@@ -1,53 +1,220 @@
-#pragma once
-#ifndef UART_PROTOCOL_H
-#define UART_PROTOCOL_H
-
-#include <HardwareSerial.h>
-#include "packet_frame.h"
-
-enum ReceiverState
-{
-	STATE_WAITING_START,
-	STATE_RECEIVING_FRAME
-};
-
-class UartProtocol
-{
-private:
-	PacketFrame packet_frame;
-
-	HardwareSerial* serial;
-	uint32_t baud_rate;
-
-	ReceiverState rx_state;
-	uint8_t rx_buffer[sizeof(Frame)];
-	uint8_t rx_index;
-	unsigned long last_byte_time;
-public:
-	UartProtocol(HardwareSerial* serial_port, uint32_t baud = 115200);
-
-
-	//Send data
-	void send_uart_data();
-	void send_uart_ack(uint16_t seq_num);
-	void send_uart_nack(uint16_t seq_num);
-	bool send_uart_master(Frame* frame);
-	bool send_uart_slave(Frame* frame);
-	bool wait_for_ack(uint16_t seq_num, HardwareSerial& serial, uint32_t timeout_ms);
-
-	//Received data
-	void receive_data_uart_master();
-	void receive_data_uart_slave();
-	bool receive_uart(Frame* frame);
-	void process_received_frame_uart_master(Frame* frame);
-	void process_received_frame_uart_slave(Frame* frame);
-	void print_frame_info(Frame* frame);
-	
-	void reset_receiver();
-	bool check_timeout();
-
-	PerformanceMonitor& get_perf_protocol() { return packet_frame.get_performance_monitor(); }
-
-};
-
-#endif // !UART_PROTOCOL_H
+#pragma once
+#ifndef UART_PROTOCOL_H
+#define UART_PROTOCOL_H
+
+#include <Arduino.h>
+#include "packet_frame.h"
+#include "link_params.h"
+#include "payload_controller.h"
+#include "channel_scheduler.h"
+#include "wire_capture.h"
+#include "tx_journal.h"
+
+#define RX_DELIVERY_DEPTH 4//received DATA frames buffered for the application, advertised as credits
+#define CREDIT_WAIT_MS 5000//longest a sender pauses on zero credit before giving up on a frame
+#define CREDIT_PROBE_MS 200//zero-credit probe interval, covers a lost window update
+#define CREDITS_UNKNOWN 0xFF//peer never advertised credits (ACK without payload), no flow control
+#define UART_RX_SPAN 256//bytes pulled from the Stream per readBytes(), also carries a partial frame across calls
+#define DELIVERY_IDLE_MS 20//quiet time before buffered frames go to a slow consumer, also the "fast consumer" bound
+#define ACK_TIMESTAMP_LEN 9//ACK payload: credits + micros() at DATA arrival + micros() at ACK send
+#define JOURNAL_DRAIN_BATCH 8//journaled messages sent per receive_data_uart_master() call
+#define UART_MAX_MESSAGE 512//longest message send_uart_message() takes, the receiver's reassembly buffer
+
+//Fragment header: first payload byte of every FLAG_FRAGMENT frame
+#define FRAGMENT_HEADER_LEN 1
+#define FRAGMENT_FIRST 0x80//starts a message, a partial one still being collected is dropped
+#define FRAGMENT_HAS_ID 0x40//first fragment of a journaled message: the TX journal record id follows the header
+#define FRAGMENT_ID_LEN 4
+#define FRAGMENT_INDEX_MASK 0x3F//fragment number modulo 64, a gap drops the message
+
+enum LinkState
+{
+	LINK_UP,
+	LINK_SUSPECT,//heartbeats unanswered, sends still go out
+	LINK_DOWN//peer silent for LINK_DOWN_MS and MAX_RETRIES probes, sends fail immediately, queued frames wait
+};
+
+template<class Config>
+class UartProtocolT
+{
+public:
+	typedef FrameT<Config> Frame;
+	typedef PacketFrameT<Config> PacketFrame;
+	typedef ChannelSchedulerT<Config> ChannelScheduler;
+	typedef QueuedMessageT<Config> QueuedMessage;
+
+private:
+	//receive_uart() needs one whole frame in the span to resync past a partial one
+	static_assert(UART_RX_SPAN >= FRAME_HEADER_LEN + Config::MAX_DATA_LEN + FRAME_TRAILER_LEN, "UART_RX_SPAN must hold one frame");
+
+	PacketFrame packet_frame;
+
+	Stream* serial;//HardwareSerial on target, PtyTransport on host
+	uint32_t baud_rate;
+
+	uint8_t rx_buffer[UART_RX_SPAN];
+	uint16_t rx_start;//first byte not parsed yet
+	uint16_t rx_end;//one past the last buffered byte
+	unsigned long last_byte_time;
+
+	WireCapture* capture;//optional wire tap, nullptr = off
+	size_t write_wire(const uint8_t* data, uint16_t length);//serial->write() through the tap
+
+	PayloadSizeController payload_controller;
+	ChannelScheduler scheduler;
+
+	//Store-and-forward: messages wait in flash until the peer ACKed every fragment
+	TxJournal* journal;//optional, nullptr = send_uart_message() reports failures to the caller
+	bool send_journal_head();
+	bool send_message(const uint8_t* data, uint16_t length, uint8_t channel, uint32_t journal_id = 0);//data == nullptr: the journal head, tagged with journal_id
+
+	//Reassembly of FLAG_FRAGMENT frames, the delivery handler only ever sees whole messages
+	uint8_t rx_message[UART_MAX_MESSAGE];
+	uint16_t rx_message_length;
+	uint8_t rx_message_next;//fragment index expected next
+	bool rx_message_active;//first fragment seen, the last one is still missing
+	bool rx_message_tagged;//FRAGMENT_HAS_ID: rx_message_id is the sender's journal record id
+	uint32_t rx_message_id;
+	uint32_t last_journal_id;//last journaled message delivered, a sender that lost its ACK sends it again
+	bool last_journal_id_valid;
+	uint32_t messages_dropped;
+	uint32_t replays_dropped;
+	bool reassemble(const Frame* frame, const uint8_t** message, uint16_t* message_length);
+	void drop_message(const char* reason);
+
+	//Credit-based flow control, receiver side
+	Frame delivery_queue[RX_DELIVERY_DEPTH];
+	uint8_t delivery_head;
+	uint8_t delivery_count;
+	uint16_t last_acked_seq;
+	bool credit_update_due;//last ACK advertised zero credit, the next free slot is announced
+	unsigned long last_delivery_ms;//how long the consumer took last time, decides eager vs deferred delivery
+	void (*delivery_handler)(const uint8_t* data, uint16_t length, uint8_t channel);
+
+	//Credit-based flow control, sender side
+	uint8_t peer_credits;
+
+	//One-way latency: four timestamps per DATA/ACK exchange, fed to the monitor's ClockSync
+	uint32_t rx_frame_time_us;//micros() when receive_uart() returned the last frame
+	uint32_t tx_time_us;//last DATA attempt put on the wire
+	uint16_t tx_timed_seq;
+	bool tx_timed_retry;//retransmitted: the ACK may belong to any attempt, no sample
+	uint32_t ack_stamp_rx_us;//arrival of the DATA frame the next ACK answers
+	uint16_t ack_stamp_seq;
+	bool ack_stamp_due;
+
+	//Session (handshake + baud step-up)
+	LinkParams session_params;
+	bool session_up;
+	bool compression_wanted;
+	uint32_t current_baud;
+	uint32_t baud_ceiling;//local max baud, lowered after a failed step-up
+	void (*baud_callback)(uint32_t baud);
+	unsigned long last_connect_attempt;
+	unsigned long last_valid_rx_time;
+	uint8_t consecutive_errors;
+	uint16_t quality_frames;
+	uint16_t quality_errors;
+
+	uint16_t stats_seq;//TYPE_STATS requests, own sequence space
+
+	//Link liveness: only a frame that validates counts as a sign of life, noise never does
+	LinkState link_state;
+	unsigned long last_peer_activity;
+	unsigned long last_heartbeat;
+	unsigned long link_down_since;
+	uint8_t unanswered_probes;//heartbeats and DATA attempts since the last sign of life
+	void note_peer_activity();
+	bool validate_rx_frame(Frame* frame);//validate_frame(), then note_peer_activity() on success
+	void drop_session(const char* reason);//forget the session key, the next connect() negotiates a new one
+	LinkState update_link_state(bool prober);
+	uint16_t probe_sequence() const;//POLL seq, never one a DATA ACK could be waited for
+	void set_link_state(LinkState state);
+
+	bool transmit_once(Frame* frame);//one send + ACK wait, no retry
+	bool wait_for_frame(uint8_t type, uint16_t seq_num, Frame* response, uint32_t timeout_ms);
+	void handle_syn(Frame* frame);
+	void get_offer(LinkParams* local) const;
+	void apply_session(const LinkParams* params);
+	void change_baud(uint32_t baud);
+	void fallback_to_base(bool lower_ceiling);
+	void update_link_quality(bool delivered, uint8_t retransmissions);
+	void check_session_health();
+	uint32_t get_advertised_baud() const { return baud_callback ? baud_ceiling : baud_rate; }
+	void handle_data(Frame* frame);
+	void handle_datagram(Frame* frame);//straight to the delivery handler, bypasses the credit queue
+	void update_peer_credits(const Frame* frame);
+	bool wait_for_credit(uint32_t timeout_ms);
+	uint8_t get_credits() const { return RX_DELIVERY_DEPTH - delivery_count; }
+	void handle_stats(Frame* frame);
+public:
+	UartProtocolT(Stream* serial_port, uint32_t baud = 115200);
+
+
+	//Send data
+	void send_uart_data();
+	bool send_uart_message(const uint8_t* data, uint16_t length);//up to UART_MAX_MESSAGE, fragmented to the adaptive payload size; with a journal: true = stored
+	void send_uart_ack(uint16_t seq_num);
+	void send_uart_nack(uint16_t seq_num);
+	bool send_uart_master(Frame* frame);
+	bool send_uart_datagram(const uint8_t* data, uint16_t length, uint8_t channel = 0);//fire-and-forget
+	bool send_uart_slave(Frame* frame);
+	bool wait_for_ack(uint16_t seq_num, uint32_t timeout_ms);
+
+	//Multiplexed channels
+	void configure_channel(uint8_t channel, uint8_t priority, ChannelMode mode, uint16_t quantum = Config::MAX_DATA_LEN) { scheduler.configure_channel(channel, priority, mode, quantum); }
+	void set_scheduler_policy(SchedulerPolicy policy) { scheduler.set_policy(policy); }
+	bool enqueue_message(uint8_t channel, const uint8_t* data, uint16_t length) { return scheduler.enqueue(channel, data, length); }
+	bool service_tx();//put the next scheduled frame on the wire, false when all queues are empty or the link is down
+	void print_channel_statistics() { scheduler.print_statistics(); }
+
+	//Received data
+	void receive_data_uart_master();
+	void receive_data_uart_slave();
+	bool receive_uart(Frame* frame);
+	void process_received_frame_uart_master(Frame* frame);
+	void process_received_frame_uart_slave(Frame* frame);
+	void print_frame_info(Frame* frame);
+	
+	void reset_receiver();
+	bool check_timeout();
+
+	//Link liveness, driven by receive_data_uart_*(): the master probes with heartbeats, the slave only listens
+	void service_link(bool send_heartbeats);
+	LinkState get_link_state() const { return link_state; }
+
+	//Delivery to the application, decoupled from the ACK so a slow consumer pauses the sender instead of timing it out.
+	//The handler gets whole messages: fragments are collected until the last one, a message cut short is dropped.
+	uint8_t deliver_pending(uint8_t max_frames = 1);//called by receive_data_uart_*(), returns frames consumed
+	void set_delivery_handler(void (*handler)(const uint8_t* data, uint16_t length, uint8_t channel)) { delivery_handler = handler; }
+	uint32_t get_messages_dropped() const { return messages_dropped; }//partial messages the sender gave up on
+	uint32_t get_replays_dropped() const { return replays_dropped; }//journaled messages delivered before, sent again
+	uint8_t get_peer_credits() const { return peer_credits; }
+
+	//Session setup
+	bool connect(uint32_t timeout_ms = Config::ACK_TIMEOUT_MS);//SYN/SYN-ACK, then switch to the agreed baud
+	void set_baud_callback(void (*callback)(uint32_t baud)) { baud_callback = callback; }
+	void set_max_baud(uint32_t baud) { baud_ceiling = LinkNegotiation::snap_baud(baud); }
+	bool is_session_up() const { return session_up; }
+	uint32_t get_current_baud() const { return current_baud; }
+	const LinkParams& get_session_params() const { return session_params; }
+
+	//Remote statistics: the peer's snapshot shows up in get_perf_protocol().print_statistics()
+	bool request_peer_stats(uint32_t timeout_ms = Config::ACK_TIMEOUT_MS);
+
+	void set_compression(bool enable);//a wish: frames go out compressed only once the handshake agreed on FEATURE_COMPRESSION
+	//Shared 32-byte key: CRC16 is replaced by ChaCha20-Poly1305 and a handshake is required before any data
+	void set_link_key(const uint8_t* key) { packet_frame.set_aead_key(key); session_up = false; }
+	void set_capture(WireCapture* tap) { capture = tap; }
+
+	//Store-and-forward TX journal: send_uart_message() appends, delivery resumes after outages and reboots
+	void set_journal(TxJournal* store) { journal = store; }
+	uint8_t drain_journal(uint8_t max_messages = JOURNAL_DRAIN_BATCH);//oldest first, stops at the first failure
+
+	PerformanceMonitor& get_perf_protocol() { return packet_frame.get_performance_monitor(); }
+
+};
+
+typedef UartProtocolT<DefaultConfig> UartProtocol;
+
+#endif // !UART_PROTOCOL_H
@@ -0,0 +1,120 @@
+#include "wire_capture.h"
+
+WireCapture::WireCapture() :
+	output(nullptr),
+	ring_head(0),
+	ring_used(0),
+	enabled(false),
+	records(0),
+	records_dropped(0)
+{
+}
+
+void WireCapture::begin_ram()
+{
+	output = nullptr;
+	clear();
+	enabled = true;
+}
+
+void WireCapture::begin_stream(Print* out)
+{
+	output = out;
+	records = 0;
+	records_dropped = 0;
+	if (output) write_file_header(output);
+	enabled = (output != nullptr);
+}
+
+void WireCapture::clear()
+{
+	ring_head = 0;
+	ring_used = 0;
+	records = 0;
+	records_dropped = 0;
+}
+
+void WireCapture::write_file_header(Print* out)
+{
+	CaptureFileHeader header;
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = CAPTURE_VERSION;
+	memset(header.reserved, 0, sizeof(header.reserved));
+	out->write((const uint8_t*)&header, sizeof(header));
+}
+
+void WireCapture::record(uint8_t flags, const uint8_t* data, uint16_t length)
+{
+	if (!enabled || !data || length == 0) return;
+
+	CaptureRecordHeader header;
+	header.timestamp_us = micros();
+	header.length = length;
+	header.flags = flags;
+	header.reserved = 0;
+
+	records++;
+
+	if (output)
+	{
+		output->write((const uint8_t*)&header, sizeof(header));
+		output->write(data, length);
+		return;
+	}
+
+	uint16_t needed = sizeof(header) + length;
+	if (needed > CAPTURE_RING_SIZE)
+	{
+		records_dropped++;
+		return;
+	}
+
+	//Drop whole records from the front until the new one fits
+	while (CAPTURE_RING_SIZE - ring_used < needed)
+	{
+		CaptureRecordHeader oldest;
+		ring_read(ring_head, (uint8_t*)&oldest, sizeof(oldest));
+		uint16_t oldest_size = sizeof(oldest) + oldest.length;
+
+		ring_head = (ring_head + oldest_size) % CAPTURE_RING_SIZE;
+		ring_used -= oldest_size;
+		records_dropped++;
+	}
+
+	ring_write((const uint8_t*)&header, sizeof(header));
+	ring_write(data, length);
+}
+
+void WireCapture::ring_write(const uint8_t* data, uint16_t length)
+{
+	uint16_t tail = (ring_head + ring_used) % CAPTURE_RING_SIZE;
+	uint16_t first = CAPTURE_RING_SIZE - tail;
+	if (first > length) first = length;
+
+	memcpy(&ring[tail], data, first);
+	memcpy(&ring[0], data + first, length - first);
+	ring_used += length;
+}
+
+void WireCapture::ring_read(uint16_t pos, uint8_t* data, uint16_t length) const
+{
+	uint16_t first = CAPTURE_RING_SIZE - pos;
+	if (first > length) first = length;
+
+	memcpy(data, &ring[pos], first);
+	memcpy(data + first, &ring[0], length - first);
+}
+
+void WireCapture::dump(Print* out)
+{
+	if (!out) return;
+
+	write_file_header(out);
+
+	//Two spans at most: head..end of ring, then the wrapped part
+	uint16_t first = CAPTURE_RING_SIZE - ring_head;
+	if (first > ring_used) first = ring_used;
+
+	out->write(&ring[ring_head], first);
+	if (ring_used > first) out->write(&ring[0], ring_used - first);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef WIRE_CAPTURE_H
+#define WIRE_CAPTURE_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+//Capture file layout (little-endian, what the ESP32 and x86/ARM hosts use natively):
+//  CaptureFileHeader once, then records back to back:
+//  CaptureRecordHeader + length raw bytes exactly as they were on the wire
+//UART records hold whatever one write()/readBytes() moved, so a frame may span several
+//records; SPI records hold one complete transaction.
+#define CAPTURE_MAGIC "WCAP"
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_DIR_TX 0x00
+#define CAPTURE_DIR_RX 0x01
+#define CAPTURE_DIR_MASK 0x01
+#define CAPTURE_LINK_UART 0x00
+#define CAPTURE_LINK_SPI 0x02
+#define CAPTURE_LINK_MASK 0x06
+
+#define CAPTURE_RING_SIZE 4096//RAM ring, oldest records are overwritten
+
+typedef struct __attribute__((packed))
+{
+	char magic[4];
+	uint8_t version;
+	uint8_t reserved[3];
+}CaptureFileHeader;
+
+typedef struct __attribute__((packed))
+{
+	uint32_t timestamp_us;//micros() at the tap, wraps every ~71 minutes
+	uint16_t length;
+	uint8_t flags;//CAPTURE_DIR_* | CAPTURE_LINK_*
+	uint8_t reserved;
+}CaptureRecordHeader;
+
+class WireCapture
+{
+private:
+	Print* output;//debug-port sink, nullptr = RAM ring
+
+	uint8_t ring[CAPTURE_RING_SIZE];
+	uint16_t ring_head;//oldest record
+	uint16_t ring_used;
+
+	bool enabled;
+	uint32_t records;
+	uint32_t records_dropped;//overwritten in the ring
+
+	void ring_write(const uint8_t* data, uint16_t length);
+	void ring_read(uint16_t pos, uint8_t* data, uint16_t length) const;
+	static void write_file_header(Print* out);
+
+public:
+	WireCapture();
+
+	void begin_ram();
+	void begin_stream(Print* out);//writes the file header straight away
+	void stop() { enabled = false; }
+	bool is_enabled() const { return enabled; }
+
+	void record(uint8_t flags, const uint8_t* data, uint16_t length);
+	void dump(Print* out);//RAM ring as a complete capture file, oldest record first
+	void clear();
+
+	uint32_t get_records() const { return records; }
+	uint32_t get_records_dropped() const { return records_dropped; }
+};
+
+#endif // !WIRE_CAPTURE_H